@@ -21,6 +21,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <cstring>
 #include <cmath>
 #include <cassert>
+#include <mutex>
+#include <atomic>
 //
 #include "comets.h"
 #include "afuncs.h"
@@ -185,7 +187,11 @@ static void grab_cached_elems(Elements *elems, const int chunk_number,
    fp = open_bc405_file( false);
    assert( fp);
    if( !cache)
+      {
       cache = (Elements *)calloc( N_CACHED_ELEMS, sizeof(Elements));
+      for( i = 0; i < N_CACHED_ELEMS; i++)   /* mark entries as empty */
+         astnums[i] = chunk_num[i] = -1;
+      }
    assert( cache);
    if( !cache)
       return;
@@ -360,9 +366,171 @@ static double *load_asteroid_masses( void)
    return( rval);
 }
 
+/* The BC-405 file,  element cache,  and precomputed-position state are
+shared between threads,  so the public entry points take this lock.  */
+
+static std::mutex bc405_mutex;
+
+/* With all 300 asteroids as perturbers,  the thirty-entry element cache
+above thrashes,  and each position requires a Kepler solution.  Instead,
+for each 40-day chunk,  we fit Chebyshev polynomials to the two-body
+positions of all the asteroids over the span in which that chunk's
+elements are used (20 days either side of its epoch),  much as is done
+for the planets in the JPL ephemerides.  A position is then a table
+lookup and a few multiply-adds.
+
+   Ten coefficients reproduce the two-body positions to better than a
+meter (about the precision of the Kepler solution itself),  and velocities
+to a few microns/second.  That's 240 bytes per asteroid per chunk;  tables
+for all of BC-405 would take some 260 MBytes,  and usually only a few of
+the asteroids are close enough to matter.  So the table for a chunk is
+allocated when first needed,  and each asteroid's coefficients within it
+are fitted when first needed.  Coefficients are never modified once
+fitted,  so they can be read without locking.  All is freed when
+detect_perturbers( ) is told to free memory.  This is off if
+ASTEROID_TABLES=0 in 'environ.dat'.   */
+
+#define BC405_CHEB_COEFFS     10
+#define MAX_BC405_N_CHUNKS    3654
+
+struct Cheb_chunk
+{
+   std::atomic<bool> fitted[MAX_BC405_N_ASTEROIDS];
+   double coeffs[MAX_BC405_N_ASTEROIDS][3 * BC405_CHEB_COEFFS];
+};
+
+static std::atomic<Cheb_chunk *> cheb_chunks[MAX_BC405_N_CHUNKS];
+static std::atomic<int> use_asteroid_tables( -1);
+
+static bool using_asteroid_tables( void)
+{
+   if( use_asteroid_tables < 0)
+      {
+      const std::lock_guard<std::mutex> lock( bc405_mutex);
+
+      if( use_asteroid_tables < 0)
+         use_asteroid_tables =
+                  (atoi( get_environment_ptr( "ASTEROID_TABLES"))
+                  && open_bc405_file( false)
+                  && n_bc405_chunks <= MAX_BC405_N_CHUNKS);
+      }
+   return( use_asteroid_tables > 0);
+}
+
+/* Fits the coefficients by interpolating at the Chebyshev nodes,  as is
+done for the planetary tables in 'pl_cache.cpp'.  Call with the lock held. */
+
+static bool fit_cheb_asteroid( Cheb_chunk *cchunk, const int chunk,
+                                    const int astnum)
+{
+   const int n = BC405_CHEB_COEFFS;
+   FILE *fp = open_bc405_file( false);
+   double *coeffs = cchunk->coeffs[astnum];
+   double posn[BC405_CHEB_COEFFS][4];
+   Elements elems;
+   int j, k, axis;
+
+   if( !fp)
+      return( false);
+   fseek( fp, ((size_t)chunk * bc405_n_asteroids + astnum)
+                            * 6 * sizeof( double), SEEK_SET);
+   grab_elems( &elems, fp, chunk);
+   for( k = 0; k < n; k++)
+      comet_posn( &elems, elems.epoch + bc405_chunk_time / 2.
+               * cos( PI * ((double)k + .5) / (double)n), posn[k]);
+   for( axis = 0; axis < 3; axis++)
+      {
+      for( j = 0; j < n; j++)
+         {
+         double sum = 0.;
+
+         for( k = 0; k < n; k++)
+            sum += posn[k][axis] * cos( PI * (double)j * ((double)k + .5) / (double)n);
+         coeffs[axis * n + j] = sum * 2. / (double)n;
+         }
+      coeffs[axis * n] /= 2.;
+      }
+   cchunk->fitted[astnum].store( true, std::memory_order_release);
+   return( true);
+}
+
+static void free_cheb_chunks( void)
+{
+   int i;
+
+   for( i = 0; i < MAX_BC405_N_CHUNKS; i++)
+      delete cheb_chunks[i].exchange( nullptr);
+   use_asteroid_tables = -1;
+}
+
+/* Returns false if tables are off,  or the JD is outside the BC-405 span
+(in which case the caller should extrapolate from the elements).  Either
+'posn' or 'vel' may be null.  Don't call this with the lock held.  */
+
+static bool asteroid_posn_from_tables( const int astnum, const double jd,
+                                       double *posn, double *vel)
+{
+   const int n = BC405_CHEB_COEFFS;
+   Cheb_chunk *cchunk;
+   const double *coeffs;
+   double t, x;
+   int chunk, i, j;
+
+   if( !using_asteroid_tables( ) || astnum < 0 || astnum >= bc405_n_asteroids)
+      return( false);
+   t = (jd - bc405_start_jd) / bc405_chunk_time;
+   chunk = (int)floor( t + .5);
+   if( chunk < 0 || chunk >= n_bc405_chunks)
+      return( false);
+   cchunk = cheb_chunks[chunk].load( std::memory_order_acquire);
+   if( !cchunk || !cchunk->fitted[astnum].load( std::memory_order_acquire))
+      {
+      const std::lock_guard<std::mutex> lock( bc405_mutex);
+
+      cchunk = cheb_chunks[chunk].load( std::memory_order_acquire);
+      if( !cchunk)
+         {
+         cchunk = new Cheb_chunk( );
+         cheb_chunks[chunk].store( cchunk, std::memory_order_release);
+         }
+      if( !cchunk->fitted[astnum].load( std::memory_order_acquire))
+         if( !fit_cheb_asteroid( cchunk, chunk, astnum))
+            return( false);
+      }
+   coeffs = cchunk->coeffs[astnum];
+   x = 2. * (t - (double)chunk);       /* -1 <= x < 1 */
+   for( i = 0; i < 3; i++, coeffs += n)
+      {
+      double t0 = 1., t1 = x, dt0 = 0., dt1 = 1.;
+      double sum = coeffs[0] + coeffs[1] * x, dsum = coeffs[1];
+
+      for( j = 2; j < n; j++)
+         {           /* T(j) and its derivative by the usual recurrences */
+         const double t2 = 2. * x * t1 - t0;
+         const double dt2 = 2. * t1 + 2. * x * dt1 - dt0;
+
+         sum += coeffs[j] * t2;
+         dsum += coeffs[j] * dt2;
+         t0 = t1;
+         t1 = t2;
+         dt0 = dt1;
+         dt1 = dt2;
+         }
+      if( posn)
+         posn[i] = sum;
+      if( vel)
+         vel[i] = dsum * 2. / bc405_chunk_time;
+      }
+   return( true);
+}
+
 int asteroid_position_raw( const int astnum, const double jd,
                               double *posn, double *vel)
 {
+   if( asteroid_posn_from_tables( astnum, jd, posn, vel))
+      return( 0);
+
+   const std::lock_guard<std::mutex> lock( bc405_mutex);
     Elements elem;
    int chunk;
 
@@ -379,6 +547,7 @@ int asteroid_position_raw( const int astnum, const double jd,
 
 double *get_asteroid_mass( const int astnum)
 {
+   const std::lock_guard<std::mutex> lock( bc405_mutex);
    int i;
    double *rval = nullptr;
 
@@ -390,9 +559,14 @@ double *get_asteroid_mass( const int astnum)
    return( rval);
 }
 
-int detect_perturbers( const double jd, const double * /*__restrict*/ xyz,
-                       double *accel)
+/* Finds the asteroids that might be close enough to 'xyz' to matter,  by
+the above scheme,  and puts their indices in 'perturbers';  returns the
+number found,  or NO_BC405_FILE.   */
+
+static int find_possible_perturbers( const double jd,
+                  const double * /*__restrict*/ xyz, int *perturbers)
 {
+   const std::lock_guard<std::mutex> lock( bc405_mutex);
    static int curr_chunk = -1;
    static int16_t posns0[MAX_BC405_N_ASTEROIDS * 3];
    static int16_t posns1[MAX_BC405_N_ASTEROIDS * 3];
@@ -401,7 +575,7 @@ int detect_perturbers( const double jd, const double * /*__restrict*/ xyz,
    static bool bc405_available = true;
    static int n_asteroids_to_use = 0;
    double thresh;
-   int i, load_posn0 = 0, load_posn1 = 0, chunk, n_fixed = 0;
+   int i, load_posn0 = 0, load_posn1 = 0, chunk, n_fixed = 0, n_found = 0;
    const char *fixed_perturber_list;
    int fixed_perturbers[MAX_BC405_N_ASTEROIDS];
 
@@ -417,6 +591,7 @@ int detect_perturbers( const double jd, const double * /*__restrict*/ xyz,
       masses = nullptr;
       open_bc405_file( true);
       grab_cached_elems( nullptr, 0, 0);
+      free_cheb_chunks( );
       return( 0);
       }
    thresh = atof( get_environment_ptr( "ASTEROID_THRESH"));
@@ -521,40 +696,58 @@ int detect_perturbers( const double jd, const double * /*__restrict*/ xyz,
             if( n_fixed)          /* fixed perturbers set;  only consider them */
                possible_perturber = 0;
             if( possible_perturber || fixed_perturber)
-               {
-               double asteroid_loc[4], dist2 = 0., delta[3], sun_dist2 = 0.;
-               double factor1, factor2;
-
-               planet_posn( i + 100, jd, asteroid_loc);
-               for( j = 0; j < 3; j++)
-                  {
-                  delta[j] = asteroid_loc[j] - xyz[j];
-                  sun_dist2 += asteroid_loc[j] * asteroid_loc[j];
-                  dist2 += delta[j] * delta[j];
-                  }
-               factor1 = SOLAR_GM * masses[i] / (sun_dist2 * sqrt( sun_dist2));
-               factor2 = SOLAR_GM * masses[i] / (dist2 * sqrt( dist2));
-               for( j = 0; j < 3; j++)
-                  {
-                  accel[j + 3] += factor2 * delta[j];
-                  accel[j + 3] -= factor1 * asteroid_loc[j];
-                  }
-#ifdef DEBUGGING_CODE
-               if( dist2 < .05 * 0.05)
-                  {
-                  FILE *debug_file = fopen( "astpert.txt", "ab");
-
-                  fprintf( debug_file, "%.5f: %3d, %f: mass %g\n",
-                           JD_TO_YEAR( jd),
-                           asteroid_numbers[i], sqrt( dist2) * AU_IN_KM, masses[i]);
-                  fclose( debug_file);
-                  }
-#endif
-               }
+               perturbers[n_found++] = i;
             }
          }
       }
-   return( 0);
+   return( n_found);
+}
+
+/* Positions of the perturbing asteroids are computed without holding the
+lock;  they may come from the Chebyshev tables,  or from planet_posn(),
+whose cache misses land in asteroid_position_raw() (which takes the lock). */
+
+int detect_perturbers( const double jd, const double * /*__restrict*/ xyz,
+                       double *accel)
+{
+   int perturbers[MAX_BC405_N_ASTEROIDS];
+   const int n_perturbers = find_possible_perturbers( jd, xyz, perturbers);
+   int i, j;
+
+   for( i = 0; i < n_perturbers; i++)
+      {
+      const int idx = perturbers[i];
+      double asteroid_loc[4], dist2 = 0., delta[3], sun_dist2 = 0.;
+      double factor1, factor2;
+
+      if( !asteroid_posn_from_tables( idx, jd, asteroid_loc, nullptr))
+         planet_posn( idx + 100, jd, asteroid_loc);
+      for( j = 0; j < 3; j++)
+         {
+         delta[j] = asteroid_loc[j] - xyz[j];
+         sun_dist2 += asteroid_loc[j] * asteroid_loc[j];
+         dist2 += delta[j] * delta[j];
+         }
+      factor1 = SOLAR_GM * masses[idx] / (sun_dist2 * sqrt( sun_dist2));
+      factor2 = SOLAR_GM * masses[idx] / (dist2 * sqrt( dist2));
+      for( j = 0; j < 3; j++)
+         {
+         accel[j + 3] += factor2 * delta[j];
+         accel[j + 3] -= factor1 * asteroid_loc[j];
+         }
+#ifdef DEBUGGING_CODE
+      if( dist2 < .05 * 0.05)
+         {
+         FILE *debug_file = fopen( "astpert.txt", "ab");
+
+         fprintf( debug_file, "%.5f: %3d, %f: mass %g\n",
+                  JD_TO_YEAR( jd),
+                  asteroid_numbers[idx], sqrt( dist2) * AU_IN_KM, masses[idx]);
+         fclose( debug_file);
+         }
+#endif
+      }
+   return( n_perturbers < 0 ? n_perturbers : 0);
 }
 
 #ifdef TEST_CODE
@@ -0,0 +1,154 @@
+/* Copyright (C) 2026, Project Pluto.  See LICENSE.  */
+
+/* bc405_test.cpp:  checks the Chebyshev asteroid tables in 'bc405.cpp'
+against positions computed directly from the BC-405 elements,  and times
+orbit integration with all 300 asteroid perturbers,  with and without the
+tables.  Requires the BC-405 data ('bc405.dat' or 'asteroid_ephemeris.txt')
+and the usual Find_Orb data files.  Positions from the tables ought to
+match those from the elements to about a meter.  Use -y(num) to set the
+number of years integrated (default 20),  -n(num) the number of
+epochs at which all asteroids are checked (default 200).
+
+   Build with 'make bc405_test'.                                       */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include "comets.h"
+#include "afuncs.h"
+#include "constant.h"
+#include "mpc_obs.h"
+#include "elem_out.h"
+#include "bc405.h"
+#include "pl_cache.h"
+
+#define N_BC405_ASTEROIDS  300
+#define MAX_POSN_DIFF      1e-11       /* AU,  i.e.,  about 1.5 meters */
+#define BC405_START_JD     2378495.
+#define BC405_END_JD       2524615.
+
+extern thread_local unsigned perturbers;
+
+static void use_asteroid_tables( const bool use_them)
+{
+   detect_perturbers( 0., nullptr, nullptr);       /* frees tables, caches */
+   planet_posn( -1, 0., nullptr);
+   set_environment_ptr( "ASTEROID_TABLES", use_them ? "1" : "0");
+}
+
+/* Integrates a Ceres-like orbit over 'n_years' from J2000,  with the
+planets and all 300 asteroids as perturbers.  Returns the time taken. */
+
+static double time_integration( double *orbit, const double n_years)
+{
+   Elements elem;
+   clock_t t0;
+
+   memset( &elem, 0, sizeof( Elements));
+   elem.major_axis = 2.7;
+   elem.ecc = .09;
+   elem.q = elem.major_axis * (1. - elem.ecc);
+   elem.incl = 10. * PI / 180.;
+   elem.arg_per = 70. * PI / 180.;
+   elem.asc_node = 80. * PI / 180.;
+   elem.epoch = elem.perih_time = J2000;
+   derive_quantities( &elem, SOLAR_GM);
+   comet_posn_and_vel( &elem, J2000, orbit, orbit + 3);
+   perturbers = 0x7fe | (1 << 20);       /* planets 1-10 and asteroids */
+   t0 = clock( );
+   integrate_orbit( orbit, J2000, J2000 + n_years * 365.25);
+   return( (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC);
+}
+
+int main( const int argc, const char **argv)
+{
+   ephem_option_t ephem_options;
+   int element_format, element_precision, i, j, n_per_asteroid = 200, rval = 0;
+   double max_resid, noise, n_years = 20.;
+   double *jds, *posns, max_posn_diff = 0., max_vel_diff = 0.;
+   double old_time, new_time, old_orbit[6], new_orbit[6], orbit_diff = 0.;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'n':
+               n_per_asteroid = atoi( argv[i] + 2);
+               break;
+            case 'y':
+               n_years = atof( argv[i] + 2);
+               break;
+            default:
+               printf( "Option '%s' ignored\n", argv[i]);
+               break;
+            }
+   get_defaults( &ephem_options, &element_format, &element_precision,
+                  &max_resid, &noise);
+   jds = (double *)malloc( n_per_asteroid * (1 + 6 * N_BC405_ASTEROIDS)
+                                       * sizeof( double));
+   posns = jds + n_per_asteroid;
+   srand( 31416);
+   for( i = 0; i < n_per_asteroid; i++)
+      jds[i] = BC405_START_JD + (BC405_END_JD - BC405_START_JD)
+                        * (double)rand( ) / (double)RAND_MAX;
+
+   use_asteroid_tables( false);
+   for( j = 0; j < N_BC405_ASTEROIDS; j++)
+      for( i = 0; i < n_per_asteroid; i++)
+         {
+         double *pptr = posns + (j * n_per_asteroid + i) * 6;
+
+         if( asteroid_position_raw( j, jds[i], pptr, pptr + 3))
+            {
+            printf( "Couldn't get BC-405 positions\n");
+            return( -1);
+            }
+         }
+   use_asteroid_tables( true);
+   for( j = 0; j < N_BC405_ASTEROIDS; j++)
+      for( i = 0; i < n_per_asteroid; i++)
+         {
+         const double *pptr = posns + (j * n_per_asteroid + i) * 6;
+         double posn[3], vel[3];
+         int k;
+
+         asteroid_position_raw( j, jds[i], posn, vel);
+         for( k = 0; k < 3; k++)
+            {
+            const double dpos = fabs( posn[k] - pptr[k]);
+            const double dvel = fabs( vel[k] - pptr[k + 3]);
+
+            if( max_posn_diff < dpos)
+               max_posn_diff = dpos;
+            if( max_vel_diff < dvel)
+               max_vel_diff = dvel;
+            }
+         }
+   printf( "Max differences: %.3g m,  %.3g mm/s\n", max_posn_diff * AU_IN_METERS,
+               max_vel_diff * AU_IN_METERS * 1000. / seconds_per_day);
+   if( max_posn_diff > MAX_POSN_DIFF)
+      {
+      printf( "FAILED\n");
+      rval = -1;
+      }
+   free( jds);
+
+            /* Now for timing: */
+   use_asteroid_tables( false);
+   old_time = time_integration( old_orbit, n_years);
+   use_asteroid_tables( true);
+   new_time = time_integration( new_orbit, n_years);
+   for( i = 0; i < 3; i++)
+      orbit_diff += (new_orbit[i] - old_orbit[i]) * (new_orbit[i] - old_orbit[i]);
+   printf( "Integration over %.1f years differs by %.3g m\n", n_years,
+               sqrt( orbit_diff) * AU_IN_METERS);
+   if( old_time > 0. && new_time > 0.)
+      {
+      printf( "Elements:   %.3f s\n", old_time);
+      printf( "Chebyshev:  %.3f s  (%.2fx)\n", new_time, old_time / new_time);
+      }
+   detect_perturbers( 0., nullptr, nullptr);
+   return( rval);
+}
@@ -77,14 +77,14 @@ const char* sofv_filename = "sofv.txt";
 double asteroid_magnitude_slope_param = .15;
 double comet_magnitude_slope_param = 10.;
 char default_comet_magnitude_type = 'N';
-int force_model = 0;
+thread_local int force_model = 0;
 
 
-extern int available_sigmas;   // defined in orb_func.cpp
+extern thread_local int available_sigmas;   // defined in orb_func.cpp
 extern double optical_albedo;  // defined in ephem0.cpp
-extern unsigned perturbers;    // defined in orbfunc.cpp. There is a field in SYORED_ORBIT with the same name !!
+extern thread_local unsigned perturbers;    // defined in orbfunc.cpp. There is a field in SYORED_ORBIT with the same name !!
 extern int debug_level;        // defined in findorb.cpp
-extern int forced_central_body;//defined in orb_func.cpp 
+extern thread_local int forced_central_body;//defined in orb_func.cpp 
 
 
 #ifdef NOT_CURRENTLY_IN_USE
@@ -761,7 +761,7 @@ int geo_score( const double *orbit, const double epoch)
    extern unsigned n_sr_orbits;
    unsigned i, n_geo, n_orbits;
    const double gm = get_planet_mass( 3);
-   extern int n_orbit_params;
+   extern thread_local int n_orbit_params;
 
    if( n_orbit_params > 6) /* don't bother with a geo score for objects */
       return( -1);         /* so well-determined that we have non-gravs */
@@ -798,7 +798,7 @@ static int elements_in_json_format( FILE *ofile, const Elements *elem,
                      const char *body_frame_note, const bool show_obs,
                      const int geocentric_score)
 {
-   extern int n_orbit_params;
+   extern thread_local int n_orbit_params;
    double jd = current_jd( );
    double jd_first, jd_last;
    double q_sigma = 0., weighted_rms;
@@ -806,7 +806,7 @@ static int elements_in_json_format( FILE *ofile, const Elements *elem,
    int first, last, i, n_used;
    extern const char *combine_all_observations;
    const char *packed_id;
-   extern double uncertainty_parameter;
+   extern thread_local double uncertainty_parameter;
    const char *reference = get_environment_ptr( "REFERENCE");
 
    if( combine_all_observations && *combine_all_observations)
@@ -1082,7 +1082,7 @@ is noted as preliminary/in progress/unreliable,  so this may change. */
 static int write_horizons_elems( const char *filename, const Elements *elem, const double *orbit)
 {
    FILE *ofile = fopen( filename, "wb");
-   extern int force_model;
+   extern thread_local int force_model;
    int i;
 
    assert( ofile);
@@ -1431,7 +1431,7 @@ static void _store_extra_orbit_info( const char *packed_id,
                const unsigned perturbers, const int n_extra_params,
                const double *solar_pressure, const char *constraints)
 {
-   extern int force_model;
+   extern thread_local int force_model;
    size_t n_lines;
    char **lines = load_file_into_memory( _extras_filename, &n_lines, false);
    FILE *ofile;
@@ -1506,7 +1506,7 @@ static int _get_extra_orbit_info( const char *packed_id,
                 unsigned *perturbers, int *n_extra_params,
                 double *solar_pressure, char *constraints)
 {
-   extern int force_model;
+   extern thread_local int force_model;
    size_t n_lines;
    char **lines = load_file_into_memory( _extras_filename, &n_lines, false);
    int i, j, rval = 0;
@@ -1807,14 +1807,14 @@ int write_out_elements_to_file( const double *orbit,
    char impact_buff[80];
    int n_more_moids = 0;
    int output_format = (precision | SHOWELEM_PERIH_TIME_MASK);
-   extern int n_orbit_params;
+   extern thread_local int n_orbit_params;
    int reference_shown = 0;
    double moids[N_MOIDS + 3];
    double j2000_ecliptic_rel_orbit[MAX_N_PARAMS];
    double barbee_style_delta_v = 0.;   /* see 'moid4.cpp' */
    const char *monte_carlo_permits;
    const bool rms_ok = (compute_rms( obs, n_obs) < max_monte_rms);
-   extern int available_sigmas;
+   extern thread_local int available_sigmas;
    int geocentric_score = -1;
    char body_frame_note[30];
    bool body_frame_note_shown = false;
@@ -1861,7 +1861,7 @@ int write_out_elements_to_file( const double *orbit,
 
    if( available_sigmas == COVARIANCE_AVAILABLE)
       {
-      extern int available_sigmas_hash;
+      extern thread_local int available_sigmas_hash;
 
       if( available_sigmas_hash != compute_available_sigmas_hash( obs, n_obs,
                   epoch_shown, perturbers, planet_orbiting))
@@ -1953,7 +1953,7 @@ int write_out_elements_to_file( const double *orbit,
       {
       char *tt_ptr;
       char sigma_buff[80];
-      extern double uncertainty_parameter;
+      extern thread_local double uncertainty_parameter;
              /* "Solar radiation pressure at 1 AU",  in             */
              /* kg*AU^3 / (m^2*d^2),  from a private communication  */
              /* from Steve Chesley; see orb_func.cpp for details    */
@@ -2784,7 +2784,7 @@ static int get_orbit_from_sof( const char *filename,
                        orbit + 6, nullptr))
             {
             double extra_info[10];
-            extern int n_orbit_params, force_model;
+            extern thread_local int n_orbit_params, force_model;
 
             extract_sof_data_ex( elems, buff, header, extra_info);
             if( elems->epoch < 2400000.)
@@ -3008,7 +3008,7 @@ static double extract_state_vect_from_text( const char *text,
       else if( *text == 'A' && text[1] >= '1' && text[1] <= '3'
                   && text[2] == '=')
          {
-         extern int n_orbit_params;
+         extern thread_local int n_orbit_params;
 
          n_orbit_params = 6 + text[1] - '1';
          force_model = ((n_orbit_params - 6) | 0x10);   /* assume inverse square for the nonce */
@@ -3126,7 +3126,7 @@ static int fetch_previous_solution(Observe *obs, const int n_obs, double *orbit,
                double *orbit_epoch, double *epoch_shown)
 {
    int got_vectors = 0, i;
-   extern int n_orbit_params;
+   extern thread_local int n_orbit_params;
    char object_name[80];
    bool do_full_improvement = false;
    double abs_mag = 10.;         /* default value for 'dummy' use */
@@ -3324,7 +3324,7 @@ static int obj_desig_to_perturber( const char *packed_desig)
 {
    int rval = -1, i;
    extern unsigned excluded_perturbers;
-   extern double object_mass;
+   extern thread_local double object_mass;
    const char *outer_planets[11] = { "            ",
                                      "     Mercury",
                                      "     Venus  ",
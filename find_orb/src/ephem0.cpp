@@ -60,7 +60,7 @@ static void put_residual_into_text(char* text, const double resid, const int res
 #define LOG_10 2.3025850929940456840179914546843642076011014886287729760333279009675726
 #define LIGHT_YEAR_IN_KM    (365.25 * seconds_per_day * SPEED_OF_LIGHT)
 
-extern int n_orbit_params;  // defined in orb_func.cpp
+extern thread_local int n_orbit_params;  // defined in orb_func.cpp
 
 const char *default_observe_filename = "observe.txt";
 const char *observe_filename = default_observe_filename;
@@ -2510,6 +2510,11 @@ static int _ephemeris_in_a_file( const char *filename, const double *orbit,
       compute_observer_loc( ephemeris_t, cinfo->planet, 0., 0., 0., geo_posn);
       compute_observer_vel( ephemeris_t, cinfo->planet, 0., 0., 0., geo_vel);
       strlcpy_error( buff, "Nothing to see here... move along... uninteresting... who cares?...");
+               /* The nominal orbit gets the full integrator,  so its */
+               /* ephemeris is unchanged;  variants are done together */
+      integrate_orbit( orbits_at_epoch, prev_ephem_t, ephemeris_t);
+      integrate_ensemble( orbits_at_epoch + n_orbit_params, n_objects - 1,
+                                 prev_ephem_t, ephemeris_t);
       for( obj_n = 0; obj_n < n_objects; obj_n++)
          {
          double *orbi = orbits_at_epoch + obj_n * n_orbit_params;
@@ -2522,7 +2527,6 @@ static int _ephemeris_in_a_file( const char *filename, const double *orbit,
          const char *sigma_delta_placeholder = "!sigma_delta!";
          const char *sigma_rvel_placeholder = "!sigma_rv!";
 
-         integrate_orbit( orbi, prev_ephem_t, ephemeris_t);
          for( j = 0; j < 3; j++)
             geo[j] = orbi[j] - geo_posn[j];
          if( !obj_n)
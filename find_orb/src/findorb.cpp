@@ -127,7 +127,7 @@ static bool _mouse_movements_are_reported = false;
 
 int debug_level = 0;
 
-extern unsigned perturbers;
+extern thread_local unsigned perturbers;
 
 #define AUTO_REPEATING                31002
 #define KEY_ADD_MENU_LINE             31004
@@ -186,7 +186,7 @@ static int count_wide_chars_in_utf8_string(const char* iptr, const char* endptr)
 
 
 
-extern int n_orbit_params;    // defined in orb_func.cpp
+extern thread_local int n_orbit_params;    // defined in orb_func.cpp
 extern double maximum_jd, minimum_jd;        /* orb_func.cpp */
 
 
@@ -650,7 +650,7 @@ static int extract_date( const char *buff, double *jd)
 
 static double *set_up_alt_orbits( const double *orbit, unsigned *n_orbits)
 {
-   extern int available_sigmas;
+   extern thread_local int available_sigmas;
    extern double *sr_orbits;
    extern unsigned n_sr_orbits;
 
@@ -2001,7 +2001,7 @@ static unsigned show_basic_info(const Observe *obs, const int n_obs,
 
 static int select_central_object( char *buff, const size_t buffsize, const bool dialog_text_only)
 {
-   extern int forced_central_body;
+   extern thread_local int forced_central_body;
    int i, c;
    const char *hotkeys = "AB0123456789L", *tptr;
 
@@ -3408,7 +3408,7 @@ static int non_grav_menu( char *message_to_user)
    char buff[400];
    int c;
    size_t i = 0;
-   extern int force_model;
+   extern thread_local int force_model;
    static int models[] = { FORCE_MODEL_NO_NONGRAVS, FORCE_MODEL_SRP,
             FORCE_MODEL_SRP_TWO_PARAM, FORCE_MODEL_SRP_THREE_PARAM,
             FORCE_MODEL_COMET_TWO_PARAM, FORCE_MODEL_COMET_THREE_PARAM,
@@ -4980,7 +4980,7 @@ int main( int argc, const char **argv)
             non_grav_menu( message_to_user);
             if( *message_to_user)      /* new force model selected */
                {
-               extern int force_model;
+               extern thread_local int force_model;
 
                for( i = 6; i < n_orbit_params; i++)
                   orbit[i] = 0.;
@@ -5377,7 +5377,7 @@ int main( int argc, const char **argv)
             break;
          case CTRL( 'F'):
             {
-            extern double **eigenvects;
+            extern thread_local double **eigenvects;
             static double total_sigma = 0.;
 
             if( eigenvects && !inquire( "Enter sigma: ", tbuff,
@@ -5402,7 +5402,7 @@ int main( int argc, const char **argv)
             break;
          case ALT_F:
             {
-            extern double **eigenvects;
+            extern thread_local double **eigenvects;
 
             if( eigenvects && eigenvects[0])
                {
@@ -5511,7 +5511,7 @@ int main( int argc, const char **argv)
                }
             else if( *tbuff == 'l')
                {
-               extern double levenberg_marquardt_lambda;
+               extern thread_local double levenberg_marquardt_lambda;
                const double orig_lambda = levenberg_marquardt_lambda;
 
                if( tbuff[1] == '*')
@@ -6316,10 +6316,12 @@ int main( int argc, const char **argv)
          case ALT_Z:
             {
             extern int integration_method;
+            const char *method_names[4] = { "Using RKF", "Using PD89",
+                           "Using RKF (doubles,  compensated)",
+                           "Using Gauss-Radau (IAS15)" };
 
-            integration_method ^= 1;
-            strlcpy_error( message_to_user, integration_method ?
-                           "Using PD89" : "Using RKF");
+            integration_method = (integration_method + 1) % 4;
+            strlcpy_error( message_to_user, method_names[integration_method]);
             }
             break;
          case ALT_X:
@@ -0,0 +1,229 @@
+/* fit_ctx.cpp: per-thread orbit determination state and batch fitting
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+/* Find_Orb grew up fitting one object at a time,  and the state of that
+fit (which perturbers are in use,  how many parameters are being solved
+for,  the force model,  and so on) lives in globals scattered across
+'orb_func.cpp',  'runge.cpp',  'pl_cache.cpp' and friends.  Rather than
+pass a context pointer through every function in the fitting path,
+those globals are declared 'thread_local'.  The main thread sees them
+exactly as before.  Each worker thread started here gets its own copy,
+initialized from a Fit_context snapshot of the main thread's settings,
+so several objects can be fitted at once without stepping on one
+another.
+
+   Things that are genuinely shared -- the JPL ephemeris file,  the
+BC-405 asteroid file,  the COSPAR orientation tables,  the planetary
+position cache -- are either read-only once loaded,  are guarded by
+locks where they're used,  or (in the case of the position cache) are
+built to be read and written concurrently.      */
+
+#include "fit_ctx.h"
+#include "orbfunc.h"
+#include "mpc_obs.h"
+#include "pl_cache.h"
+#include "runge.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <cassert>
+
+extern thread_local unsigned perturbers;
+extern thread_local int n_orbit_params;
+extern thread_local int force_model;
+extern thread_local int forced_central_body;
+extern thread_local double levenberg_marquardt_lambda;
+extern thread_local double object_mass;
+extern thread_local clock_t integration_timeout;
+extern thread_local int show_runtime_messages;
+extern thread_local int best_fit_planet;
+
+thread_local int fit_worker_id = 0;
+
+void fit_context_capture( Fit_context *ctx)
+{
+   ctx->perturbers = perturbers;
+   ctx->n_orbit_params = n_orbit_params;
+   ctx->force_model = force_model;
+   ctx->forced_central_body = forced_central_body;
+   ctx->levenberg_marquardt_lambda = levenberg_marquardt_lambda;
+   ctx->object_mass = object_mass;
+   ctx->solar_multiplier = get_solar_multiplier( );
+   ctx->best_fit_planet = best_fit_planet;
+   ctx->integration_timeout = integration_timeout;
+   ctx->show_runtime_messages = show_runtime_messages;
+   ctx->worker_id = fit_worker_id;
+}
+
+void fit_context_install( const Fit_context *ctx)
+{
+   perturbers = ctx->perturbers;
+   n_orbit_params = ctx->n_orbit_params;
+   force_model = ctx->force_model;
+   forced_central_body = ctx->forced_central_body;
+   levenberg_marquardt_lambda = ctx->levenberg_marquardt_lambda;
+   object_mass = ctx->object_mass;
+   set_solar_multiplier( ctx->solar_multiplier);
+   best_fit_planet = ctx->best_fit_planet;
+   integration_timeout = ctx->integration_timeout;
+   show_runtime_messages = ctx->show_runtime_messages;
+   fit_worker_id = ctx->worker_id;
+}
+
+/* The number of worker threads defaults to the number of hardware
+threads,  but can be set with FIT_THREADS in 'environ.dat'. */
+
+unsigned get_n_fit_threads( void)
+{
+   unsigned rval = (unsigned)atoi( get_environment_ptr( "FIT_THREADS"));
+
+   if( !rval)
+      rval = std::thread::hardware_concurrency( );
+   if( !rval)
+      rval = 1;
+   return( rval);
+}
+
+/* full_improvement() is called over and over,  and starting and joining
+a fresh set of threads each time adds up;  so the threads are started
+once and then wait for more work.  The pool is
+deliberately never freed:  its threads just sit idle until the program
+exits.  Only one batch of work runs at a time;  'call_mutex' makes any
+other caller wait its turn.    */
+
+struct Fit_thread_pool
+{
+   std::mutex call_mutex, mutex;
+   std::condition_variable work_ready, work_done;
+   const std::function<void( const unsigned)> *func = nullptr;
+   unsigned n_threads = 0, n_to_run = 0, n_running = 0;
+   uint64_t generation = 0;
+};
+
+static thread_local bool is_pool_thread = false;
+
+static void pool_thread_loop( Fit_thread_pool *pool, const unsigned thread_no,
+                              uint64_t generation)
+{
+   std::unique_lock<std::mutex> lock( pool->mutex);
+
+   is_pool_thread = true;
+   for( ;;)
+      {
+      pool->work_ready.wait( lock,
+                  [&]( ) { return( pool->generation != generation); });
+      generation = pool->generation;
+      if( thread_no < pool->n_to_run)
+         {
+         const std::function<void( const unsigned)> *func = pool->func;
+
+         lock.unlock( );
+         (*func)( thread_no);
+         lock.lock( );
+         if( !--pool->n_running)
+            pool->work_done.notify_one( );
+         }
+      }
+}
+
+void run_on_fit_threads( const unsigned n_threads,
+                     const std::function<void( const unsigned)> &func)
+{
+   static Fit_thread_pool *pool = new Fit_thread_pool;
+
+   assert( !is_pool_thread);     /* we'd wait forever on ourselves */
+   std::lock_guard<std::mutex> call_lock( pool->call_mutex);
+   std::unique_lock<std::mutex> lock( pool->mutex);
+
+   while( pool->n_threads < n_threads)
+      std::thread( pool_thread_loop, pool, pool->n_threads++,
+                                          pool->generation).detach( );
+   pool->func = &func;
+   pool->n_to_run = pool->n_running = n_threads;
+   pool->generation++;
+   pool->work_ready.notify_all( );
+   pool->work_done.wait( lock, [&]( ) { return( !pool->n_running); });
+   pool->func = nullptr;
+}
+
+static void fit_one_object( Fit_job *job)
+{
+   int i;
+
+   if( !job->epoch)
+      job->epoch = initial_orbit( job->obs, job->n_obs, job->orbit);
+   job->rval = 0;
+   for( i = 0; i < job->n_iterations && !job->rval; i++)
+      job->rval = full_improvement( job->obs, job->n_obs, job->orbit,
+                  job->epoch, nullptr, ORBIT_SIGMAS_REQUESTED, job->epoch);
+   set_locs( job->orbit, job->epoch, job->obs, job->n_obs);
+   job->rms = compute_rms( job->obs, job->n_obs);
+}
+
+/* Jobs are handed out through a shared atomic index,  so a thread that
+gets a few quick objects just moves on to the next one;  there's no need
+to try to balance the load ahead of time.  Each object starts from the
+caller's fit state,  with full_improvement()'s step sizes reset,  so that
+the result doesn't depend on which objects that thread fitted before it.
+Returns the number of jobs for which full_improvement() reported no
+errors. */
+
+int fit_objects_in_parallel( Fit_job *jobs, const int n_jobs, unsigned n_threads)
+{
+   Fit_context ctx;
+   std::atomic<int> next_job( 0), n_succeeded( 0);
+   std::vector<std::thread> workers;
+   unsigned i;
+
+   if( !n_threads)
+      n_threads = get_n_fit_threads( );
+   if( n_threads > (unsigned)n_jobs)
+      n_threads = (unsigned)n_jobs;
+   get_environment_ptr( "FIT_THREADS");   /* ensure environ.dat is loaded */
+   fit_context_capture( &ctx);            /* _before_ threads start */
+   ctx.show_runtime_messages = 0;
+   for( i = 0; i < n_threads; i++)
+      workers.emplace_back( [&, i]( )
+         {
+         Fit_context local_ctx = ctx;
+         int idx;
+
+         local_ctx.worker_id = (int)i + 1;
+         fit_context_install( &local_ctx);
+         while( (idx = next_job++) < n_jobs)
+            {
+            Fit_job *job = jobs + idx;
+
+            fit_context_install( &local_ctx);      /* start each object */
+            full_improvement( nullptr, 0, nullptr, 0., nullptr, 0, 0.);
+            fit_one_object( job);
+            if( !job->rval)
+               n_succeeded++;
+            }
+         planet_posn( PLANET_POSN_FLUSH_THREAD_STATS, 0., nullptr);
+         });
+   for( auto &w : workers)
+      w.join( );
+   return( n_succeeded);
+}
@@ -0,0 +1,68 @@
+#ifndef FIT_CTX_H_INCLUDE
+#define FIT_CTX_H_INCLUDE
+
+/* fit_ctx.h: per-thread orbit determination state,  and a driver
+for fitting many objects at once on a pool of threads.  See 'fit_ctx.cpp'. */
+
+#include <ctime>
+#include <functional>
+#include "mpc_obs.h"       /* for MAX_N_PARAMS */
+
+struct Observe;
+
+/* Everything that the fitting and integration code treats as "the
+current object's settings".  In a single-threaded run,  these are just
+the usual globals.  Each worker thread gets its own copy of the globals
+(they're declared 'thread_local'),  and a Fit_context is how the settings
+chosen on the main thread get carried over to the workers. */
+
+struct Fit_context
+{
+    unsigned perturbers;
+    int n_orbit_params;
+    int force_model;
+    int forced_central_body;
+    double levenberg_marquardt_lambda;
+    double object_mass;
+    long double solar_multiplier;   /* see compute_effective_solar_multiplier() */
+    int best_fit_planet;       /* where Encke integration starts;  see runge.cpp */
+    clock_t integration_timeout;
+    int show_runtime_messages;
+    int worker_id;             /* 0 = main thread */
+};
+
+void fit_context_capture(Fit_context* ctx);
+void fit_context_install(const Fit_context* ctx);
+
+/* One object to be fitted by fit_objects_in_parallel().  The caller
+loads the observations and supplies a starting orbit at 'epoch'.  If
+'epoch' is zero,  initial_orbit() is run to get one.  On return,  'orbit'
+and 'epoch' hold the fitted state vector,  'rms' is the unweighted RMS
+in arcseconds,  and 'rval' is the last full_improvement() return value. */
+
+struct Fit_job
+{
+    Observe* obs;
+    int n_obs;
+    int n_iterations;
+    double orbit[MAX_N_PARAMS];
+    double epoch;
+    double rms;
+    int rval;
+};
+
+unsigned get_n_fit_threads(void);
+
+/* Calls func( 0),  func( 1), ... func( n_threads - 1) at once,  each on
+its own thread from a pool that's kept from one call to the next,  and
+returns when they're all done.  Pool threads keep their thread_local
+state between calls,  so 'func' should start with fit_context_install().
+It mustn't be called from within a pool thread.  */
+
+void run_on_fit_threads(const unsigned n_threads,
+                 const std::function<void(const unsigned)>& func);
+int fit_objects_in_parallel(Fit_job* jobs, const int n_jobs, unsigned n_threads);
+
+extern thread_local int fit_worker_id;
+
+#endif // !FIT_CTX_H_INCLUDE
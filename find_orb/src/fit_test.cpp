@@ -0,0 +1,400 @@
+/* fit_test.cpp: checks fit_objects_in_parallel( ) against serial fitting
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+/* Loads every object in an astrometry file,  gets an initial orbit for
+each on the main thread,  then fits them all with
+fit_objects_in_parallel( ) on one,  two,  three,  and the given number of
+threads.  Each object's fit should come out exactly the same every time,
+since every worker has its own copy of the fitting state (see
+'fit_ctx.cpp'),  reset before each object;  any difference means some
+state is leaking between threads or from one object to the next,  and
+the test fails.  The timings are shown as well.
+
+   fit_test (filename) [-t(threads)] [-i(iterations)]
+
+   Before that,  one full_improvement( ) step is taken for each object
+with an area/mass ("A=") constraint in effect,  once with the partials
+found on the main thread (SERIAL_PARTIALS=1) and once with them spread
+over the thread pool.  The two should agree;  if they don't,  the worker
+threads aren't integrating with the same force model as the main thread.
+Then a step is taken with finite-difference partials and again with
+VARIATIONAL_PARTIALS=1,  with and without non-gravs and constraints,
+and the two steps should come out nearly the same.
+
+   The number of threads defaults to FIT_THREADS (or the number of
+hardware threads),  the number of full_improvement( ) iterations per
+object to three.  The usual Find_Orb data files are needed.       */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include "comets.h"
+#include "afuncs.h"
+#include "mpc_obs.h"
+#include "elem_out.h"
+#include "orbfunc.h"
+#include "fit_ctx.h"
+#include "sigma.h"
+#include "runge.h"
+
+#define MAX_POSN_DIFF_KM      1e-6
+#define MAX_VARIATIONAL_DIFF  1e-2
+#define VARIATIONAL_TEST_LAMBDA 1e+6
+#define TEST_CONSTRAINT       "A=0.1"
+#define N_RUNS                4
+
+extern thread_local int force_model, n_orbit_params;
+
+/* As in findorb.cpp,  we start reading well ahead of the object's first
+observation,  in case there's a #Sigma: or similar header line.
+load_object( ) sets 'n_obs' to the number of observations actually
+loaded (duplicates are dropped),  so it's given a copy of 'id';
+otherwise,  loading the object again would read only part of it.  */
+
+static Observe *load_object_at_offset( FILE *ifile, const OBJECT_INFO *id,
+                                       double *orbit, int *n_obs)
+{
+   long file_offset = id->file_offset - 40000L;
+   double curr_epoch, epoch_shown;
+   char buff[200];
+   OBJECT_INFO tid = *id;
+   Observe *rval;
+
+   if( file_offset < 0L)
+      file_offset = 0L;
+   fseek( ifile, file_offset, SEEK_SET);
+   if( file_offset)        /* read and discard partial line */
+      if( !fgets( buff, sizeof( buff), ifile))
+         return( nullptr);
+   rval = load_object( ifile, &tid, &curr_epoch, &epoch_shown, orbit);
+   *n_obs = tid.n_obs;
+   return( rval);
+}
+
+static double posn_diff_in_km( const double *orbit1, const double *orbit2)
+{
+   double diff = 0.;
+   int i;
+
+   for( i = 0; i < 3; i++)
+      diff += (orbit1[i] - orbit2[i]) * (orbit1[i] - orbit2[i]);
+   return( sqrt( diff) * AU_IN_KM);
+}
+
+/* Returns the difference,  in km,  between the positions after one
+full_improvement( ) step with serial and with parallel partials;  or a
+negative value if the object couldn't be loaded.  */
+
+static double check_partials( FILE *ifile, const OBJECT_INFO *id)
+{
+   double orbit[2][MAX_N_PARAMS], start_orbit[MAX_N_PARAMS], epoch = 0.;
+   int i, j, n_obs;
+   Fit_context ctx;
+
+   for( i = 0; i < 2; i++)
+      {
+      Observe *obs = load_object_at_offset( ifile, id, orbit[i], &n_obs);
+
+      if( !obs)
+         return( -1.);
+      if( !i)
+         {
+         epoch = initial_orbit( obs, n_obs, start_orbit);
+         compute_effective_solar_multiplier( TEST_CONSTRAINT);
+         fit_context_capture( &ctx);
+         }
+      memcpy( orbit[i], start_orbit, sizeof( start_orbit));
+      for( j = 0; j < n_obs; j++)      /* initial_orbit( ) may have used */
+         obs[j].is_included = 1;       /* only part of the arc           */
+      set_environment_ptr( "SERIAL_PARTIALS", i ? "0" : "1");
+            /* load_object( ) resets the "A=" constraint,  and     */
+            /* full_improvement( ) adjusts the LM lambda and the   */
+            /* deltas used for partials;  start both steps alike.  */
+      fit_context_install( &ctx);
+      full_improvement( nullptr, 0, nullptr, 0., nullptr, 0, 0.);
+      full_improvement( obs, n_obs, orbit[i], epoch, nullptr,
+                        NO_ORBIT_SIGMAS_REQUESTED, epoch);
+      unload_observations( obs, n_obs);
+      }
+   compute_effective_solar_multiplier( nullptr);
+   return( posn_diff_in_km( orbit[0], orbit[1]));
+}
+
+/* Takes one full_improvement( ) step from the same starting orbit with
+finite-difference partials,  then with variational ones (see
+VARIATIONAL_PARTIALS in 'orb_func.cpp').  Left to itself,  the step
+would solve the normal equations,  and along directions the observations
+hardly constrain,  small differences in the partials would make for
+big differences in the step.  A large Levenberg-Marquardt lambda makes
+it a short step down the gradient instead,  which depends on the
+partials directly.  Returns the larger of the relative differences
+between the two steps in position and (if any) in the non-gravs;  zero if
+the finite-difference step failed (so there's nothing to compare);  or a
+negative value if the object couldn't be loaded.     */
+
+static double check_variational( FILE *ifile, const OBJECT_INFO *id,
+                     const int model, const char *constraint)
+{
+   double orbit[2][MAX_N_PARAMS], start_orbit[MAX_N_PARAMS], epoch = 0.;
+   double rval = 0.;
+   int i, j, n_obs, err_code[2];
+   Fit_context ctx;
+
+   for( i = 0; i < 2; i++)
+      {
+      Observe *obs = load_object_at_offset( ifile, id, orbit[i], &n_obs);
+
+      if( !obs)
+         return( -1.);
+      if( !i)
+         {
+         epoch = initial_orbit( obs, n_obs, start_orbit);
+         force_model = model;
+         n_orbit_params = 6 + (model & 0xf);
+         for( j = 6; j < n_orbit_params; j++)
+            start_orbit[j] = 0.;
+         fit_context_capture( &ctx);
+         ctx.levenberg_marquardt_lambda = VARIATIONAL_TEST_LAMBDA;
+         }
+      memcpy( orbit[i], start_orbit, sizeof( start_orbit));
+      for( j = 0; j < n_obs; j++)
+         obs[j].is_included = 1;
+      set_environment_ptr( "VARIATIONAL_PARTIALS", i ? "1" : "0");
+      fit_context_install( &ctx);
+      full_improvement( nullptr, 0, nullptr, 0., nullptr, 0, 0.);
+      err_code[i] = full_improvement( obs, n_obs, orbit[i], epoch, constraint,
+                        NO_ORBIT_SIGMAS_REQUESTED, epoch);
+      unload_observations( obs, n_obs);
+      }
+   set_environment_ptr( "VARIATIONAL_PARTIALS", "0");
+   if( !err_code[0])
+      {
+      rval = posn_diff_in_km( orbit[0], orbit[1])
+                  / posn_diff_in_km( orbit[0], start_orbit);
+      for( j = 6; j < n_orbit_params; j++)
+         if( orbit[0][j] != start_orbit[j])
+            {
+            const double diff = fabs( (orbit[0][j] - orbit[1][j])
+                                    / (orbit[0][j] - start_orbit[j]));
+
+            if( rval < diff)
+               rval = diff;
+            }
+      if( err_code[1])        /* variational step failed,  FD didn't */
+         rval = 1.;
+      }
+   force_model = FORCE_MODEL_NO_NONGRAVS;
+   n_orbit_params = 6;
+   return( rval);
+}
+
+static const struct
+   {
+   int model;
+   const char *constraint;
+   } variational_cases[] = {
+      { FORCE_MODEL_NO_NONGRAVS, nullptr },
+      { FORCE_MODEL_NO_NONGRAVS, "e=0.5" },
+      { FORCE_MODEL_SRP, nullptr },
+      { FORCE_MODEL_SRP, "A=0.1" } };
+
+#define N_VARIATIONAL_CASES (int)( sizeof( variational_cases) / sizeof( variational_cases[0]))
+
+static double run_fits( Fit_job *jobs, const int n_jobs, const unsigned n_threads)
+{
+   const auto t0 = std::chrono::steady_clock::now( );
+
+   fit_objects_in_parallel( jobs, n_jobs, n_threads);
+   return( std::chrono::duration<double>(
+                  std::chrono::steady_clock::now( ) - t0).count( ));
+}
+
+int main( const int argc, const char **argv)
+{
+   ephem_option_t ephem_options;
+   int element_format, element_precision, n_ids, n_jobs = 0, i, j;
+   int n_iterations = 3, n_differing = 0, *id_index;
+   unsigned n_threads = 0, thread_counts[N_RUNS] = { 1, 2, 3, 0 };
+   double max_resid, noise, times[N_RUNS], max_diff = 0.;
+   OBJECT_INFO *ids;
+   Fit_job *jobs[N_RUNS];
+   FILE *ifile;
+
+   if( argc < 2)
+      {
+      printf( "Usage:  fit_test (filename) [-t(threads)] [-i(iterations)]\n");
+      return( -1);
+      }
+   for( i = 2; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'i':
+               n_iterations = atoi( argv[i] + 2);
+               break;
+            case 't':
+               n_threads = (unsigned)atoi( argv[i] + 2);
+               break;
+            default:
+               printf( "Option '%s' ignored\n", argv[i]);
+               break;
+            }
+   get_defaults( &ephem_options, &element_format, &element_precision,
+                  &max_resid, &noise);
+   load_up_sigma_records( "sigma.txt");
+   ids = find_objects_in_file( argv[1], &n_ids, nullptr);
+   ifile = fopen( argv[1], "rb");
+   if( !ids || n_ids <= 0 || !ifile)
+      {
+      printf( "Couldn't read objects from '%s'\n", argv[1]);
+      return( -1);
+      }
+   if( n_threads)
+      {
+      char buff[20];
+
+      snprintf( buff, sizeof( buff), "%u", n_threads);
+      set_environment_ptr( "FIT_THREADS", buff);
+      }
+   if( get_n_fit_threads( ) < 2)        /* partials would all be serial */
+      set_environment_ptr( "FIT_THREADS", "2");
+   for( i = 0; i < n_ids; i++)
+      if( ids[i].n_obs >= 3)
+         {
+         const double diff = check_partials( ifile, ids + i);
+
+         if( diff < 0.)
+            {
+            printf( "Couldn't load %s\n", ids[i].obj_name);
+            return( -1);
+            }
+         if( max_diff < diff)
+            max_diff = diff;
+         if( diff > MAX_POSN_DIFF_KM)
+            {
+            printf( "%s: serial/parallel partials (%s) differ by %g km\n",
+                     ids[i].obj_name, TEST_CONSTRAINT, diff);
+            n_differing++;
+            }
+         }
+   printf( "Largest partials difference %g km\n", max_diff);
+   max_diff = 0.;
+   for( i = 0; i < n_ids; i++)
+      if( ids[i].n_obs >= 3)
+         for( j = 0; j < N_VARIATIONAL_CASES; j++)
+            {
+            const char *constraint = variational_cases[j].constraint;
+            const double diff = check_variational( ifile, ids + i,
+                                 variational_cases[j].model, constraint);
+
+            if( diff < 0.)
+               {
+               printf( "Couldn't load %s\n", ids[i].obj_name);
+               return( -1);
+               }
+            if( max_diff < diff)
+               max_diff = diff;
+            if( diff > MAX_VARIATIONAL_DIFF)
+               {
+               printf( "%s: variational partials (force model %x, %s) differ by %g\n",
+                     ids[i].obj_name, variational_cases[j].model,
+                     constraint ? constraint : "unconstrained", diff);
+               n_differing++;
+               }
+            }
+   printf( "Largest variational partials difference %g\n", max_diff);
+   max_diff = 0.;
+   thread_counts[N_RUNS - 1] = (n_threads ? n_threads : get_n_fit_threads( ));
+   for( j = 0; j < N_RUNS; j++)
+      jobs[j] = (Fit_job *)calloc( n_ids, sizeof( Fit_job));
+   id_index = (int *)calloc( n_ids, sizeof( int));
+            /* Each object is loaded once per run,  since fitting changes
+               the observations (residuals,  weights,  rejections).  */
+   for( i = 0; i < n_ids; i++)
+      if( ids[i].n_obs >= 3)
+         {
+         double orbit[MAX_N_PARAMS], curr_epoch;
+
+         for( j = 0; j < N_RUNS; j++)
+            {
+            jobs[j][n_jobs].obs = load_object_at_offset( ifile, ids + i,
+                                          orbit, &jobs[j][n_jobs].n_obs);
+            jobs[j][n_jobs].n_iterations = n_iterations;
+            if( !jobs[j][n_jobs].obs || jobs[j][n_jobs].n_obs < 3)
+               {
+               printf( "Couldn't load %s\n", ids[i].obj_name);
+               return( -1);
+               }
+            }
+         curr_epoch = initial_orbit( jobs[0][n_jobs].obs,
+                                       jobs[0][n_jobs].n_obs, orbit);
+         for( j = 0; j < N_RUNS; j++)
+            {
+            int k;
+
+            jobs[j][n_jobs].epoch = curr_epoch;
+            memcpy( jobs[j][n_jobs].orbit, orbit, sizeof( orbit));
+                     /* initial_orbit( ) may have excluded some obs */
+            for( k = 0; k < jobs[j][n_jobs].n_obs; k++)
+               jobs[j][n_jobs].obs[k].is_included =
+                              jobs[0][n_jobs].obs[k].is_included;
+            }
+         id_index[n_jobs++] = i;
+         }
+   fclose( ifile);
+   printf( "%d objects to be fitted\n", n_jobs);
+   if( !n_jobs)
+      return( -1);
+   for( j = 0; j < N_RUNS; j++)
+      times[j] = run_fits( jobs[j], n_jobs, thread_counts[j]);
+   for( j = 1; j < N_RUNS; j++)
+      for( i = 0; i < n_jobs; i++)
+         {
+         const Fit_job *job0 = jobs[0] + i, *job1 = jobs[j] + i;
+         const double diff = posn_diff_in_km( job0->orbit, job1->orbit);
+
+         if( max_diff < diff)
+            max_diff = diff;
+         if( diff > MAX_POSN_DIFF_KM || job0->rval != job1->rval
+                     || job0->rms != job1->rms)
+            {
+            printf( "%s: %u threads differ by %g km;  rms %f vs. %f\n",
+                        ids[id_index[i]].obj_name, thread_counts[j], diff,
+                        job0->rms, job1->rms);
+            n_differing++;
+            }
+         }
+   printf( "Largest difference %g km\n", max_diff);
+   for( j = 0; j < N_RUNS; j++)
+      printf( "%2u thread(s):  %.3f s  (%.2fx)\n", thread_counts[j], times[j],
+                  times[0] / times[j]);
+   for( j = 0; j < N_RUNS; j++)
+      {
+      for( i = 0; i < n_jobs; i++)
+         unload_observations( jobs[j][i].obs, jobs[j][i].n_obs);
+      free( jobs[j]);
+      }
+   free( id_index);
+   find_objects_in_file( nullptr, nullptr, nullptr);
+   if( n_differing)
+      printf( "FAILED:  %d differences\n", n_differing);
+   return( n_differing ? -1 : 0);
+}
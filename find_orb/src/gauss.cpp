@@ -354,7 +354,7 @@ double convenient_gauss( const Observe *obs, int n_obs, double *orbit,
 {
    double p2, old_orbit[6], d0;
    unsigned obs_idx[3], i;
-   extern double uncertainty_parameter;
+   extern thread_local double uncertainty_parameter;
 
    uncertainty_parameter = 99.;
    while( n_obs && !obs->is_included)
@@ -19,6 +19,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <cstdlib>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 
 /* MS only got around to adding 'isfinite',  asinh in VS2013 : */
 
@@ -31,8 +32,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #define PI 3.1415926535897932384626433832795028841971693993751058209749445923
 
 /* Everyplace else,  we can go with a lot of spherical harmonic
-terms (more than are probably ever apt to be really needed) : */
-#define N_TERMS 50
+terms (more than are probably ever apt to be really needed).  The
+GGM03C terms below only go to degree 50;  if N_TERMS is set higher
+(the 'geopot_test' program does so),  the terms past that are zero,
+unless _fill_missing_terms is set (see below). */
+
+#ifndef N_TERMS
+   #define N_TERMS 50
+#endif
+#define GGM03C_DEGREE 50
 
 
 /* First few terms for the Earth geopotential expansion,  from  GGM03C
@@ -48,7 +56,7 @@ convenient C array below.  Note that data in the same format is available
 for the Moon,  Mars,  and Venus;  it should be quite easy to add them to
 Find_Orb in the same way,  if we ever decide that would matter.   */
 
-   static long double ggm03c_terms[] = {           /* l m   (l=degree,  m=order) */
+   static long double ggm03c_terms[(N_TERMS + 1) * (N_TERMS + 2)] = {  /* l m   (l=degree,  m=order) */
         1.000000000000E+00,  0.000000000000E+00,   /* 0 0 */
 
         0.000000000000E+00,  0.000000000000E+00,   /* 1 0 */
@@ -1504,11 +1512,47 @@ for each ALP.  The following lets you avoid that... admittedly,  at the
 cost of possibly hitting issues for l >= 877,  if that ever happens.
 (I currently set a stricter assert of l < 800.)  */
 
-static void renormalize_terms( void)
+/* geo_gradient_in_au() works in doubles,  so it gets its own copy of the
+renormalized terms,  plus the coefficients for the Cunningham recursions
+(see below),  which would otherwise cost two divisions per term per call.
+These are all set up once,  the first time either function is called
+(thread-safely,  through the initialization of a static local). */
+
+static double geo_terms[(N_TERMS + 1) * (N_TERMS + 2)];
+static double recur_a[N_TERMS + 1][N_TERMS + 1];
+static double recur_b[N_TERMS + 1][N_TERMS + 1];
+
+/* For the 'geopot_test' program,  which times things out to degree 100:
+if this is set before the geopotential is first computed,  the terms
+past GGM03C_DEGREE are made up,  with about the magnitudes real terms
+would have (Kaula's rule,  1e-5 / l^2),  so that they're not just
+zeroes contributing nothing.  Don't use this for anything real!  */
+
+int _fill_missing_terms = 0;
+
+static void fill_missing_terms( void)
+{
+   uint32_t seed = 31416;
+   int l, m, i;
+
+   for( l = GGM03C_DEGREE + 1; l <= N_TERMS; l++)
+      for( m = 0; m <= l; m++)
+         for( i = 0; i < (m ? 2 : 1); i++)      /* S(l,0) = 0 */
+            {
+            seed = seed * 1664525u + 1013904223u;
+            ggm03c_terms[l * (l + 1) + m + m + i] = 1e-5L / (long double)( l * l)
+                           * ((long double)seed / 2147483648.L - 1.L);
+            }
+}
+
+static bool renormalize_terms( void)
 {
    int l, m;
    long double *geo_tptr = ggm03c_terms;
 
+   if( _fill_missing_terms)
+      fill_missing_terms( );
+
    for( l = 0; l <= N_TERMS; l++)
       {
       long double factor = sqrtl( (long double)( l + l + 1));
@@ -1521,9 +1565,23 @@ static void renormalize_terms( void)
          *geo_tptr++ *= ( m ? factor * sqrt_2 : factor);
 
          if( l != m)
+            {
             factor /= sqrtl((long double)((l + m + 1) * (l - m)));
+            recur_a[l][m] = (double)( 2 * l - 1) / (double)( l - m);
+            recur_b[l][m] = (double)( l + m - 1) / (double)( l - m);
+            }
          }
       }
+   for( l = 0; l < (N_TERMS + 1) * (N_TERMS + 2); l++)
+      geo_terms[l] = (double)ggm03c_terms[l];
+   return( true);
+}
+
+static bool set_up_terms( void)
+{
+   static const bool renormalized = renormalize_terms( );
+
+   return( renormalized);
 }
 
 /* A note on determining the derivative of an associated Legendre polynomial:
@@ -1589,16 +1647,11 @@ static long double geo_potential( const long double x, const long double y,
    long double rval = 0.;
    long double drval_dr = 0., drval_dtheta = 0., drval_dphi = 0.;
    int l, m;
-   static bool renormalized = false;
 
+   set_up_terms( );
    assert( n_terms < 800);       /* see above comments on limits */
    if( n_terms > N_TERMS)
       n_terms = N_TERMS;
-   if( renormalized == false)
-      {
-      renormalize_terms( );
-      renormalized = true;
-      }
 
    sin_mtheta[0] = 0.;
    cos_mtheta[0] = 1.;
@@ -1673,6 +1726,85 @@ static long double geo_potential( const long double x, const long double y,
    return( rval);
 }
 
+/* The acceleration due to the geopotential,  computed directly in
+rectangular coordinates using the recursions of Cunningham (1970) for
+
+   V(n,m) = (R/r)^(n+1) P(n,m)(sin lat) cos( m * lon)
+   W(n,m) = (R/r)^(n+1) P(n,m)(sin lat) sin( m * lon)
+
+as given in Montenbruck & Gill,  _Satellite Orbits_,  section 3.2.  This
+gets the same derivatives as geo_potential( ),  but with no trig functions
+and no divisions by r_cyl (so no trouble over the poles),  and the
+recursion for each degree runs over all orders at once,  which the
+compiler can vectorize.  We're using unnormalized terms in doubles.
+The normalization itself is done in long doubles (see above),  but
+the unnormalized terms shrink,  and V and W grow,  roughly as
+1/sqrt((2n)!) and sqrt((2n)!);  somewhere past degree 140,  they'd
+underflow or overflow.
+With N_TERMS at 50 (or even 101,  for 'geopot_test'),  that's not an
+issue.
+
+   As with geo_potential( ),  x, y, z are in units of the earth's radius,
+and terms of degree n_terms and above are left out.  The result is in
+units where the acceleration at the earth's surface is 1,  with the sign
+flipped (i.e.,  the gradient of the negated potential),  and doesn't
+include the central (degree 0) term.  _starting_term is ignored.  */
+
+static void geo_gradient( const double x, const double y, const double z,
+                           double *derivs, int n_terms)
+{
+   const double rho = 1. / (x * x + y * y + z * z);
+   const double x0 = x * rho, y0 = y * rho, z0 = z * rho;
+   double v[N_TERMS + 1][N_TERMS + 1], w[N_TERMS + 1][N_TERMS + 1];
+   double ax = 0., ay = 0., az = 0.;
+   int n, m;
+
+   set_up_terms( );
+   if( n_terms > N_TERMS)
+      n_terms = N_TERMS;
+   v[0][0] = sqrt( rho);
+   w[0][0] = 0.;
+   for( n = 1; n <= n_terms; n++)     /* need V & W up to n_terms */
+      {
+      const double *aptr = recur_a[n], *bptr = recur_b[n];
+      const double tn = (double)( 2 * n - 1);
+
+      for( m = 0; m < n - 1; m++)
+         {
+         v[n][m] = aptr[m] * z0 * v[n - 1][m] - bptr[m] * rho * v[n - 2][m];
+         w[n][m] = aptr[m] * z0 * w[n - 1][m] - bptr[m] * rho * w[n - 2][m];
+         }
+      v[n][n - 1] = tn * z0 * v[n - 1][n - 1];
+      w[n][n - 1] = tn * z0 * w[n - 1][n - 1];
+      v[n][n] = tn * (x0 * v[n - 1][n - 1] - y0 * w[n - 1][n - 1]);
+      w[n][n] = tn * (x0 * w[n - 1][n - 1] + y0 * v[n - 1][n - 1]);
+      }
+
+   for( n = 2; n < n_terms; n++)
+      {
+      const double *geo_tptr = geo_terms + n * (n + 1);
+      const double *vptr = v[n + 1], *wptr = w[n + 1];
+
+      ax -= geo_tptr[0] * vptr[1];
+      ay -= geo_tptr[0] * wptr[1];
+      az -= (double)( n + 1) * geo_tptr[0] * vptr[0];
+      for( m = 1; m <= n; m++)
+         {
+         const double c = geo_tptr[m + m], s = geo_tptr[m + m + 1];
+         const double fac = (double)( (n - m + 1) * (n - m + 2));
+
+         ax += .5 * ((-c * vptr[m + 1] - s * wptr[m + 1])
+                    + fac * (c * vptr[m - 1] + s * wptr[m - 1]));
+         ay += .5 * ((-c * wptr[m + 1] + s * vptr[m + 1])
+                    + fac * (-c * wptr[m - 1] + s * vptr[m - 1]));
+         az += (double)( n - m + 1) * (-c * vptr[m] - s * wptr[m]);
+         }
+      }
+   derivs[0] = -ax;
+   derivs[1] = -ay;
+   derivs[2] = -az;
+}
+
 #define EARTH_MAJOR_AXIS 6378140.
 #define AU_IN_KM 1.495978707e+8
 #define AU_IN_METERS (AU_IN_KM * 1000.)
@@ -1683,14 +1815,15 @@ const double seconds_per_day = 24. * 60. * 60.;
 /* Input xyz are in AU.  The return value is in AU^2/day^2,  with the
 derivatives in AU/day^2. */
 
+static const double earth_gm_mks = 0.3986004415E+15; /* GGM03 value, in m^3/s^2 */
+static const double earth_gm_aud = earth_gm_mks * seconds_per_day * seconds_per_day
+               / (AU_IN_METERS * AU_IN_METERS * AU_IN_METERS);
+                                       /* in AU^3/day^2 */
+
 double geo_potential_in_au( const double x, const double y, const double z,
                  double *derivs, const int n_terms)
 {
    long double lderivs[3];
-   const double earth_gm_mks = 0.3986004415E+15; /* GGM03 value, in m^3/s^2 */
-   const double earth_gm_aud = earth_gm_mks * seconds_per_day * seconds_per_day
-               / (AU_IN_METERS * AU_IN_METERS * AU_IN_METERS);
-                                       /* in AU^3/day^2 */
    double rval =  -(double)geo_potential( (long double)( x / EARTH_R),
                                           (long double)( y / EARTH_R),
                                           (long double)( z / EARTH_R),
@@ -1726,3 +1859,18 @@ double geo_potential_in_au( const double x, const double y, const double z,
       }
    return( rval);
 }
+
+/* Same derivatives as geo_potential_in_au( ),  i.e.,  minus the
+acceleration in AU/day^2 for xyz in AU,  but computed in doubles with
+geo_gradient( ) above.  That's several times faster,  and is what the
+integrator uses. */
+
+void geo_gradient_in_au( const double x, const double y, const double z,
+                 double *derivs, const int n_terms)
+{
+   size_t i;
+
+   geo_gradient( x / EARTH_R, y / EARTH_R, z / EARTH_R, derivs, n_terms);
+   for( i = 0; i < 3; i++)
+      derivs[i] *= earth_gm_aud / (EARTH_R * EARTH_R);
+}
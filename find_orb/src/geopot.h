@@ -3,5 +3,7 @@
 
 double geo_potential_in_au(const double x, const double y, const double z,
     double* derivs, const int n_terms);    /* geo_pot.c */
+void geo_gradient_in_au(const double x, const double y, const double z,
+    double* derivs, const int n_terms);    /* geo_pot.c */
 
 #endif
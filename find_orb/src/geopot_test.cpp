@@ -0,0 +1,123 @@
+/* Copyright (C) 2026, Project Pluto.  See LICENSE.  */
+
+/* geopot_test.cpp:  checks the double-precision Cunningham geopotential
+gradient (geo_gradient_in_au( ) in 'geo_pot.cpp') against the long double
+spherical-coordinate version from geo_potential_in_au( ),  at random
+points from 200 km above the earth's surface out to beyond geosynchronous
+orbit,  and times both for fields of degree 10,  20,  50,  and 100.  The
+two ought to agree to a part in 1e+10 or better.  Use -n(num) to set the
+number of points (default 100000).
+
+   The GGM03C terms in 'geo_pot.cpp' only go to degree 50.  So the
+makefile builds a copy of it with room for degree 100,  and the terms
+past 50 are made up (see _fill_missing_terms in 'geo_pot.cpp').  The
+degree 100 results show how the two methods do with that many terms,
+not what the real field is like.
+
+   Build with 'make geopot_test'.                                      */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include "geopot.h"
+
+#define MAX_REL_DIFF      1e-10
+#define EARTH_R_IN_AU     (6378.140 / 1.495978707e+8)
+
+static const int degrees[] = { 10, 20, 50, 100 };
+
+extern int _fill_missing_terms;       /* see 'geo_pot.cpp' */
+
+#define N_DEGREES (int)( sizeof( degrees) / sizeof( degrees[0]))
+
+static double rand_value( void)
+{
+   return( (double)rand( ) / (double)RAND_MAX);
+}
+
+int main( const int argc, const char **argv)
+{
+   int i, j, n_points = 100000, rval = 0;
+   double *locs;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'n':
+               n_points = atoi( argv[i] + 2);
+               break;
+            default:
+               printf( "Option '%s' ignored\n", argv[i]);
+               break;
+            }
+   _fill_missing_terms = 1;
+   locs = (double *)malloc( n_points * 3 * sizeof( double));
+   srand( 31416);
+   for( i = 0; i < n_points; i++)
+      {                 /* random direction;  radius 1.03 to 8 earth radii */
+      const double z = 2. * rand_value( ) - 1.;
+      const double lon = 2. * 3.14159265358979323 * rand_value( );
+      const double r = EARTH_R_IN_AU * (1.03 + 7. * rand_value( ));
+      const double r_cyl = r * sqrt( 1. - z * z);
+
+      locs[i * 3] = r_cyl * cos( lon);
+      locs[i * 3 + 1] = r_cyl * sin( lon);
+      locs[i * 3 + 2] = r * z;
+      }
+   printf( "Degree   Max rel diff   Old (us)   New (us)  Speedup\n");
+   for( j = 0; j < N_DEGREES; j++)
+      {
+      const int n_terms = degrees[j] + 1;
+      double max_diff = 0., old_time, new_time, sum = 0.;
+      clock_t t0;
+
+      for( i = 0; i < n_points; i++)
+         {
+         const double *loc = locs + i * 3;
+         double old_grad[3], new_grad[3], diff, len;
+
+         geo_potential_in_au( loc[0], loc[1], loc[2], old_grad, n_terms);
+         geo_gradient_in_au( loc[0], loc[1], loc[2], new_grad, n_terms);
+         diff = hypot( hypot( old_grad[0] - new_grad[0],
+                              old_grad[1] - new_grad[1]),
+                              old_grad[2] - new_grad[2]);
+         len = hypot( hypot( old_grad[0], old_grad[1]), old_grad[2]);
+         if( max_diff < diff / len)
+            max_diff = diff / len;
+         }
+            /* 'sum' is just to keep the calls from being optimized out */
+      t0 = clock( );
+      for( i = 0; i < n_points; i++)
+         {
+         double grad[3];
+
+         geo_potential_in_au( locs[i * 3], locs[i * 3 + 1], locs[i * 3 + 2],
+                                                grad, n_terms);
+         sum += grad[0];
+         }
+      old_time = (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC;
+      t0 = clock( );
+      for( i = 0; i < n_points; i++)
+         {
+         double grad[3];
+
+         geo_gradient_in_au( locs[i * 3], locs[i * 3 + 1], locs[i * 3 + 2],
+                                                grad, n_terms);
+         sum -= grad[0];
+         }
+      new_time = (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC;
+      printf( "%4d     %.3e   %9.3f  %9.3f  %6.2fx%s\n", degrees[j], max_diff,
+                  old_time * 1e+6 / (double)n_points,
+                  new_time * 1e+6 / (double)n_points,
+                  (new_time > 0. ? old_time / new_time : 0.),
+                  (fabs( sum) < 1. ? "" : " ?"));
+      if( max_diff > MAX_REL_DIFF)
+         rval = -1;
+      }
+   free( locs);
+   if( rval)
+      printf( "FAILED\n");
+   return( rval);
+}
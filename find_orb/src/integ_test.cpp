@@ -0,0 +1,466 @@
+/* Copyright (C) 2026, Project Pluto.  See LICENSE.  */
+
+/* integ_test.cpp:  checks the double-precision,  compensated-summation
+integrator (integration_method = 2;  see integrate_orbit_compensated() in
+'orb_func.cpp') and the Gauss-Radau one (integration_method = 3;  see
+integrate_orbit_radau( )) against the usual long double RKF,  and
+compares their speeds.  A set of reference orbits (main belt,  near-earth,
+comets,  a TNO) is integrated forward over a span of years and then back
+again with each method,  all planets and the moon included as perturbers.
+Errors,  as seen from the earth,  are relative to RKF with a tolerance of
+1e-15 going forward,  and to the starting point coming back.  Compensated
+RKF ought to agree with RKF to much better than a milliarcsecond,  and
+Gauss-Radau ought to be within a milliarcsecond (or no worse than RKF,
+which can be off by a few mas for orbits passing near the earth).
+
+   Without a JPL ephemeris,  the method of Cowell is used throughout
+(ENCKE=0).  Encke's method,  relative to a planet,  needs the planet's
+acceleration to match its positions,  and that isn't true enough of the
+analytic theories used in place of JPL:  at the earth,  the two are off
+by 1e-8 AU/day^2,  which adds up to thousands of mas in the close
+approaches below.
+
+   Then come two close approaches,  modelled on those of (99942) Apophis
+to the earth in 2029 (38000 km from the geocenter at 7.4 km/s) and of
+2024 YR4 to the moon in 2032 (5000 km from the moon's center at 13 km/s).
+These are made up:  the object is placed at that distance and speed at
+the time of closest approach,  then integrated back two years for a
+starting point.  Each method then integrates it four years forward,
+through the encounter;  we show the number of force evaluations and the
+error relative to Gauss-Radau with RADAU_EPSILON=1e-15.  (RKF makes a
+poor reference here:  rounding limits it to a few mas,  the difference
+between runs with tolerances of 1e-15 and 1e-16.  Gauss-Radau results
+at epsilons from 1e-13 to 1e-15 agree to a tenth of that.)  Gauss-Radau
+ought to be within a mas,  and the compensated RKF within a mas of RKF.
+RKF at its default tolerance is much less accurate;  so its tolerance is
+tightened until it's as accurate as Gauss-Radau (or it gives up trying),
+and Gauss-Radau ought to need fewer force evaluations than RKF does then.
+
+   Next,  a cloud of variants around each reference orbit,  and around
+each close approach,  is integrated all at once with integrate_ensemble()
+(as is done for ephemerides of Monte Carlo and SR clouds),  and again one
+variant at a time with integrate_orbit().  They ought to agree to better
+than a milliarcsecond,  too,  or for the encounters,  to within the error
+of RKF itself (shown above):  the ensemble takes the steps needed by the
+worst-off variant,  so it's usually more accurate than the variants
+integrated one at a time.  The encounters check the variants that fall
+back on the full force model.  Times for both are shown.
+
+   Finally,  the reference orbits are integrated forward with RKF,  with
+and without ADAPTIVE_PERTURBERS (see 'runge.cpp'),  showing the difference
+and the percentage of planetary positions actually computed for each
+planet.  The earth and moon are always computed exactly.  If no positions
+at all are saved for an orbit,  something is wrong,  and the test fails.
+
+   Use -y(num) to set the number of years integrated (default 20),
+-n(num) to set the number of timing runs (default 1).  Requires the
+usual Find_Orb data files.
+
+   Build with 'make integ_test'.                                       */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <cstdint>
+#include "comets.h"
+#include "afuncs.h"
+#include "stringex.h"
+#include "constant.h"
+#include "mpc_obs.h"
+#include "elem_out.h"
+#include "orbfunc.h"
+#include "runge.h"
+#include "pl_cache.h"
+
+#define MAX_DIFF_IN_MAS    1.
+#define N_METHODS          3     /* RKF,  RKF in doubles,  Gauss-Radau */
+#define N_VARIANTS        50     /* number of orbits in each ensemble */
+
+extern thread_local unsigned perturbers;
+extern unsigned excluded_perturbers;
+extern thread_local int64_t n_force_evaluations;
+extern int integration_method;
+extern double integration_tolerance;
+
+static const int methods[N_METHODS] = { 0, 2, 3 };
+static const char *method_names[N_METHODS] = { "Long doubles",
+                                 "Compensated", "Gauss-Radau" };
+
+typedef struct
+{
+   const char *name;
+   double q, ecc, incl, asc_node, arg_per;
+} Reference_orbit;
+
+static const Reference_orbit ref_orbits[] = {
+   { "Main belt",      2.55,  .09,   10.,  80.,  70. },
+   { "Earth-crosser",   .75,  .19,    3., 204., 126. },
+   { "Earth co-orbit",  .98,  .03,    1.,   0.,   0. },
+   { "Jupiter-family", 1.3,   .65,   12., 100., 200. },
+   { "Long-period",     .6,   .995,  60., 120.,  10. },
+   { "TNO",           38.,    .05,    8., 100.,  60. } };
+
+#define N_REF_ORBITS (sizeof( ref_orbits) / sizeof( ref_orbits[0]))
+
+typedef struct
+{
+   const char *name;
+   double jd;              /* time of closest approach */
+   int planet;             /* 3 = earth,  10 = moon */
+   double miss_km, speed_km_s;
+} Encounter;
+
+static const Encounter encounters[] = {
+   { "Apophis-like", 2462240.407,  3, 38000.,  7.4 },
+   { "2024 YR4-like", 2463588.5,  10,  5000., 13. } };
+
+#define N_ENCOUNTERS (sizeof( encounters) / sizeof( encounters[0]))
+
+static void set_up_orbit( double *orbit, const Reference_orbit *ref,
+                                 const double jd)
+{
+   Elements elem;
+
+   memset( &elem, 0, sizeof( Elements));
+   elem.q = ref->q;
+   elem.ecc = ref->ecc;
+   elem.major_axis = elem.q / (1. - elem.ecc);
+   elem.incl = ref->incl * PI / 180.;
+   elem.asc_node = ref->asc_node * PI / 180.;
+   elem.arg_per = ref->arg_per * PI / 180.;
+   elem.epoch = elem.perih_time = jd + 30.;
+   derive_quantities( &elem, SOLAR_GM);
+   comet_posn_and_vel( &elem, jd, orbit, orbit + 3);
+}
+
+/* Angle between two positions of the object,  as seen from the earth
+at time 'jd',  in milliarcseconds. */
+
+static double angular_diff_in_mas( const double *posn1, const double *posn2,
+                                 const double jd)
+{
+   double earth_loc[3], topo1[3], topo2[3];
+   int i;
+
+   earth_lunar_posn( jd, earth_loc, nullptr);
+   for( i = 0; i < 3; i++)
+      {
+      topo1[i] = posn1[i] - earth_loc[i];
+      topo2[i] = posn2[i] - earth_loc[i];
+      }
+   return( vector3_dist( topo1, topo2) / vector3_length( topo1)
+                                 * (180. / PI) * 3600. * 1000.);
+}
+
+static void earth_or_moon_posn( const int planet, const double jd,
+                                 double *posn)
+{
+   double earth_loc[3];
+
+   if( planet == 10)
+      earth_lunar_posn( jd, earth_loc, posn);
+   else
+      earth_lunar_posn( jd, posn, nullptr);
+}
+
+/* Sets up 'orbit' so that at jd = enc->jd,  it's at closest approach
+to the earth or moon,  offset from it along the ecliptic pole and moving
+in the ecliptic plane relative to it (so offset and relative velocity are
+perpendicular).    */
+
+static void set_up_encounter( double *orbit, const Encounter *enc)
+{
+   const double dt = .001;
+   const double r = enc->miss_km / AU_IN_KM;
+   const double v = enc->speed_km_s * seconds_per_day / AU_IN_KM;
+   double before[3], after[3];
+   int i;
+
+   earth_or_moon_posn( enc->planet, enc->jd, orbit);
+   earth_or_moon_posn( enc->planet, enc->jd - dt, before);
+   earth_or_moon_posn( enc->planet, enc->jd + dt, after);
+   for( i = 0; i < 3; i++)
+      orbit[i + 3] = (after[i] - before[i]) / (2. * dt);
+   orbit[2] += r;
+   orbit[3] += v * .6;
+   orbit[4] += v * .8;
+}
+
+/* Sets up 'n_variants' orbits scattered around 'orbit' by up to one
+part in 10000 in each component,  as a Monte Carlo cloud might be. */
+
+static void set_up_cloud( double *cloud, const double *orbit,
+                                 const unsigned n_variants)
+{
+   unsigned i, j;
+
+   for( i = 0; i < n_variants; i++)
+      for( j = 0; j < 6; j++)
+         cloud[i * 6 + j] = orbit[j] * (1. + 1e-4 * sin( (double)( i * 6 + j + 1)));
+}
+
+/* Integrates the cloud of variants around 'orbit' from t0 to t1 with
+integrate_ensemble(),  and one at a time with integrate_orbit(),  and
+returns the largest difference between the two in milliarcseconds.  */
+
+static double check_ensemble( const double *orbit, const double t0,
+            const double t1, double *ensemble_time, double *single_time)
+{
+   double *cloud = (double *)malloc( 2 * N_VARIANTS * 6 * sizeof( double));
+   double *singles = cloud + N_VARIANTS * 6, rval = 0.;
+   clock_t t_start;
+   unsigned i;
+
+   set_up_cloud( cloud, orbit, N_VARIANTS);
+   memcpy( singles, cloud, N_VARIANTS * 6 * sizeof( double));
+   integration_method = 0;
+   perturbers = 0x7fe;        /* planets and moon */
+   t_start = clock( );
+   integrate_ensemble( cloud, N_VARIANTS, t0, t1);
+   *ensemble_time = (double)( clock( ) - t_start) / (double)CLOCKS_PER_SEC;
+   t_start = clock( );
+   for( i = 0; i < N_VARIANTS; i++)
+      integrate_orbit( singles + i * 6, t0, t1);
+   *single_time = (double)( clock( ) - t_start) / (double)CLOCKS_PER_SEC;
+   for( i = 0; i < N_VARIANTS; i++)
+      {
+      const double diff = angular_diff_in_mas( singles + i * 6,
+                                                cloud + i * 6, t1);
+
+      if( rval < diff)
+         rval = diff;
+      }
+   free( cloud);
+   return( rval);
+}
+
+static double integrate_with( double *orbit, const int method,
+               const double t0, const double t1, const int n_reps)
+{
+   double tarray[6];
+   clock_t t_start;
+   int i;
+
+   integration_method = method;
+   perturbers = 0x7fe;        /* planets and moon */
+   n_force_evaluations = 0;
+   t_start = clock( );
+   for( i = 0; i < n_reps; i++)
+      {
+      memcpy( tarray, orbit, 6 * sizeof( double));
+      integrate_orbit( tarray, t0, t1);
+      }
+   memcpy( orbit, tarray, 6 * sizeof( double));
+   return( (double)( clock( ) - t_start) / (double)CLOCKS_PER_SEC);
+}
+
+int main( const int argc, const char **argv)
+{
+   ephem_option_t ephem_options;
+   int element_format, element_precision, n_reps = 1, rval = 0;
+   int de_version;
+   double max_resid, noise, n_years = 20., times[N_METHODS];
+   double rkf_errors[N_ENCOUNTERS];
+   char saved_epsilon[40];
+   const double t0 = J2000 + .123456789;
+   const double saved_tolerance = integration_tolerance;
+   size_t i, j;
+
+   for( i = 1; i < (size_t)argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'n':
+               n_reps = atoi( argv[i] + 2);
+               break;
+            case 'y':
+               n_years = atof( argv[i] + 2);
+               break;
+            default:
+               printf( "Option '%s' ignored\n", argv[i]);
+               break;
+            }
+   get_defaults( &ephem_options, &element_format, &element_precision,
+                  &max_resid, &noise);
+   excluded_perturbers = 0;   /* usually set when observations are loaded */
+   get_jpl_ephemeris_info( &de_version, nullptr, nullptr);
+   if( !de_version)
+      {
+      printf( "No JPL ephemeris;  using the method of Cowell\n\n");
+      set_environment_ptr( "ENCKE", "0");
+      }
+   strlcpy_error( saved_epsilon, get_environment_ptr( "RADAU_EPSILON"));
+   for( j = 0; j < N_METHODS; j++)
+      times[j] = 0.;
+   printf( "Errors after %.1f years (forward,  then back to start),  mas:\n",
+                  n_years);
+   printf( "                  Long doubles        Compensated         Gauss-Radau\n");
+   for( i = 0; i < N_REF_ORBITS; i++)
+      {
+      const double t1 = t0 + n_years * 365.25 + .3141592653589793;
+      double orbit[6], ref_orbit[6], orbits[N_METHODS][6];
+      double diffs[2][N_METHODS], rkf_diff[2];
+      size_t k;
+
+      set_up_orbit( orbit, ref_orbits + i, t0);
+      memcpy( ref_orbit, orbit, 6 * sizeof( double));
+      integration_tolerance = 1e-15;
+      integrate_with( ref_orbit, 0, t0, t1, 1);
+      integration_tolerance = saved_tolerance;
+      for( j = 0; j < N_METHODS; j++)
+         {
+         memcpy( orbits[j], orbit, 6 * sizeof( double));
+         times[j] += integrate_with( orbits[j], methods[j], t0, t1, n_reps);
+         diffs[0][j] = angular_diff_in_mas( ref_orbit, orbits[j], t1);
+         }
+      rkf_diff[0] = angular_diff_in_mas( orbits[0], orbits[1], t1);
+      for( j = 0; j < N_METHODS; j++)
+         {
+         times[j] += integrate_with( orbits[j], methods[j], t1, t0, n_reps);
+         diffs[1][j] = angular_diff_in_mas( orbit, orbits[j], t0);
+         }
+      rkf_diff[1] = angular_diff_in_mas( orbits[0], orbits[1], t0);
+      printf( "%-16s", ref_orbits[i].name);
+      for( j = 0; j < N_METHODS; j++)
+         printf( " %9.6f %9.6f", diffs[0][j], diffs[1][j]);
+      printf( "\n");
+      for( k = 0; k < 2; k++)
+         if( rkf_diff[k] > MAX_DIFF_IN_MAS || (diffs[k][2] > MAX_DIFF_IN_MAS
+                                      && diffs[k][2] > diffs[k][0]))
+            rval = -1;
+      }
+
+   printf( "\nClose approaches:  force evaluations,  and error in mas,  after 4 years\n");
+   for( i = 0; i < N_ENCOUNTERS; i++)
+      {
+      const double t_start = encounters[i].jd - 730.;
+      const double t_end = encounters[i].jd + 730.;
+      double orbit[6], ref_orbit[6], results[N_METHODS][6], radau_diff = 0.;
+      long radau_evals = 0;
+
+      integration_tolerance = 1e-16;
+      set_up_encounter( orbit, encounters + i);
+      integrate_with( orbit, 0, encounters[i].jd, t_start, 1);
+      integration_tolerance = saved_tolerance;
+      memcpy( ref_orbit, orbit, 6 * sizeof( double));
+      set_environment_ptr( "RADAU_EPSILON", "1e-15");
+      integrate_with( ref_orbit, 3, t_start, t_end, 1);
+      set_environment_ptr( "RADAU_EPSILON", saved_epsilon);
+      printf( "%s:\n", encounters[i].name);
+      for( j = 0; j < N_METHODS; j++)
+         {
+         double diff;
+
+         memcpy( results[j], orbit, 6 * sizeof( double));
+         integrate_with( results[j], methods[j], t_start, t_end, 1);
+         diff = angular_diff_in_mas( ref_orbit, results[j], t_end);
+         printf( "   %-14s %9ld evals  %10.6f\n", method_names[j],
+                     (long)n_force_evaluations, diff);
+         if( !j)
+            rkf_errors[i] = diff;
+         radau_diff = diff;         /* Gauss-Radau comes last */
+         radau_evals = (long)n_force_evaluations;
+         }
+      if( radau_diff > MAX_DIFF_IN_MAS || angular_diff_in_mas( results[0],
+                                 results[1], t_end) > MAX_DIFF_IN_MAS)
+         rval = -1;
+      for( j = 0; j < 10; j++)
+         {
+         double tarray[6], diff;
+
+         integration_tolerance = saved_tolerance * pow( .5, (double)j);
+         memcpy( tarray, orbit, 6 * sizeof( double));
+         integrate_with( tarray, 0, t_start, t_end, 1);
+         diff = angular_diff_in_mas( ref_orbit, tarray, t_end);
+         if( diff <= radau_diff || j == 9)
+            {
+            printf( "   RKF, tol %.2g %9ld evals  %10.6f\n",
+                     integration_tolerance, (long)n_force_evaluations, diff);
+            if( radau_evals >= (long)n_force_evaluations)
+               rval = -1;
+            break;
+            }
+         }
+      integration_tolerance = saved_tolerance;
+      }
+
+   printf( "\nEnsembles of %d variants:  largest difference from integrating\n",
+                        N_VARIANTS);
+   printf( "them one at a time,  in mas,  and times for one at a time and ensemble\n");
+   for( i = 0; i < N_REF_ORBITS + N_ENCOUNTERS; i++)
+      {
+      double orbit[6], t_start, t_end, diff, single_time, ensemble_time;
+      const char *name;
+
+      if( i < N_REF_ORBITS)
+         {
+         name = ref_orbits[i].name;
+         set_up_orbit( orbit, ref_orbits + i, t0);
+         t_start = t0;
+         t_end = t0 + n_years * 365.25 + .3141592653589793;
+         }
+      else
+         {
+         const Encounter *enc = encounters + i - N_REF_ORBITS;
+
+         name = enc->name;
+         set_up_encounter( orbit, enc);
+         t_start = enc->jd - 730.;
+         t_end = enc->jd + 730.;
+         integrate_with( orbit, 0, enc->jd, t_start, 1);
+         }
+      diff = check_ensemble( orbit, t_start, t_end, &ensemble_time,
+                                                &single_time);
+      printf( "%-16s %10.6f  %7.3f s  %7.3f s  (%.2fx)\n", name, diff,
+                  single_time, ensemble_time, single_time / ensemble_time);
+      if( diff > MAX_DIFF_IN_MAS && (i < N_REF_ORBITS
+                            || diff > rkf_errors[i - N_REF_ORBITS]))
+         rval = -1;
+      }
+
+   printf( "\nADAPTIVE_PERTURBERS=1:  difference in mas,  then %% of positions computed\n");
+   printf( "                         Mer   Ven   Ear   Mar   Jup   Sat   Ura   Nep   Plu\n");
+   integration_method = 0;
+   for( i = 0; i < N_REF_ORBITS; i++)
+      {
+      const double t1 = t0 + n_years * 365.25 + .3141592653589793;
+      double orbit[6], adapted[6], diff;
+      int64_t n_requested[N_PERTURBER_COUNTS], n_computed[N_PERTURBER_COUNTS];
+      int64_t n_saved = 0;
+
+      set_up_orbit( orbit, ref_orbits + i, t0);
+      memcpy( adapted, orbit, 6 * sizeof( double));
+      set_environment_ptr( "ADAPTIVE_PERTURBERS", "0");
+      reset_adaptive_perturbers( );
+      integrate_with( orbit, 0, t0, t1, 1);
+      set_environment_ptr( "ADAPTIVE_PERTURBERS", "1");
+      reset_adaptive_perturbers( );
+      integrate_with( adapted, 0, t0, t1, 1);
+      get_perturber_counts( n_requested, n_computed);
+      diff = angular_diff_in_mas( orbit, adapted, t1);
+      printf( "%-16s %7.4f", ref_orbits[i].name, diff);
+      for( j = 1; j < 10; j++)
+         if( n_requested[j])
+            {
+            printf( " %5.1f", 100. * (double)n_computed[j] / (double)n_requested[j]);
+            n_saved += n_requested[j] - n_computed[j];
+            }
+         else
+            printf( "     -");
+      printf( "\n");
+      if( diff > MAX_DIFF_IN_MAS || n_saved <= 0)
+         rval = -1;
+      }
+   set_environment_ptr( "ADAPTIVE_PERTURBERS", "0");
+   reset_adaptive_perturbers( );
+   integration_method = 0;
+   if( rval)
+      printf( "FAILED\n");
+   for( j = 0; j < N_METHODS; j++)
+      if( times[j] > 0.)
+         printf( "%-14s %.3f s  (%.2fx)\n", method_names[j], times[j],
+                              times[0] / times[j]);
+   return( rval);
+}
@@ -0,0 +1,172 @@
+/* Copyright (C) 2026, Project Pluto.  See LICENSE.  */
+
+/* lsq_test.cpp:  checks the blocked accumulation/LDL^T least-squares
+code in 'lsquare.cpp' against the older per-observation accumulation and
+Gauss-Jordan inversion (LSQUARE_GAUSS_JORDAN),  and compares their speeds.
+A synthetic nine-parameter fit to 10000 observations is made,  with
+partials differing by many orders of magnitude in scale (much as they do
+for a real orbit fit with non-gravitational parameters).  The solutions
+and covariance matrices from both ought to agree to about 1e-12 (relative
+to the parameter sigmas).  Use -n(num) to set the number of timing runs,
+-o(num) to set the number of observations.
+
+   g++ -O3 -o lsq_test lsq_test.cpp lsquare.cpp                       */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "lsquare.h"
+
+#define N_PARAMS        9
+#define MAX_DIFF        1e-12
+
+static double gaussian_noise( void)
+{
+   const double u1 = ((double)rand( ) + 1.) / ((double)RAND_MAX + 2.);
+   const double u2 = (double)rand( ) / (double)RAND_MAX;
+
+   return( sqrt( -2. * log( u1)) * cos( 2. * 3.14159265358979323846 * u2));
+}
+
+      /* Partials of a made-up model:  polynomial and periodic terms in */
+      /* time,  scaled over about twelve orders of magnitude.           */
+
+static void set_partials( double *partials, const double t)
+{
+   const double x = t / 1000.;
+
+   partials[0] = 1.;
+   partials[1] = t;
+   partials[2] = t * t * 1e-3;
+   partials[3] = sin( t * .0172) * 1e+4;
+   partials[4] = cos( t * .0172) * 1e+4;
+   partials[5] = sin( t * .2128) * 1e-2;
+   partials[6] = cos( t * .2128) * 1e-2;
+   partials[7] = x * x * x * 1e+6;
+   partials[8] = exp( -x * x) * 1e-6;
+}
+
+static double *obs_times, *obs_resids, *obs_weights;
+
+static void *do_fit( const int n_obs, const int flags, double *result,
+                     double **covar)
+{
+   void *lsq = lsquare_init_ex( N_PARAMS, flags);
+   double partials[N_PARAMS];
+   int i;
+
+   for( i = 0; i < n_obs; i++)
+      {
+      set_partials( partials, obs_times[i]);
+      lsquare_add_observation( lsq, obs_resids[i], obs_weights[i], partials);
+      }
+   if( lsquare_solve( lsq, result))
+      printf( "Solution failed\n");
+   *covar = lsquare_covariance_matrix( lsq);
+   return( lsq);
+}
+
+int main( const int argc, const char **argv)
+{
+   const double true_params[N_PARAMS] = { 1.3, -2e-3, 7e-4, 3e-4, -1e-4,
+                              2e+2, 5e+1, 3e-6, 4e+5 };
+   double result[N_PARAMS], old_result[N_PARAMS], partials[N_PARAMS];
+   double *covar, *old_covar, max_soln_diff = 0., max_covar_diff = 0.;
+   double old_time, new_time;
+   int i, j, n_reps = 100, n_obs = 10000, rval = 0;
+   clock_t t0;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'n':
+               n_reps = atoi( argv[i] + 2);
+               break;
+            case 'o':
+               n_obs = atoi( argv[i] + 2);
+               break;
+            default:
+               printf( "Option '%s' ignored\n", argv[i]);
+               break;
+            }
+   obs_times = (double *)malloc( 3 * n_obs * sizeof( double));
+   obs_resids = obs_times + n_obs;
+   obs_weights = obs_resids + n_obs;
+   srand( 31416);
+   for( i = 0; i < n_obs; i++)
+      {
+      const double sigma = .1 + 2. * (double)rand( ) / (double)RAND_MAX;
+
+      obs_times[i] = -1500. + 3000. * (double)rand( ) / (double)RAND_MAX;
+      set_partials( partials, obs_times[i]);
+      obs_resids[i] = sigma * gaussian_noise( );
+      for( j = 0; j < N_PARAMS; j++)
+         obs_resids[i] += true_params[j] * partials[j];
+      obs_weights[i] = 1. / sigma;
+      }
+
+   lsquare_free( do_fit( n_obs, LSQUARE_GAUSS_JORDAN, old_result, &old_covar));
+   lsquare_free( do_fit( n_obs, 0, result, &covar));
+   if( !covar || !old_covar)
+      {
+      printf( "Covariance matrix failed\n");
+      return( -1);
+      }
+   printf( "%d observations,  %d parameters\n", n_obs, N_PARAMS);
+   printf( "  Parameter        True value        Old solution      New solution      Sigma\n");
+   for( i = 0; i < N_PARAMS; i++)
+      {
+      const double sigma = sqrt( covar[i * (N_PARAMS + 1)]);
+      const double diff = fabs( result[i] - old_result[i]) / sigma;
+
+      printf( "%6d %18.10e %18.10e %18.10e %10.3e\n", i, true_params[i],
+                        old_result[i], result[i], sigma);
+      if( max_soln_diff < diff)
+         max_soln_diff = diff;
+      for( j = 0; j < N_PARAMS; j++)
+         {
+         const double cdiff = fabs( covar[i * N_PARAMS + j]
+                                  - old_covar[i * N_PARAMS + j])
+                         / sqrt( covar[i * (N_PARAMS + 1)] * covar[j * (N_PARAMS + 1)]);
+
+         if( max_covar_diff < cdiff)
+            max_covar_diff = cdiff;
+         }
+      }
+   printf( "Max differences: %.3g sigma (solution),  %.3g (correlation)\n",
+               max_soln_diff, max_covar_diff);
+   if( max_soln_diff > MAX_DIFF || max_covar_diff > MAX_DIFF)
+      {
+      printf( "FAILED\n");
+      rval = -1;
+      }
+   free( covar);
+   free( old_covar);
+
+            /* Now for timing: */
+   t0 = clock( );
+   for( i = 0; i < n_reps; i++)
+      {
+      lsquare_free( do_fit( n_obs, LSQUARE_GAUSS_JORDAN, old_result, &old_covar));
+      free( old_covar);
+      }
+   old_time = (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC;
+   t0 = clock( );
+   for( i = 0; i < n_reps; i++)
+      {
+      lsquare_free( do_fit( n_obs, 0, result, &covar));
+      free( covar);
+      }
+   new_time = (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC;
+   if( old_time > 0. && new_time > 0.)
+      {
+      printf( "Gauss-Jordan:  %.3f s,  %.2f ms/fit\n", old_time,
+                  old_time * 1000. / (double)n_reps);
+      printf( "LDL^T:         %.3f s,  %.2f ms/fit  (%.2fx)\n", new_time,
+                  new_time * 1000. / (double)n_reps, old_time / new_time);
+      }
+   free( obs_times);
+   return( rval);
+}
@@ -23,7 +23,14 @@ below above the pivot_value( ) function).  I did this thinking
 it would reduce roundoff errors in matrix inversion,  resulting
 in more stable results for short-arc solutions.  In practice,  it
 doesn't really seem to help or hinder,  but it's still a good
-idea for nearly-singular matrices.  */
+idea for nearly-singular matrices.
+
+   2026 October:  observations are now accumulated in blocks (see
+flush_buffered_rows()),  and solutions found by LDL^T factorization rather
+than by inverting W^T W (see ldlt_factor()).  The covariance matrix is
+only computed if asked for.  The old scheme is still available with
+lsquare_init_ex( n_params, LSQUARE_GAUSS_JORDAN);  'lsq_test.cpp'
+compares the two.  */
 
 // #define LSQUARE_ERROR_DEBUGGING
 
@@ -52,13 +59,24 @@ idea for nearly-singular matrices.  */
 
 #define LSQUARE struct lsquare
 
+   /* Weighted observations are buffered,  LSQUARE_BLOCK at a time,  in
+      'buff' (stored column by column,  with the weighted residuals as an
+      extra column),  then folded into W^T W and W^T u in one rank-k update.
+   'lambda' is the Levenberg-Marquardt damping factor for the buffered
+   rows;  if it changes,  the rows are flushed first.
+      'factored' is the LDL^T factorization of W^T W,  made when first
+      needed and discarded if more observations come in.  */
+
+#define LSQUARE_BLOCK         32
+
 LSQUARE
    {
-   int n_params, n_obs;
-   ldouble *wtw, *uw;
+   int n_params, n_obs, n_buffered, flags;
+   ldouble *wtw, *uw, *factored;
+   double *buff, lambda;
    };
 
-void *lsquare_init( const int n_params)
+void *lsquare_init_ex( const int n_params, const int flags)
 {
    LSQUARE *rval = (LSQUARE *)calloc( 1, sizeof( LSQUARE));
 
@@ -66,11 +84,20 @@ void *lsquare_init( const int n_params)
       return( (void *)rval);
    rval->n_params = n_params;
    rval->n_obs = 0;
+   rval->flags = flags;
    rval->uw = (ldouble *)calloc( (n_params + 1) * n_params, sizeof( ldouble));
    rval->wtw = rval->uw + n_params;
+   if( !(flags & LSQUARE_GAUSS_JORDAN))
+      rval->buff = (double *)calloc( (n_params + 1) * LSQUARE_BLOCK,
+                                                      sizeof( double));
    return(( void *)rval);
 }
 
+void *lsquare_init( const int n_params)
+{
+   return( lsquare_init_ex( n_params, 0));
+}
+
 #ifdef LSQUARE_ERROR_DEBUGGING
 static inline ldouble lfabs( ldouble ival)
 {
@@ -101,7 +128,59 @@ static void dump_matrix( const ldouble *matrix, const int xsize, const int ysize
 }
 #endif
 
-double levenberg_marquardt_lambda = 0.;      /* damping factor */
+thread_local double levenberg_marquardt_lambda = 0.;      /* damping factor */
+
+/* The weighted rows are summed in ordinary doubles,  four partial sums
+at a time (which compilers will happily vectorize),  and only the block
+totals are added in to the long double accumulators.  With at most
+LSQUARE_BLOCK rows per sum,  this loses very little compared to summing
+every row in long doubles,  and is much faster when 'ldouble' is the
+software-emulated __float128.  Unused rows are zeroed so that the block
+can always be processed in fours.      */
+
+static void flush_buffered_rows( LSQUARE *lsq)
+{
+   const int n_params = lsq->n_params;
+   const int n_rows = (lsq->n_buffered + 3) & ~3;
+   const ldouble lambda = (ldouble)lsq->lambda;
+   int i, j, k;
+
+   if( !lsq->n_buffered)
+      return;
+   for( i = 0; i <= n_params; i++)
+      for( j = lsq->n_buffered; j < n_rows; j++)
+         lsq->buff[i * LSQUARE_BLOCK + j] = 0.;
+   for( i = 0; i < n_params; i++)
+      {
+      const double *col_i = lsq->buff + i * LSQUARE_BLOCK;
+
+      for( j = i; j <= n_params; j++)
+         {
+         const double *col_j = lsq->buff + j * LSQUARE_BLOCK;
+         double sums[4] = { 0., 0., 0., 0. };
+         ldouble total;
+
+         for( k = 0; k < n_rows; k += 4)
+            {
+            sums[0] += col_i[k] * col_j[k];
+            sums[1] += col_i[k + 1] * col_j[k + 1];
+            sums[2] += col_i[k + 2] * col_j[k + 2];
+            sums[3] += col_i[k + 3] * col_j[k + 3];
+            }
+         total = (ldouble)( (sums[0] + sums[1]) + (sums[2] + sums[3]));
+         if( j == n_params)        /* the residual column */
+            lsq->uw[i] += total;
+         else if( i == j)
+            lsq->wtw[i * (n_params + 1)] += total + total * lambda;
+         else
+            {
+            lsq->wtw[i + j * n_params] += total;
+            lsq->wtw[j + i * n_params] += total;
+            }
+         }
+      }
+   lsq->n_buffered = 0;
+}
 
 int lsquare_add_observation( void *lsquare, const double residual,
                                   const double weight, const double *obs)
@@ -110,7 +189,29 @@ int lsquare_add_observation( void *lsquare, const double residual,
    int i, j;
    const int n_params = lsq->n_params;
 
-   for( i = 0; i < n_params; i++)
+   if( lsq->factored)
+      {
+      free( lsq->factored);
+      lsq->factored = nullptr;
+      }
+   if( lsq->buff)
+      {
+      double *bptr;
+
+      if( lsq->lambda != levenberg_marquardt_lambda)
+         {
+         flush_buffered_rows( lsq);
+         lsq->lambda = levenberg_marquardt_lambda;
+         }
+      bptr = lsq->buff + lsq->n_buffered;
+
+      for( i = 0; i < n_params; i++, bptr += LSQUARE_BLOCK)
+         *bptr = weight * obs[i];
+      *bptr = weight * residual;
+      if( ++lsq->n_buffered == LSQUARE_BLOCK)
+         flush_buffered_rows( lsq);
+      }
+   else for( i = 0; i < n_params; i++)
       {
       const ldouble w2_obs_i = (ldouble)( weight * weight * obs[i]);
 
@@ -124,7 +225,7 @@ int lsquare_add_observation( void *lsquare, const double residual,
    return( lsq->n_obs);
 }
 
-ldouble lsquare_determinant;
+thread_local ldouble lsquare_determinant;
 
    /* A simple Gauss-Jordan matrix inverter,  with partial pivoting.  It
       first extends the size x size square matrix into a size-high by
@@ -263,93 +364,6 @@ static ldouble *calc_inverse( const ldouble *src, const int size)
    return( rval);
 }
 
-#ifdef CHOLESKY_INVERSION
-
-   /* Cholesky decomposition,  as described in _Numerical Recipes_ 2.9.
-      Cholesky decomposition appears to be widely recommended for inverting
-      covariance matrices,  and I may end up going that route.  I started
-      out with Gauss-Jackson,  though,  and it appears to work Just Fine.
-      (Admittedly,  with tweaks to improve pivot selection and the
-      calc_improved_matrix() trick given below to "polish" an initial
-      inversion.)  I may take the time,  at some point,  to try to get
-      Cholesky inversion to work... though I don't think it'll actually
-      get me anything at this point.  At least for the nonce,  I'm leaving
-      it ifdeffed out. */
-
-static int cholesky_decomposition( ldouble *a, const int size, ldouble *diag)
-{
-   int i, j;
-
-   for( i = 0; i < size; i++)
-      for( j = i; j < size; j++)
-         {
-         ldouble sum = a[i * size + j];
-         int k;
-
-         for( k = i - 1; k >= 0; k--)
-            sum -= a[i * size + k] * a[j * size + k];
-         if( i == j)
-            {
-            if( sum < 0.)       /* not actually positive definite after all */
-               return( -1);
-            else
-               diag[i] = sqrt( sum);
-            }
-         else
-            a[j * size + i] = sum / diag[i];
-         }
-   return( 0);
-}
-
-   /* Inverting a symmetric positive-definite matrix,  again as described */
-   /* in _Numerical Recipes_,  with slight modifications.  In their       */
-   /* version,  the lower triangle is computed;  I added a few lines to   */
-   /* get the upper.  NOTE: does not work yet.                            */
-
-static int cholesky_inversion( ldouble *a, const int size)
-{
-   ldouble diag[30];
-   int i, j, k, rval = cholesky_decomposition( a, size, diag);
-
-   assert( !rval);
-   if( !rval)
-      {
-      for( i = 0; i < size; i++)
-         {
-         a[i * (size + 1)] = 1. / diag[i];
-         for( j = i + 1; j < size; j++)
-            {
-            ldouble sum = 0;
-
-            for( k = i; k < j; k++)
-               sum -= a[j * size + k] * a[k * size + i];
-            a[j * size + i] = sum / diag[j];
-            }
-         }
-      for( i = 1; i < size; i++)          /* copy lower diag to upper */
-         for( j = 0; j < i; j++)
-            a[j * size + i] = a[i * size + j];
-      }
-   return( rval);
-}
-
-static ldouble *invert_symmetric_positive_definite_matrix( const ldouble *a,
-                           const int size)
-{
-   ldouble *rval = (ldouble *)calloc( size * size, sizeof( ldouble));
-   int cholesky_rval;
-
-   memcpy( rval, a, size * size * sizeof( ldouble));
-   cholesky_rval = cholesky_inversion( rval, size);
-   if( cholesky_rval)
-      {
-      free( rval);
-      rval = nullptr;
-      }
-   return( rval);
-}
-#endif
-
 static void mult_matrices( ldouble *prod, const ldouble *a, const int awidth,
                   const int aheight, const ldouble *b, const int bwidth)
 {
@@ -421,16 +435,118 @@ static ldouble *calc_inverse_improved( const ldouble *src, const int size)
    return( inverse);
 }
 
-int lsquare_solve( const void *lsquare, double *result)
+/* The normal equations are symmetric and (barring degenerate fits)
+positive definite,  so we can factor them as L D L^T,  with L being unit
+lower triangular and D diagonal,  and solve by forward and back
+substitution instead of inverting.  That's roughly a sixth the work of
+Gauss-Jordan inversion,  needs no square roots in long double,  and
+doesn't require pivoting.
+
+   Before factoring,  the matrix is equilibrated:  row and column i are
+scaled by 1/sqrt(A[i][i]),  so the diagonal becomes all ones.  The scale
+factors need not be exact (they just have to be applied consistently),  so
+they're computed in ordinary doubles.  The fit parameters can differ by
+many orders of magnitude in scale (positions vs. velocities vs.
+non-gravitational parameters),  and equilibration keeps that from costing
+us precision.
+
+   The result is 'size' scale factors followed by the size x size factored
+matrix (D on the diagonal,  L below it),  followed by 'size' ldoubles of
+scratch space.  If a pivot isn't positive,  the matrix isn't (numerically)
+positive definite and we return nullptr;  the caller then falls back to
+Gauss-Jordan inversion,  which will at least behave as it always has.  */
+
+static ldouble *ldlt_factor( const ldouble *matrix, const int size)
+{
+   ldouble *rval = (ldouble *)calloc( (size + 2) * size, sizeof( ldouble));
+   ldouble *scale = rval, *a = rval + size, *v = a + size * size;
+   int i, j, k;
+
+   if( !rval)
+      return( nullptr);
+   for( i = 0; i < size; i++)
+      {
+      const double diag = (double)matrix[i * (size + 1)];
+
+      if( !(diag > 0.))
+         {
+         free( rval);
+         return( nullptr);
+         }
+      scale[i] = (ldouble)( 1. / sqrt( diag));
+      }
+   for( i = 0; i < size; i++)
+      for( j = 0; j < size; j++)
+         a[i * size + j] = matrix[i * size + j] * scale[i] * scale[j];
+   for( j = 0; j < size; j++)
+      {
+      ldouble *row_j = a + j * size;
+
+      for( k = 0; k < j; k++)
+         {
+         v[k] = row_j[k] * a[k * (size + 1)];
+         row_j[j] -= row_j[k] * v[k];
+         }
+      if( !(row_j[j] > 0.))
+         {
+         free( rval);
+         return( nullptr);
+         }
+      for( i = j + 1; i < size; i++)
+         {
+         ldouble *row_i = a + i * size;
+         ldouble sum = row_i[j];
+
+         for( k = 0; k < j; k++)
+            sum -= row_i[k] * v[k];
+         row_i[j] = sum / row_j[j];
+         }
+      }
+   return( rval);
+}
+
+/* Solves A x = b,  given the above factorization of A;  'b' is replaced
+with 'x'.  With equilibration,  A = S^-1 (L D L^T) S^-1,  where S is the
+diagonal matrix of scale factors;  so x = S L^-T D^-1 L^-1 S b.  */
+
+static void ldlt_solve( const ldouble *factored, const int size, ldouble *b)
+{
+   const ldouble *scale = factored, *a = factored + size;
+   int i, j;
+
+   for( i = 0; i < size; i++)
+      b[i] *= scale[i];
+   for( i = 1; i < size; i++)            /* forward:  solve L y = b */
+      for( j = 0; j < i; j++)
+         b[i] -= a[i * size + j] * b[j];
+   for( i = 0; i < size; i++)
+      b[i] /= a[i * (size + 1)];
+   for( i = size - 2; i >= 0; i--)      /* back:  solve L^T x = y */
+      for( j = i + 1; j < size; j++)
+         b[i] -= a[j * size + i] * b[j];
+   for( i = 0; i < size; i++)
+      b[i] *= scale[i];
+}
+
+/* Observations are buffered and the factorization is cached,  so the
+'const' functions below may actually have to do some work on the LSQUARE
+structure first.  (It's logically const,  even if not physically so.)  */
+
+static const ldouble *get_factored_matrix( const void *lsquare)
+{
+   LSQUARE *lsq = (LSQUARE *)lsquare;
+
+   flush_buffered_rows( lsq);
+   if( !lsq->factored)
+      lsq->factored = ldlt_factor( lsq->wtw, lsq->n_params);
+   return( lsq->factored);
+}
+
+static int solve_by_inversion( const LSQUARE *lsq, double *result)
 {
-   const LSQUARE *lsq = (const LSQUARE *)lsquare;
    int i, j, n_params = lsq->n_params;
    ldouble *inverse;
 
-   if( n_params > lsq->n_obs)       /* not enough observations yet */
-      return( -1);
-
-// inverse = invert_symmetric_positive_definite_matrix( lsq->wtw, n_params);
    inverse = calc_inverse_improved( lsq->wtw, n_params);
    if( !inverse)
       return( -2);            /* couldn't invert matrix */
@@ -448,6 +564,46 @@ int lsquare_solve( const void *lsquare, double *result)
    return( 0);
 }
 
+/* After the initial solution,  we do one round of iterative improvement
+(_Numerical Recipes_,  chap. 2.5 again;  see calc_inverse_improved()):
+compute the residual r = b - Ax using the unfactored matrix,  solve
+A dx = r,  and add dx to x.  It's cheap,  O(n_params^2).  */
+
+int lsquare_solve( const void *lsquare, double *result)
+{
+   const LSQUARE *lsq = (const LSQUARE *)lsquare;
+   const int n_params = lsq->n_params;
+   const ldouble *factored;
+   ldouble *x, *dx;
+   int i, j;
+
+   if( n_params > lsq->n_obs)       /* not enough observations yet */
+      return( -1);
+   if( lsq->flags & LSQUARE_GAUSS_JORDAN)
+      return( solve_by_inversion( lsq, result));
+   factored = get_factored_matrix( lsquare);
+   if( !factored)          /* not positive definite;  try it the old way */
+      return( solve_by_inversion( lsq, result));
+   x = (ldouble *)calloc( 2 * n_params, sizeof( ldouble));
+   if( !x)
+      return( -2);
+   dx = x + n_params;
+   for( i = 0; i < n_params; i++)
+      x[i] = lsq->uw[i];
+   ldlt_solve( factored, n_params, x);
+   for( i = 0; i < n_params; i++)
+      {
+      dx[i] = lsq->uw[i];
+      for( j = 0; j < n_params; j++)
+         dx[i] -= lsq->wtw[i * n_params + j] * x[j];
+      }
+   ldlt_solve( factored, n_params, dx);
+   for( i = 0; i < n_params; i++)
+      result[i] = (double)( x[i] + dx[i]);
+   free( x);
+   return( 0);
+}
+
 static double *convert_ldouble_matrix_to_double( const ldouble *matrix,
                               const int size)
 {
@@ -459,17 +615,45 @@ static double *convert_ldouble_matrix_to_double( const ldouble *matrix,
    return( rval);
 }
 
+/* The covariance matrix is the inverse of W^T W.  Only here do we
+actually form an inverse,  column by column from the LDL^T factors.  */
+
 double *lsquare_covariance_matrix( const void *lsquare)
 {
    const LSQUARE *lsq = (const LSQUARE *)lsquare;
+   const int n_params = lsq->n_params;
    ldouble *lrval = nullptr;
 
-   if( lsq->n_params <= lsq->n_obs)       /* got enough observations */
-      lrval = calc_inverse_improved( lsq->wtw, lsq->n_params);
-//    lrval = invert_symmetric_positive_definite_matrix( lsq->wtw, lsq->n_params);
+   if( n_params > lsq->n_obs)       /* not enough observations yet */
+      return( nullptr);
+   if( !(lsq->flags & LSQUARE_GAUSS_JORDAN))
+      {
+      const ldouble *factored = get_factored_matrix( lsquare);
+
+      if( factored)
+         lrval = (ldouble *)calloc( n_params * n_params, sizeof( ldouble));
+      if( lrval)
+         {
+         int i, j;
+
+         for( i = 0; i < n_params; i++)
+            {
+            ldouble *column = lrval + i * n_params;
+
+            column[i] = 1.;
+            ldlt_solve( factored, n_params, column);
+            }
+         for( i = 0; i < n_params; i++)     /* symmetrize */
+            for( j = 0; j < i; j++)
+               lrval[i * n_params + j] = lrval[j * n_params + i] =
+                   (lrval[i * n_params + j] + lrval[j * n_params + i]) * .5;
+         }
+      }
+   if( !lrval)
+      lrval = calc_inverse_improved( lsq->wtw, n_params);
    if( lrval)
       {
-      double *rval = convert_ldouble_matrix_to_double( lrval, lsq->n_params);
+      double *rval = convert_ldouble_matrix_to_double( lrval, n_params);
 
       free( lrval);
       return( rval);
@@ -480,8 +664,9 @@ double *lsquare_covariance_matrix( const void *lsquare)
 
 double *lsquare_wtw_matrix( const void *lsquare)
 {
-   const LSQUARE *lsq = (const LSQUARE *)lsquare;
+   LSQUARE *lsq = (LSQUARE *)lsquare;
 
+   flush_buffered_rows( lsq);
    return( convert_ldouble_matrix_to_double( lsq->wtw, lsq->n_params));
 }
 
@@ -490,29 +675,7 @@ void lsquare_free( void *lsquare)
    const LSQUARE *lsq = (const LSQUARE *)lsquare;
 
    free( lsq->uw);
+   free( lsq->buff);
+   free( lsq->factored);
    free( lsquare);
 }
-
-#ifdef TEST_CODE
-#include <cstdio>
-
-void main( int argc, char **argv)
-{
-   FILE *ifile = fopen( "imatrix", "rb");
-   int size, i, j;
-   double *matrix, *inv;
-
-   fscanf( ifile, "%d", &size);
-   matrix = (double *)calloc( size * size, sizeof( double));
-   for( i = 0; i < size * size; i++)
-      fscanf( ifile, "%lf", matrix + i);
-   inv = calc_inverse_improved( matrix, size);
-   for( i = 0; i < size; i++)
-      {
-      printf( "\n");
-      for( j = 0; j < size; j++)
-         printf( "%10.5lf", *inv++);
-      }
-   free( inv);
-}
-#endif
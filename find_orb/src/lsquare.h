@@ -16,9 +16,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 02110-1301, USA. */
 
 void *lsquare_init( const int n_params);
+void *lsquare_init_ex( const int n_params, const int flags);
 int lsquare_add_observation( void *lsquare, const double residual,
                                     const double weight, const double *obs);
 int lsquare_solve( const void *lsquare, double *result);
 void lsquare_free( void *lsquare);
 double *lsquare_covariance_matrix( const void *lsquare);
 double *lsquare_wtw_matrix( const void *lsquare);
+
+         /* Flag for lsquare_init_ex():  accumulate W^T W one observation at
+            a time and solve by Gauss-Jordan inversion,  as was done before
+            the blocked accumulation/LDL^T solver.  Mostly for comparison. */
+#define LSQUARE_GAUSS_JORDAN     1
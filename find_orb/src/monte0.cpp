@@ -118,20 +118,22 @@ static double *store_ra_decs_mags_times(unsigned n_obs, const Observe *obs)
 void restore_ra_decs_mags_times(unsigned n_obs, Observe *obs, const double *stored_ra_decs)
 {
    const double *tptr = stored_ra_decs;
+   unsigned i;
 
    assert( tptr);
-   while( n_obs--)
+   for( i = 0; i < n_obs; i++)
       {
-      obs->ra = *tptr++;
-      obs->dec = *tptr++;
-      obs->obs_mag = *tptr++;
-      obs->jd = *tptr++;
-      if( obs->note2 == 'S')
-         set_obs_vect( obs);
+      obs[i].ra = *tptr++;
+      obs[i].dec = *tptr++;
+      obs[i].obs_mag = *tptr++;
+      obs[i].jd = *tptr++;
+      obs[i].flags &= ~OBS_TEMP_USE_FLAG;
+      if( obs[i].note2 == 'S')      /* satellite offsets are already in */
+         set_obs_vect( obs + i);    /* obs_posn;  just reset the vector */
       else
-         set_up_observation( obs);
-      obs++;
+         obs[i].flags |= OBS_TEMP_USE_FLAG;
       }
+   set_up_observations( obs, (int)n_obs);
 }
 
 
@@ -167,11 +169,21 @@ static uint64_t pcg_64_bits( pcg32_random_t* rng)
           | ((uint64_t)pcg32_random_r( rng) << 32));
 }
 
+   /* Each thread has its own generator (and its own saved Box-Muller
+value).  Normally these just run on from the fixed seed;  but for Monte
+Carlo and statistical ranging,  where variants may be computed in any
+order on any number of threads,  each variant gets its own stream via
+select_random_stream(),  so that the result doesn't depend on which
+thread got to it first.  */
+
+static thread_local pcg32_random_t rng = { 314159265, 358979323 };
+static thread_local double saved_gaussian = 0.;
+static thread_local bool have_saved_gaussian = false;
+
 /* Returns a uniform random variable,  0 <= rval < 1. */
 
 double uniform_random( const int free_up)
 {
-   static pcg32_random_t rng = { 314159265, 358979323 };
    const double two_to_the_63rd_power = 9223372036854775808.;
 
    if( free_up)         /* flag to free up memory */
@@ -180,6 +192,24 @@ double uniform_random( const int free_up)
       return( (double)( pcg_64_bits( &rng) >> 1) / two_to_the_63rd_power);
 }
 
+/* Same seeding as 'pcg32_srandom_r' on the PCG site:  the stream ID
+selects one of 2^63 distinct sequences,  all starting from 'seed'. */
+
+void select_random_stream( const uint64_t seed, const uint64_t stream_id)
+{
+   rng.state = 0;
+   rng.inc = (stream_id << 1) | 1;
+   pcg32_random_r( &rng);
+   rng.state += seed;
+   pcg32_random_r( &rng);
+   have_saved_gaussian = false;
+}
+
+uint64_t random_64_bits( void)
+{
+   return( pcg_64_bits( &rng));
+}
+
 /* The Box-Muller transform converts two uniformly-distributed random
 variables into two Gaussian-distributed random variables.  We save one
 for a subsequent call.  See
@@ -191,12 +221,10 @@ times for Monte Carlo and statistical ranging. */
 
 double gaussian_random( void)
 {
-   static double saved = 0.;
-   static bool have_a_value_already = false;
    double rval;
 
-   if( have_a_value_already)
-      rval = saved;
+   if( have_saved_gaussian)
+      rval = saved_gaussian;
    else
       {
       const double rt = log( 1. - uniform_random( 0));
@@ -204,9 +232,9 @@ double gaussian_random( void)
       const double theta = 2. * PI * uniform_random( 0);
 
       rval = r * cos( theta);
-      saved = r * sin( theta);
+      saved_gaussian = r * sin( theta);
       }
-   have_a_value_already = !have_a_value_already;
+   have_saved_gaussian = !have_saved_gaussian;
    return( rval);
 }
 
@@ -234,6 +262,7 @@ double *add_gaussian_noise_to_obs(int n_obs, Observe *obs,
 {
    const double noise_in_radians = noise_in_sigmas * PI / (180. * 3600.);
    double *rval;
+   int i;
 
    if( !obs)         /* flag to free up memory */
       {
@@ -241,22 +270,24 @@ double *add_gaussian_noise_to_obs(int n_obs, Observe *obs,
       return( nullptr);
       }
    rval = store_ra_decs_mags_times( n_obs, obs);
-   while( n_obs--)
+   for( i = 0; i < n_obs; i++)
       {
+      Observe *optr = obs + i;
       const double x = gaussian_random( );
       const double y = gaussian_random( );
 
-      obs->ra  += x * obs->posn_sigma_1 * noise_in_radians / cos( obs->dec);
-      obs->dec += y * obs->posn_sigma_2 * noise_in_radians;
-      if( obs->obs_mag != BLANK_MAG)
-         obs->obs_mag += gaussian_random( ) * obs->mag_sigma;
-      obs->jd  +=     gaussian_random( ) * obs->time_sigma;
-      if( obs->note2 == 'S')
-         set_obs_vect( obs);
+      optr->ra  += x * optr->posn_sigma_1 * noise_in_radians / cos( optr->dec);
+      optr->dec += y * optr->posn_sigma_2 * noise_in_radians;
+      if( optr->obs_mag != BLANK_MAG)
+         optr->obs_mag += gaussian_random( ) * optr->mag_sigma;
+      optr->jd  +=     gaussian_random( ) * optr->time_sigma;
+      optr->flags &= ~OBS_TEMP_USE_FLAG;
+      if( optr->note2 == 'S')
+         set_obs_vect( optr);
       else
-         set_up_observation( obs);
-      obs++;
+         optr->flags |= OBS_TEMP_USE_FLAG;
       }
+   set_up_observations( obs, n_obs);
    return( rval);
 }
 
@@ -271,8 +302,8 @@ double *add_gaussian_noise_to_obs(int n_obs, Observe *obs,
          (2020 Jun 18) One can set SIGMA_
        */
 
-static char format[10];
-static int precision;
+static thread_local char format[10];
+static thread_local int precision;
 
 char *put_double_in_buff( char *buff, const double ival)
 {
@@ -379,7 +410,7 @@ double dump_monte_data_to_file( FILE *ofile, const double *sigmas,
    const double sigma_a = sigmas[MONTE_INV_A] * semimajor_axis * semimajor_axis;
    int i;
    char tbuff[40], *tptr;
-   extern int available_sigmas;
+   extern thread_local int available_sigmas;
 
    fprintf( ofile, "Planet orbiting: %d\n", planet_orbiting);
    fprintf( ofile, "Sigmas:\n");
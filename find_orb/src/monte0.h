@@ -18,6 +18,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #define MONTE_H_INCLUDE
 
 #include <iosfwd>
+#include <cstdint>
 
 struct Observe;
 struct Elements;
@@ -48,6 +49,9 @@ double dump_monte_data_to_file(FILE *ofile, const double *sigmas, const double s
          const double ecc, const int planet_orbiting);                       /* monte0.cpp */
 char * put_double_in_buff(char *buff, const double ival);    /* monte0.cpp */
 double gaussian_random(void);                           /* monte0.c */
+void select_random_stream( const uint64_t seed,
+                  const uint64_t stream_id);               /* monte0.cpp */
+uint64_t random_64_bits( void);                             /* monte0.cpp */
 void remove_insignificant_digits(char* tbuff);          /* monte0.c */
 
 
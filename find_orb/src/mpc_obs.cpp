@@ -53,6 +53,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <cstdarg>
 #include <cassert>
 #include <cerrno>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+   #include <fcntl.h>
+   #include <sys/mman.h>
+   #include <unistd.h>
+#else
+   #include <process.h>    /* for _getpid() prototype */
+   #define getpid _getpid
+#endif
 //
 
 
@@ -68,8 +82,11 @@ static void reduce_designation(char* desig, const char* idesig);
 
 static void *_ades_ids_stack = nullptr;
 
+static std::mutex debug_mutex;     /* fitting threads share 'debug.txt' */
+
 int debug_printf( const char *format, ...)
 {
+   const std::lock_guard<std::mutex> lock( debug_mutex);
    const char *debug_file_name = "debug.txt";
    FILE *ofile = fopen_ext( debug_file_name, "ca");
 
@@ -1313,20 +1330,19 @@ int earth_lunar_vel( const double jd, double   *earth_loc, double   *lunar_loc)
    return( earth_lunar_posn_vel( jd, earth_loc, lunar_loc, 1));
 }
 
-/* Input time is a JD in UT.  Output offset is in equatorial    */
-/* J2000, in AU.    Declared 'inline' because it's used exactly */
-/* once,  in compute_observer_loc.                              */
+/* Given the planet's orientation matrix (as from calc_planet_orientation),
+computes the observer's offset from the planet's center and velocity
+relative to it.  Output is in equatorial J2000, in AU.  Note that the
+matrix is modified.  */
 
-static inline int compute_topocentric_offset( const double ut,
+static void topocentric_offset_from_orientation( double *precess_matrix,
                const int planet_no,
                const double rho_cos_phi,
                const double rho_sin_phi, const double lon,
                double *offset, double *vel)
 {
-   double precess_matrix[9];
    int i;
 
-   calc_planet_orientation( planet_no, 0, ut, precess_matrix);
    spin_matrix( precess_matrix, precess_matrix + 3, lon);
    for( i = 0; i < 3; i++)
       {
@@ -1342,6 +1358,23 @@ static inline int compute_topocentric_offset( const double ut,
       if( vel)
          vel[i] = -rho_cos_phi * precess_matrix[i + 3] * omega;
       }
+}
+
+/* Input time is a JD in UT.  Output offset is in equatorial    */
+/* J2000, in AU.    Declared 'inline' because it's used exactly */
+/* twice,  in compute_observer_loc() and compute_observer_vel(). */
+
+static inline int compute_topocentric_offset( const double ut,
+               const int planet_no,
+               const double rho_cos_phi,
+               const double rho_sin_phi, const double lon,
+               double *offset, double *vel)
+{
+   double precess_matrix[9];
+
+   calc_planet_orientation( planet_no, 0, ut, precess_matrix);
+   topocentric_offset_from_orientation( precess_matrix, planet_no,
+                     rho_cos_phi, rho_sin_phi, lon, offset, vel);
    return( 0);
 }
 
@@ -1547,16 +1580,41 @@ static int jpl_code_to_planet_idx( const int spice_code)
    return( rval);
 }
 
-void set_up_observation(Observe *obs)
+/* Station data needed to locate an observer,  as found by get_observer_data().
+'lacks_offset' means the station is listed,  but without parallax constants. */
+
+typedef struct
+   {
+   double rho_cos_phi, rho_sin_phi, lon;
+   int observer_planet;
+   bool lacks_offset;
+   } Station_info;
+
+static void get_station_info( Station_info *sinfo, const char *mpc_code)
 {
    char tbuff[300];
    mpc_code_t cinfo;
-   int observer_planet = get_observer_data( obs->mpc_code, tbuff, &cinfo);
+
+   sinfo->observer_planet = get_observer_data( mpc_code, tbuff, &cinfo);
+   sinfo->rho_cos_phi = cinfo.rho_cos_phi;
+   sinfo->rho_sin_phi = cinfo.rho_sin_phi;
+   sinfo->lon = cinfo.lon;
+   sinfo->lacks_offset = (sinfo->observer_planet != -1
+               && !memcmp( tbuff + 3, "                          ", 26));
+}
+
+/* Flags (and comments) the observation if its station is unknown or lacks
+parallax constants,  and returns the planet from which it was made.      */
+
+static int check_observer_station( Observe *obs, const Station_info *sinfo)
+{
+   int observer_planet = sinfo->observer_planet;
 
    if( observer_planet == -1)
       {
       static unsigned n_unfound = 0;
       static char unfound[10][4];
+      char tbuff[300];
       unsigned i;
 
       obs->is_included = 0;
@@ -1582,8 +1640,7 @@ void set_up_observation(Observe *obs)
          }
       observer_planet = 3;    /* default to geocentric */
       }
-   else if( obs->note2 != 'S' && obs->note2 != 'V'
-               && !memcmp( tbuff + 3, "                          ", 26))
+   else if( obs->note2 != 'S' && obs->note2 != 'V' && sinfo->lacks_offset)
       {
       obs->is_included = 0;
       obs->flags |= OBS_NO_OFFSET | OBS_DONT_USE;
@@ -1591,13 +1648,216 @@ void set_up_observation(Observe *obs)
       }
    if( observer_planet == -2)          /* satellite observation */
       observer_planet = jpl_code_to_planet_idx( obs->ref_center);
+   return( observer_planet);
+}
+
+void set_up_observation(Observe *obs)
+{
+   Station_info sinfo;
+   int observer_planet;
+
+   get_station_info( &sinfo, obs->mpc_code);
+   observer_planet = check_observer_station( obs, &sinfo);
    compute_observer_loc( obs->jd, observer_planet,
-               cinfo.rho_cos_phi, cinfo.rho_sin_phi, cinfo.lon, obs->obs_posn);
+               sinfo.rho_cos_phi, sinfo.rho_sin_phi, sinfo.lon, obs->obs_posn);
    compute_observer_vel( obs->jd, observer_planet,
-               cinfo.rho_cos_phi, cinfo.rho_sin_phi, cinfo.lon, obs->obs_vel);
+               sinfo.rho_cos_phi, sinfo.rho_sin_phi, sinfo.lon, obs->obs_vel);
    set_obs_vect( obs);
 }
 
+/* Setting up observations one at a time,  nearly all the time goes to the
+earth's orientation:  precession,  nutation,  EOPs,  and sidereal time are
+all evaluated for each observation,  twice (for position and velocity).
+set_up_observations() does the same job as set_up_observation() for each
+observation flagged with OBS_TEMP_USE_FLAG (clearing the flag),  but :
+
+   -- looks up each station once,  rather than once per observation;
+   -- computes the planet's position and velocity once per epoch,  and the
+orientation matrix once per observation;
+   -- gets the earth's positions and velocities for all epochs with two
+planet_posn_batch() calls,  which (with a JPL ephemeris) read each
+ephemeris record once and evaluate several epochs at a time;
+   -- when several observations fall within the same EARTH_ORIENTATION_STEP
+(45 minutes of TT),  evaluates precession and nutation (including the EOP
+corrections) at the ends of that step and interpolates linearly between
+them.  Sidereal time and polar motion are still computed for each
+observation.  The interpolation error is at most 2e-11 radians (0.14 mm
+at the earth's surface),  and an interpolated matrix costs about an eighth
+as much as an exact one.  Isolated observations are handled exactly.  */
+
+#define EARTH_ORIENTATION_STEP   (1. / 32.)
+
+typedef struct
+   {
+   double jdt0;            /* start of current step;  0 = nothing cached */
+   double precession[2][9];
+   } Earth_orientation_cache;
+
+static inline double earth_orientation_step( const double jd)
+{
+   return( floor( jd / EARTH_ORIENTATION_STEP) * EARTH_ORIENTATION_STEP);
+}
+
+/* Computes the same matrix as calc_planet_orientation( 3, 0, ut, matrix)
+(see lunar/cospar.cpp and eop_prec.cpp),  except with precession/nutation
+interpolated as described above. */
+
+static void interpolated_earth_orientation( Earth_orientation_cache *cache,
+                     const double ut, double *matrix)
+{
+   const double tdt = ut + td_minus_ut( ut) / seconds_per_day;
+   const double year = 2000. + (tdt - J2000) / 365.25;
+   const double jdt = J2000 + (year - 2000.) * 365.25;
+   const double jdt0 = earth_orientation_step( jdt);
+   const double frac = (jdt - jdt0) / EARTH_ORIENTATION_STEP;
+   earth_orientation_params eo_params;
+   int i;
+
+   if( jdt0 != cache->jdt0)
+      {
+      for( i = 0; i < 2; i++)
+         {
+         const double node_jdt = jdt0 + (double)i * EARTH_ORIENTATION_STEP;
+
+         get_earth_orientation_params( node_jdt, &eo_params, 0x18);
+         setup_precession_with_nutation_delta( cache->precession[i],
+                  2000. + (node_jdt - J2000) / 365.25,
+                  eo_params.dPsi, eo_params.dEps);
+         }
+      cache->jdt0 = jdt0;
+      }
+   for( i = 0; i < 9; i++)
+      matrix[i] = cache->precession[0][i]
+               + frac * (cache->precession[1][i] - cache->precession[0][i]);
+   get_earth_orientation_params( jdt, &eo_params, 7);
+   spin_matrix( matrix, matrix + 3,
+         -green_sidereal_time( jdt - eo_params.tdt_minus_ut1 / seconds_per_day));
+   spin_matrix( matrix, matrix + 6, -eo_params.dX);     /* polar motion in x */
+   spin_matrix( matrix + 3, matrix + 6, eo_params.dY); /* polar motion in y */
+   for( i = 3; i < 6; i++)          /* flip y-axis to point at E90,  as */
+      matrix[i] = -matrix[i];       /* calc_planet_orientation() does  */
+}
+
+static int compare_obs_codes( const void *a, const void *b, void *context)
+{
+   const Observe *obs = (const Observe *)context;
+
+   return( strcmp( obs[*(const int *)a].mpc_code, obs[*(const int *)b].mpc_code));
+}
+
+static int compare_obs_jds( const void *a, const void *b, void *context)
+{
+   const Observe *obs = (const Observe *)context;
+   const double jd1 = obs[*(const int *)a].jd;
+   const double jd2 = obs[*(const int *)b].jd;
+
+   return( jd1 > jd2 ? 1 : (jd1 < jd2 ? -1 : 0));
+}
+
+void set_up_observations( Observe *obs, const int n_obs)
+{
+   int *idx = (int *)malloc( n_obs * sizeof( int));
+   Station_info *sinfo = (Station_info *)malloc( n_obs * sizeof( Station_info));
+   double *earth_jds = (double *)malloc( n_obs * 7 * sizeof( double));
+   double *earth_posns = earth_jds + n_obs, *earth_vels = earth_posns + 3 * n_obs;
+   Earth_orientation_cache cache;
+   double planet_posn[3], planet_vel[3], planet_jd = 0.;
+   int i, j, n = 0, n_earth = 0, earth_idx = 0, prev_planet = -99;
+
+   assert( idx && sinfo && earth_jds);
+   if( !idx || !sinfo || !earth_jds)
+      {
+      free( idx);
+      free( sinfo);
+      free( earth_jds);
+      for( i = 0; i < n_obs; i++)
+         if( obs[i].flags & OBS_TEMP_USE_FLAG)
+            {
+            set_up_observation( obs + i);
+            obs[i].flags &= ~OBS_TEMP_USE_FLAG;
+            }
+      return;
+      }
+   for( i = 0; i < n_obs; i++)
+      if( obs[i].flags & OBS_TEMP_USE_FLAG)
+         idx[n++] = i;
+   shellsort_r( idx, n, sizeof( int), compare_obs_codes, obs);
+   for( i = 0; i < n; i++)
+      {
+      Observe *optr = obs + idx[i];
+
+      if( i && !strcmp( optr->mpc_code, obs[idx[i - 1]].mpc_code))
+         sinfo[idx[i]] = sinfo[idx[i - 1]];
+      else
+         get_station_info( sinfo + idx[i], optr->mpc_code);
+      sinfo[idx[i]].observer_planet = check_observer_station( optr, sinfo + idx[i]);
+      }
+
+   shellsort_r( idx, n, sizeof( int), compare_obs_jds, obs);
+   for( i = 0; i < n; i++)
+      if( sinfo[idx[i]].observer_planet == 3
+               && (!n_earth || earth_jds[n_earth - 1] != obs[idx[i]].jd))
+         earth_jds[n_earth++] = obs[idx[i]].jd;
+   planet_posn_batch( PLANET_POSN_EARTH, n_earth, earth_jds, earth_posns);
+   planet_posn_batch( PLANET_POSN_EARTH + PLANET_POSN_VELOCITY_OFFSET,
+                  n_earth, earth_jds, earth_vels);
+   cache.jdt0 = 0.;
+   for( i = 0; i < n; i++)
+      {
+      Observe *optr = obs + idx[i];
+      const Station_info *sptr = sinfo + idx[i];
+      const int planet_no = sptr->observer_planet;
+
+      if( planet_no != prev_planet || optr->jd != planet_jd)
+         {
+         if( planet_no == 3)
+            {
+            while( earth_jds[earth_idx] != optr->jd)
+               earth_idx++;
+            assert( earth_idx < n_earth);
+            memcpy( planet_posn, earth_posns + 3 * earth_idx, 3 * sizeof( double));
+            memcpy( planet_vel, earth_vels + 3 * earth_idx, 3 * sizeof( double));
+            }
+         else
+            {
+            compute_observer_loc( optr->jd, planet_no, 0., 0., 0., planet_posn);
+            compute_observer_vel( optr->jd, planet_no, 0., 0., 0., planet_vel);
+            }
+         prev_planet = planet_no;
+         planet_jd = optr->jd;
+         }
+      memcpy( optr->obs_posn, planet_posn, 3 * sizeof( double));
+      memcpy( optr->obs_vel, planet_vel, 3 * sizeof( double));
+      if( planet_no != -2 && (sptr->rho_sin_phi || sptr->rho_cos_phi))
+         {
+         const double ut = optr->jd - td_minus_ut( optr->jd) / seconds_per_day;
+         const double step = earth_orientation_step( optr->jd);
+         double matrix[9], offset[3], vel[3];
+
+         assert( planet_no < 9000);
+         if( planet_no == 3 && (step == cache.jdt0 ||
+                  (i < n - 1 && step == earth_orientation_step( obs[idx[i + 1]].jd))))
+            interpolated_earth_orientation( &cache, ut, matrix);
+         else
+            calc_planet_orientation( planet_no, 0, ut, matrix);
+         topocentric_offset_from_orientation( matrix, planet_no,
+               sptr->rho_cos_phi, sptr->rho_sin_phi, sptr->lon, offset, vel);
+         equatorial_to_ecliptic( offset);
+         equatorial_to_ecliptic( vel);
+         for( j = 0; j < 3; j++)
+            {
+            optr->obs_posn[j] += offset[j];
+            optr->obs_vel[j] += vel[j];
+            }
+         }
+      set_obs_vect( optr);
+      optr->flags &= ~OBS_TEMP_USE_FLAG;
+      }
+   free( idx);
+   free( sinfo);
+   free( earth_jds);
+}
+
 static int set_data_from_obs_header(Observe *obs);
 
 /* Some historical observations are provided in apparent coordinates of date.
@@ -1620,8 +1880,12 @@ static void adjust_for_aberration(Observe *obs)
 int apply_debiasing = 0;
 int object_type;
 
+/* If 'defer_set_up' is true,  the observer's position isn't computed;
+the observation is instead flagged with OBS_TEMP_USE_FLAG,  and the
+caller should later pass it to set_up_observations().  */
 
-static int parse_observation(Observe *obs, const char *buff)
+static int parse_observation(Observe *obs, const char *buff,
+                                          const bool defer_set_up)
 {
    unsigned time_format;
    double utc = extract_date_from_mpc_report( buff, &time_format);
@@ -1802,7 +2066,10 @@ static int parse_observation(Observe *obs, const char *buff)
          fcct_error_message_shown = true;   /* see efindorb.txt */
          }
       }
-   set_up_observation( obs);
+   if( defer_set_up)
+      obs->flags |= OBS_TEMP_USE_FLAG;
+   else
+      set_up_observation( obs);
    return( 0);
 }
 
@@ -1878,6 +2145,20 @@ static int compare_desigs( const char *desig1, const char *desig2)
    return( rval);
 }
 
+static unsigned desig_hash( const char *reduced)
+{
+   unsigned loc = 42, i;
+   const uint32_t *tptr = (const uint32_t *)reduced;  /* horrible type pun */
+
+   for( i = 0; i < 3; i++)
+      {
+      loc ^= (unsigned)*tptr++;
+      loc ^= loc << 13;
+      loc ^= loc >> 8;
+      }
+   return( loc);
+}
+
 /* In load_observations(),  we need to know if a given "new" observation
 is of an already-found object.  To do that,  we keep track of designations
 in a hash table of OBJECT_INFO structures.  The following function either
@@ -1892,17 +2173,10 @@ static unsigned find_in_hash_table( const OBJECT_INFO *objs, const char *desig,
    else
       {
       char reduced[13];
-      unsigned loc = 42, i;
-      uint32_t *tptr = (uint32_t *)reduced;  /* horrible type pun */
+      unsigned loc, i;
 
       reduce_designation( reduced, desig);
-      for( i = 0; i < 3; i++)
-         {
-         loc ^= (unsigned)*tptr++;
-         loc ^= loc << 13;
-         loc ^= loc >> 8;
-         }
-      loc %= table_size;
+      loc = desig_hash( reduced) % table_size;
       i = 1;
       assert( *desig);
       while( objs[loc].packed_desig[0]
@@ -1925,7 +2199,7 @@ static const char *new_xdesig_indicator = "New xdesig";
 static int xref_designation( char *desig)
 {
    static char *xlate_table = nullptr;
-   static char prev_desig_in[12], prev_desig_out[12];
+   static thread_local char prev_desig_in[12], prev_desig_out[12];
    static int n_lines = 0;
    char reduced_desig[13];
    int i, gap;
@@ -3007,7 +3281,7 @@ static void fix_radar_time( char *buff)
 int unload_observations(Observe *obs, const int n_obs)
 {
    int i;
-   extern int available_sigmas;
+   extern thread_local int available_sigmas;
 
    if( obs)
       {
@@ -3387,6 +3661,19 @@ bool use_sigmas = true;
 extern int is_interstellar;
 static double _overall_obj_alt_limit, _overall_sun_alt_limit;
 
+typedef struct
+   {
+   const int64_t *line_offsets;
+   int64_t prologue_len;
+   int n_lines, n_read, prev_rval;
+   bool in_prologue;
+   } Indexed_lines;
+
+static bool set_up_indexed_lines( Indexed_lines *idx, FILE *ifile,
+                                        const char *packed_desig);
+static int fgets_indexed( char *buff, const size_t buffsize,
+                  void *ades_context, FILE *ifile, Indexed_lines *idx);
+
 Observe  *load_observations(FILE *ifile, const char *packed_desig, const int n_obs)
 {
    const double days_per_year = 365.25;
@@ -3422,6 +3709,8 @@ Observe  *load_observations(FILE *ifile, const char *packed_desig, const int n_o
    double spacecraft_vel[3];
    static int suppress_private_obs = -1;
    int count_satellite_coord_errors[N_SATELL_COORD_ERRORS];
+   Indexed_lines indexed;
+   const bool using_index = set_up_indexed_lines( &indexed, ifile, packed_desig);
 
    memset( count_satellite_coord_errors, 0, sizeof( count_satellite_coord_errors));
    move_add_nstr( 1, 2, "Loading observations", -1);
@@ -3453,7 +3742,9 @@ Observe  *load_observations(FILE *ifile, const char *packed_desig, const int n_o
    for( i = 0; i < 3; i++)
       spacecraft_vel[i] = 0.;
    i = 0;
-   while( fgets_with_ades_xlation( buff, sizeof( buff), ades_context, ifile)
+   while( (using_index
+            ? fgets_indexed( buff, sizeof( buff), ades_context, ifile, &indexed)
+            : fgets_with_ades_xlation( buff, sizeof( buff), ades_context, ifile))
                   && i != n_obs)
       {
       int is_rwo = 0, fixes_made = 0;
@@ -3489,7 +3780,7 @@ Observe  *load_observations(FILE *ifile, const char *packed_desig, const int n_o
       jd = observation_jd( buff);
       if( is_in_range( jd) && !compare_desigs( packed_desig, buff))
          {
-         const int error_code = parse_observation( rval + i, buff);
+         const int error_code = parse_observation( rval + i, buff, true);
 
          strcpy( rval[i].packed_id, original_packed_desig);
          if( error_code)
@@ -3513,7 +3804,7 @@ Observe  *load_observations(FILE *ifile, const char *packed_desig, const int n_o
                if( observation_is_good)
                   {
                   rval[i].ref_center = spacecraft_offset_reference;
-                  parse_observation( rval + i, buff);
+                  parse_observation( rval + i, buff, false);
                   }
                }
 
@@ -3869,6 +4160,7 @@ Observe  *load_observations(FILE *ifile, const char *packed_desig, const int n_o
       }
    free_ades2mpc_context( ades_context);
    n_obs_actually_loaded = i;
+   set_up_observations( rval, n_obs_actually_loaded);
    if( debug_level)
       debug_printf( "%u obs found in file\n",  n_obs_actually_loaded);
    for( i = 0; i < n_obs_actually_loaded; i++)
@@ -4183,6 +4475,1062 @@ static bool fullname_pattern_matched( const char *full_name, const char *pattern
    return( false);
 }
 
+/* Large observation files (the MPC's NumObs and UnnObs files run to
+gigabytes) are scanned by find_objects_in_file() in parallel,  if they
+can be.  The file is memory-mapped and split into line-aligned chunks;
+each thread runs its chunks through its own ADES context (primed with any
+PSV header at the start of the file),  building a table of the objects
+in that chunk and a 'columnar' list of where each observation's line
+starts and its JD.  The chunk results are then merged in file order,  so
+the OBJECT_INFO array is the same as we'd get by reading the file a line
+at a time.
+
+   That's only true if the lines can be handled independently of each
+other.  Some can't:  'COM = (xdesig)' and 'COM fullname' lines,  NEOCP
+ephemerides,  XML ADES,  .rwo data,  mid-file PSV headers,  '#ignore
+obs' sections,  etc.  A thread finding any of those flags its chunk,  and
+the whole file is then read the old-fashioned way.  Most big archive files
+contain nothing of the sort.   */
+
+#define MIN_PARALLEL_SCAN_SIZE     (4 << 20)
+#define SCAN_CHUNK_SIZE            (16 << 20)
+#define MAX_SCAN_PROLOGUE          (1 << 20)
+
+typedef struct
+   {
+   const char *data;
+   size_t size;
+#ifdef _WIN32
+   HANDLE map_handle;
+#endif
+   } Mapped_file;
+
+static bool map_file( Mapped_file *map, const char *filename)
+{
+   map->data = nullptr;
+   map->size = 0;
+#ifdef _WIN32
+   HANDLE hfile = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ,
+                  nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   LARGE_INTEGER size;
+
+   if( hfile == INVALID_HANDLE_VALUE)
+      return( false);
+   if( GetFileSizeEx( hfile, &size) && size.QuadPart > 0
+                  && (uint64_t)size.QuadPart <= (uint64_t)SIZE_MAX)
+      {
+      HANDLE hmap = CreateFileMappingA( hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+      if( hmap)
+         {
+         map->data = (const char *)MapViewOfFile( hmap, FILE_MAP_READ, 0, 0, 0);
+         if( map->data)
+            {
+            map->size = (size_t)size.QuadPart;
+            map->map_handle = hmap;
+            }
+         else
+            CloseHandle( hmap);
+         }
+      }
+   CloseHandle( hfile);       /* the mapping keeps the file open */
+#else
+   const int fd = open( filename, O_RDONLY);
+   struct stat st;
+
+   if( fd < 0)
+      return( false);
+   if( !fstat( fd, &st) && st.st_size > 0
+                  && (uint64_t)st.st_size <= (uint64_t)SIZE_MAX)
+      {
+      void *addr = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+      if( addr != MAP_FAILED)
+         {
+         map->data = (const char *)addr;
+         map->size = (size_t)st.st_size;
+         }
+      }
+   close( fd);                /* the mapping keeps the file open */
+#endif
+   return( map->data != nullptr);
+}
+
+static void unmap_file( Mapped_file *map)
+{
+   if( map->data)
+      {
+#ifdef _WIN32
+      UnmapViewOfFile( map->data);
+      CloseHandle( map->map_handle);
+#else
+      munmap( (void *)map->data, map->size);
+#endif
+      }
+   map->data = nullptr;
+}
+
+/* Copies the line starting at 'iptr' to 'buff',  with the line ending
+and trailing spaces removed,  as fgets_trimmed() would,  and returns a
+pointer to the start of the next line.  CR-only line endings,  embedded
+nulls and lines too long for 'buff' are things fgets() would handle
+differently,  so we just flag them.   */
+
+static const char *get_mapped_line( char *buff, const size_t buffsize,
+                const char *iptr, const char *end, bool *is_odd)
+{
+   const char *eol = (const char *)memchr( iptr, '\n', end - iptr);
+   const char *next_line = (eol ? eol + 1 : end);
+   size_t len = (eol ? eol : end) - iptr;
+
+   if( len && iptr[len - 1] == '\r')
+      len--;
+   if( len >= buffsize - 1 || memchr( iptr, '\r', len) || memchr( iptr, '\0', len))
+      {
+      *is_odd = true;
+      len = 0;
+      }
+   while( len && iptr[len - 1] == ' ')
+      len--;
+   memcpy( buff, iptr, len);
+   buff[len] = '\0';
+   return( next_line);
+}
+
+/* Objects found in a chunk (or the whole file) are kept in order of their
+first appearance,  with a hash table of indices (plus one;  zero means
+an empty slot) to find them by reduced designation.  */
+
+typedef struct
+   {
+   OBJECT_INFO *objs;
+   char (*reduced)[13];
+   int *hash;
+   int n_objs, n_alloced;
+   unsigned hash_size;
+   } Object_list;
+
+static int find_or_add_object( Object_list *list, const char *desig,
+                                   bool *is_new)
+{
+   char reduced[13];
+   unsigned loc, i = 1;
+
+   reduce_designation( reduced, desig);
+   if( list->n_objs >= list->n_alloced)
+      {
+      list->n_alloced = list->n_alloced * 2 + 64;
+      list->objs = (OBJECT_INFO *)realloc( list->objs,
+                                 list->n_alloced * sizeof( OBJECT_INFO));
+      list->reduced = (char (*)[13])realloc( list->reduced,
+                                 list->n_alloced * 13);
+      free( list->hash);
+      list->hash_size = (unsigned)list->n_alloced * 2 + 1;
+      list->hash = (int *)calloc( list->hash_size, sizeof( int));
+      for( i = 0; i < (unsigned)list->n_objs; i++)
+         {
+         unsigned j = 1;
+
+         loc = desig_hash( list->reduced[i]) % list->hash_size;
+         while( list->hash[loc])
+            loc = (loc + j++) % list->hash_size;
+         list->hash[loc] = (int)i + 1;
+         }
+      i = 1;
+      }
+   loc = desig_hash( reduced) % list->hash_size;
+   while( list->hash[loc])
+      {
+      const int idx = list->hash[loc] - 1;
+
+      if( !strcmp( list->reduced[idx], reduced))
+         {
+         *is_new = false;
+         return( idx);
+         }
+      loc = (loc + i++) % list->hash_size;
+      }
+   list->hash[loc] = list->n_objs + 1;
+   memset( list->objs + list->n_objs, 0, sizeof( OBJECT_INFO));
+   memcpy( list->objs[list->n_objs].packed_desig, desig, 12);
+   strcpy( list->reduced[list->n_objs], reduced);
+   *is_new = true;
+   return( list->n_objs++);
+}
+
+static void free_object_list( Object_list *list)
+{
+   free( list->objs);
+   free( list->reduced);
+   free( list->hash);
+   memset( list, 0, sizeof( Object_list));
+}
+
+/* The observation store for the last file scanned in parallel (or whose
+index was read;  see below):  for each object (in order of first
+appearance),  the byte offsets of the lines for its observations and their
+JDs,  in file order.  'sorted' lists the objects in order of reduced
+designation,  for binary searching.  'lines_are_independent' is set if
+all an object's observations can be loaded by reading just the lines
+listed for it (plus the 'prologue' lines before the first observation);
+that isn't so if the file contains second lines for satellite/roving
+observer/radar data,  or '#' lines between observations.  */
+
+typedef struct
+   {
+   double jd_start, jd_end, jd_updated;
+   int64_t file_offset;
+   int32_t n_obs;
+   char packed_desig[13], reduced[13], mpc_codes[16], solution_exists;
+   } Obs_index_entry;
+
+typedef struct
+   {
+   char *filename;
+   int64_t file_size, file_mtime, prologue_len;
+   int n_objs, n_obs;
+   bool lines_are_independent;
+   Obs_index_entry *entries;
+   int32_t *first_obs, *sorted;
+   int64_t *line_offsets;
+   double *jds;
+   Mapped_file index_map;      /* set if the above point into an index file */
+   } Obs_store;
+
+static Obs_store obs_store;
+
+#define MAX_OBS_STORE_ARRAYS     20
+
+/* Sets 'arrays' to point to the store's array pointers,  in the order in
+which they're saved in an index file,  and 'sizes' to their sizes in bytes
+for the given numbers of objects and observations.  Returns the number
+of arrays.   */
+
+static int get_obs_store_arrays( void ***arrays, size_t *sizes,
+                                 const int n_objs, const int n_obs)
+{
+   int n = 0;
+
+#define ADD_ARRAY( ARRAY, COUNT)  {  arrays[n] = (void **)&obs_store.ARRAY;  \
+               sizes[n++] = (size_t)(COUNT) * sizeof( *obs_store.ARRAY); }
+   ADD_ARRAY( entries, n_objs);
+   ADD_ARRAY( first_obs, n_objs + 1);
+   ADD_ARRAY( sorted, n_objs);
+   ADD_ARRAY( line_offsets, n_obs);
+   ADD_ARRAY( jds, n_obs);
+#undef ADD_ARRAY
+   assert( n <= MAX_OBS_STORE_ARRAYS);
+   return( n);
+}
+
+static void free_obs_store( void)
+{
+   free( obs_store.filename);
+   if( obs_store.index_map.data)
+      unmap_file( &obs_store.index_map);
+   else
+      {
+      void **arrays[MAX_OBS_STORE_ARRAYS];
+      size_t sizes[MAX_OBS_STORE_ARRAYS];
+      const int n_arrays = get_obs_store_arrays( arrays, sizes, 0, 0);
+      int i;
+
+      for( i = 0; i < n_arrays; i++)
+         free( *arrays[i]);
+      }
+   memset( &obs_store, 0, sizeof( Obs_store));
+}
+
+/* Allocates the store's arrays for the given numbers of objects and obs. */
+
+static void alloc_obs_store( const int n_objs, const int n_obs)
+{
+   void **arrays[MAX_OBS_STORE_ARRAYS];
+   size_t sizes[MAX_OBS_STORE_ARRAYS];
+   const int n_arrays = get_obs_store_arrays( arrays, sizes, n_objs, n_obs);
+   int i;
+
+   obs_store.n_objs = n_objs;
+   obs_store.n_obs = n_obs;
+   for( i = 0; i < n_arrays; i++)
+      *arrays[i] = calloc( sizes[i] + 1, 1);
+}
+
+static int compare_reduced_desigs( const void *a, const void *b, void *context)
+{
+   const Obs_index_entry *entries = (const Obs_index_entry *)context;
+
+   return( strcmp( entries[*(const int32_t *)a].reduced,
+                   entries[*(const int32_t *)b].reduced));
+}
+
+/* Returns the number of observations of the given object found when
+'filename' was last scanned,  and (if that's non-zero) pointers to
+the byte offsets of their lines and their JDs.  Zero is returned if
+the file wasn't scanned in parallel,  or if the object wasn't in it. */
+
+int find_observation_lines( const char *filename, const char *packed_desig,
+                   const int64_t **line_offsets, const double **jds)
+{
+   char reduced[13];
+   int lo = 0, hi = obs_store.n_objs;
+
+   if( !obs_store.filename || strcmp( filename, obs_store.filename))
+      return( 0);
+   reduce_designation( reduced, packed_desig);
+   while( lo < hi)
+      {
+      const int mid = (lo + hi) / 2, idx = obs_store.sorted[mid];
+      const int compare = strcmp( obs_store.entries[idx].reduced, reduced);
+
+      if( !compare)
+         {
+         const int first = obs_store.first_obs[idx];
+
+         if( line_offsets)
+            *line_offsets = obs_store.line_offsets + first;
+         if( jds)
+            *jds = obs_store.jds + first;
+         return( obs_store.first_obs[idx + 1] - first);
+         }
+      if( compare < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   return( 0);
+}
+
+static bool get_file_size_and_time( const char *filename, FILE *ifile,
+                              int64_t *size, int64_t *mtime)
+{
+#ifdef _WIN32
+   struct _stat64 st;
+   int err;
+
+   if( ifile)
+      err = _fstat64( _fileno( ifile), &st);
+   else if( filename)
+      err = _stat64( filename, &st);
+   else
+      return( false);
+#else
+   struct stat st;
+   int err;
+
+   if( ifile)
+      err = fstat( fileno( ifile), &st);
+   else if( filename)
+      err = stat( filename, &st);
+   else
+      return( false);
+#endif
+
+   if( err)
+      return( false);
+   *size = (int64_t)st.st_size;
+   *mtime = (int64_t)st.st_mtime;
+   return( true);
+}
+
+/* The store for a file is saved as an 'index' file,  with '.fidx'
+appended to the name.  Next time that file is opened,  if its size and
+modification time match those in the index (and the settings that affect
+which lines are counted as observations,  and of which objects,  haven't
+changed),  the index is memory-mapped and used as-is.  So reopening even
+a gigabyte-sized file takes milliseconds,  and loading an object means
+reading just its lines (see load_observations()).
+
+   The index is a header,  followed by the store's arrays in the order
+given by get_obs_store_arrays(),  each starting on an eight-byte boundary.
+Since the arrays are used straight from the memory map,  they're in native
+byte order;  if it was made on a machine with different byte order or
+structure layout,  the header won't match and the file will just be
+rescanned.  Set OBS_INDEX_FILES=0 in 'environ.dat' to neither read nor
+write index files.  */
+
+#define OBS_INDEX_MAGIC          0x78646966u      /* 'fidx' */
+#define OBS_INDEX_VERSION        1
+#define OBS_INDEX_INDEPENDENT    1
+
+typedef struct
+   {
+   uint32_t magic, version, entry_size, flags;
+   int64_t file_size, file_mtime, prologue_len;
+   uint64_t settings_hash;
+   int32_t n_objs, n_obs;
+   } Obs_index_header;
+
+static uint64_t fnv1a_hash( uint64_t hash, const void *data, size_t n_bytes)
+{
+   const unsigned char *tptr = (const unsigned char *)data;
+
+   while( n_bytes--)
+      hash = (hash ^ *tptr++) * 0x100000001b3ULL;
+   return( hash);
+}
+
+static uint64_t obs_index_settings_hash( void)
+{
+   const char *envars[2] = { "ACCEPTED_STATIONS", "REJECTED_STATIONS" };
+   uint64_t hash = 0xcbf29ce484222325ULL;
+   int64_t xdesig_size = 0, xdesig_mtime = 0;
+   char path[PATH_MAX];
+   size_t i;
+
+   hash = fnv1a_hash( hash, &minimum_observation_jd, sizeof( double));
+   hash = fnv1a_hash( hash, &maximum_observation_jd, sizeof( double));
+   hash = fnv1a_hash( hash, &separate_periodic_comet_apparitions, sizeof( int));
+   for( i = 0; i < 2; i++)
+      {
+      const char *tptr = get_environment_ptr( envars[i]);
+
+      hash = fnv1a_hash( hash, tptr, strlen( tptr) + 1);
+      }
+   make_config_dir_name( path, "xdesig.txt");
+   if( !get_file_size_and_time( path, nullptr, &xdesig_size, &xdesig_mtime))
+      get_file_size_and_time( "xdesig.txt", nullptr, &xdesig_size, &xdesig_mtime);
+   hash = fnv1a_hash( hash, &xdesig_size, sizeof( int64_t));
+   hash = fnv1a_hash( hash, &xdesig_mtime, sizeof( int64_t));
+   return( hash);
+}
+
+static size_t obs_index_layout( const int n_objs, const int n_obs,
+                                         size_t *offsets)
+{
+   void **arrays[MAX_OBS_STORE_ARRAYS];
+   size_t sizes[MAX_OBS_STORE_ARRAYS];
+   const int n_arrays = get_obs_store_arrays( arrays, sizes, n_objs, n_obs);
+   size_t loc = sizeof( Obs_index_header);
+   int i;
+
+   for( i = 0; i < n_arrays; i++)
+      {
+      offsets[i] = loc;
+      loc = (loc + sizes[i] + 7) & ~(size_t)7;
+      }
+   return( loc);
+}
+
+static bool using_obs_index_files( void)
+{
+   return( atoi( get_environment_ptr( "OBS_INDEX_FILES")) != 0);
+}
+
+static void make_obs_index_name( char *index_name, const char *filename)
+{
+   snprintf_err( index_name, PATH_MAX, "%s.fidx", filename);
+}
+
+/* If the index can't be written (read-only directory,  say),  we just
+go without.  It's written to a temporary file,  which is then renamed,
+so another Find_Orb run reading the index never sees it half-written.
+The header is still written last,  so that a partly written index
+can't be mistaken for a good one.  A file modified within the
+last few seconds may yet be modified again within the same second,
+without the modification time changing;  we don't index those.  */
+
+static void write_obs_index( void)
+{
+   Obs_index_header hdr;
+   char index_name[PATH_MAX], temp_name[PATH_MAX + 20];
+   const char zeroes[8] = { 0 };
+   void **arrays[MAX_OBS_STORE_ARRAYS];
+   size_t sizes[MAX_OBS_STORE_ARRAYS];
+   const int n_arrays = get_obs_store_arrays( arrays, sizes,
+                                    obs_store.n_objs, obs_store.n_obs);
+   FILE *ofile;
+   bool ok;
+   int i;
+
+   if( (int64_t)time( nullptr) < obs_store.file_mtime + 3)
+      return;
+   memset( &hdr, 0, sizeof( hdr));
+   hdr.version = OBS_INDEX_VERSION;
+   hdr.entry_size = (uint32_t)sizeof( Obs_index_entry);
+   hdr.flags = (obs_store.lines_are_independent ? OBS_INDEX_INDEPENDENT : 0);
+   hdr.file_size = obs_store.file_size;
+   hdr.file_mtime = obs_store.file_mtime;
+   hdr.prologue_len = obs_store.prologue_len;
+   hdr.settings_hash = obs_index_settings_hash( );
+   hdr.n_objs = obs_store.n_objs;
+   hdr.n_obs = obs_store.n_obs;
+   make_obs_index_name( index_name, obs_store.filename);
+   snprintf_err( temp_name, sizeof( temp_name), "%s.%ld.tmp", index_name,
+                                             (long)getpid( ));
+   ofile = fopen( temp_name, "wb");
+   if( !ofile)
+      return;
+   ok = (fwrite( &hdr, sizeof( hdr), 1, ofile) == 1);
+   for( i = 0; ok && i < n_arrays; i++)
+      {
+      const size_t n_pad = (8 - sizes[i] % 8) % 8;
+
+      ok = (fwrite( *arrays[i], 1, sizes[i], ofile) == sizes[i]
+               && fwrite( zeroes, 1, n_pad, ofile) == n_pad);
+      }
+   if( ok)
+      {
+      hdr.magic = OBS_INDEX_MAGIC;
+      ok = (!fseek( ofile, 0L, SEEK_SET)
+               && fwrite( &hdr, sizeof( hdr), 1, ofile) == 1);
+      }
+   if( fclose( ofile))
+      ok = false;
+#ifdef _WIN32
+   if( ok)              /* rename() won't replace an existing file */
+      remove( index_name);
+#endif
+   if( !ok || rename( temp_name, index_name))
+      remove( temp_name);
+   else
+      debug_printf( "Wrote index '%s' (%d objects,  %d obs)\n", index_name,
+                     obs_store.n_objs, obs_store.n_obs);
+}
+
+/* Reads the index for 'filename',  if there is one and it's up to date,
+and returns the objects in the file (as find_objects_in_file() would,
+before sorting) with their number in *n_found.  Otherwise,  nullptr is
+returned,  and the file will have to be scanned.   */
+
+static OBJECT_INFO *load_obs_index( const char *filename, int *n_found)
+{
+   const Obs_index_header *hdr;
+   char index_name[PATH_MAX];
+   void **arrays[MAX_OBS_STORE_ARRAYS];
+   size_t offsets[MAX_OBS_STORE_ARRAYS], sizes[MAX_OBS_STORE_ARRAYS];
+   int64_t file_size, file_mtime;
+   Mapped_file map;
+   OBJECT_INFO *rval;
+   int i, n_arrays;
+
+   if( !get_file_size_and_time( filename, nullptr, &file_size, &file_mtime))
+      return( nullptr);
+   make_obs_index_name( index_name, filename);
+   if( !map_file( &map, index_name))
+      return( nullptr);
+   hdr = (const Obs_index_header *)map.data;
+   if( map.size < sizeof( Obs_index_header) || hdr->magic != OBS_INDEX_MAGIC
+            || hdr->version != OBS_INDEX_VERSION
+            || hdr->entry_size != (uint32_t)sizeof( Obs_index_entry)
+            || hdr->file_size != file_size || hdr->file_mtime != file_mtime
+            || hdr->n_objs < 0 || hdr->n_obs < 0
+            || map.size != obs_index_layout( hdr->n_objs, hdr->n_obs, offsets)
+            || hdr->settings_hash != obs_index_settings_hash( ))
+      {
+      unmap_file( &map);
+      return( nullptr);
+      }
+   free_obs_store( );
+   obs_store.file_size = file_size;
+   obs_store.file_mtime = file_mtime;
+   obs_store.prologue_len = hdr->prologue_len;
+   obs_store.lines_are_independent = ((hdr->flags & OBS_INDEX_INDEPENDENT) != 0);
+   obs_store.n_objs = hdr->n_objs;
+   obs_store.n_obs = hdr->n_obs;
+   n_arrays = get_obs_store_arrays( arrays, sizes, 0, 0);
+   for( i = 0; i < n_arrays; i++)      /* arrays are used in place */
+      *arrays[i] = (void *)( map.data + offsets[i]);
+   obs_store.index_map = map;
+   obs_store.filename = (char *)malloc( strlen( filename) + 1);
+   strcpy( obs_store.filename, filename);
+   rval = (OBJECT_INFO *)calloc( obs_store.n_objs + 1, sizeof( OBJECT_INFO));
+   for( i = 0; i < obs_store.n_objs; i++)
+      {
+      const Obs_index_entry *entry = obs_store.entries + i;
+
+      rval[i].jd_start = entry->jd_start;
+      rval[i].jd_end = entry->jd_end;
+      rval[i].jd_updated = entry->jd_updated;
+      rval[i].file_offset = (long)entry->file_offset;
+      rval[i].n_obs = entry->n_obs;
+      rval[i].solution_exists = entry->solution_exists;
+      memcpy( rval[i].packed_desig, entry->packed_desig, 13);
+      memcpy( rval[i].mpc_codes, entry->mpc_codes, 16);
+      }
+   *n_found = obs_store.n_objs;
+   debug_printf( "Read index '%s' (%d objects,  %d obs)\n", index_name,
+                     obs_store.n_objs, obs_store.n_obs);
+   return( rval);
+}
+
+#ifdef _WIN32
+   #define fseek64( ifile, offset)  _fseeki64( ifile, offset, SEEK_SET)
+#else
+   #define fseek64( ifile, offset)  fseeko( ifile, (off_t)(offset), SEEK_SET)
+#endif
+
+/* When loading observations from a file for which the store is current
+(and 'lines_are_independent'),  we can skip straight to the object's lines
+instead of reading through the whole file.  The prologue is read first,
+so that any PSV header and '#' settings before the first observation are
+seen.  fgets_indexed() otherwise works just as fgets_with_ades_xlation()
+does.   */
+
+static bool set_up_indexed_lines( Indexed_lines *idx, FILE *ifile,
+                                        const char *packed_desig)
+{
+   int64_t size, mtime;
+
+   memset( idx, 0, sizeof( Indexed_lines));
+   if( !obs_store.filename || !obs_store.lines_are_independent
+            || !get_file_size_and_time( nullptr, ifile, &size, &mtime)
+            || size != obs_store.file_size || mtime != obs_store.file_mtime)
+      return( false);
+   idx->n_lines = find_observation_lines( obs_store.filename, packed_desig,
+                                                &idx->line_offsets, nullptr);
+   if( !idx->n_lines)         /* object not in index;  'line_offsets' unset */
+      return( false);
+   idx->prologue_len = obs_store.prologue_len;
+   idx->in_prologue = true;
+   return( !fseek( ifile, 0L, SEEK_SET));
+}
+
+static char *next_indexed_line( char *buff, const size_t buffsize,
+                                FILE *ifile, Indexed_lines *idx)
+{
+   if( idx->in_prologue)
+      {
+      if( ftell( ifile) < (long)idx->prologue_len)
+         return( fgets_trimmed( buff, buffsize, ifile));
+      idx->in_prologue = false;
+      }
+   if( idx->n_read == idx->n_lines
+            || fseek64( ifile, idx->line_offsets[idx->n_read++]))
+      return( nullptr);
+   return( fgets_trimmed( buff, buffsize, ifile));
+}
+
+static int fgets_indexed( char *buff, const size_t buffsize,
+                  void *ades_context, FILE *ifile, Indexed_lines *idx)
+{
+   int rval = idx->prev_rval;
+
+   if( rval)
+      rval = xlate_ades2mpc_in_place( ades_context, buff);
+   while( !rval && next_indexed_line( buff, buffsize, ifile, idx))
+      rval = xlate_ades2mpc_in_place( ades_context, buff);
+   buff[strcspn( buff, "\r\n")] = '\0';
+   idx->prev_rval = rval;
+   return( rval);
+}
+
+typedef struct
+   {
+   const char *start, *end;
+   Object_list objects;
+   int64_t *line_offsets;
+   double *jds;
+   int *obj_idx;
+   int n_obs, n_obs_alloced;
+   bool needs_serial_scan, has_dependent_lines;
+   } Scan_chunk;
+
+/* Lines that (after ADES translation) would change the state of the
+scan in find_objects_in_file(),  or have it read ahead in the file.
+Mostly these are '#' (formerly 'COM') lines,  .rwo data,  and bits of
+NEOCP ephemerides (see get_neocp_data();  note that a short line can
+be taken as an NEOCP designation).  */
+
+static bool line_needs_serial_scan( const char *buff, const size_t len)
+{
+   size_t neocp_len = 0;
+
+   while( (unsigned char)buff[neocp_len] >= ' ')
+      neocp_len++;
+   while( neocp_len && buff[neocp_len - 1] == ' ')
+      neocp_len--;
+   if( neocp_len && neocp_len < 10)
+      return( true);
+   if( len > MINIMUM_RWO_LENGTH)
+      return( true);
+   if( *buff == '#')
+      return( !strcmp( buff, "#Combine all") || !memcmp( buff, "#= ", 3)
+               || !memcmp( buff, "#fullname ", 10)
+               || !strcmp( buff, "#ignore obs") || isdigit( buff[1]));
+   return( strstr( buff, "<p><b>") || strstr( buff, "the geocenter")
+               || strstr( buff, " observatory code "));
+}
+
+static bool looks_like_psv_header( const char *buff)
+{
+   while( *buff == ' ')
+      buff++;
+   return( *buff >= 'a' && *buff <= 'z' && strchr( buff, '|'));
+}
+
+/* Raw lines that would change the state of the ADES translation:  XML,
+PSV header lines (which start with a lowercase field name,  or with '# '
+or '! '),  and in a PSV file,  anything that isn't PSV data (which would
+end the PSV section).  */
+
+static bool raw_line_needs_serial_scan( const char *buff, const bool is_psv)
+{
+   if( *buff == '<' || ((*buff == '#' || *buff == '!') && buff[1] == ' ')
+                    || looks_like_psv_header( buff))
+      return( true);
+   return( is_psv && !strchr( buff, '|'));
+}
+
+static void add_obs_to_chunk( Scan_chunk *chunk, const int64_t offset,
+                              const double jd, const int obj_idx)
+{
+   if( chunk->n_obs == chunk->n_obs_alloced)
+      {
+      chunk->n_obs_alloced = chunk->n_obs_alloced * 2 + 1024;
+      chunk->line_offsets = (int64_t *)realloc( chunk->line_offsets,
+                        chunk->n_obs_alloced * sizeof( int64_t));
+      chunk->jds = (double *)realloc( chunk->jds,
+                        chunk->n_obs_alloced * sizeof( double));
+      chunk->obj_idx = (int *)realloc( chunk->obj_idx,
+                        chunk->n_obs_alloced * sizeof( int));
+      }
+   chunk->line_offsets[chunk->n_obs] = offset;
+   chunk->jds[chunk->n_obs] = jd;
+   chunk->obj_idx[chunk->n_obs] = obj_idx;
+   chunk->n_obs++;
+}
+
+/* Adds one (translated) observation line to the object list,  much as
+find_objects_in_file() does.  'next_line' is the offset of the line
+after this one,  i.e.,  where ftell() would be at this point.  */
+
+static void add_line_to_object_list( Object_list *list, char *buff,
+                  const double jd, const int64_t next_line, int *obj_idx)
+{
+   const size_t iline_len = strlen( buff);
+   OBJECT_INFO *obj;
+   bool is_new;
+   char *tptr;
+   int i;
+
+   if( *buff == '#')
+      *buff = ' ';           /* handle remarked-out lines,  too */
+   xref_designation( buff);
+   *obj_idx = find_or_add_object( list, buff, &is_new);
+   obj = list->objs + *obj_idx;
+   if( is_new)
+      {
+      obj->jd_start = obj->jd_end = obj->jd_updated = jd;
+      obj->file_offset = (long)( next_line - (int64_t)iline_len - 100);
+      if( obj->file_offset < 0)
+         obj->file_offset = 0;
+      }
+   obj->n_obs++;
+   if( buff[14] == 'x' || buff[14] == 'X')   /* deleted observation */
+      obj->solution_exists++;     /* ..flagged via soln exists */
+   if( obj->jd_start > jd)
+      obj->jd_start = jd;
+   if( obj->jd_end < jd)
+      obj->jd_end = jd;
+   if( obj->jd_updated < jd)
+      obj->jd_updated = jd;
+   i = 0;
+   tptr = obj->mpc_codes;
+   while( tptr[i] && memcmp( tptr + i, buff + 77, 3))
+      i += 3;
+   if( i < 15)     /* new obscode for this object */
+      memcpy( tptr + i, buff + 77, 3);
+   if( !memcmp( buff + 72, "NEOCP", 5))
+      {
+      const double jd_u = get_neocp_update_jd( buff);
+
+      if( obj->jd_updated < jd_u)
+         obj->jd_updated = jd_u;
+      }
+}
+
+static void scan_chunk( Scan_chunk *chunk, const Mapped_file *map,
+                  const size_t prologue_len, const bool is_psv,
+                  const char *station)
+{
+   char buff[550];
+   const char *tptr = map->data;
+   void *ades_context = init_ades2mpc( );
+
+   while( tptr < map->data + prologue_len)   /* feed header to ADES context */
+      {
+      tptr = get_mapped_line( buff, sizeof( buff), tptr,
+                        map->data + prologue_len, &chunk->needs_serial_scan);
+      while( xlate_ades2mpc_in_place( ades_context, buff))
+         ;     /* deliberately empty loop */
+      }
+   tptr = chunk->start;
+   while( tptr < chunk->end && !chunk->needs_serial_scan)
+      {
+      const int64_t line_offset = tptr - map->data;
+      bool found_obs = false, found_comment = false;
+      int xlate_rval;
+
+      tptr = get_mapped_line( buff, sizeof( buff), tptr, chunk->end,
+                                       &chunk->needs_serial_scan);
+      if( raw_line_needs_serial_scan( buff, is_psv))
+         chunk->needs_serial_scan = true;
+      xlate_rval = xlate_ades2mpc_in_place( ades_context, buff);
+      while( xlate_rval && !chunk->needs_serial_scan)
+         {
+         const size_t iline_len = strcspn( buff, "\r\n");
+         double jd;
+
+         buff[iline_len] = '\0';     /* as fgets_with_ades_xlation() does */
+
+         convert_com_to_pound_sign( buff);
+         if( line_needs_serial_scan( buff, iline_len))
+            chunk->needs_serial_scan = true;
+         else if( is_in_range( jd = observation_jd( buff)))
+            {
+            if( is_second_line( buff))
+               chunk->has_dependent_lines = true;
+            else if( !station || !memcmp( buff + 76, station, 3))
+               {
+               int obj_idx;
+
+               add_line_to_object_list( &chunk->objects, buff, jd,
+                                          tptr - map->data, &obj_idx);
+               add_obs_to_chunk( chunk, line_offset, jd, obj_idx);
+               found_obs = true;
+               }
+            }
+         else if( *buff == '#')
+            found_comment = true;
+         xlate_rval = xlate_ades2mpc_in_place( ades_context, buff);
+         }
+      if( found_comment && !found_obs)     /* '#' line that wouldn't be */
+         chunk->has_dependent_lines = true;  /* read when loading an object */
+      }
+   free_ades2mpc_context( ades_context);
+}
+
+static void merge_object_info( OBJECT_INFO *obj, const OBJECT_INFO *chunk_obj)
+{
+   int i, j;
+
+   obj->n_obs += chunk_obj->n_obs;
+   obj->solution_exists += chunk_obj->solution_exists;
+   if( obj->jd_start > chunk_obj->jd_start)
+      obj->jd_start = chunk_obj->jd_start;
+   if( obj->jd_end < chunk_obj->jd_end)
+      obj->jd_end = chunk_obj->jd_end;
+   if( obj->jd_updated < chunk_obj->jd_updated)
+      obj->jd_updated = chunk_obj->jd_updated;
+   for( j = 0; chunk_obj->mpc_codes[j]; j += 3)
+      {
+      i = 0;
+      while( obj->mpc_codes[i] && memcmp( obj->mpc_codes + i,
+                                          chunk_obj->mpc_codes + j, 3))
+         i += 3;
+      if( i < 15)
+         memcpy( obj->mpc_codes + i, chunk_obj->mpc_codes + j, 3);
+      }
+}
+
+/* Returns the objects in the file in order of first appearance (with
+their number in *n_found),  or nullptr if the file is too small to
+bother,  or couldn't be mapped,  or has something in it that requires
+reading it a line at a time.  If the file was scanned and 'station' is
+null,  the resulting store is saved as an index file.   */
+
+static OBJECT_INFO *scan_file_in_parallel( const char *filename,
+                           const char *station, int *n_found)
+{
+   Mapped_file map;
+   unsigned n_threads = (unsigned)atoi( get_environment_ptr( "OBS_LOAD_THREADS"));
+   std::vector<Scan_chunk> chunks;
+   std::vector<std::thread> workers;
+   std::atomic<size_t> next_chunk( 0);
+   Object_list objects;
+   char buff[550];
+   const char *tptr;
+   size_t i, prologue_len = 0;
+   bool is_psv = false, needs_serial_scan = false, found_obs = false;
+   bool lines_are_independent = true;
+   void *ades_context;
+   OBJECT_INFO *rval = nullptr;
+   int j, n_obs = 0;
+
+   if( !n_threads)
+      n_threads = std::thread::hardware_concurrency( );
+   if( !n_threads)
+      n_threads = 1;
+   if( combine_all_observations || *get_environment_ptr( "FIX_OBSERVATIONS"))
+      return( nullptr);
+   if( !map_file( &map, filename))
+      return( nullptr);
+   if( map.size < MIN_PARALLEL_SCAN_SIZE)
+      {
+      unmap_file( &map);
+      return( nullptr);
+      }
+            /* Lines before the first observation are a header (with   */
+            /* PSV field names,  possibly),  fed to each thread's ADES  */
+            /* context before it starts on its chunks.                  */
+   ades_context = init_ades2mpc( );
+   tptr = map.data;
+   while( tptr < map.data + map.size && !needs_serial_scan && !found_obs)
+      {
+      const char *next_line = get_mapped_line( buff, sizeof( buff), tptr,
+                              map.data + map.size, &needs_serial_scan);
+      int xlate_rval;
+
+      if( *buff == '<' || tptr - map.data > MAX_SCAN_PROLOGUE)
+         needs_serial_scan = true;
+      if( looks_like_psv_header( buff))
+         is_psv = true;
+      xlate_rval = xlate_ades2mpc_in_place( ades_context, buff);
+      while( xlate_rval && !found_obs)
+         {
+         const size_t iline_len = strcspn( buff, "\r\n");
+
+         buff[iline_len] = '\0';
+         convert_com_to_pound_sign( buff);
+         if( observation_jd( buff))
+            found_obs = true;
+         else if( line_needs_serial_scan( buff, iline_len))
+            needs_serial_scan = true;
+         xlate_rval = xlate_ades2mpc_in_place( ades_context, buff);
+         }
+      if( !found_obs)
+         tptr = next_line;
+      }
+   free_ades2mpc_context( ades_context);
+   prologue_len = tptr - map.data;
+   if( needs_serial_scan)
+      {
+      unmap_file( &map);
+      return( nullptr);
+      }
+               /* break the rest of the file into line-aligned chunks */
+   while( tptr < map.data + map.size)
+      {
+      Scan_chunk chunk;
+      const char *end = tptr + SCAN_CHUNK_SIZE;
+
+      if( end >= map.data + map.size)
+         end = map.data + map.size;
+      else
+         {
+         end = (const char *)memchr( end, '\n', map.data + map.size - end);
+         end = (end ? end + 1 : map.data + map.size);
+         }
+      memset( &chunk, 0, sizeof( Scan_chunk));
+      chunk.start = tptr;
+      chunk.end = end;
+      chunks.push_back( chunk);
+      tptr = end;
+      }
+   if( n_threads > chunks.size( ))
+      n_threads = (unsigned)chunks.size( );
+   snprintf_err( buff, sizeof( buff), "Scanning observations (%u threads)",
+                        n_threads);
+   move_add_nstr( 3, 3, buff, -1);
+   refresh_console( );
+   observatory_is_acceptable( "500");   /* load these before threads start */
+   memset( buff, ' ', 12);
+   buff[12] = '\0';
+   xref_designation( buff);
+   for( i = 0; i < n_threads; i++)
+      workers.emplace_back( [&]( )
+         {
+         size_t idx;
+
+         while( (idx = next_chunk++) < chunks.size( ))
+            scan_chunk( &chunks[idx], &map, prologue_len, is_psv, station);
+         });
+   for( auto &worker : workers)
+      worker.join( );
+
+   for( i = 0; i < chunks.size( ); i++)
+      {
+      if( chunks[i].needs_serial_scan)
+         needs_serial_scan = true;
+      if( chunks[i].has_dependent_lines)
+         lines_are_independent = false;
+      }
+   memset( &objects, 0, sizeof( Object_list));
+   if( !needs_serial_scan)
+      {                    /* merge the chunk results,  in file order */
+      for( i = 0; i < chunks.size( ); i++)
+         {
+         Scan_chunk *chunk = &chunks[i];
+         std::vector<int> file_idx( chunk->objects.n_objs);
+
+         for( j = 0; j < chunk->objects.n_objs; j++)
+            {
+            const OBJECT_INFO *chunk_obj = chunk->objects.objs + j;
+            bool is_new;
+            const int idx = find_or_add_object( &objects,
+                                          chunk_obj->packed_desig, &is_new);
+
+            if( is_new)
+               objects.objs[idx] = *chunk_obj;
+            else
+               merge_object_info( objects.objs + idx, chunk_obj);
+            file_idx[j] = idx;
+            }
+         for( j = 0; j < chunk->n_obs; j++)
+            chunk->obj_idx[j] = file_idx[chunk->obj_idx[j]];
+         n_obs += chunk->n_obs;
+         }
+               /* ...then make the columnar store,  grouped by object */
+      free_obs_store( );
+      alloc_obs_store( objects.n_objs, n_obs);
+      get_file_size_and_time( filename, nullptr, &obs_store.file_size,
+                                                 &obs_store.file_mtime);
+      obs_store.prologue_len = (int64_t)prologue_len;
+      obs_store.lines_are_independent = lines_are_independent;
+      for( j = 0; j < objects.n_objs; j++)
+         {
+         const OBJECT_INFO *obj = objects.objs + j;
+         Obs_index_entry *entry = obs_store.entries + j;
+
+         entry->jd_start = obj->jd_start;
+         entry->jd_end = obj->jd_end;
+         entry->jd_updated = obj->jd_updated;
+         entry->file_offset = (int64_t)obj->file_offset;
+         entry->n_obs = obj->n_obs;
+         entry->solution_exists = obj->solution_exists;
+         memcpy( entry->packed_desig, obj->packed_desig, 13);
+         memcpy( entry->mpc_codes, obj->mpc_codes, 16);
+         strcpy( entry->reduced, objects.reduced[j]);
+         }
+      for( j = 0; j < objects.n_objs; j++)
+         obs_store.first_obs[j + 1] = obs_store.first_obs[j]
+                                    + objects.objs[j].n_obs;
+      for( i = 0; i < chunks.size( ); i++)
+         for( j = 0; j < chunks[i].n_obs; j++)
+            {
+            const int loc = obs_store.first_obs[chunks[i].obj_idx[j]]++;
+
+            obs_store.line_offsets[loc] = chunks[i].line_offsets[j];
+            obs_store.jds[loc] = chunks[i].jds[j];
+            }
+      for( j = objects.n_objs; j > 0; j--)     /* undo the above '++'s */
+         obs_store.first_obs[j] = obs_store.first_obs[j - 1];
+      obs_store.first_obs[0] = 0;
+      for( j = 0; j < objects.n_objs; j++)
+         obs_store.sorted[j] = j;
+      shellsort_r( obs_store.sorted, objects.n_objs, sizeof( int32_t),
+                        compare_reduced_desigs, obs_store.entries);
+      obs_store.filename = (char *)malloc( strlen( filename) + 1);
+      strcpy( obs_store.filename, filename);
+      if( !station && using_obs_index_files( ))
+         write_obs_index( );
+      rval = objects.objs;
+      objects.objs = nullptr;
+      *n_found = objects.n_objs;
+      }
+   free_object_list( &objects);
+   for( i = 0; i < chunks.size( ); i++)
+      {
+      free_object_list( &chunks[i].objects);
+      free( chunks[i].line_offsets);
+      free( chunks[i].jds);
+      free( chunks[i].obj_idx);
+      }
+   unmap_file( &map);
+   return( rval);
+}
+
 /* find_objects_in_file( ) reads through the file of MPC astrometric data
    specified by 'filename',  and figures out which objects appear in that
    file.  Those objects can then be listed on the console (findorb) or
@@ -4215,12 +5563,14 @@ OBJECT_INFO *find_objects_in_file( const char *filename,
    const clock_t t0 = clock( );
    int next_output = 2000, n_obs_read = 0;
    long filesize;
+   bool already_scanned = false;
 
    if( obj_name_stack)
       {
       destroy_stack( obj_name_stack);
       obj_name_stack = nullptr;
       }
+   free_obs_store( );
 
    if( !ifile)
       {
@@ -4239,12 +5589,26 @@ OBJECT_INFO *find_objects_in_file( const char *filename,
    *new_xdesig = *new_name = '\0';
    strcpy( mpc_code_from_neocp, "500");   /* default is geocenter */
    neocp_file_type = NEOCP_FILE_TYPE_UNKNOWN;
-   rval = (OBJECT_INFO *)calloc( n_alloced + 1, sizeof( OBJECT_INFO));
+   if( !station && !combine_all_observations && using_obs_index_files( )
+            && !fixing_trailing_and_leading_spaces)
+      rval = load_obs_index( filename, &n);
+   else
+      rval = nullptr;
+   if( !rval)
+      rval = scan_file_in_parallel( filename, station, &n);
+   if( rval)
+      {
+      already_scanned = true;
+      n_alloced = n;
+      }
+   else
+      rval = (OBJECT_INFO *)calloc( n_alloced + 1, sizeof( OBJECT_INFO));
    obj_name_stack = create_stack( 2000);
    if( debug_level > 8)
       debug_printf( "About to read input\n");
    ades_context = init_ades2mpc( );
-   while( fgets_with_ades_xlation( buff, sizeof( buff), ades_context, ifile))
+   while( !already_scanned
+            && fgets_with_ades_xlation( buff, sizeof( buff), ades_context, ifile))
       {
       size_t iline_len = strlen( buff);
       bool is_neocp = false;
@@ -5639,7 +7003,7 @@ int sanity_test_observations( const char *filename)
       {
       line_no++;
       if( observation_jd( buff) && !is_second_line( buff))
-         if( !parse_observation( &obs, buff))
+         if( !parse_observation( &obs, buff, false))
             {
             DPT alt_az_sun, alt_az_obj;
 
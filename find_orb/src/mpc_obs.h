@@ -18,6 +18,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #define MPC_OBS_H_INCLUDE
 
 #include <cstdio>
+#include <cstdint>
 
 struct Observe;
 
@@ -222,6 +223,8 @@ Observe  *load_observations( FILE *ifile, const char *packed_desig,
 int unload_observations(Observe   *obs, const int n_obs);
 OBJECT_INFO *find_objects_in_file( const char *filename,
                                          int *n_found, const char *station);
+int find_observation_lines( const char *filename, const char *packed_desig,
+                   const int64_t **line_offsets, const double **jds);
 void sort_object_info(OBJECT_INFO *ids, const int n_ids, int compare_by_last_obs_time);
 int get_object_name( char *obuff, const char *packed_desig);
 int get_observer_data( const char   *mpc_code, char *buff, mpc_code_t *cinfo);
@@ -257,6 +260,8 @@ double get_step_size(const char *stepsize, char *step_units,
 //         const int n_steps, const char *mpc_code,
 //         ephem_option_t options, const unsigned n_objects);
 int integrate_orbit(double *orbit, const double t0, const double t1);
+int integrate_ensemble( double *orbits, const unsigned n_orbits,
+                  const double t0, const double t1);       /* orb_func.cpp */
 int generate_obs_text(const Observe *obs, const int n_obs, char *buff,
                                           const size_t buffsize);
 void set_solutions_found( OBJECT_INFO *ids, const int n_ids);
@@ -296,6 +301,7 @@ char* mpc_station_name(char* station_data);
 int sort_obs_by_date_and_remove_duplicates(Observe* obs, const int n_obs);
 int write_environment_pointers(void);           
 void set_up_observation(Observe* obs);  
+void set_up_observations( Observe *obs, const int n_obs);
 int set_tholen_style_sigmas(Observe* obs, const char* buff);
 int load_environment_file(const char* filename);  
 void set_obs_vect(Observe* obs);        /* mpc_obs.h */
@@ -518,7 +524,7 @@ inverse square force.  */
 
 #define FORCE_MODEL_YARKO_A2           0x111
 
-extern int force_model;
+extern thread_local int force_model;
 
 bool is_inverse_square_force_model( void);
 
@@ -44,8 +44,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #define SOLAR_GM (GAUSS_K * GAUSS_K)
 
 
-extern int n_orbit_params, force_model;
-extern int available_sigmas;
+extern thread_local int n_orbit_params, force_model;
+extern thread_local int available_sigmas;
 
 struct Simplex_context
 {
@@ -223,7 +223,7 @@ static STORED_ORBIT
    unsigned perturbers;
    } *stored = nullptr;
 
-extern unsigned perturbers;
+extern thread_local unsigned perturbers;
 
 void push_orbit( const double epoch, const double *orbit)
 {
@@ -775,7 +775,7 @@ double generate_mc_variant_from_covariance( double *var_orbit,
                                                      const double *orbit)
 {
    int i, j;
-   extern double **eigenvects;
+   extern thread_local double **eigenvects;
    double rval = 0.;
 
    assert( eigenvects);
@@ -44,6 +44,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include "shellsor.h"
 #include "smvsop.h"
 #include "sr.h"
+#include "fit_ctx.h"
 
 
 #include <cmath>
@@ -52,6 +53,11 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <cassert>
 #include <cstdio>
 #include <ctime>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <utility>
+#include <vector>
 //
 
 /* MS only got around to adding 'isfinite' in VS2013 : */
@@ -67,20 +73,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 int snprintf( char *string, const size_t max_len, const char *format, ...);
 #endif
 
-unsigned perturbers = 0;
-int integration_method = 0;
+thread_local unsigned perturbers = 0;
+int integration_method = 0;     /* 0=RKF, 1=PD89, 2=RKF in doubles, 3=Radau */
 extern int debug_level;
 
 
 #define AUTOMATIC_PERTURBERS  1
 #define MAX_CONSTRAINTS 5
 
-int n_orbit_params = 6; // used in extern in ephem0.cpp
+thread_local int n_orbit_params = 6; // used in extern in ephem0.cpp
 int setting_outside_of_arc = 1;
-double uncertainty_parameter = 99.;
-int available_sigmas = NO_SIGMAS_AVAILABLE;
-int available_sigmas_hash = 0;
-static bool fail_on_hitting_planet = false;
+thread_local double uncertainty_parameter = 99.;
+thread_local int available_sigmas = NO_SIGMAS_AVAILABLE;
+thread_local int available_sigmas_hash = 0;
+static thread_local bool fail_on_hitting_planet = false;
 
 static int evaluate_limited_orbit(const double* orbit,
     const int planet_orbiting, const double epoch,
@@ -248,9 +254,6 @@ int find_parabolic_orbit(Observe *obs, const int n_obs,
    return( rval);
 }
 
-long double take_pd89_step( const long double jd, Elements *ref_orbit,
-                 const long double *ival, long double *ovals,
-                 const int n_vals, const long double step);    /* runge.cpp */
 static int is_unreasonable_orbit( const double *orbit);     /* orb_func.cpp */
 static int is_unreasonable_orbitl( const long double *orbit);
 
@@ -258,15 +261,15 @@ double integration_tolerance = 1.e-12;
 double minimum_jd = 77432.5;      /* 1 Jan -4500 */
 double maximum_jd = 4277757.5;    /* 1 Jan +7000 */
 
-char *runtime_message;
-int show_runtime_messages = 1;
+thread_local char *runtime_message;
+thread_local int show_runtime_messages = 1;
 
-static unsigned perturbers_automatically_found;
+static thread_local unsigned perturbers_automatically_found;
 extern unsigned always_included_perturbers;
 
 static int reset_auto_perturbers( const double jd, const double *orbit)
 {
-   extern int forced_central_body;     /* and include asteroid perts   */
+   extern thread_local int forced_central_body;  /* and include asteroid perts */
    unsigned mask;
    const int perturbing_planet = check_for_perturbers(
                                 (jd - J2000) / 36525., orbit);
@@ -288,7 +291,7 @@ static int reset_auto_perturbers( const double jd, const double *orbit)
    return( perturbing_planet);
 }
 
-clock_t integration_timeout = (clock_t)0;
+thread_local clock_t integration_timeout = (clock_t)0;
 
 #define STEP_INCREMENT 2
 #define INTEGRATION_TIMED_OUT       -3
@@ -309,23 +312,350 @@ static void ldouble_to_double( double *ovals, const long double *ivals,
       *ovals++ = (double)*ivals++;
 }
 
-int integrate_orbitl( long double *orbit, const long double t0, const long double t1)
+/* If a Dense_output is passed to integrate_orbit_vals(),  then as the
+integration passes each of the 'times' (which must be in the order the
+integration will reach them,  and run no further than t1),  the state
+at that time is interpolated (see interpolate_step() in 'runge.cpp') and
+stored in 'states',  n_stored values apiece.  This lets set_locs_extended()
+run one integration across the arc,  instead of stopping (and restarting
+with a two-day step) at every observation.  */
+
+typedef struct
+{
+   int n_times, n_done, n_stored;
+   const double *times;
+   long double *states;
+} Dense_output;
+
+static bool dense_time_reached( const Dense_output *dense, const long double t,
+                                    const bool going_backward)
+{
+   if( !dense || dense->n_done == dense->n_times)
+      return( false);
+   return( going_backward ? dense->times[dense->n_done] >= t
+                          : dense->times[dense->n_done] <= t);
+}
+
+/* Adds 'delta' to the value *hi + *lo,  with the rounding error of the
+sum going into *lo.  This is the 'TwoSum' of Knuth and Moller,  exact
+whichever of *hi or delta is the larger (so long as the compiler doesn't
+rearrange it;  -ffast-math would break this).    */
+
+static inline void compensated_add( double *hi, double *lo, const double delta)
+{
+   const double y = delta + *lo;
+   const double sum = *hi + y;
+   const double b = sum - *hi;
+
+   *lo = (*hi - (sum - b)) + (y - b);
+   *hi = sum;
+}
+
+/* With integration_method == 2,  integrate_orbit_vals() comes here,
+unless it's carrying the state transition matrix.  The steps are the
+same Runge-Kutta-Fehlberg ones,  but computed in doubles,  which on
+x86-64 are several times faster than the x87 long doubles used otherwise.
+To keep the precision,  the state is carried as a pair of doubles,  the
+value and the rounding error so far,  and each step's change in the state
+is added in with compensated summation (see take_rk_step_compensated() in
+'runge.cpp').  Time is handled the same way:  step boundaries fall on
+multiples of the stepsize,  which are exact in doubles,  but t0 and t1
+(observation times,  for example) may need more bits than that.
+
+   The progress display is left out;  but the integration can still be
+interrupted with a keystroke.   */
+
+static int integrate_orbit_compensated( long double *orbit,
+               const long double t0, const long double t1, const int n_vals,
+               double stepsize, const bool fixed_step, const bool use_encke,
+               Dense_output *dense)
+{
+   const double step_increase = .9 * integration_tolerance
+                                        / pow( STEP_INCREMENT, 5.);
+   const bool going_backward = (t1 < t0);
+   const double t_end = (double)t1;
+   const double t_end_lo = (double)( t1 - (long double)t_end);
+   const unsigned saved_perturbers = perturbers;
+   static thread_local double min_stepsize;
+   double t = (double)t0, t_lo = (double)( t0 - (long double)t);
+   double state[MAX_N_PARAMS], state_lo[MAX_N_PARAMS];
+   bool reset_of_elements_needed = true;
+   int i, rval = 0, n_steps = 0;
+   Elements ref_orbit;
+
+   if( !min_stepsize)
+      {
+      min_stepsize = atof( get_environment_ptr( "MIN_STEPSIZE")) / seconds_per_day;
+      if( !min_stepsize)
+         min_stepsize = 1e-5;   /* 1e-5 day = 0.864 seconds */
+      }
+   ref_orbit.central_obj = -1;
+   for( i = 0; i < n_orbit_params; i++)
+      {
+      state[i] = (double)orbit[i];
+      state_lo[i] = (double)( orbit[i] - (long double)state[i]);
+      }
+   while( (t != t_end || t_lo != t_end_lo) && !rval)
+      {
+      double new_t = ceil( (t - .5) / stepsize + .5) * stepsize + .5;
+      double new_t_lo = 0., delta_t, err, delta[MAX_N_PARAMS];
+
+      reset_auto_perturbers( t, state);
+      if( reset_of_elements_needed || !(n_steps % 50))
+         if( use_encke)
+            {
+            extern thread_local int best_fit_planet;
+
+            find_relative_orbit( t, state, &ref_orbit, best_fit_planet);
+            reset_of_elements_needed = false;
+            }
+      if( (!going_backward && new_t > t_end) || (going_backward && new_t < t_end))
+         {
+         new_t = t_end;
+         new_t_lo = t_end_lo;
+         }
+      delta_t = (new_t - t) + (new_t_lo - t_lo);
+      err = take_rk_step_compensated( t + t_lo, &ref_orbit, state, state_lo,
+                                    delta, n_vals, delta_t);
+      n_steps++;
+      if( err < integration_tolerance || fixed_step
+                        || fabs( stepsize) < min_stepsize)  /* it's good! */
+         {
+         if( dense_time_reached( dense, (long double)new_t + new_t_lo,
+                                             going_backward))
+            {
+            const long double lt = (long double)t + (long double)t_lo;
+            const long double step = (long double)delta_t;
+            long double y0[MAX_N_PARAMS], y1[MAX_N_PARAMS];
+            long double f0[MAX_N_PARAMS], f1[MAX_N_PARAMS];
+
+            for( i = 0; i < n_orbit_params; i++)
+               {
+               y0[i] = (long double)state[i] + (long double)state_lo[i];
+               y1[i] = y0[i] + (i < n_vals ? (long double)delta[i] : 0.);
+               }
+            calc_state_derivatives( lt, y0, f0, &ref_orbit, n_vals);
+            calc_state_derivatives( lt + step, y1, f1, &ref_orbit, n_vals);
+            while( dense_time_reached( dense, (long double)new_t + new_t_lo,
+                                             going_backward))
+               {
+               interpolate_step( &ref_orbit, lt, y0, f0, y1, f1,
+                        dense->states + dense->n_done * dense->n_stored,
+                        n_vals, step,
+                        ((long double)dense->times[dense->n_done] - lt) / step);
+               dense->n_done++;
+               }
+            }
+         for( i = 0; i < n_vals; i++)
+            compensated_add( state + i, state_lo + i, delta[i]);
+         if( err < step_increase && !fixed_step)
+            if( fabs( delta_t - stepsize) < fabs( stepsize * .01))
+               stepsize *= STEP_INCREMENT;
+         t = new_t;
+         t_lo = new_t_lo;
+         if( fail_on_hitting_planet)
+            {
+            extern thread_local int planet_hit;
+
+            if( planet_hit != -1)
+               rval = HIT_A_PLANET;
+            }
+         }
+      else           /* failed:  try again with a smaller step */
+         {
+         stepsize /= STEP_INCREMENT;
+         reset_of_elements_needed = true;
+         }
+      if( !rval)
+         rval = is_unreasonable_orbit( state);
+      if( rval > 0)
+         debug_printf( "Unreasonable %d at %.5f (%.5f to %.5f)\n",
+                  rval, t, (double)t0, (double)t1);
+      if( integration_timeout && !(n_steps % 100))
+         if( clock( ) > integration_timeout)
+            rval = INTEGRATION_TIMED_OUT;
+      if( !(n_steps % 500) && show_runtime_messages)
+         if( curses_kbhit_without_mouse( ) > 0)
+            rval = USER_INTERRUPTED;
+      }
+   for( i = 0; i < n_vals; i++)
+      orbit[i] = (long double)state[i] + (long double)state_lo[i];
+   perturbers = saved_perturbers;
+   return( rval);
+}
+
+/* With integration_method == 3,  integrate_orbit_vals() comes here,
+unless it's carrying the state transition matrix.  This uses the Gauss-
+Radau steps of take_radau_step() in 'runge.cpp',  with IAS15's automatic
+step control:  the step is scaled by (epsilon / error) ^ (1/7),  where
+'error' comes from the timescale on which the acceleration changes (see
+the comments there).  As with RKF,  ENCKE=1 gets us Encke's method,  with
+the reference orbit reset every fifty steps.  The default epsilon of 1e-12
+(and a corrector tolerance ten times that) gives errors no larger than
+RKF's at its default tolerance,  with about as many force evaluations away
+from planets and far fewer through close approaches (see 'integ_test.cpp');
+state and time are again carried as pairs of doubles,  to keep rounding
+out of it (see integrate_orbit_compensated( ) above).  The steps aren't
+kept on a grid;  the last one is just cut short to land on t1.  Steps
+change quickly and smoothly through close approaches,  where the RKF
+integrators waste a lot of force evaluations on rejected steps.    */
+
+static int integrate_orbit_radau( long double *orbit,
+               const long double t0, const long double t1, const int n_vals,
+               double stepsize, const bool fixed_step, const bool use_encke,
+               Dense_output *dense)
+{
+   const bool going_backward = (t1 < t0);
+   const double t_end = (double)t1;
+   const double t_end_lo = (double)( t1 - (long double)t_end);
+   const double safety_factor = .25;
+   const unsigned saved_perturbers = perturbers;
+   static thread_local double min_stepsize;
+   double epsilon = atof( get_environment_ptr( "RADAU_EPSILON"));
+   double t = (double)t0, t_lo = (double)( t0 - (long double)t);
+   double state[MAX_N_PARAMS], state_lo[MAX_N_PARAMS];
+   bool reset_of_elements_needed = true;
+   int i, rval = 0, n_steps = 0;
+   Radau_state rs;
+   Elements ref_orbit;
+
+   if( !min_stepsize)
+      {
+      min_stepsize = atof( get_environment_ptr( "MIN_STEPSIZE")) / seconds_per_day;
+      if( !min_stepsize)
+         min_stepsize = 1e-5;   /* 1e-5 day = 0.864 seconds */
+      }
+   if( !epsilon)
+      epsilon = 1e-12;
+   memset( &rs, 0, sizeof( Radau_state));
+   rs.pc_tolerance = 10. * epsilon;
+   ref_orbit.central_obj = -1;
+   for( i = 0; i < n_orbit_params; i++)
+      {
+      state[i] = (double)orbit[i];
+      state_lo[i] = (double)( orbit[i] - (long double)state[i]);
+      }
+   while( (t != t_end || t_lo != t_end_lo) && !rval)
+      {
+      double new_t = t + stepsize, new_t_lo = t_lo, delta_t, err;
+      double delta[6], new_stepsize;
+
+      reset_auto_perturbers( t, state);
+      if( reset_of_elements_needed || !(n_steps % 50))
+         if( use_encke)
+            {
+            extern thread_local int best_fit_planet;
+
+            find_relative_orbit( t, state, &ref_orbit, best_fit_planet);
+            reset_of_elements_needed = false;
+            rs.step = 0.;     /* old b[] were relative to the old orbit */
+            }
+      if( (!going_backward && new_t >= t_end) || (going_backward && new_t <= t_end))
+         {
+         new_t = t_end;
+         new_t_lo = t_end_lo;
+         }
+      delta_t = (new_t - t) + (new_t_lo - t_lo);
+      err = take_radau_step( t + t_lo, &ref_orbit, &rs, state, state_lo,
+                                    delta, delta_t);
+      n_steps++;
+      if( fixed_step)
+         new_stepsize = stepsize;
+      else if( err > 0.)
+         new_stepsize = delta_t * pow( epsilon / err, 1. / 7.);
+      else if( err == 0.)
+         new_stepsize = delta_t / safety_factor;
+      else           /* NaN:  something went badly wrong */
+         new_stepsize = delta_t * safety_factor;
+      if( fixed_step || fabs( new_stepsize) >= safety_factor * fabs( delta_t)
+                     || fabs( delta_t) < min_stepsize)     /* it's good! */
+         {
+         accept_radau_step( &rs, delta_t);
+         while( dense_time_reached( dense, (long double)new_t + new_t_lo,
+                                             going_backward))
+            {
+            const long double lt = (long double)t + (long double)t_lo;
+            long double *optr = dense->states + dense->n_done * dense->n_stored;
+            double ddelta[6];
+
+            radau_dense_output( &rs, &ref_orbit, t + t_lo, state, (double)(
+                       ((long double)dense->times[dense->n_done] - lt)
+                                    / (long double)delta_t), ddelta);
+            for( i = 0; i < dense->n_stored; i++)
+               optr[i] = (long double)state[i] + (long double)state_lo[i]
+                           + (i < 6 ? (long double)ddelta[i] : 0.);
+            dense->n_done++;
+            }
+         for( i = 0; i < 6; i++)
+            compensated_add( state + i, state_lo + i, delta[i]);
+         t = new_t;
+         t_lo = new_t_lo;
+         if( !fixed_step)
+            {
+            if( fabs( new_stepsize) > fabs( delta_t) / safety_factor)
+               new_stepsize = delta_t / safety_factor;
+            stepsize = new_stepsize;
+            }
+         if( fail_on_hitting_planet)
+            {
+            extern thread_local int planet_hit;
+
+            if( planet_hit != -1)
+               rval = HIT_A_PLANET;
+            }
+         }
+      else           /* failed:  try again with a smaller step */
+         {
+         stepsize = new_stepsize;
+         reset_of_elements_needed = true;
+         }
+      if( fabs( stepsize) < min_stepsize)
+         stepsize = (going_backward ? -min_stepsize : min_stepsize);
+      if( !rval)
+         rval = is_unreasonable_orbit( state);
+      if( rval > 0)
+         debug_printf( "Unreasonable %d at %.5f (%.5f to %.5f)\n",
+                  rval, t, (double)t0, (double)t1);
+      if( integration_timeout && !(n_steps % 100))
+         if( clock( ) > integration_timeout)
+            rval = INTEGRATION_TIMED_OUT;
+      if( !(n_steps % 500) && show_runtime_messages)
+         if( curses_kbhit_without_mouse( ) > 0)
+            rval = USER_INTERRUPTED;
+      }
+   for( i = 0; i < n_vals; i++)
+      orbit[i] = (long double)state[i] + (long double)state_lo[i];
+   perturbers = saved_perturbers;
+   return( rval);
+}
+
+/* Integrates the first 'n_vals' elements of 'orbit'.  Normally,  that's
+just the position and velocity,  with any non-gravitational parameters
+left as-is.  With n_vals = 7 * n_orbit_params,  the state transition
+matrix is carried along too;  see 'runge.cpp'.    */
+
+static int integrate_orbit_vals( long double *orbit, const long double t0,
+                  const long double t1, const int n_vals, Dense_output *dense)
 {
    long double stepsize = 2.;
-   static long double fixed_stepsize = -1.;
+   static thread_local long double fixed_stepsize = -1.;
    const long double chicken = .9;
    int reset_of_elements_needed = 1;
    const long double step_increase = chicken * integration_tolerance
-                 / powl( STEP_INCREMENT, (integration_method ? 9. : 5.));
-   static int use_encke = -1;
+                 / powl( STEP_INCREMENT, (integration_method == 1 ? 9. : 5.));
+   static thread_local int use_encke = -1;
    long double t = t0;
-   static time_t real_time = (time_t)0;
+   static thread_local time_t real_time = (time_t)0;
    long double prev_t = t, last_err = 0.;
    int n_rejects = 0, rval;
    unsigned saved_perturbers = perturbers;
    int n_steps = 0, prev_n_steps = 0;
    int going_backward = (t1 < t0);
-   static int n_changes;
+   static thread_local int n_changes;
+         /* Scratch space for the step functions.  It's only used within */
+         /* a step,  so the recursive call for delta-V can share it.     */
+   static thread_local long double
+               step_workspace[PD89_STEP_WORKSPACE( MAX_N_INTEGRATED_VALS)];
    Elements ref_orbit;
 
    assert( fabsl( t0) < 1e+9);
@@ -335,7 +665,7 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
          {                 /* integrate to time of maneuver & add delta-v */
          size_t i;
 
-         integrate_orbitl( orbit, t0, orbit[9]);
+         integrate_orbit_vals( orbit, t0, orbit[9], n_vals, dense);
          for( i = 0; i < 3; i++)
             if( t0 < t1)      /* integrating forward,  add delta-v; */
                orbit[i + 3] += orbit[i + 6] * seconds_per_day / AU_IN_METERS;
@@ -370,6 +700,18 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
       stepsize = fixed_stepsize;
    if( going_backward)
       stepsize = -stepsize;
+   while( dense_time_reached( dense, t, going_backward))
+      {                    /* output times at the start of integration */
+      memcpy( dense->states + dense->n_done * dense->n_stored, orbit,
+                     dense->n_stored * sizeof( long double));
+      dense->n_done++;
+      }
+   if( integration_method == 2 && n_vals <= n_orbit_params)
+      return( integrate_orbit_compensated( orbit, t, t1, n_vals,
+                     (double)stepsize, fixed_stepsize > 0., use_encke != 0, dense));
+   if( integration_method == 3 && n_vals <= n_orbit_params)
+      return( integrate_orbit_radau( orbit, t, t1, n_vals,
+                     (double)stepsize, fixed_stepsize > 0., use_encke != 0, dense));
    while( t != t1 && !rval)
       {
       long double delta_t, new_t = ceill( (t - .5) / stepsize + .5) * stepsize + .5;
@@ -381,7 +723,7 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
       if( reset_of_elements_needed || !(n_steps % 50))
          if( use_encke)
             {
-            extern int best_fit_planet;
+            extern thread_local int best_fit_planet;
 
             find_relative_orbit( t, dorbit, &ref_orbit, best_fit_planet);
             reset_of_elements_needed = 0;
@@ -390,12 +732,10 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
       if( !(n_steps % 500) && show_runtime_messages && time( nullptr) != real_time)
          {
          char buff[80];
-         extern int best_fit_planet, n_posns_cached;
-         extern int64_t planet_ns;
-         extern double best_fit_planet_dist;
-#ifdef TEST_PLANET_CACHING_HASH_FUNCTION
-         extern long total_n_searches, total_n_probes, max_probes_required;
-#endif
+         extern thread_local int best_fit_planet, n_posns_cached;
+         extern thread_local int64_t planet_ns;
+         extern thread_local double best_fit_planet_dist;
+         Planet_cache_stats cache_stats;
 
          if( runtime_message)
             move_add_nstr( 9, 10, runtime_message, -1);
@@ -451,16 +791,15 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
          snprintf_err( buff, sizeof( buff), "Vel: %11.6f %11.6f %11.6f",
                      dorbit[3], dorbit[4], dorbit[5]);
          move_add_nstr( 15, 10, buff, -1);
-#ifdef TEST_PLANET_CACHING_HASH_FUNCTION
-         if( total_n_searches)
+         get_planet_cache_stats( &cache_stats);
+         if( cache_stats.hits + cache_stats.misses)
             {
-            snprintf_err( buff, sizeof( buff), "%ld searches; avg %.2f max %ld     ",
-                            total_n_searches,
-                            (double)total_n_probes / (double)total_n_searches,
-                            max_probes_required);
+            snprintf_err( buff, sizeof( buff), "Cache: %.2f%% hits; %.0f evictions; %.0f slots    ",
+                  100. * (double)cache_stats.hits
+                        / (double)( cache_stats.hits + cache_stats.misses),
+                  (double)cache_stats.evictions, (double)cache_stats.n_slots);
             move_add_nstr( 16, 10, buff, -1);
             }
-#endif
          refresh_console( );
          if( curses_kbhit_without_mouse( ) > 0)
             return( USER_INTERRUPTED);
@@ -482,11 +821,13 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
          case 0:
          default:
             {
-            long double new_vals[MAX_N_PARAMS];
-            static long double min_stepsize;
-            const double err = (integration_method ?
-                   take_pd89_step( t, &ref_orbit, orbit, new_vals, 6, delta_t) :
-                   take_rk_stepl( t, &ref_orbit, orbit, new_vals, 6, delta_t));
+            long double new_vals[MAX_N_INTEGRATED_VALS];
+            static thread_local long double min_stepsize;
+            const double err = (integration_method == 1 ?
+                   take_pd89_step( t, &ref_orbit, orbit, new_vals, n_vals, delta_t,
+                                   step_workspace) :
+                   take_rk_stepl( t, &ref_orbit, orbit, new_vals, n_vals, delta_t,
+                                   step_workspace));
 
             if( !min_stepsize)
                {
@@ -500,7 +841,24 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
             if( err < integration_tolerance || fixed_stepsize > 0.
                         || fabs( stepsize) < min_stepsize)  /* it's good! */
                {
-               memcpy( orbit, new_vals, n_orbit_params * sizeof( long double));
+               if( dense_time_reached( dense, new_t, going_backward))
+                  {
+                  long double f0[MAX_N_INTEGRATED_VALS];
+                  long double f1[MAX_N_INTEGRATED_VALS];
+
+                  calc_state_derivatives( t, orbit, f0, &ref_orbit, n_vals);
+                  calc_state_derivatives( new_t, new_vals, f1, &ref_orbit, n_vals);
+                  while( dense_time_reached( dense, new_t, going_backward))
+                     {
+                     interpolate_step( &ref_orbit, t, orbit, f0, new_vals, f1,
+                              dense->states + dense->n_done * dense->n_stored,
+                              n_vals, delta_t,
+                              ((long double)dense->times[dense->n_done] - t) / delta_t);
+                     dense->n_done++;
+                     }
+                  }
+               memcpy( orbit, new_vals, (n_vals > n_orbit_params ? n_vals : n_orbit_params)
+                                             * sizeof( long double));
                if( err < step_increase && !fixed_stepsize)
                   if( fabsl( delta_t - stepsize) < fabsl( stepsize * .01))
                      {
@@ -537,7 +895,7 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
             rval = INTEGRATION_TIMED_OUT;
       if( step_taken && fail_on_hitting_planet)
          {
-         extern int planet_hit;
+         extern thread_local int planet_hit;
 
          if( planet_hit != -1)
             rval = HIT_A_PLANET;
@@ -545,7 +903,7 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
 #ifdef PROBABLY_UNNEEDED
       if( debug_level && n_steps % 10000 == 0)
          {
-         extern int best_fit_planet;
+         extern thread_local int best_fit_planet;
          ELEMENTS elems;
 
          find_relative_orbit( t, orbit, &elems, best_fit_planet);
@@ -562,6 +920,11 @@ int integrate_orbitl( long double *orbit, const long double t0, const long doubl
    return( rval);
 }
 
+int integrate_orbitl( long double *orbit, const long double t0, const long double t1)
+{
+   return( integrate_orbit_vals( orbit, t0, t1, 6, nullptr));
+}
+
 int integrate_orbit( double *orbit, const double t0, const double t1)
 {
    long double tarray[MAX_N_PARAMS];
@@ -573,6 +936,153 @@ int integrate_orbit( double *orbit, const double t0, const double t1)
    return( rval);
 }
 
+/* Integrates 'n_orbits' orbits (stored one after another,  n_orbit_params
+doubles apiece,  as for ephemerides of Monte Carlo or SR clouds) from t0
+to t1,  all together:  every orbit takes the same steps,  so the planet
+positions for each step are computed once for the whole ensemble,  and the
+force evaluation runs over a structure-of-arrays copy of the orbits (see
+calc_ensemble_derivatives() in 'runge.cpp').  The stepsize is controlled
+as in integrate_orbit_vals(),  with the worst error among the orbits
+deciding whether a step is accepted.  That means one orbit making a close
+approach slows them all down;  but it's still about twice as fast as
+integrating them one by one (see 'integ_test.cpp').
+
+   Integration is in doubles.  If ENCKE is set,  each orbit gets its own
+heliocentric reference orbit,  reset every fifty steps or after a step is
+rejected.  With non-gravs
+(n_orbit_params > 6) or ENSEMBLE_INTEGRATION=0,  or for a single orbit,
+we just call integrate_orbit() for each orbit in turn.  Returns zero if
+all went well,  or the last non-zero value from integrating one orbit.
+If any orbit hits a planet (and that's being treated as an error),  we
+stop and return HIT_A_PLANET,  as integrate_orbit() would.  */
+
+int integrate_ensemble( double *orbits, const unsigned n_orbits,
+                  const double t0, const double t1)
+{
+   static thread_local int use_ensemble = -1, use_encke = -1;
+   static thread_local double min_stepsize;
+   const double step_increase = .9 * integration_tolerance
+                                        / pow( STEP_INCREMENT, 5.);
+   const unsigned saved_perturbers = perturbers;
+   const bool going_backward = (t1 < t0);
+   double t = t0, stepsize = (going_backward ? -2. : 2.);
+   double *vals, *new_vals, *work;
+   Elements *ref_orbits;
+   bool reset_of_elements_needed = true;
+   unsigned i, j;
+   int rval = 0, n_steps = 0;
+
+   if( use_ensemble == -1)
+      use_ensemble = (*get_environment_ptr( "ENSEMBLE_INTEGRATION") != '0');
+   if( use_encke == -1)
+      use_encke = atoi( get_environment_ptr( "ENCKE"));
+   if( !min_stepsize)
+      {
+      min_stepsize = atof( get_environment_ptr( "MIN_STEPSIZE")) / seconds_per_day;
+      if( !min_stepsize)
+         min_stepsize = 1e-5;   /* 1e-5 day = 0.864 seconds */
+      }
+   for( i = 0; i < n_orbits && !rval; i++)
+      rval = is_unreasonable_orbit( orbits + i * n_orbit_params);
+   if( n_orbits < 2 || !use_ensemble || n_orbit_params != 6 || rval
+               || t0 > maximum_jd || t1 > maximum_jd
+               || t0 < minimum_jd || t1 < minimum_jd)
+      {
+      rval = 0;
+      for( i = 0; i < n_orbits; i++)
+         {
+         const int err = integrate_orbit( orbits + i * n_orbit_params, t0, t1);
+
+         if( err)
+            rval = err;
+         }
+      return( rval);
+      }
+   vals = (double *)malloc( (12 + 58) * n_orbits * sizeof( double));
+   ref_orbits = (Elements *)malloc( n_orbits * sizeof( Elements));
+   assert( vals);
+   assert( ref_orbits);
+   new_vals = vals + 6 * n_orbits;
+   work = new_vals + 6 * n_orbits;
+   for( i = 0; i < n_orbits; i++)
+      {
+      for( j = 0; j < 6; j++)
+         vals[j * n_orbits + i] = orbits[i * 6 + j];
+      ref_orbits[i].central_obj = -1;
+      }
+   while( t != t1 && !rval)
+      {
+      double new_t = ceil( (t - .5) / stepsize + .5) * stepsize + .5, err;
+
+      if( saved_perturbers & AUTOMATIC_PERTURBERS)
+         {
+         unsigned mask = 0;
+
+         for( i = 0; i < n_orbits; i++)
+            {
+            double orbit[6];
+
+            for( j = 0; j < 6; j++)
+               orbit[j] = vals[j * n_orbits + i];
+            perturbers = saved_perturbers;
+            reset_auto_perturbers( t, orbit);
+            mask |= perturbers;
+            }
+         perturbers = mask;
+         }
+      else
+         perturbers = saved_perturbers | always_included_perturbers;
+      if( reset_of_elements_needed || !(n_steps % 50))
+         if( use_encke)
+            {
+            for( i = 0; i < n_orbits; i++)
+               {
+               double orbit[6];
+
+               for( j = 0; j < 6; j++)
+                  orbit[j] = vals[j * n_orbits + i];
+               find_relative_orbit( t, orbit, ref_orbits + i, 0);
+               }
+            reset_of_elements_needed = false;
+            }
+      if( (!going_backward && new_t > t1) || (going_backward && new_t < t1))
+         new_t = t1;
+      err = take_ensemble_rk_step( t, ref_orbits, vals, new_vals, n_orbits,
+                                       n_orbits, new_t - t, work);
+      n_steps++;
+      if( err < integration_tolerance || fabs( stepsize) < min_stepsize)
+         {
+         std::swap( vals, new_vals);
+         if( err < step_increase)
+            if( fabs( new_t - t - stepsize) < fabs( stepsize * .01))
+               stepsize *= STEP_INCREMENT;
+         t = new_t;
+         if( fail_on_hitting_planet)
+            {
+            extern thread_local int planet_hit;
+
+            if( planet_hit != -1)
+               rval = HIT_A_PLANET;
+            }
+         }
+      else
+         {
+         stepsize /= STEP_INCREMENT;
+         reset_of_elements_needed = true;
+         }
+      if( integration_timeout && !(n_steps % 100))
+         if( clock( ) > integration_timeout)
+            rval = INTEGRATION_TIMED_OUT;
+      }
+   for( i = 0; i < n_orbits; i++)
+      for( j = 0; j < 6; j++)
+         orbits[i * 6 + j] = vals[j * n_orbits + i];
+   free( vals < new_vals ? vals : new_vals);
+   free( ref_orbits);
+   perturbers = saved_perturbers;
+   return( rval);
+}
+
 /* At times,  the orbits generated by 'full steps' or Herget or other methods
    are completely unreasonable.  The exact definition of 'unreasonable'
    is pretty darn fuzzy.  The following function says that if at the epoch,
@@ -750,15 +1260,251 @@ otherwise be the case.
    If we don't actually need a state vector for a second epoch,  then
 we can set orbit2 = nullptr.  Or use plain ol' set_locs(),  which -- as
 you can see below -- basically just calls set_locs_extended() with a
-nullptr orbit2.                          */
+nullptr orbit2.
+
+   If 'stm' is non-null,  the variational equations are integrated along
+with the orbit,  and the 6 x n_orbit_params state transition matrix at
+each observation time is stored in 'stm',  one after the other.  If
+'orbit2' is also non-null,  the matrix for 'epoch2' follows them.
+
+   Each pass is a single integration,  with the states at observation
+times (and epoch2) interpolated from the integrator's own steps;  see
+Dense_output above.  DENSE_OUTPUT=0 gets the old behavior of stopping
+at (and restarting from) each observation in turn.     */
+
+static void set_computed_ra_dec( Observe *obs);
+
+/* In interactive use,  set_locs() is often called over and over with the
+same orbit:  toggling observations or changing weights changes the
+residuals,  but not the trajectory.  So each thread keeps the states it
+has computed at observation times (and second epochs) for its last few
+orbits.  The key is the orbit,  its epoch,  and whatever else changes
+the integration (perturbers,  force model,  A= constraint,  central body,
+which JPL ephemeris is loaded,  whether hitting a planet is an error,
+etc.);  a 64-bit hash of it lets us skip the full comparison for
+non-matches.
+
+   If all the times we need are in the cache,  no integration is done at
+all.  If some aren't (observations added at either end of the arc,  say),
+we integrate from the last cached state before the first missing one.
+The integration also notes which perturbers it found it needed,  so
+those are cached too,  and put back into 'perturbers_automatically_found'
+when the cached states are used.  Only plain set_locs() calls are
+cached;  when the state transition matrix is being computed,  we're
+integrating with each of many different orbits anyway.  TRAJECTORY_CACHE=0
+turns this off.  */
+
+#define N_TRAJECTORY_CACHES 2
+
+typedef struct
+{
+   uint64_t hash;
+   double orbit[MAX_N_PARAMS], epoch, tolerance, object_mass;
+   long double solar_multiplier;
+   unsigned perturbers, excluded_perturbers;
+   int n_params, force_model, integration_method, dense_output;
+   int forced_central_body, ephem_generation, fail_on_hitting_planet;
+   unsigned found_perturbers;    /* perturbers_automatically_found bits */
+   int n_states, n_alloced;      /* n_alloced counts states of n_params */
+   unsigned last_used;
+   double *times;                /* sorted in increasing order */
+   long double *states;          /* n_params values per time */
+} Trajectory_cache;
+
+         /* Worker threads come and go,  so the caches are freed when */
+         /* the thread that owns them exits:                           */
+static thread_local struct Trajectory_caches
+{
+   Trajectory_cache cache[N_TRAJECTORY_CACHES];
+
+   ~Trajectory_caches( )
+      {
+      for( int i = 0; i < N_TRAJECTORY_CACHES; i++)
+         {
+         free( cache[i].times);
+         free( cache[i].states);
+         }
+      }
+} trajectory_caches;
+
+static uint64_t hash_bytes( uint64_t hash, const void *data, size_t n_bytes)
+{
+   const unsigned char *tptr = (const unsigned char *)data;
+
+   while( n_bytes--)          /* FNV-1a */
+      hash = (hash ^ *tptr++) * (uint64_t)0x100000001b3;
+   return( hash);
+}
+
+static bool same_trajectory_key( const Trajectory_cache *a, const Trajectory_cache *b)
+{
+   return( a->hash == b->hash && a->n_params == b->n_params
+         && !memcmp( a->orbit, b->orbit, a->n_params * sizeof( double))
+         && a->epoch == b->epoch && a->tolerance == b->tolerance
+         && a->object_mass == b->object_mass && a->perturbers == b->perturbers
+         && a->solar_multiplier == b->solar_multiplier
+         && a->excluded_perturbers == b->excluded_perturbers
+         && a->force_model == b->force_model
+         && a->integration_method == b->integration_method
+         && a->dense_output == b->dense_output
+         && a->forced_central_body == b->forced_central_body
+         && a->ephem_generation == b->ephem_generation
+         && a->fail_on_hitting_planet == b->fail_on_hitting_planet);
+}
+
+/* Returns the cache for this orbit,  or (if there isn't one) empties the
+least recently used cache and sets it up for this orbit.  */
+
+static Trajectory_cache *get_trajectory_cache( const double *orbit,
+                  const double epoch, const int dense_output)
+{
+   extern unsigned excluded_perturbers;
+   extern thread_local double object_mass;
+   extern thread_local int forced_central_body;
+   static thread_local unsigned n_uses;
+   Trajectory_cache key, *trajectory_cache = trajectory_caches.cache;
+   Trajectory_cache *rval = trajectory_cache;
+   int i;
+
+   memset( &key, 0, sizeof( key));
+   memcpy( key.orbit, orbit, n_orbit_params * sizeof( double));
+   key.epoch = epoch;
+   key.tolerance = integration_tolerance;
+   key.object_mass = object_mass;
+   key.solar_multiplier = get_solar_multiplier( );
+   key.perturbers = perturbers;
+   key.excluded_perturbers = excluded_perturbers;
+   key.n_params = n_orbit_params;
+   key.force_model = force_model;
+   key.integration_method = integration_method;
+   key.dense_output = dense_output;
+   key.forced_central_body = forced_central_body;
+   key.ephem_generation = get_jpl_ephemeris_generation( );
+   key.fail_on_hitting_planet = fail_on_hitting_planet;
+   key.hash = hash_bytes( (uint64_t)0xcbf29ce484222325, key.orbit,
+                                 n_orbit_params * sizeof( double));
+   key.hash = hash_bytes( key.hash, &key.epoch, 3 * sizeof( double));
+   key.hash = hash_bytes( key.hash, &key.perturbers, 2 * sizeof( unsigned));
+   key.hash = hash_bytes( key.hash, &key.n_params, 7 * sizeof( int));
+   n_uses++;
+   for( i = 0; i < N_TRAJECTORY_CACHES; i++)
+      if( same_trajectory_key( trajectory_cache + i, &key))
+         {
+         trajectory_cache[i].last_used = n_uses;
+         return( trajectory_cache + i);
+         }
+   for( i = 1; i < N_TRAJECTORY_CACHES; i++)
+      if( rval->last_used > trajectory_cache[i].last_used)
+         rval = trajectory_cache + i;
+   key.times = rval->times;
+   key.states = rval->states;
+   if( rval->n_params == key.n_params)    /* else,  reallocate on first use */
+      key.n_alloced = rval->n_alloced;
+   key.last_used = n_uses;
+   *rval = key;
+   return( rval);
+}
+
+/* Returns a pointer to the cached state at time 't',  or nullptr. */
+
+static const long double *find_cached_state( const Trajectory_cache *cache,
+                                 const double t)
+{
+   int lo = 0, hi = cache->n_states;
+
+   while( lo < hi)
+      {
+      const int mid = (lo + hi) / 2;
+
+      if( cache->times[mid] < t)
+         lo = mid + 1;
+      else
+         hi = mid;
+      }
+   return( lo < cache->n_states && cache->times[lo] == t ?
+                  cache->states + lo * cache->n_params : nullptr);
+}
+
+static void move_cached_state( Trajectory_cache *cache, const int from,
+                                 const int to)
+{
+   if( from != to)
+      {
+      cache->times[to] = cache->times[from];
+      memcpy( cache->states + to * cache->n_params,
+              cache->states + from * cache->n_params,
+              cache->n_params * sizeof( long double));
+      }
+}
+
+/* Adds the 'n' states integrated to 'times' (which run either forward or
+backward,  as set_locs_extended( ) reaches them),  each 'stride' long
+doubles apart,  to the cache.  They're merged in from the top end down,
+so each integration costs one pass over the cache rather than one
+insertion per state.  Times that are already cached are skipped.  */
+
+static void add_cached_states( Trajectory_cache *cache, const double *times,
+                  const long double *states, const int stride, const int n)
+{
+   const int n_params = cache->n_params, end = cache->n_states + n;
+   int i = cache->n_states - 1, j, dj, out = end;
+
+   if( !n)
+      return;
+   if( end > cache->n_alloced)
+      {
+      cache->n_alloced = end * 2 + 64;
+      cache->times = (double *)realloc( cache->times,
+                           cache->n_alloced * sizeof( double));
+      cache->states = (long double *)realloc( cache->states,
+                           cache->n_alloced * n_params * sizeof( long double));
+      }
+   if( times[0] <= times[n - 1])       /* go through the new times */
+      {                                /* from latest to earliest  */
+      j = n - 1;
+      dj = -1;
+      }
+   else
+      {
+      j = 0;
+      dj = 1;
+      }
+   for( ; j >= 0 && j < n; j += dj)
+      {
+      const double t = times[j];
 
-#define is_between( t1, t2, t3)  ((t2 - t1) * (t3 - t2) >= 0.)
+      while( i >= 0 && cache->times[i] > t)
+         move_cached_state( cache, i--, --out);
+      if( (i < 0 || cache->times[i] != t) && (out == end || cache->times[out] != t))
+         {
+         out--;
+         cache->times[out] = t;
+         memcpy( cache->states + out * n_params, states + j * stride,
+                                    n_params * sizeof( long double));
+         }
+      }
+   while( i >= 0 && out - 1 > i)     /* close up any gap left by skipped */
+      move_cached_state( cache, i--, --out);      /* duplicate times */
+   out -= i + 1;
+   if( out)
+      {
+      memmove( cache->times, cache->times + out, (end - out) * sizeof( double));
+      memmove( cache->states, cache->states + out * n_params,
+                     (end - out) * n_params * sizeof( long double));
+      }
+   cache->n_states = end - out;
+}
 
 static int set_locs_extended( const double *orbit, const double epoch_jd,
                        Observe *obs, const int n_obs,
-                       const double epoch2, double *orbit2)
+                       const double epoch2, double *orbit2, double *stm)
 {
+   static thread_local int use_dense_output = -1, use_trajectory_cache;
    int i, pass, rval = is_unreasonable_orbit( orbit);
+   Trajectory_cache *cache = nullptr;
+   unsigned saved_found_perturbers = 0;
+   const int stm_size = 6 * n_orbit_params;
+   const int n_vals = (stm ? n_orbit_params + stm_size : 6);
 
    if( rval)
       {
@@ -768,50 +1514,148 @@ static int set_locs_extended( const double *orbit, const double epoch_jd,
       return( -9);
       }
 
+   if( n_obs)        /* observations are sorted by JD */
+      {
+      double jd_min = obs[0].jd, jd_max = obs[n_obs - 1].jd;
+
+      if( orbit2)
+         {
+         jd_min = (epoch2 < jd_min ? epoch2 : jd_min);
+         jd_max = (epoch2 > jd_max ? epoch2 : jd_max);
+         }
+      jd_min = (epoch_jd < jd_min ? epoch_jd : jd_min);
+      jd_max = (epoch_jd > jd_max ? epoch_jd : jd_max);
+      cover_planet_tables( jd_min, jd_max);
+      }
+
    for( i = 0; i < n_obs && obs[i].jd < epoch_jd; i++)
       ;
 
-               /* set obs[0...i-1] on pass=0, obs[i...n_obs-1] on pass=1: */
-   for( pass = 0; pass < 2; pass++)
+   if( use_dense_output == -1)
+      {
+      use_dense_output = (*get_environment_ptr( "DENSE_OUTPUT") != '0');
+      use_trajectory_cache = (*get_environment_ptr( "TRAJECTORY_CACHE") != '0');
+      }
+   if( !stm && use_trajectory_cache)
       {
-      int j = (pass ? i : i - 1);
-      long double curr_orbit[MAX_N_PARAMS];
-      double curr_t = epoch_jd;
+      cache = get_trajectory_cache( orbit, epoch_jd, use_dense_output);
+      perturbers_automatically_found |= cache->found_perturbers;
+      saved_found_perturbers = perturbers_automatically_found;
+      perturbers_automatically_found = 0;
+      }
 
+               /* set obs[0...i-1] on pass=0, obs[i...n_obs-1] on pass=1: */
+   for( pass = 0; pass < 2 && !rval; pass++)
+      {
+      const int dir = (pass ? 1 : -1);
+      const bool want_epoch2 = (orbit2 != nullptr
+                        && (pass ? epoch2 >= epoch_jd : epoch2 <= epoch_jd));
+      int j, k, n_times = 0, epoch2_idx = -1, n_cached = 0;
+      long double curr_orbit[MAX_N_INTEGRATED_VALS];
+      double start_t = epoch_jd;
+      double *times = (double *)malloc( (n_obs + 1) * sizeof( double));
+      Dense_output dense;
+
+               /* list the times we need,  in the order we'll reach them: */
+      for( j = (pass ? i : i - 1); j >= 0 && j < n_obs; j += dir)
+         {
+         if( want_epoch2 && epoch2_idx < 0 && (obs[j].jd - epoch2) * dir > 0.)
+            {
+            epoch2_idx = n_times;
+            times[n_times++] = epoch2;
+            }
+         times[n_times++] = obs[j].jd;
+         }
+      if( want_epoch2 && epoch2_idx < 0)
+         {
+         epoch2_idx = n_times;
+         times[n_times++] = epoch2;
+         }
       double_to_ldouble( curr_orbit, orbit, n_orbit_params);
-      while( j < n_obs && j >= 0)
+      if( stm)             /* start out with the identity matrix */
+         for( k = 0; k < stm_size; k++)
+            curr_orbit[n_orbit_params + k] =
+                        (k / n_orbit_params == k % n_orbit_params ? 1. : 0.);
+      dense.n_stored = (n_vals > n_orbit_params ? n_vals : n_orbit_params);
+      dense.states = (long double *)malloc( (n_times + 1) * dense.n_stored
+                                                   * sizeof( long double));
+      if( cache)     /* use what's cached,  up to the first time that isn't */
          {
-         double light_lagged_orbit[6], temp_orbit[MAX_N_PARAMS];
-         Observe *optr = obs + j;
+         const long double *cached;
 
-         if( orbit2 && is_between( curr_t, epoch2, optr->jd))
+         while( n_cached < n_times
+                  && (cached = find_cached_state( cache, times[n_cached])) != nullptr)
+            {
+            memcpy( dense.states + n_cached * dense.n_stored, cached,
+                                    dense.n_stored * sizeof( long double));
+            n_cached++;
+            }
+         if( n_cached && n_cached < n_times)
             {
-            rval = integrate_orbitl( curr_orbit, curr_t, epoch2);
-            if( rval)
-               return( rval);
-            ldouble_to_double( orbit2, curr_orbit, n_orbit_params);
-            curr_t = epoch2;
+            memcpy( curr_orbit, dense.states + (n_cached - 1) * dense.n_stored,
+                                    dense.n_stored * sizeof( long double));
+            start_t = times[n_cached - 1];
             }
-         rval = integrate_orbitl( curr_orbit, curr_t, optr->jd);
-         if( rval)
-            return( rval);
-         curr_t = optr->jd;
-         ldouble_to_double( temp_orbit, curr_orbit, n_orbit_params);
-         light_time_lag( optr->jd, temp_orbit, optr->obs_posn, light_lagged_orbit,
-                  optr->note2 == 'R');
-         memcpy( optr->obj_posn, light_lagged_orbit, 3 * sizeof( double));
-         memcpy( optr->obj_vel, light_lagged_orbit + 3, 3 * sizeof( double));
-         j += (pass ? 1 : -1);
          }
-      if( orbit2)
-         if( (!pass && curr_t >= epoch2) || (pass && curr_t <= epoch2))
+      dense.n_times = n_times - n_cached;
+      dense.n_done = 0;
+      dense.times = times + n_cached;
+      dense.states += n_cached * dense.n_stored;
+      if( n_cached == n_times)
+         rval = 0;
+      else if( use_dense_output)
+         rval = integrate_orbit_vals( curr_orbit, start_t, times[n_times - 1],
+                                    n_vals, &dense);
+      else        /* the old way:  integrate from one time to the next */
+         for( k = n_cached; !rval && k < n_times; k++)
+            {
+            rval = integrate_orbit_vals( curr_orbit, (k ? times[k - 1] : epoch_jd),
+                                    times[k], n_vals, nullptr);
+            memcpy( dense.states + (k - n_cached) * dense.n_stored, curr_orbit,
+                                    dense.n_stored * sizeof( long double));
+            }
+      dense.states -= n_cached * dense.n_stored;
+      if( cache && !rval)
+         add_cached_states( cache, times + n_cached,
+                                 dense.states + n_cached * dense.n_stored,
+                                 dense.n_stored, n_times - n_cached);
+      for( j = (pass ? i : i - 1), k = 0; !rval && k < n_times; k++)
+         {
+         const long double *state = dense.states + k * dense.n_stored;
+
+         if( k == epoch2_idx)
             {
-            rval = integrate_orbitl( curr_orbit, curr_t, epoch2);
-            if( rval)
-               return( rval);
-            ldouble_to_double( orbit2, curr_orbit, n_orbit_params);
+            ldouble_to_double( orbit2, state, n_orbit_params);
+            if( stm)
+               ldouble_to_double( stm + n_obs * stm_size,
+                                  state + n_orbit_params, stm_size);
             }
+         else
+            {
+            double light_lagged_orbit[6], temp_orbit[MAX_N_PARAMS];
+            Observe *optr = obs + j;
+
+            if( stm)
+               ldouble_to_double( stm + j * stm_size,
+                                  state + n_orbit_params, stm_size);
+            ldouble_to_double( temp_orbit, state, n_orbit_params);
+            light_time_lag( optr->jd, temp_orbit, optr->obs_posn, light_lagged_orbit,
+                     optr->note2 == 'R');
+            memcpy( optr->obj_posn, light_lagged_orbit, 3 * sizeof( double));
+            memcpy( optr->obj_vel, light_lagged_orbit + 3, 3 * sizeof( double));
+            j += dir;
+            }
+         }
+      free( dense.states);
+      free( times);
+      }
+   if( cache)
+      {
+      cache->found_perturbers |= perturbers_automatically_found;
+      perturbers_automatically_found |= saved_found_perturbers;
       }
+   if( rval)
+      return( rval);
 
             /* We've now set the object heliocentric positions and */
             /* velocities,  in ecliptic J2000,  for each observation */
@@ -819,41 +1663,44 @@ static int set_locs_extended( const double *orbit, const double epoch_jd,
             /* computed RA/decs and distances to the object at those */
             /* times. */
    for( i = 0; i < n_obs; i++)
-      {
-      double loc[3], ra, dec, r = 0.;
-      int j;
+      set_computed_ra_dec( obs + i);
+   return( 0);
+}
 
-      for( j = 0; j < 3; j++)
-         {
-         loc[j] = obs[i].obj_posn[j] - obs[i].obs_posn[j];
-         r += loc[j] * loc[j];
-         }
-      r = sqrt( r);
-      obs[i].r = r;
-      ecliptic_to_equatorial( loc);
-      ra = atan2( loc[1], loc[0]);
-      if( r > 100000. || r <= 0.)
-         debug_printf( "???? bad r: %f %f %f: %s\n",
-                  loc[0], loc[1], loc[2], obs->packed_id);
-      if( r)
-         dec = asine( loc[2] / r);
-      else
-         dec = 0.;
-      while( ra - obs[i].ra > PI)
-         ra -= 2. * PI;
-      while( ra - obs[i].ra < -PI)
-         ra += 2. * PI;
-      obs[i].computed_ra = ra;
-      obs[i].computed_dec = dec;
-      set_solar_r( obs + i);
+static void set_computed_ra_dec( Observe *obs)
+{
+   double loc[3], ra, dec, r = 0.;
+   int j;
+
+   for( j = 0; j < 3; j++)
+      {
+      loc[j] = obs->obj_posn[j] - obs->obs_posn[j];
+      r += loc[j] * loc[j];
       }
-   return( 0);
+   r = sqrt( r);
+   obs->r = r;
+   ecliptic_to_equatorial( loc);
+   ra = atan2( loc[1], loc[0]);
+   if( r > 100000. || r <= 0.)
+      debug_printf( "???? bad r: %f %f %f: %s\n",
+               loc[0], loc[1], loc[2], obs->packed_id);
+   if( r)
+      dec = asine( loc[2] / r);
+   else
+      dec = 0.;
+   while( ra - obs->ra > PI)
+      ra -= 2. * PI;
+   while( ra - obs->ra < -PI)
+      ra += 2. * PI;
+   obs->computed_ra = ra;
+   obs->computed_dec = dec;
+   set_solar_r( obs);
 }
 
 int set_locs( const double *orbit, const double t0, Observe *obs,
                        const int n_obs)
 {
-   return( set_locs_extended( orbit, t0, obs, n_obs, t0, nullptr));
+   return( set_locs_extended( orbit, t0, obs, n_obs, t0, nullptr, nullptr));
 }
 
 double observation_rms( const Observe *obs)
@@ -932,7 +1779,7 @@ It does this with the logic given in 'herget.htm#sund_xplns'. */
 #define XFER_INTEGRATION_FAILED    -4
 #define XFER_OK                     0
 
-clock_t t_transfer;
+thread_local clock_t t_transfer;
 
 static int find_transfer_orbit( double *orbit, Observe *obs1, Observe *obs2,
                 const int already_have_approximate_orbit)
@@ -1205,7 +2052,7 @@ int extended_orbit_fit( double *orbit, Observe *obs, int n_obs,
       rval = find_parameterized_orbit( torbit, params, obs1, obs2,
                      fit_type, 0);
       if( !rval)
-         rval = set_locs_extended( torbit, obs1.jd, obs, n_obs, epoch, orbit_at_epoch);
+         rval = set_locs_extended( torbit, obs1.jd, obs, n_obs, epoch, orbit_at_epoch, nullptr);
       if( rval)
          return( rval);
       for( j = 0; j < n_obs; j++)
@@ -1259,7 +2106,7 @@ int extended_orbit_fit( double *orbit, Observe *obs, int n_obs,
    rval = find_parameterized_orbit( torbit, params, obs1, obs2,
                      fit_type, 0);
    if( !rval)
-      set_locs_extended( torbit, obs1.jd, obs, n_obs, epoch, orbit_at_epoch);
+      set_locs_extended( torbit, obs1.jd, obs, n_obs, epoch, orbit_at_epoch, nullptr);
    if( rval)
       return( rval);
             /* Except we really want to return the orbit at epoch : */
@@ -1633,26 +2480,125 @@ static int sr_orbit_compare( const void *a, const void *b)
    return( (ta->score > tb->score) ? 1 : -1);
 }
 
+/* Statistical ranging and Monte Carlo both compute many independent
+"variant" orbits,  each requiring its own integration over the arc.
+run_variants() calls 'func' for each index from 'first' up to (but not
+including) 'end',  spread over get_n_fit_threads() threads in the same
+manner as compute_partials().  Each thread gets its own scratch copy of
+the observations;  'obs' itself is left untouched.  It also gets the
+caller's fitting state (including the "A=" solar multiplier),  so each
+variant is integrated with the same force model it would be on the main
+thread.
+
+   Indices are handed out in increasing order,  and the time limit (if
+'max_time' is non-zero) is only checked before taking a new index;  so
+the indices that actually got processed are always 'first' up to the
+return value.  'func' must write only to per-index storage.  Results
+therefore don't depend on the number of threads,  except that (as
+before) more of them may be done before the time runs out.  */
+
+static unsigned run_variants( const unsigned first, const unsigned end,
+               const Observe *obs, const unsigned n_obs, const double max_time,
+               const std::function<void( const unsigned, Observe *)> &func)
+{
+   const auto end_time = std::chrono::steady_clock::now( )
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     std::chrono::duration<double>( max_time));
+   unsigned n_threads = get_n_fit_threads( ), rval;
+
+   if( first >= end)
+      return( first);
+   if( n_threads > end - first)
+      n_threads = end - first;
+   if( n_threads < 2 || fit_worker_id)
+      {
+      Observe *tobs = (Observe *)malloc( n_obs * sizeof( Observe));
+
+      if( n_obs)
+         memcpy( tobs, obs, n_obs * sizeof( Observe));
+      for( rval = first; rval < end; rval++)
+         {
+         if( max_time && std::chrono::steady_clock::now( ) > end_time)
+            break;
+         func( rval, tobs);
+         }
+      free( tobs);
+      }
+   else
+      {
+      Fit_context ctx;
+      std::atomic<unsigned> next_idx( first);
+      std::atomic<bool> out_of_time( false);
+      std::atomic<unsigned> found_perturbers( perturbers_automatically_found);
+      const bool saved_fail_on_hitting_planet = fail_on_hitting_planet;
+
+      fit_context_capture( &ctx);
+      ctx.show_runtime_messages = 0;
+      run_on_fit_threads( n_threads, [&]( const unsigned thread_no)
+            {
+            Observe *tobs = (Observe *)malloc( n_obs * sizeof( Observe));
+            Fit_context local_ctx = ctx;
+            unsigned idx;
+
+            local_ctx.worker_id = (int)thread_no + 1;
+            fit_context_install( &local_ctx);
+            fail_on_hitting_planet = saved_fail_on_hitting_planet;
+            perturbers_automatically_found = found_perturbers;
+            if( n_obs)
+               memcpy( tobs, obs, n_obs * sizeof( Observe));
+            while( !out_of_time)
+               {
+               if( max_time && std::chrono::steady_clock::now( ) > end_time)
+                  out_of_time = true;
+               else if( (idx = next_idx++) < end)
+                  func( idx, tobs);
+               else
+                  break;
+               }
+            found_perturbers |= perturbers_automatically_found;
+            free( tobs);
+            planet_posn( PLANET_POSN_FLUSH_THREAD_STATS, 0., nullptr);
+            });
+      perturbers_automatically_found = found_perturbers;
+      rval = next_idx;
+      if( rval > end)
+         rval = end;
+      }
+   return( rval);
+}
+
+/* The first SR orbit sets up 'sr_roots',  which all the others use;  so
+it's found before the rest are farmed out to threads.  Which orbits are
+found depends only on their index,  and they're gathered in index order
+before sorting,  so the thread count doesn't change the result.   */
+
 int get_sr_orbits( sr_orbit_t *orbits, Observe *obs,
                const unsigned n_obs, const unsigned starting_orbit,
                const unsigned max_orbits, const double max_time,
                [[maybe_unused]] const double noise_in_sigmas, const int writing_sr_elems)
 {
-   const clock_t end_clock =
-             clock( ) + (clock_t)( max_time * (double)CLOCKS_PER_SEC);
-   unsigned i, rval = 0;
-   sr_orbit_t *tptr = orbits;
-
-   for( i = 0; i < max_orbits && clock( ) < end_clock; i++)
+   unsigned i, n_tried, rval = 0;
+   std::vector<char> found( max_orbits, 0);
+   const auto find_one = [&]( const unsigned idx, Observe *tobs)
       {
-      if( !find_nth_sr_orbit( tptr, obs, n_obs, i + starting_orbit)
-                   && (n_obs == 2 || !adjust_herget_results( obs, n_obs, tptr->orbit)))
+      sr_orbit_t *tptr = orbits + idx;
+
+      if( !find_nth_sr_orbit( tptr, tobs, n_obs, idx + starting_orbit)
+                   && (n_obs == 2 || !adjust_herget_results( tobs, n_obs, tptr->orbit)))
          {
-         tptr->score = evaluate_initial_orbit( obs, n_obs, tptr->orbit, obs[0].jd);
-         tptr++;
+         tptr->score = evaluate_initial_orbit( tobs, n_obs, tptr->orbit, tobs[0].jd);
+         if( isfinite( tptr->score))      /* NaN scores would upset qsort() */
+            found[idx] = 1;
          }
-      }
-   rval = (unsigned)( tptr - orbits);
+      };
+
+   if( !max_orbits || max_time <= 0.)
+      return( 0);
+   n_tried = (starting_orbit ? 0 : run_variants( 0, 1, obs, n_obs, 0., find_one));
+   n_tried = run_variants( n_tried, max_orbits, obs, n_obs, max_time, find_one);
+   for( i = 0; i < n_tried; i++)
+      if( found[i])
+         orbits[rval++] = orbits[i];
    qsort( orbits, rval, sizeof( sr_orbit_t), sr_orbit_compare);
    if( writing_sr_elems)
       for( i = 0; i < rval; i++)
@@ -1763,17 +2709,21 @@ static inline void compute_sr_sigmas( const double *sr_orbits,
    const int planet_orbiting = 0;      /* heliocentric only,  at least for now */
    Elements elem0;
 
+   std::vector<double> orbits( sr_orbits, sr_orbits + 6 * n_orbits);
+
+   run_variants( 0, n_orbits, nullptr, 0, 0.,
+            [&]( const unsigned idx, Observe *)
+               {
+               integrate_orbit( &orbits[idx * 6], epoch, epoch_shown);
+               });
    elem0.major_axis = elem0.ecc = 0.;     /* just to avoid uninitialized  */
    for( i = 0; i < n_orbits; i++)         /* variable warnings            */
       {
-      double orbit[6];
       Elements elem;
 
       memset( &elem, 0, sizeof(Elements));
       elem.gm = SOLAR_GM;
-      memcpy( orbit, sr_orbits + 6 * i, 6 * sizeof( double));
-      integrate_orbit( orbit, epoch, epoch_shown);
-      calc_classical_elements( &elem, orbit, epoch_shown, 1);
+      calc_classical_elements( &elem, &orbits[i * 6], epoch_shown, 1);
       add_monte_orbit( monte_data, &elem, i);
       if( !i)
          elem0 = elem;
@@ -2165,7 +3115,7 @@ void compute_variant_orbit( double *variant, const double *ref_orbit,
                      const double n_sigmas)
 {
    int i;
-   extern double **eigenvects;
+   extern thread_local double **eigenvects;
 
    assert( eigenvects);
    if( eigenvects)
@@ -2373,7 +3323,7 @@ static int evaluate_limited_orbit( const double *orbit,
    return( rval);
 }
 
-double **eigenvects;
+thread_local double **eigenvects;
 
 void **calloc_double_dimension_array( const size_t x, const size_t y,
                                     const size_t obj_size)
@@ -2496,7 +3446,7 @@ at each tweak to make sure it had an effect somewhere between 'min_change' to
 that range,  the tweak is re-scaled and we try again.  */
 
 bool use_symmetric_derivatives = false;
-int forced_central_body = 0;
+thread_local int forced_central_body = 0;
 double probability_of_blunder = 0.;
 int use_blunder_method = 0;
 
@@ -2653,6 +3603,446 @@ static void _tweak_orbit( double *orbit, const int axis, double tweak, [[maybe_u
      orbit[axis] += tweak;
 }
 
+/* Everything full_improvement() needs in order to compute the partial
+derivatives of the residuals (and elements and constraints) with respect
+to one parameter.  Each parameter's partials are found independently of
+the others',  so they can be computed on separate threads;  see
+compute_partials( ).   */
+
+struct Partials_data
+{
+   const double *orbit;
+   const Observe *orig_obs;
+   double *asteroid_mass;
+   const char *limited_orbit;
+   const double *central_obj_state;
+   const double *elements_in_array;
+   const double *constraint;
+   double *slopes;
+   double (*element_slopes)[MONTE_N_ENTRIES];
+   double (*constraint_slope)[MAX_N_PARAMS];
+   double *delta_vals;
+   const double *stm;            /* see set_locs_extended( ) */
+   const double *rel_orbit2;
+   double epoch, epoch2, integration_length, r_mult;
+   int n_obs, n_params, n_constraints, planet_orbiting;
+   bool use_symmetric_derivatives, fail_on_hitting_planet;
+   bool showing_deltas_in_debug_file;
+   char *progress_text;          /* nullptr on worker threads */
+   size_t progress_text_size;
+};
+
+/* Finds the partials for parameter 'i',  using 'obs' as scratch space
+(it's left as a copy of 'orig_obs').  Adjusts 'delta_vals[i]' until the
+tweak changes the residuals by a reasonable amount.  Returns 0 on success,
+-8 if the tweaked orbit couldn't be integrated,  -4 if the user hit a key
+to interrupt things,  or -1 if the deltas never converged.  */
+
+static int compute_partials_for_param( const Partials_data *p, Observe *obs,
+                                       const int i)
+{
+   const double min_change = 0.03, max_change = 3.0, optimal_change = 1.0;
+   double low_delta = 0., high_delta = 0., low_change = 0., high_change = 0.;
+   const int n_obs = p->n_obs, n_params = p->n_params;
+   int n_iterations = 0, j, err_code = 0, set_locs_rval;
+   const int max_iterations = 100;
+   bool keep_iterating = true;
+   Elements elem;
+
+   while( !err_code && keep_iterating)
+      {
+      double tweaked_orbit[MAX_N_PARAMS];
+      const double original_asteroid_mass = (p->asteroid_mass ? *p->asteroid_mass : 0.);
+      double delta_val =
+                p->delta_vals[i] / (p->integration_length * p->integration_length);
+      double worst_error_in_sigmas;
+      double worst_error_squared = 0, rescale;
+      double *slope_ptr;
+      double rel_orbit[MAX_N_PARAMS];
+      int n_tweaks = 0;
+      const int max_n_tweaks = 30;
+
+               /* for asteroid mass computations,  on first pass, */
+               /* try to set a "reasonable" delta :   */
+      if( i == 6 && p->asteroid_mass && !n_iterations)
+         delta_val = 1.e-15 + original_asteroid_mass / 100.;
+      do
+         {
+         memcpy( tweaked_orbit, p->orbit, n_orbit_params * sizeof( double));
+         if( p->asteroid_mass && i == 6)
+            *p->asteroid_mass -= delta_val;
+         else                    /* adjust position/velocity */
+            _tweak_orbit( tweaked_orbit, i, -delta_val, n_params);
+         if( p->progress_text)
+            snprintf_err( p->progress_text, p->progress_text_size,
+                     "Evaluating %d of %d : iter %d   ", i + 1,
+                                 n_params, n_iterations);
+         if( debug_level > 4)
+            debug_printf( "About to set locs #2: delta_val %f\n", delta_val);
+         fail_on_hitting_planet = true;
+         set_locs_rval = set_locs_extended( tweaked_orbit, p->epoch, obs,
+                    n_obs, p->epoch2, rel_orbit, nullptr);
+         fail_on_hitting_planet = p->fail_on_hitting_planet;
+         for( j = 0; !set_locs_rval && j < n_obs; j++)
+            {
+            double d = vect_diff2( obs[j].obj_posn, p->orig_obs[j].obj_posn);
+
+            d = sqrt( d) / obs[j].r;
+            if( d > 0.001)              /* tweaked orbit too different from */
+               set_locs_rval = 1;      /* the original one; try smaller tweak */
+            }
+         if( debug_level > 4)
+            debug_printf( "Second set done: %d\n", set_locs_rval);
+         if( set_locs_rval == INTEGRATION_TIMED_OUT
+                       || set_locs_rval == USER_INTERRUPTED)
+
+            err_code = set_locs_rval;
+         if( set_locs_rval)      /* gonna have to try again, */
+            {                    /* with a smaller tweak */
+            delta_val /= 2.;
+            p->delta_vals[i] /= 2.;
+            n_tweaks++;
+            if( n_tweaks >= max_n_tweaks)
+               err_code = -1;
+            }
+         }
+         while( set_locs_rval && !err_code);
+      if( err_code)
+         {
+         memcpy( obs, p->orig_obs, n_obs * sizeof(Observe));
+         return( -8);
+         }
+      slope_ptr = p->slopes + i;
+      for( j = 0; j < n_obs; j++, slope_ptr += 2 * n_params)
+         get_residual_data( obs + j, slope_ptr, slope_ptr + n_params);
+
+      for( j = 0; j < 6; j++)
+         rel_orbit[j] -= p->central_obj_state[j];
+               /* evaluate elements of 'rel_orbit',  then  put */
+               /* into an array form: */
+      elem.gm = get_planet_mass( p->planet_orbiting);
+      elem.abs_mag = calc_absolute_magnitude( obs, n_obs);
+      rotate_state_vector_to_current_frame( rel_orbit, p->epoch2,
+                                             p->planet_orbiting, nullptr);
+      calc_classical_elements( &elem, rel_orbit, p->epoch2, 1);
+
+      put_orbital_elements_in_array_form( &elem, p->element_slopes[i]);
+      for( j = 0; j < MONTE_N_ENTRIES; j++)
+         {
+         p->element_slopes[i][j] -= p->elements_in_array[j];
+         p->element_slopes[i][j] /= delta_val;
+         }
+      if( p->limited_orbit)
+         {
+         double constraint2[MAX_CONSTRAINTS];
+
+         evaluate_limited_orbit( rel_orbit, p->planet_orbiting, p->epoch2,
+                                   p->limited_orbit, constraint2);
+         for( j = 0; j < p->n_constraints; j++)
+            p->constraint_slope[j][i] =
+                    (constraint2[j] - p->constraint[j]) / delta_val;
+         if( *p->limited_orbit == 'R')
+            {
+            const double tconstraint = p->r_mult *
+                (dotted_dist( obs + n_obs - 1) - atof( p->limited_orbit + 2));
+
+            p->constraint_slope[0][j] = (p->constraint[0] - tconstraint) / delta_val;
+            }
+         }
+      if( p->use_symmetric_derivatives)
+         {
+         memcpy( tweaked_orbit, p->orbit, n_orbit_params * sizeof( double));
+         if( p->asteroid_mass && i == 6)
+            *p->asteroid_mass += delta_val;
+         else                    /* adjust position/velocity */
+            _tweak_orbit( tweaked_orbit, i, delta_val, n_params);
+         if( p->progress_text)
+            memcpy( p->progress_text, "Reverse   ", 10);
+         fail_on_hitting_planet = true;
+         set_locs_rval = set_locs( tweaked_orbit, p->epoch, obs, n_obs);
+         if( set_locs_rval == USER_INTERRUPTED)
+            {
+            memcpy( obs, p->orig_obs, n_obs * sizeof(Observe));
+            debug_printf( "Interrupted full step\n");
+            return( -4);
+            }
+         if( set_locs_rval)      /* fall back on simple, asymmetric method */
+            {
+            debug_printf( "Symmetric fail : %d\n", set_locs_rval);
+            memcpy( obs, p->orig_obs, n_obs * sizeof(Observe));
+            }
+         fail_on_hitting_planet = p->fail_on_hitting_planet;
+         }
+      else
+         memcpy( obs, p->orig_obs, n_obs * sizeof(Observe));
+      slope_ptr = p->slopes + i;
+      for( j = 0; j < n_obs; j++, slope_ptr += 2 * n_params)
+         if( obs[j].is_included)
+            {
+            double xresidual, yresidual;
+
+            get_residual_data( obs + j, &xresidual, &yresidual);
+
+            slope_ptr[0] -= xresidual;
+            slope_ptr[n_params] -= yresidual;
+            if( obs[j].note2 != 'R')
+               {
+               const double error_squared = slope_ptr[0] * slope_ptr[0]
+                        + slope_ptr[n_params] * slope_ptr[n_params];
+
+               if( worst_error_squared < error_squared)
+                  worst_error_squared = error_squared;
+               }
+            slope_ptr[0]        /= delta_val;
+            slope_ptr[n_params] /= delta_val;
+            if( p->use_symmetric_derivatives && !set_locs_rval)
+               {       /* delta is actually twice the 'specified' value */
+               slope_ptr[0]        /= 2.;
+               slope_ptr[n_params] /= 2.;
+               }
+            }
+      worst_error_in_sigmas = sqrt( worst_error_squared);
+      if( p->showing_deltas_in_debug_file)
+         debug_printf( "Iter %d, Change param %d: %f sigmas; delta %.3e (%.3e)\n",
+            n_iterations,
+            i, worst_error_in_sigmas, delta_val, p->delta_vals[i]);
+      worst_error_in_sigmas += 1e-10;        /* ensure _some change; */
+                        /* evades divide-by-zero/range errors below */
+      if( worst_error_in_sigmas > min_change && worst_error_in_sigmas < max_change)
+         keep_iterating = false;
+      if( worst_error_in_sigmas <= optimal_change)
+         {
+         low_delta = p->delta_vals[i];
+         low_change = worst_error_in_sigmas;
+         }
+      else
+         {
+         high_delta = p->delta_vals[i];
+         high_change = worst_error_in_sigmas;
+         }
+      rescale = optimal_change / worst_error_in_sigmas;
+      if( low_change && high_change && (n_iterations & 1))  /* we've got it bracketed */
+         {
+         const double slope = log( high_delta / low_delta)
+                            / log( high_change / low_change);
+
+         rescale = exp( log( rescale) * slope);
+         }
+      p->delta_vals[i] *= rescale;
+      if( p->asteroid_mass)
+         *p->asteroid_mass = original_asteroid_mass;
+      if( n_iterations++ >= max_iterations)
+         {
+         debug_printf( "Ran over iteration limit! %s\n", obs->packed_id);
+         debug_printf( "Worst err %f sigmas\n", worst_error_in_sigmas);
+         err_code = -3;
+         }
+      }
+   memcpy( obs, p->orig_obs, n_obs * sizeof(Observe));
+   return( err_code ? -1 : 0);
+}
+
+/* Partials of the residuals for 'obs' with respect to its (light-time
+lagged) position and velocity,  found numerically.  No integration is
+involved,  so this is cheap.      */
+
+static void residual_gradient( Observe *obs, double *dx, double *dy)
+{
+   const Observe saved_obs = *obs;
+   const double speed = vector3_length( obs->obj_vel);
+   int i;
+
+   for( i = 0; i < 6; i++)
+      {
+      double *vptr = (i < 3 ? obs->obj_posn + i : obs->obj_vel + i - 3);
+      double h = 1e-7 * (i < 3 ? obs->r : speed);
+      double x1, y1, x2, y2;
+
+      if( !h)
+         h = 1e-12;
+      *vptr += h;
+      set_computed_ra_dec( obs);
+      get_residual_data( obs, &x1, &y1);
+      *vptr -= h + h;
+      set_computed_ra_dec( obs);
+      get_residual_data( obs, &x2, &y2);
+      dx[i] = (x1 - x2) / (h + h);
+      dy[i] = (y1 - y2) / (h + h);
+      *obs = saved_obs;
+      }
+}
+
+/* Partials from the state transition matrices found when the nominal
+orbit was integrated.  Same sign convention as the finite-difference
+code above:  slopes are the change in the quantity when the parameter is
+_decreased_.  The light-lagged position at each observation is taken to
+be posn - vel * light_time.  For the elements and constraints at epoch2,
+the state is nudged along the corresponding column of the matrix.  */
+
+static void compute_variational_partials( const Partials_data *p, Observe *obs)
+{
+   const int n_obs = p->n_obs, n_params = p->n_params;
+   const int stm_size = 6 * n_orbit_params;
+   const double *phi2 = p->stm + n_obs * stm_size;
+   int i, j, k;
+   Elements elem;
+
+   for( j = 0; j < n_obs; j++)
+      {
+      const double *phi = p->stm + j * stm_size;
+      const double light_time = obs[j].r / AU_PER_DAY;
+      double dx[6], dy[6], *slope_ptr = p->slopes + j * 2 * n_params;
+
+      residual_gradient( obs + j, dx, dy);
+      for( i = 0; i < n_params; i++)
+         {
+         slope_ptr[i] = slope_ptr[i + n_params] = 0.;
+         for( k = 0; k < 6; k++)
+            {
+            double dstate = phi[k * n_orbit_params + i];
+
+            if( k < 3)
+               dstate -= light_time * phi[(k + 3) * n_orbit_params + i];
+            slope_ptr[i]            -= dx[k] * dstate;
+            slope_ptr[i + n_params] -= dy[k] * dstate;
+            }
+         }
+      }
+
+   for( i = 0; i < n_params; i++)
+      {
+      double rel_orbit[MAX_N_PARAMS], h, col_len = 0.;
+
+      for( k = 0; k < 6; k++)
+         col_len += phi2[k * n_orbit_params + i] * phi2[k * n_orbit_params + i];
+      col_len = sqrt( col_len);
+      h = (col_len ? 1e-7 * vector3_length( p->rel_orbit2) / col_len : 1.);
+      memcpy( rel_orbit, p->rel_orbit2, n_orbit_params * sizeof( double));
+      for( k = 0; k < 6; k++)
+         rel_orbit[k] -= h * phi2[k * n_orbit_params + i];
+      if( i >= 6)             /* non-grav parameters are nudged directly */
+         rel_orbit[i] -= h;
+      elem.gm = get_planet_mass( p->planet_orbiting);
+      elem.abs_mag = calc_absolute_magnitude( obs, n_obs);
+      rotate_state_vector_to_current_frame( rel_orbit, p->epoch2,
+                                             p->planet_orbiting, nullptr);
+      calc_classical_elements( &elem, rel_orbit, p->epoch2, 1);
+      put_orbital_elements_in_array_form( &elem, p->element_slopes[i]);
+      for( j = 0; j < MONTE_N_ENTRIES; j++)
+         {
+         p->element_slopes[i][j] -= p->elements_in_array[j];
+         p->element_slopes[i][j] /= h;
+         }
+      if( p->limited_orbit)
+         {
+         double constraint2[MAX_CONSTRAINTS];
+
+         evaluate_limited_orbit( rel_orbit, p->planet_orbiting, p->epoch2,
+                                   p->limited_orbit, constraint2);
+         for( j = 0; j < p->n_constraints; j++)
+            p->constraint_slope[j][i] = (constraint2[j] - p->constraint[j]) / h;
+         }
+      }
+}
+
+/* Variational partials are used if VARIATIONAL_PARTIALS=1 is set in
+'environ.dat',  and the non-gravs (if any) enter the force linearly.  That
+rules out the lag and delta-V models (both with ten parameters).  Asteroid
+mass determinations and constraints on the last observation's distance
+still go through finite differences.  So do objects orbiting a planet:
+the variational equations leave out J2 and drag,  which matter there. */
+
+static bool use_variational_partials( const double *orbit, const double epoch,
+                  const double *asteroid_mass, const char *limited_orbit)
+{
+   double rel_orbit[6];
+
+   if( !atoi( get_environment_ptr( "VARIATIONAL_PARTIALS")))
+      return( false);
+   if( asteroid_mass || n_orbit_params > 9 || force_model == FORCE_MODEL_DELTA_V)
+      return( false);
+   if( limited_orbit && *limited_orbit == 'R')
+      return( false);
+   if( find_best_fit_planet( epoch, orbit, rel_orbit))
+      return( false);
+   return( true);
+}
+
+/* Computes the partials for all 'n_params' parameters.  Each parameter
+means one or two integrations over the full arc,  so when there are
+several parameters and we're not already on a worker thread (see
+'fit_ctx.cpp'),  they're spread over a pool of threads,  each with its
+own copy of the observations and of the fitting settings.  (Except when
+solving for an asteroid mass:  that's done by tweaking the mass all the
+integrations share,  so those partials have to be found one at a time.)
+The partials for each parameter are written to their own slots,  and the
+deltas don't depend on the order in which parameters are handled,  so
+the results are the same either way.      */
+
+static int compute_partials( const Partials_data *p, Observe *obs)
+{
+   unsigned n_threads;
+   int i, err_code = 0;
+
+   if( p->stm)
+      {
+      compute_variational_partials( p, obs);
+      return( 0);
+      }
+   n_threads = get_n_fit_threads( );
+   if( n_threads > (unsigned)p->n_params)
+      n_threads = (unsigned)p->n_params;
+   if( n_threads < 2 || fit_worker_id || p->asteroid_mass
+                     || atoi( get_environment_ptr( "SERIAL_PARTIALS")))
+      {
+      for( i = 0; !err_code && i < p->n_params; i++)
+         err_code = compute_partials_for_param( p, obs, i);
+      }
+   else
+      {
+      Fit_context ctx;
+      std::atomic<int> next_param( 0), rval( 0);
+      std::atomic<unsigned> found_perturbers( perturbers_automatically_found);
+
+      fit_context_capture( &ctx);
+      ctx.show_runtime_messages = 0;
+      if( p->progress_text)
+         snprintf_err( p->progress_text, p->progress_text_size,
+                  "Evaluating %d params on %u threads   ", p->n_params, n_threads);
+      run_on_fit_threads( n_threads, [&]( const unsigned thread_no)
+            {
+            Observe *tobs = (Observe *)malloc( p->n_obs * sizeof( Observe));
+            Partials_data tp = *p;
+            Fit_context local_ctx = ctx;
+            int idx;
+
+            local_ctx.worker_id = (int)thread_no + 1;
+            fit_context_install( &local_ctx);
+            fail_on_hitting_planet = p->fail_on_hitting_planet;
+            perturbers_automatically_found = found_perturbers;
+            tp.progress_text = nullptr;
+            memcpy( tobs, p->orig_obs, p->n_obs * sizeof( Observe));
+            while( !rval && (idx = next_param++) < p->n_params)
+               {
+               const int err = compute_partials_for_param( &tp, tobs, idx);
+
+               if( err)
+                  {
+                  int zero = 0;
+
+                  rval.compare_exchange_strong( zero, err);
+                  }
+               }
+            found_perturbers |= perturbers_automatically_found;
+            free( tobs);
+            planet_posn( PLANET_POSN_FLUSH_THREAD_STATS, 0., nullptr);
+            });
+      perturbers_automatically_found = found_perturbers;
+      err_code = rval;
+      }
+   return( err_code);
+}
+
 const char *monte_label[MONTE_N_ENTRIES] = {
                            "Tp", "e", "q", "Q", "1/a", "i", "M",
                            "omega", "Omega", "MOID", "H" };
@@ -2690,7 +4080,7 @@ int full_improvement(Observe *obs, int n_obs, double *orbit,
                    { 1e-4, 1e-4, 1e-5, 1e-5, 1e-3, 1e-3,
                     1e-8, 1e-8, 1e-8,
                     1e-8, 1e-8, 1e-8 };
-   static double delta_vals[MAX_N_PARAMS];
+   static thread_local double delta_vals[MAX_N_PARAMS];
    double constraint[MAX_CONSTRAINTS];
    double sigma_squared = 0.;       /* see Danby, p. 243, (7.5.20) */
    double scale_factor = 1.;
@@ -2700,8 +4090,10 @@ int full_improvement(Observe *obs, int n_obs, double *orbit,
    int i, j, n_skipped_obs = 0, err_code = 0;
    int n_included_observations = 0;
    bool really_use_symmetric_derivatives;
+   Partials_data partials;
+   double *stm = nullptr;
    const int n_total_obs = n_obs;
-   const char *covariance_filename = "covar.txt";
+   char covariance_filename[20], covariance_json_filename[20];
    char tstr[80];
    Elements elem;
    Observe *orig_obs = nullptr;
@@ -2710,10 +4102,25 @@ int full_improvement(Observe *obs, int n_obs, double *orbit,
    const double r_mult = 1e+2;
    double orbit2[MAX_N_PARAMS];
    int set_locs_rval;
-   extern double levenberg_marquardt_lambda;
+   extern thread_local double levenberg_marquardt_lambda;
    const bool saved_fail_on_hitting_planet =
                                      fail_on_hitting_planet;
 
+         /* Worker threads (see 'fit_ctx.cpp') each get their own */
+         /* covariance files,  rather than overwriting one pair   */
+   if( fit_worker_id)
+      {
+      snprintf( covariance_filename, sizeof( covariance_filename),
+                                    "covar%d.txt", fit_worker_id);
+      snprintf( covariance_json_filename, sizeof( covariance_json_filename),
+                                    "covar%d.json", fit_worker_id);
+      }
+   else
+      {
+      strcpy( covariance_filename, "covar.txt");
+      strcpy( covariance_json_filename, "covar.json");
+      }
+
    if( !obs)
       {
       if( eigenvects)
@@ -2792,14 +4199,17 @@ int full_improvement(Observe *obs, int n_obs, double *orbit,
 
    snprintf_err( tstr, sizeof( tstr), "fi/setting locs: %f  ", JD_TO_YEAR( epoch));
    fail_on_hitting_planet = true;
-   set_locs_rval = set_locs_extended( orbit, epoch, obs, n_obs, epoch2, orbit2);
+   if( use_variational_partials( orbit, epoch, asteroid_mass, limited_orbit))
+      stm = (double *)malloc( (n_obs + 1) * 6 * n_orbit_params * sizeof( double));
+   set_locs_rval = set_locs_extended( orbit, epoch, obs, n_obs, epoch2, orbit2, stm);
    fail_on_hitting_planet = saved_fail_on_hitting_planet;
    if( set_locs_rval)
       {
-      extern int planet_hit;
+      extern thread_local int planet_hit;
 
       debug_printf( "Hit planet %d in full_improvement : %d\n",
                       planet_hit, set_locs_rval);
+      free( stm);
       runtime_message = nullptr;
       return( -4);
       }
@@ -2814,6 +4224,8 @@ int full_improvement(Observe *obs, int n_obs, double *orbit,
       central_obj_state[i] = orbit2[i] - tvect[i];
       orbit2[i] = tvect[i];
       }
+   for( i = 6; i < n_orbit_params; i++)      /* non-gravs carry over */
+      tvect[i] = orbit2[i];
             /* After the above: if the object,  at the "display epoch", */
             /* is in a heliocentric orbit,  the central object is the   */
             /* "un-moving" sun.  In a planetocentric case,  that vector */
@@ -2866,214 +4278,42 @@ int full_improvement(Observe *obs, int n_obs, double *orbit,
    orig_obs = (Observe *)calloc( n_obs, sizeof(Observe));
    memcpy( orig_obs, obs, n_obs * sizeof(Observe));
 
-   for( i = 0; !err_code && i < n_params; i++)
-      {
-      const double min_change = 0.03, max_change = 3.0, optimal_change = 1.0;
-      double low_delta = 0., high_delta = 0., low_change = 0., high_change = 0.;
-      int n_iterations = 0;
-      const int max_iterations = 100;
-      bool keep_iterating = true;
-
-      while( !err_code && keep_iterating)
-         {
-         double tweaked_orbit[MAX_N_PARAMS];
-         const double original_asteroid_mass = (asteroid_mass ? *asteroid_mass : 0.);
-         double delta_val =
-                      delta_vals[i] / (integration_length * integration_length);
-         double worst_error_in_sigmas;
-         double worst_error_squared = 0, rescale;
-         double *slope_ptr;
-         double rel_orbit[MAX_N_PARAMS];
-         int n_tweaks = 0;
-         const int max_n_tweaks = 30;
-
-                  /* for asteroid mass computations,  on first pass, */
-                  /* try to set a "reasonable" delta :   */
-         if( i == 6 && asteroid_mass && !n_iterations)
-            delta_val = 1.e-15 + original_asteroid_mass / 100.;
-         do
-            {
-            memcpy( tweaked_orbit, orbit, n_orbit_params * sizeof( double));
-            if( asteroid_mass && i == 6)
-               *asteroid_mass -= delta_val;
-            else                    /* adjust position/velocity */
-               _tweak_orbit( tweaked_orbit, i, -delta_val, n_params);
-            snprintf_err( tstr, sizeof( tstr), "Evaluating %d of %d : iter %d   ", i + 1,
-                                    n_params, n_iterations);
-            if( debug_level > 4)
-               debug_printf( "About to set locs #2: delta_val %f\n", delta_val);
-            fail_on_hitting_planet = true;
-            set_locs_rval = set_locs_extended( tweaked_orbit, epoch, obs,
-                       n_obs, epoch2, rel_orbit);
-            fail_on_hitting_planet = saved_fail_on_hitting_planet;
-            for( j = 0; !set_locs_rval && j < n_obs; j++)
-               {
-               double d = vect_diff2( obs[j].obj_posn, orig_obs[j].obj_posn);
-
-               d = sqrt( d) / obs[j].r;
-               if( d > 0.001)              /* tweaked orbit too different from */
-                  set_locs_rval = 1;      /* the original one; try smaller tweak */
-               }
-            if( debug_level > 4)
-               debug_printf( "Second set done: %d\n", set_locs_rval);
-            if( set_locs_rval == INTEGRATION_TIMED_OUT
-                          || set_locs_rval == USER_INTERRUPTED)
-
-               err_code = set_locs_rval;
-            if( set_locs_rval)      /* gonna have to try again, */
-               {                    /* with a smaller tweak */
-               delta_val /= 2.;
-               delta_vals[i] /= 2.;
-               n_tweaks++;
-               if( n_tweaks >= max_n_tweaks)
-                  err_code = -1;
-               }
-            }
-            while( set_locs_rval && !err_code);
-         if( err_code)
-            {
-            memcpy( obs, orig_obs, n_obs * sizeof(Observe));
-            free( orig_obs);
-            free( xresids);
-            memcpy( orbit, original_orbit, n_orbit_params * sizeof( double));
-            return( -8);
-            }
-         slope_ptr = slopes + i;
-         for( j = 0; j < n_obs; j++, slope_ptr += 2 * n_params)
-            get_residual_data( obs + j, slope_ptr, slope_ptr + n_params);
-
-         for( j = 0; j < 6; j++)
-            rel_orbit[j] -= central_obj_state[j];
-                  /* evaluate elements of 'rel_orbit',  then  put */
-                  /* into an array form: */
-         elem.gm = get_planet_mass( planet_orbiting);
-         elem.abs_mag = calc_absolute_magnitude( obs, n_obs);
-         rotate_state_vector_to_current_frame( rel_orbit, epoch2, planet_orbiting, nullptr);
-         calc_classical_elements( &elem, rel_orbit, epoch2, 1);
-
-         put_orbital_elements_in_array_form( &elem, element_slopes[i]);
-         for( j = 0; j < MONTE_N_ENTRIES; j++)
-            {
-            element_slopes[i][j] -= elements_in_array[j];
-            element_slopes[i][j] /= delta_val;
-            }
-         if( limited_orbit)
-            {
-            double constraint2[MAX_CONSTRAINTS];
-
-            evaluate_limited_orbit( rel_orbit, planet_orbiting, epoch2,
-                                      limited_orbit, constraint2);
-            for( j = 0; j < n_constraints; j++)
-               constraint_slope[j][i] =
-                       (constraint2[j] - constraint[j]) / delta_val;
-            if( *limited_orbit == 'R')
-               {
-               const double tconstraint =
-                     r_mult * (dotted_dist( obs + n_obs - 1) - atof( limited_orbit + 2));
-
-               constraint_slope[0][j] = (constraint[0] - tconstraint) / delta_val;
-               }
-            }
-         if( really_use_symmetric_derivatives)
-            {
-            memcpy( tweaked_orbit, orbit, n_orbit_params * sizeof( double));
-            if( asteroid_mass && i == 6)
-               *asteroid_mass += delta_val;
-            else                    /* adjust position/velocity */
-               _tweak_orbit( tweaked_orbit, i, delta_val, n_params);
-            memcpy( tstr, "Reverse   ", 10);
-            fail_on_hitting_planet = true;
-            set_locs_rval = set_locs( tweaked_orbit, epoch, obs, n_obs);
-            if( set_locs_rval == USER_INTERRUPTED)
-               {
-               free( xresids);
-               free( orig_obs);
-               memcpy( orbit, original_orbit, n_orbit_params * sizeof( double));
-               runtime_message = nullptr;
-               debug_printf( "Interrupted full step\n");
-               return( -4);
-               }
-            if( set_locs_rval)      /* fall back on simple, asymmetric method */
-               {
-               debug_printf( "Symmetric fail : %d\n", set_locs_rval);
-               memcpy( obs, orig_obs, n_obs * sizeof(Observe));
-               }
-            fail_on_hitting_planet = saved_fail_on_hitting_planet;
-            }
-         else
-            memcpy( obs, orig_obs, n_obs * sizeof(Observe));
-         slope_ptr = slopes + i;
-         for( j = 0; j < n_obs; j++, slope_ptr += 2 * n_params)
-            if( obs[j].is_included)
-               {
-               double xresidual, yresidual;
-
-               get_residual_data( obs + j, &xresidual, &yresidual);
-
-               slope_ptr[0] -= xresidual;
-               slope_ptr[n_params] -= yresidual;
-               if( obs[j].note2 != 'R')
-                  {
-                  const double error_squared = slope_ptr[0] * slope_ptr[0]
-                           + slope_ptr[n_params] * slope_ptr[n_params];
-
-                  if( worst_error_squared < error_squared)
-                     worst_error_squared = error_squared;
-                  }
-               slope_ptr[0]        /= delta_val;
-               slope_ptr[n_params] /= delta_val;
-               if( really_use_symmetric_derivatives && !set_locs_rval)
-                  {       /* delta is actually twice the 'specified' value */
-                  slope_ptr[0]        /= 2.;
-                  slope_ptr[n_params] /= 2.;
-                  }
-               }
-         worst_error_in_sigmas = sqrt( worst_error_squared);
-         if( showing_deltas_in_debug_file)
-            debug_printf( "Iter %d, Change param %d: %f sigmas; delta %.3e (%.3e)\n",
-               n_iterations,
-               i, worst_error_in_sigmas, delta_val, delta_vals[i]);
-         worst_error_in_sigmas += 1e-10;        /* ensure _some change; */
-                           /* evades divide-by-zero/range errors below */
-         if( worst_error_in_sigmas > min_change && worst_error_in_sigmas < max_change)
-            keep_iterating = false;
-         if( worst_error_in_sigmas <= optimal_change)
-            {
-            low_delta = delta_vals[i];
-            low_change = worst_error_in_sigmas;
-            }
-         else
-            {
-            high_delta = delta_vals[i];
-            high_change = worst_error_in_sigmas;
-            }
-         rescale = optimal_change / worst_error_in_sigmas;
-         if( low_change && high_change && (n_iterations & 1))  /* we've got it bracketed */
-            {
-            const double slope = log( high_delta / low_delta)
-                               / log( high_change / low_change);
-
-            rescale = exp( log( rescale) * slope);
-            }
-         delta_vals[i] *= rescale;
-         if( asteroid_mass)
-            *asteroid_mass = original_asteroid_mass;
-         if( n_iterations++ >= max_iterations)
-            {
-            debug_printf( "Ran over iteration limit! %s\n", obs->packed_id);
-            debug_printf( "Worst err %f sigmas\n", worst_error_in_sigmas);
-            err_code = -3;
-            runtime_message = nullptr;
-            }
-         }
-      }
+   partials.orbit = orbit;
+   partials.orig_obs = orig_obs;
+   partials.asteroid_mass = asteroid_mass;
+   partials.limited_orbit = limited_orbit;
+   partials.central_obj_state = central_obj_state;
+   partials.elements_in_array = elements_in_array;
+   partials.constraint = constraint;
+   partials.slopes = slopes;
+   partials.element_slopes = element_slopes;
+   partials.constraint_slope = constraint_slope;
+   partials.delta_vals = delta_vals;
+   partials.stm = stm;
+   partials.rel_orbit2 = tvect;
+   partials.epoch = epoch;
+   partials.epoch2 = epoch2;
+   partials.integration_length = integration_length;
+   partials.r_mult = r_mult;
+   partials.n_obs = n_obs;
+   partials.n_params = n_params;
+   partials.n_constraints = n_constraints;
+   partials.planet_orbiting = planet_orbiting;
+   partials.use_symmetric_derivatives = really_use_symmetric_derivatives;
+   partials.fail_on_hitting_planet = saved_fail_on_hitting_planet;
+   partials.showing_deltas_in_debug_file = (showing_deltas_in_debug_file != 0);
+   partials.progress_text = tstr;
+   partials.progress_text_size = sizeof( tstr);
+   err_code = compute_partials( &partials, obs);
+   free( stm);
    memcpy( obs, orig_obs, n_obs * sizeof(Observe));
    free( orig_obs);
    if( err_code)
       {
       free( xresids);
       memcpy( orbit, original_orbit, n_orbit_params * sizeof( double));
-      return( -1);
+      runtime_message = nullptr;
+      return( err_code);
       }
 
    lsquare = lsquare_init( n_params);
@@ -3182,7 +4422,7 @@ int full_improvement(Observe *obs, int n_obs, double *orbit,
       {
       char tbuff[200];
       FILE *ofile = fopen_ext( get_file_name( tbuff, covariance_filename), "tfcwb");
-      FILE *json_ofile = fopen_ext( get_file_name( tbuff, "covar.json"), "tfcwb");
+      FILE *json_ofile = fopen_ext( get_file_name( tbuff, covariance_json_filename), "tfcwb");
       double *matrix = lsquare_covariance_matrix( lsquare);
       double *wtw = lsquare_wtw_matrix( lsquare);
       double eigenvals[MAX_N_PARAMS], eigenvectors[MAX_N_PARAMS * MAX_N_PARAMS];
@@ -4051,7 +5291,7 @@ double initial_orbit(Observe *obs, int n_obs, double *orbit)
    perturbers = AUTOMATIC_PERTURBERS | always_included_perturbers;
    if( !strcmp( obs->mpc_code, "Daw"))    /* For Dawn-based observations, */
       {                                   /* show a Ceres-centric orbit   */
-      extern int forced_central_body;     /* and include asteroid perts   */
+      extern thread_local int forced_central_body;  /* and include asteroid perts */
 
       forced_central_body = 100;
       dawn_based_observations = true;
@@ -4286,6 +5526,17 @@ double initial_orbit(Observe *obs, int n_obs, double *orbit)
    return( orbit_epoch);           /* ...and return epoch = JD of first observation */
 }
 
+/* Monte Carlo variants are generated and integrated on get_n_fit_threads()
+threads,  then written out in order on the main thread.  Variant 'i' draws
+its noise from random stream 'i' (see 'monte0.cpp'),  so the variants
+don't depend on the number of threads or the order in which they happen
+to be computed.  Set MONTE_CARLO_SEED to get the same variants every time;
+otherwise,  the seed comes from the main thread's generator,  giving a
+different (but still reproducible) set of variants for each run.
+
+   Note that the elements written for each variant use residuals etc.
+from the nominal orbit;  only the orbit itself varies.   */
+
 int orbital_monte_carlo( const double *orbit, Observe *obs, const int n_obs,
          const double curr_epoch, const double epoch_shown)
 {
@@ -4295,30 +5546,47 @@ int orbital_monte_carlo( const double *orbit, Observe *obs, const int n_obs,
    const char *saved_name = elements_filename;
    const char *vects_filename = get_environment_ptr( "VARIANT_VECT_FILE");
    FILE *ofile = (*vects_filename ? fopen( vects_filename, "wb") : nullptr);
+   const uint64_t fixed_seed = (uint64_t)strtoull(
+                        get_environment_ptr( "MONTE_CARLO_SEED"), nullptr, 10);
+   const uint64_t seed = (fixed_seed ? fixed_seed : random_64_bits( ));
+   double **main_eigenvects = eigenvects;
+   std::vector<double> sig_squared, chi_squared;
 
    assert( sr_orbits);
    n_sr_orbits = max_n_sr_orbits;
    available_sigmas = NO_SIGMAS_AVAILABLE;
    elements_filename = "sr_elems.txt";
+   sig_squared.resize( n_sr_orbits);
+   chi_squared.resize( n_sr_orbits);
+   run_variants( 0, n_sr_orbits, obs, (unsigned)n_obs, 0.,
+            [&]( const unsigned idx, Observe *tobs)
+               {
+               double *torbit = sr_orbits + idx * n_orbit_params;
+
+               eigenvects = main_eigenvects;
+               select_random_stream( seed, idx);
+               sig_squared[idx] = generate_mc_variant_from_covariance( torbit, orbit);
+               if( idx < 1000)
+                  {
+                  double rms;
+                  int n_resids;
+
+                  set_locs( torbit, curr_epoch, tobs, n_obs);
+                  rms = compute_weighted_rms( tobs, n_obs, &n_resids);
+                  chi_squared[idx] = rms * rms * n_resids;
+                  }
+               integrate_orbit( torbit, curr_epoch, epoch_shown);
+               });
    if( ofile)
       fprintf( ofile, "Epoch JD %f TDT\n", epoch_shown);
    for( i = 0; i < n_sr_orbits; i++)
       {
       double *torbit = sr_orbits + i * n_orbit_params;
-      const double sig_squared = generate_mc_variant_from_covariance( torbit, orbit);
       const char *format_str = "%+17.6f %+17.6f %+17.6f %+14.12f %+14.12f %+14.12f\n";
 
       if( i < 1000)
-         {
-         double rms;
-         int n_resids;
-
-         set_locs( torbit, curr_epoch, obs, n_obs);
-         rms = compute_weighted_rms( obs, n_obs, &n_resids);
-         debug_printf( "Var %4d: %9.6f %.8f\n", i, sig_squared,
-                        rms * rms * n_resids);
-         }
-      integrate_orbit( torbit, curr_epoch, epoch_shown);
+         debug_printf( "Var %4d: %9.6f %.8f\n", i, sig_squared[i],
+                        chi_squared[i]);
       write_out_elements_to_file( torbit, epoch_shown, epoch_shown,
            obs, n_obs, "", 6, 1, ELEM_OUT_ALTERNATIVE_FORMAT | ELEM_OUT_NO_COMMENT_DATA);
       append_elements_to_element_file = 1;
@@ -4333,7 +5601,6 @@ int orbital_monte_carlo( const double *orbit, Observe *obs, const int n_obs,
       }
    if( ofile)
       fclose( ofile);
-   set_locs( orbit, curr_epoch, obs, n_obs);
    compute_sr_sigmas( sr_orbits, n_sr_orbits, curr_epoch, epoch_shown);
    available_sigmas_hash = compute_available_sigmas_hash( obs, n_obs,
          epoch_shown, perturbers, 0);
@@ -4802,7 +6069,7 @@ int metropolis_search(Observe *obs, const int n_obs, double *orbit,
 {
    int iter;
    double rms = compute_weighted_rms( obs, n_obs, nullptr);
-   extern double **eigenvects;
+   extern thread_local double **eigenvects;
    double zorbit[MAX_N_PARAMS];
 
    if( !eigenvects)
@@ -4852,6 +6119,7 @@ int clean_up_find_orb_memory( void)
    get_observer_data( nullptr, nullptr, nullptr);
    get_object_name( nullptr, nullptr);
    planet_posn( -1, 0., nullptr);
+   reset_adaptive_perturbers( );
    add_gaussian_noise_to_obs( 0, nullptr, 0.);
    full_improvement( nullptr, 0, nullptr, 0., nullptr, 0, 0.);
    if( sr_orbits)
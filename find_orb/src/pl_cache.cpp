@@ -42,15 +42,59 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <cstring>
 #include <cassert>
 #include <cmath>
+#include <mutex>
+#include <atomic>
+#include <vector>
 #ifdef TIMING_ON
     #include <time.h>
 #endif
 
 extern int debug_level;
 
-int64_t planet_ns;
+thread_local int64_t planet_ns;
 static void *jpl_eph = nullptr;
 
+/* The JPL ephemeris (and the 'jpl_eph' pointer itself) is shared by all
+threads.  Loading it,  the fallbacks when it's missing,  and the BC-405
+asteroids all go through planet_posn_raw() with this lock held.  Once the
+ephemeris is loaded,  though,  it's published in 'shared_jpl_eph',  and
+positions come from jpl_pleph_r() with a per-thread scratch area,  with
+no locking at all.  (Even the locked path is only taken on a cache miss
+in planet_posn().)  */
+
+static std::mutex ephem_mutex;
+static std::atomic<void *> shared_jpl_eph( nullptr);
+static std::atomic<int> jpl_eph_generation( 0);
+
+/* Each thread allocates its own JPL scratch area when it first needs
+one,  and frees it when the thread exits.  If the ephemeris is re-loaded
+(the generation number changes),  the scratch area is re-allocated to
+match the new one.   */
+
+struct Jpl_scratch_holder
+{
+   void *scratch = nullptr;
+   int generation = -1;
+   ~Jpl_scratch_holder( ) { if( scratch) jpl_free_scratch( scratch); }
+};
+
+static thread_local Jpl_scratch_holder jpl_scratch;
+
+static void *get_jpl_scratch( void *eph)
+{
+   const int generation = jpl_eph_generation;
+
+   if( jpl_scratch.generation != generation)
+      {
+      if( jpl_scratch.scratch)
+         jpl_free_scratch( jpl_scratch.scratch);
+      jpl_scratch.scratch = jpl_alloc_scratch( eph);
+      jpl_scratch.generation = generation;
+      }
+   return( jpl_scratch.scratch);
+}
+
+#define PI 3.1415926535897932384626433832795028841971693993751058209749445923
 #define J2000 2451545.0
 #define J0 (J2000 - 2000. * 365.25)
 #define JD_TO_YEAR( jd)  (((jd)-J2000) / 365.25 + 2000.)
@@ -59,10 +103,26 @@ static void *jpl_eph = nullptr;
 
 
 
-static int planet_posn_raw( int planet_no, const double jd,
-                            double *vect_2000)
+/* Planets 1-9 are heliocentric;  planet 3 is the Earth-Moon barycenter,
+and 10 is the geocentric moon.  With a null scratch pointer,  the
+(non-reentrant) jpl_pleph() is used,  and the caller must hold the lock. */
+
+static int jpl_planet_state( void *eph, void *scratch, const int planet_no,
+                        const double jd, double *state, const int calc_vel)
 {
    const int jpl_center = 11;         /* default to heliocentric */
+   const int target = (planet_no == 3 ? 13 : planet_no);
+   const int center = (planet_no == 10 ? 3 : jpl_center);
+
+   if( scratch)
+      return( jpl_pleph_r( eph, scratch, jd, target, center, state, calc_vel));
+   else
+      return( jpl_pleph( eph, jd, target, center, state, calc_vel));
+}
+
+static int unlocked_planet_posn_raw( int planet_no, const double jd,
+                            double *vect_2000)
+{
    int rval = 0;
    static const char *jpl_filename = nullptr;
    const int bc405_start = 100;
@@ -139,6 +199,11 @@ static int planet_posn_raw( int planet_no, const double jd,
                jpl_get_double( jpl_eph, JPL_EPHEM_AU_IN_KM),
                jpl_get_double( jpl_eph, JPL_EPHEM_EARTH_MOON_RATIO));
          }
+      if( jpl_eph)            /* publish it for lock-free use */
+         {
+         jpl_eph_generation++;
+         shared_jpl_eph = jpl_eph;
+         }
       }
 
    if( jpl_eph)
@@ -148,16 +213,16 @@ static int planet_posn_raw( int planet_no, const double jd,
 
       if( planet_no < 0)          /* flag to unload everything */
          {
+         shared_jpl_eph = nullptr;
+         jpl_eph_generation++;
          jpl_close_ephemeris( jpl_eph);
          jpl_eph = nullptr;
          jpl_filename = nullptr;
          return( 0);
          }
-      else if( planet_no == 10)
-         failure_code = jpl_pleph( jpl_eph, jd, 10, 3, state, calc_vel);
       else
-         failure_code = jpl_pleph( jpl_eph, jd,
-              (planet_no == 3) ? 13 : planet_no, jpl_center, state, calc_vel);
+         failure_code = jpl_planet_state( jpl_eph, nullptr, planet_no, jd,
+                                          state, calc_vel);
       if( !failure_code)         /* we're done */
          {
          if( debug_level > 8)
@@ -214,170 +279,362 @@ static int planet_posn_raw( int planet_no, const double jd,
             }
          rval = 0;
          }
+      else     /* e.g.,  the SSB:  the sun is the best we can do,  and */
+         {     /* is better than leaving 'vect_2000' uninitialized */
+         vect_2000[0] = vect_2000[1] = vect_2000[2] = 0.;
+         }
       }
 
    return( rval);
 }
 
-#define POSN_CACHE struct posn_cache
-
-POSN_CACHE
-   {
-   double jd;
-   double vect[3];
-   int planet_no;
-   };
+static int planet_posn_raw( const int planet_no, const double jd,
+                            double *vect_2000)
+{
+   void *eph = shared_jpl_eph.load( std::memory_order_acquire);
+   const int calc_vel = (planet_no > PLANET_POSN_VELOCITY_OFFSET - 2);
+   const int body = planet_no - (calc_vel ? PLANET_POSN_VELOCITY_OFFSET : 0);
 
-#define POSN_NODE struct posn_node
+   if( eph && body > 0 && body <= 10)
+      {
+      void *scratch = get_jpl_scratch( eph);
+      double state[6];
 
-POSN_NODE
-   {
-   double min_jd;
-   int used;
-   POSN_CACHE *data;
-   };
+      if( scratch && !jpl_planet_state( eph, scratch, body, jd, state, calc_vel))
+         {
+         memcpy( vect_2000, state + calc_vel * 3, 3 * sizeof( double));
+         equatorial_to_ecliptic( vect_2000);
+         return( 0);
+         }
+      }     /* on failure,  fall through to get the usual error handling */
 
-#define node_size                     1659
-   /* When a node is 90% full,  it's time to split it. */
-#define splitting_size    (node_size - (node_size / 10))
-   /* If a node reaches splitting_size,  "spill over" to an adjacent  */
-   /* node if it's less than half full : */
-#define spillover_size    (node_size / 2)
-int n_posns_cached = 0;
+   const std::lock_guard<std::mutex> lock( ephem_mutex);
 
-/* Hash the JD and planet number.  It seems a fair bit of time is
-spent in this function,  so I spent a good bit of time trying to make
-it as simple/fast as possible while still giving good distribution
-(i.e.,  no more or not many more table collisions than would be
-expected with a "perfectly randomizing" hash function.)  It helps
-that node_size is not a power of two.
+   return( unlocked_planet_posn_raw( planet_no, jd, vect_2000));
+}
 
-   Note that it works well _for the planet positions being hashed
-here_.  Don't rely on it as a general-purpose hashing function!
+/* For a fit over a known span of time,  we can do better than caching
+individual positions.  cover_planet_tables() fits Chebyshev polynomials
+to the positions of the planets (and the lunar offset) over that span,
+much as the JPL ephemerides themselves do,  and planet_posn() then gets
+positions within the span with a few multiply-adds,  with no hashing or
+locking.  This is off unless PLANET_TABLES=1 in 'environ.dat'.
+
+   Segment lengths and polynomial degrees are a little more generous
+than those in DE-430 (where,  for example,  Mercury gets 8-day segments
+with 14 coefficients).  Segments are aligned to multiples of their length
+from J2000,  so the coefficients for a given segment don't depend on
+the span requested,  and fits made with tables built for different
+spans agree.
+
+   A table is never modified once built.  If a span is requested that
+the current table doesn't cover,  a new table is built (covering both,
+if they're reasonably close together) and swapped in atomically.  The old
+one may still be in use by another thread,  so it's 'retired' rather than
+freed.  Readers announce themselves with a simple epoch scheme:  before
+loading the table pointer,  a thread copies the current 'table_epoch'
+into its own slot in reader_epochs[],  and zeroes the slot when done.
+Swapping in a new table bumps the epoch;  a retired table is freed once
+no slot shows an epoch older than the one at which it was retired,
+since any reader that could have loaded the old pointer must have
+announced an older epoch.  A thread that can't get a slot (there are
+MAX_TABLE_READERS of them) just doesn't use the tables.    */
+
+#define N_TABLE_PLANETS 10
+#define MAX_CHEB_COEFFS 16
+
+struct Cheb_planet
+{
+   double seg_len;
+   int n_coeffs;
+   int64_t first_seg, n_segs;
+   double *coeffs;              /* n_segs * 3 * n_coeffs */
+};
 
-   Updated 2015 Feb 12:  MSVC objected to simply setting
+struct Planet_tables
+{
+   double jd_start, jd_end;
+   Cheb_planet planet[N_TABLE_PLANETS + 1];     /* [0] (the sun) is unused */
+};
 
-   const int32_t *dword_ptr = (int32_t *)&jd;
+static const double cheb_seg_len[N_TABLE_PLANETS + 1] = { 0.,
+                  8., 16., 16., 32., 32., 32., 32., 32., 32., 4. };
+static const int cheb_n_coeffs[N_TABLE_PLANETS + 1] = { 0,
+                  16, 12, 15, 13, 10, 9, 8, 8, 8, 15 };
 
-   and accessing the four-byte halves of jd directly,  so we're now
-doing a totally pointless memcpy.         */
+#define MAX_TABLE_READERS 256
 
-static inline int hash_function( const int planet_no, const double jd)
+struct Retired_tables
+{
+   Planet_tables *tables;
+   uint64_t epoch;
+};
+
+static std::atomic<Planet_tables *> planet_tables( nullptr);
+static std::vector<Retired_tables> retired_tables;
+static std::mutex tables_mutex;
+static std::atomic<int> use_planet_tables( -1);
+static std::atomic<uint64_t> table_epoch( 1);
+static std::atomic<uint64_t> reader_epochs[MAX_TABLE_READERS];
+static std::atomic<bool> reader_slot_taken[MAX_TABLE_READERS];
+
+/* Each thread claims a reader slot the first time it looks at the
+tables,  and gives it back when the thread exits. */
+
+struct Table_reader_slot
 {
-   int32_t dword_ptr[2];
-   int rval;
+   int idx;
+
+   Table_reader_slot( )
+   {
+      for( idx = 0; idx < MAX_TABLE_READERS; idx++)
+         if( !reader_slot_taken[idx].exchange( true))
+            return;
+      idx = -1;
+   }
+   ~Table_reader_slot( )
+   {
+      if( idx >= 0)
+         reader_slot_taken[idx].store( false);
+   }
+};
 
-   memcpy( dword_ptr, &jd, sizeof( double));
-   rval = dword_ptr[0] ^ dword_ptr[1] ^ (planet_no << 8);
+static thread_local Table_reader_slot reader_slot;
 
-   rval &= 0x7fffffff;
-   rval %= node_size;
-   assert( rval >= 0);
-   assert( rval < node_size);
-   return( rval);
+static const Planet_tables *acquire_planet_tables( void)
+{
+   if( reader_slot.idx < 0)
+      return( nullptr);
+   reader_epochs[reader_slot.idx].store( table_epoch.load( ));
+   return( planet_tables.load( ));
 }
 
-/* When a node gets to 'splitting_size' values,  we compact them
-(removing unused entries),  then partition them in half.  We do
-that partitioning,  at least for the nonce,  the lazy way : we
-sort the entire array.  */
+static inline void release_planet_tables( void)
+{
+   if( reader_slot.idx >= 0)
+      reader_epochs[reader_slot.idx].store( 0, std::memory_order_release);
+}
 
+/* Builds one planet's coefficients by interpolating at the Chebyshev
+nodes of each segment.  That's not quite a least-squares or minimax fit,
+but it's within a hair of the latter,  and far simpler.  Returns the
+largest error found at segment midpoints (which aren't nodes),  for
+debugging purposes,  or a negative value if planet_posn_raw() failed. */
 
-static int compare_cached_posns( const void *a, const void *b, [[maybe_unused]] void *ignored_context)
+static double build_cheb_planet( Cheb_planet *cp, const int planet_no,
+                                 const double jd_start, const double jd_end)
 {
-   const POSN_CACHE *pa = (const POSN_CACHE *)a;
-   const POSN_CACHE *pb = (const POSN_CACHE *)b;
-   int rval;
+   const int n = cheb_n_coeffs[planet_no];
+   int64_t seg;
+   double max_err = 0.;
+
+   cp->seg_len = cheb_seg_len[planet_no];
+   cp->n_coeffs = n;
+   cp->first_seg = (int64_t)floor( (jd_start - J2000) / cp->seg_len);
+   cp->n_segs = (int64_t)floor( (jd_end - J2000) / cp->seg_len)
+                  - cp->first_seg + 1;
+   cp->coeffs = (double *)calloc( (size_t)cp->n_segs * 3 * n, sizeof( double));
+   if( !cp->coeffs)
+      return( -1.);
+   for( seg = 0; seg < cp->n_segs; seg++)
+      {
+      const double jd0 = J2000 + (double)( cp->first_seg + seg) * cp->seg_len;
+      const double half_len = cp->seg_len / 2.;
+      double *coeffs = cp->coeffs + seg * 3 * n;
+      double posn[MAX_CHEB_COEFFS][3], mid_posn[3], check[3];
+      int i, j, k;
 
-   if( pa->jd > pb->jd)
-      rval = 1;
-   else if( pa->jd < pb->jd)
-      rval = -1;
-   else
-      rval = 0;
-   return( rval);
+      for( k = 0; k < n; k++)
+         {
+         const double x = cos( PI * ((double)k + .5) / (double)n);
+
+         if( planet_posn_raw( planet_no, jd0 + half_len * (x + 1.), posn[k]))
+            return( -1.);
+         }
+      for( j = 0; j < n; j++)
+         for( i = 0; i < 3; i++)
+            {
+            double sum = 0.;
+
+            for( k = 0; k < n; k++)
+               sum += posn[k][i] * cos( PI * (double)j * ((double)k + .5) / (double)n);
+            coeffs[i * n + j] = sum * 2. / (double)n;
+            }
+      for( i = 0; i < 3; i++)
+         coeffs[i * n] /= 2.;
+      if( debug_level > 2)
+         {
+         planet_posn_raw( planet_no, jd0 + half_len, mid_posn);
+         for( i = 0; i < 3; i++)
+            {              /* at x = 0,  T_j alternates 1, 0, -1, 0, 1... */
+            check[i] = 0.;
+            for( j = 0; j < n; j += 2)
+               check[i] += (j % 4 ? -coeffs[i * n + j] : coeffs[i * n + j]);
+            if( max_err < fabs( check[i] - mid_posn[i]))
+               max_err = fabs( check[i] - mid_posn[i]);
+            }
+         }
+      }
+   return( max_err);
 }
 
-static void collapse_and_partition( POSN_CACHE *ovals, const POSN_CACHE *ivals)
+static void free_planet_tables( Planet_tables *tables)
 {
-   int i, array_size;
+   int i;
 
-   for( i = array_size = 0; i < node_size; i++)
-      if( ivals[i].planet_no)
-         ovals[array_size++] = ivals[i];
-   assert( array_size == splitting_size);
-   shellsort_r( ovals, array_size, sizeof( POSN_CACHE), compare_cached_posns, nullptr);
+   for( i = 1; i <= N_TABLE_PLANETS; i++)
+      free( tables->planet[i].coeffs);
+   free( tables);
 }
 
-/*   The following three long ints keep track of the number of searches
-and probes done,  and the "worst-case" maximum number of probes required,
-just to check that the hash function is truly random enough.      */
+/* Frees retired tables that no reader can still be using.  Call with
+tables_mutex locked. */
 
-/* #define TEST_PLANET_CACHING_HASH_FUNCTION */
+static void free_retired_tables( void)
+{
+   uint64_t oldest = UINT64_MAX;
+   size_t i, j;
 
-#ifdef TEST_PLANET_CACHING_HASH_FUNCTION
-long total_n_searches = 0, total_n_probes = 0, max_probes_required = 0;
-#endif
+   for( i = 0; i < MAX_TABLE_READERS; i++)
+      {
+      const uint64_t epoch = reader_epochs[i].load( );
+
+      if( epoch && epoch < oldest)
+         oldest = epoch;
+      }
+   for( i = j = 0; i < retired_tables.size( ); i++)
+      if( retired_tables[i].epoch <= oldest)
+         free_planet_tables( retired_tables[i].tables);
+      else
+         retired_tables[j++] = retired_tables[i];
+   retired_tables.resize( j);
+}
 
-static int find_within_node( const int planet_no, const double jd, const POSN_CACHE *cache)
+static Planet_tables *build_planet_tables( const double jd_start, const double jd_end)
 {
-   int loc = hash_function( planet_no, jd);
-   int n_probes = 1;
+   Planet_tables *rval = (Planet_tables *)calloc( 1, sizeof( Planet_tables));
+   int i;
 
-   while( cache[loc].planet_no)
+   if( !rval)
+      return( nullptr);
+   rval->jd_start = jd_start;
+   rval->jd_end = jd_end;
+   for( i = 1; i <= N_TABLE_PLANETS; i++)
       {
-      if( cache[loc].planet_no == planet_no && cache[loc].jd == jd)
-         break;
-      n_probes++;
-      loc = (loc + n_probes) % node_size;
+      const double max_err = build_cheb_planet( rval->planet + i, i,
+                                       jd_start, jd_end);
+
+      if( max_err < 0.)
+         {
+         free_planet_tables( rval);
+         return( nullptr);
+         }
+      if( debug_level > 2)
+         debug_printf( "Planet %d: %d segments,  max err %.3g AU\n", i,
+                  (int)rval->planet[i].n_segs, max_err);
       }
-#if 0
-   for( int i = 0; i < node_size; i++)
-      if( i != loc)
-         assert( cache[i].planet_no != planet_no || cache[i].jd != jd);
-#endif
-#ifdef TEST_PLANET_CACHING_HASH_FUNCTION
-   if( max_probes_required < n_probes)
-      max_probes_required = n_probes;
-   total_n_searches++;
-   total_n_probes += n_probes;
-#endif
-   return( loc);
+   return( rval);
 }
 
-/* At one time or another,  I've had concerns that the scheme for caching
-planetary positions (essentially a single-level hashed B-tree;  see
-'pl_cache.txt' for details) was buggy.  The check_integrity() function does
-some basic consistency tests (are all the nodes within the time range
-they're supposed to be?  is the number of used nodes what it's supposed to
-be?)  If such concerns recur,  we can #define CHECK_CACHING_INTEGRITY
-and see if it finds anything we need to worry about.
+/* Returns 0 if planetary positions from jd_start to jd_end will come from
+the Chebyshev tables,  or -1 if tables are turned off or couldn't be
+built (in which case planet_posn() works just as it did before). */
 
-#define CHECK_CACHING_INTEGRITY
-*/
-
-#ifdef CHECK_CACHING_INTEGRITY
-static void check_integrity( const POSN_NODE *nodes, const int n_nodes)
+int cover_planet_tables( double jd_start, double jd_end)
 {
-   int i;
+   Planet_tables *tables;
 
-   for( i = 0; i < n_nodes; i++, nodes++)
+   if( use_planet_tables < 0)
+      use_planet_tables = atoi( get_environment_ptr( "PLANET_TABLES"));
+   if( !use_planet_tables)
+      return( -1);
+   if( jd_start > jd_end)
       {
-      int j, n_used = 0;
-      const double max_jd = (i < n_nodes - 1 ? nodes[1].min_jd : 1e+20);
-      const POSN_CACHE *cptr = nodes->data;
+      const double temp = jd_start;
 
-      for( j = 0; j < node_size; j++, cptr++)
-         if( cptr->planet_no)
-            {
-            assert( cptr->jd >= nodes->min_jd);
-            assert( cptr->jd <= max_jd);
-            n_used++;
-            }
-      assert( n_used == nodes->used);
+      jd_start = jd_end;
+      jd_end = temp;
       }
+   const Planet_tables *curr_tables = acquire_planet_tables( );
+   const bool covered = (curr_tables && curr_tables->jd_start <= jd_start
+                                     && curr_tables->jd_end >= jd_end);
+
+   release_planet_tables( );
+   if( covered)
+      return( 0);
+
+   const std::lock_guard<std::mutex> lock( tables_mutex);
+   const double max_gap = 365.25;
+
+   tables = planet_tables.load( std::memory_order_acquire);
+   if( tables && tables->jd_start <= jd_start && tables->jd_end >= jd_end)
+      return( 0);       /* another thread built what we need */
+   jd_start -= 1.;      /* leave a little slack for integration steps */
+   jd_end += 1.;
+   if( tables && jd_start < tables->jd_end + max_gap
+              && jd_end > tables->jd_start - max_gap)
+      {                             /* extend existing table */
+      if( jd_start > tables->jd_start)
+         jd_start = tables->jd_start;
+      if( jd_end < tables->jd_end)
+         jd_end = tables->jd_end;
+      }
+   Planet_tables *new_tables = build_planet_tables( jd_start, jd_end);
+
+   if( !new_tables)
+      return( -1);
+   planet_tables.store( new_tables);
+   if( tables)
+      retired_tables.push_back( { tables, ++table_epoch });
+   free_retired_tables( );
+   return( 0);
+}
+
+/* Only call this when no other thread is using the tables. */
+
+static void free_all_planet_tables( void)
+{
+   const std::lock_guard<std::mutex> lock( tables_mutex);
+   Planet_tables *tables = planet_tables.exchange( nullptr);
+
+   if( tables)
+      free_planet_tables( tables);
+   for( Retired_tables &t : retired_tables)
+      free_planet_tables( t.tables);
+   retired_tables.clear( );
+   use_planet_tables = -1;
+}
+
+/* Evaluates the Chebyshev series by Clenshaw's recurrence.  Returns
+false if the table doesn't cover the JD in question. */
+
+static inline bool planet_posn_from_tables( const Planet_tables *tables,
+                  const int planet_no, const double jd, double *vect_2000)
+{
+   const Cheb_planet *cp = tables->planet + planet_no;
+   const double t = (jd - J2000) / cp->seg_len;
+   const int64_t seg = (int64_t)floor( t) - cp->first_seg;
+   const int n = cp->n_coeffs;
+   const double *coeffs;
+   double x, b1[3] = { 0., 0., 0. }, b2[3] = { 0., 0., 0. };
+   int i, j;
+
+   if( seg < 0 || seg >= cp->n_segs)
+      return( false);
+   coeffs = cp->coeffs + seg * 3 * n;
+   x = 2. * (t - floor( t)) - 1.;
+   for( j = n - 1; j >= 1; j--)
+      for( i = 0; i < 3; i++)
+         {
+         const double b0 = 2. * x * b1[i] - b2[i] + coeffs[i * n + j];
+
+         b2[i] = b1[i];
+         b1[i] = b0;
+         }
+   for( i = 0; i < 3; i++)
+      vect_2000[i] = x * b1[i] - b2[i] + coeffs[i * n];
+   return( true);
 }
-#endif         /* #ifdef CHECK_CACHING_INTEGRITY */
 
 /* Computing planetary positions is somewhat expensive if we're using
 JPL ephemerides,  and _very_ expensive if we aren't (the PS-1996 method
@@ -386,40 +643,215 @@ requesting the same data over and over (for example,  if we're integrating
 over a particular time span repeatedly).  So it makes sense to cache the
 planetary positions.
 
-   Below,  this is done with a hash table in a very standard sort of way.
-The planet_no and jd are hashed, we look in the 'cache' table,  we do a
-quadratic search if there's an hash collision.  If we find the data,  we
-return it.  If we don't find it,  we call the planet_posn_raw( ) (uncached)
-function, and add the result to the cache, and _then_ return it.
+   The cache is one table shared by every thread.  (Previously,  it was a
+single-level hashed B-tree,  private to one thread;  see 'pl_cache.txt'.)
+It's set-associative:  the planet number and JD are hashed to pick a set
+of N_WAYS slots,  and the position can be in any of those slots.  The
+table size is fixed when it's first used (see PLANET_CACHE_SIZE in
+'environ.def'),  so memory use is bounded.
+
+   Reads take no locks.  Each slot has a sequence number that is odd while
+the slot is being written.  A reader notes the sequence number,  copies
+the slot,  and checks that the number hasn't changed;  if it has,  or if
+it was odd,  the read is treated as a cache miss.  A writer claims a slot
+by bumping its sequence number from even to odd with a compare-exchange;
+if that fails,  someone else is writing there,  and we just don't bother
+caching that position.  Everything in a slot is stored in atomic words,
+so none of this involves data races as far as C++ is concerned.
+
+   When a set is full,  a slot is evicted using the 'clock' algorithm:
+each slot has a 'referenced' flag,  set whenever it's read.  The set's
+clock hand sweeps over the slots,  clearing flags,  until it finds a
+slot that hasn't been referenced since the last sweep.  That gives us
+something close to LRU without having to update a list on every hit. */
+
+#define N_WAYS  8
+
+struct Posn_slot
+{
+   std::atomic<uint32_t> seq;
+   std::atomic<uint32_t> referenced;
+   std::atomic<uint64_t> key;          /* planet_no;  zero = empty slot */
+   std::atomic<uint64_t> words[4];     /* JD,  then x, y, z,  as bits */
+};
+
+struct Posn_set
+{
+   Posn_slot slot[N_WAYS];
+   std::atomic<uint32_t> hand;
+};
 
-   When the table is more than 80% full,  we double the table size,  dump
-everything computed to date,  and start from scratch.  This is admittedly
-mildly wasteful,  but I don't think the performance benefit of expanding
-the cache and adding everything we've got back in would be worthwhile.
-(It wouldn't be hard to do,  though.)
+static std::atomic<Posn_set *> cache_sets( nullptr);
+static uint64_t n_sets;                  /* always a power of two */
+static std::mutex cache_alloc_mutex;
 
-   If the cache gets above some limit (currently set to a million cached
-positions,  or about 36 MBytes),  we stop growing the cache.  So if you
-had a _really_ long integration,  the cache gets dumped,  rebuilt to the
-same size,  dumped again,  built to the same size,  etc.
+static std::atomic<uint64_t> total_hits( 0), total_misses( 0), total_evictions( 0);
 
-   Previously,  the data was stored using a balanced tree.  I don't know
-what possessed me to do something that dumb.  (At the very least,  had
-I keyed the tree using the above hash function,  entries to the tree would
-have been nearly random,  and a plain old unbalanced tree would have worked
-Just Fine.)    */
+/* Counting every hit in a shared atomic would have all the threads
+fighting over one cache line,  which is exactly what we're trying to
+avoid.  So each thread counts locally,  and adds its counts to the
+totals every so often (and when it's done).  */
 
-#define MAX_N_NODES 10000
+static thread_local uint64_t local_hits, local_misses, local_evictions;
+thread_local int n_posns_cached = 0;
+
+static void flush_cache_counters( void)
+{
+   total_hits += local_hits;
+   total_misses += local_misses;
+   total_evictions += local_evictions;
+   local_hits = local_misses = local_evictions = 0;
+}
+
+void get_planet_cache_stats( Planet_cache_stats *stats)
+{
+   flush_cache_counters( );
+   stats->hits = total_hits;
+   stats->misses = total_misses;
+   stats->evictions = total_evictions;
+   stats->n_slots = (cache_sets ? n_sets * N_WAYS : 0);
+}
+
+static Posn_set *get_cache_sets( void)
+{
+   Posn_set *rval = cache_sets.load( std::memory_order_acquire);
+
+   if( !rval)
+      {
+      const std::lock_guard<std::mutex> lock( cache_alloc_mutex);
+
+      rval = cache_sets.load( std::memory_order_acquire);
+      if( !rval)
+         {
+         uint64_t n_slots = (uint64_t)atof( get_environment_ptr( "PLANET_CACHE_SIZE"));
+
+         if( n_slots < 1024)
+            n_slots = 1 << 19;
+         n_sets = 1;
+         while( n_sets * N_WAYS < n_slots)
+            n_sets <<= 1;
+         rval = new Posn_set[n_sets]( );
+         cache_sets.store( rval, std::memory_order_release);
+         }
+      }
+   return( rval);
+}
+
+/* Only call this when no other thread is using the cache;  i.e.,  when
+unloading the ephemeris from the main thread.  */
+
+static void free_cache( void)
+{
+   const std::lock_guard<std::mutex> lock( cache_alloc_mutex);
+
+   delete[] cache_sets.exchange( nullptr);
+   n_posns_cached = 0;
+}
+
+/* Mixes the bits of the JD and planet number thoroughly (this is the
+'splitmix64' finalizer),  so that positions are spread evenly over the
+sets no matter how regular the JDs are.   */
+
+static inline uint64_t hash_function( const int planet_no, const double jd)
+{
+   uint64_t rval;
+
+   memcpy( &rval, &jd, sizeof( double));
+   rval ^= (uint64_t)planet_no * 0x9e3779b97f4a7c15ULL;
+   rval ^= rval >> 30;
+   rval *= 0xbf58476d1ce4e5b9ULL;
+   rval ^= rval >> 27;
+   rval *= 0x94d049bb133111ebULL;
+   rval ^= rval >> 31;
+   return( rval);
+}
+
+static bool find_in_cache( Posn_set *set, const uint64_t key, const uint64_t jd_bits,
+                           double *vect)
+{
+   int i;
+
+   for( i = 0; i < N_WAYS; i++)
+      {
+      Posn_slot *slot = set->slot + i;
+
+      if( slot->key.load( std::memory_order_relaxed) == key)
+         {
+         const uint32_t seq0 = slot->seq.load( std::memory_order_acquire);
+         uint64_t words[4];
+         size_t j;
+
+         if( seq0 & 1)        /* someone's writing here right now */
+            continue;
+         for( j = 0; j < 4; j++)
+            words[j] = slot->words[j].load( std::memory_order_relaxed);
+         std::atomic_thread_fence( std::memory_order_acquire);
+         if( slot->key.load( std::memory_order_relaxed) == key
+                     && words[0] == jd_bits
+                     && slot->seq.load( std::memory_order_relaxed) == seq0)
+            {
+            memcpy( vect, words + 1, 3 * sizeof( double));
+            if( !slot->referenced.load( std::memory_order_relaxed))
+               slot->referenced.store( 1, std::memory_order_relaxed);
+            return( true);
+            }
+         }
+      }
+   return( false);
+}
+
+static void add_to_cache( Posn_set *set, const uint64_t key, const uint64_t jd_bits,
+                           const double *vect)
+{
+   Posn_slot *slot = nullptr;
+   uint32_t seq0;
+   bool evicting = false;
+   int i;
+
+   for( i = 0; i < N_WAYS && !slot; i++)     /* use an empty slot if we can */
+      if( !set->slot[i].key.load( std::memory_order_relaxed))
+         slot = set->slot + i;
+   for( i = 0; i < 2 * N_WAYS && !slot; i++)  /* otherwise,  run the clock */
+      {
+      Posn_slot *tslot = set->slot +
+                 set->hand.fetch_add( 1, std::memory_order_relaxed) % N_WAYS;
+
+      if( !tslot->referenced.exchange( 0, std::memory_order_relaxed)
+                                    || i == 2 * N_WAYS - 1)
+         {
+         slot = tslot;
+         evicting = true;
+         }
+      }
+   seq0 = slot->seq.load( std::memory_order_relaxed);
+   if( (seq0 & 1) || !slot->seq.compare_exchange_strong( seq0, seq0 + 1,
+                                 std::memory_order_acquire))
+      return;              /* another thread is writing to this slot */
+   std::atomic_thread_fence( std::memory_order_release);
+   if( evicting && slot->key.load( std::memory_order_relaxed))
+      local_evictions++;
+   slot->key.store( key, std::memory_order_relaxed);
+   slot->words[0].store( jd_bits, std::memory_order_relaxed);
+   for( i = 0; i < 3; i++)
+      {
+      uint64_t bits;
+
+      memcpy( &bits, vect + i, sizeof( double));
+      slot->words[i + 1].store( bits, std::memory_order_relaxed);
+      }
+   slot->referenced.store( 1, std::memory_order_relaxed);
+   slot->seq.store( seq0 + 2, std::memory_order_release);
+   n_posns_cached++;
+}
 
 int planet_posn( const int planet_no, const double jd, double *vect_2000)
 {
-   static POSN_NODE *nodes = nullptr;
-   static int n_nodes = 0, n_nodes_alloced = 0, curr_node = 0;
-   int loc, rval = 0;
+   Posn_set *set;
+   uint64_t hash, jd_bits;
+   int rval = 0;
 #ifdef TIMING_ON
    int64_t t_start;
 #endif
-   POSN_CACHE *cache;
 
    assert( fabs( jd) < 1e+9);
    if( !planet_no)            /* the sun */
@@ -428,26 +860,29 @@ int planet_posn( const int planet_no, const double jd, double *vect_2000)
       return( 0);
       }
 
-   if( planet_no < 0 || n_nodes >= MAX_N_NODES)
-      {                                  /* flag to unload everything */
-      int i;
-
-      for( i = 0; i < n_nodes; i++)
-         if( nodes[i].data)
-            free( nodes[i].data);
-      if( nodes)
-         free( nodes);
-      nodes = nullptr;
-      n_posns_cached = 0;
-      n_nodes = n_nodes_alloced = curr_node = 0;
-      }
-
    if( planet_no < 0)
       {
-      planet_posn_raw( -1, 0., nullptr);
+      flush_cache_counters( );
+      if( planet_no != PLANET_POSN_FLUSH_THREAD_STATS)
+         {                               /* flag to unload everything */
+         free_cache( );
+         free_all_planet_tables( );
+         planet_posn_raw( -1, 0., nullptr);
+         }
       return( 0);
       }
 
+   if( planet_no <= N_TABLE_PLANETS)
+      {
+      const Planet_tables *tables = acquire_planet_tables( );
+      const bool got_it = (tables
+                  && planet_posn_from_tables( tables, planet_no, jd, vect_2000));
+
+      release_planet_tables( );
+      if( got_it)
+         return( 0);
+      }
+
    if( (planet_no % PLANET_POSN_VELOCITY_OFFSET) == PLANET_POSN_EARTH
              || (planet_no % PLANET_POSN_VELOCITY_OFFSET) == PLANET_POSN_MOON)
       {
@@ -472,118 +907,126 @@ int planet_posn( const int planet_no, const double jd, double *vect_2000)
       return( rval);
       }
 
-   if( !nodes || n_nodes == n_nodes_alloced - 1)
+   set = get_cache_sets( );
+   hash = hash_function( planet_no, jd);
+   set += hash & (n_sets - 1);
+   memcpy( &jd_bits, &jd, sizeof( double));
+   if( find_in_cache( set, (uint64_t)planet_no, jd_bits, vect_2000))
       {
-      const unsigned new_n_alloced = 100 + 3 * n_nodes_alloced / 2;
-
-      nodes = (POSN_NODE *)realloc( nodes, new_n_alloced * sizeof( POSN_NODE));
-      assert( nodes);
-      if( !n_nodes_alloced)      /* set up first node : */
-         {
-         n_nodes = 1;
-         nodes[0].min_jd = -1e+10;
-         nodes[0].used = 0;
-         nodes[0].data = (POSN_CACHE *)calloc( node_size, sizeof( POSN_CACHE));
-         }
-      n_nodes_alloced = new_n_alloced;
+      if( ++local_hits >= 4096)
+         flush_cache_counters( );
+      return( 0);
       }
-
-             /* Now,  find the right node in which to find/store this posn: */
-   while( curr_node + 1 < n_nodes && nodes[curr_node + 1].min_jd <= jd)
-      curr_node++;
-   while( curr_node && jd < nodes[curr_node].min_jd)
-      curr_node--;
-   assert( jd >= nodes[curr_node].min_jd);
-   assert( curr_node == n_nodes - 1 || jd < nodes[curr_node + 1].min_jd);
-
-   cache = nodes[curr_node].data;
-   loc = find_within_node( planet_no, jd, cache);
+   local_misses++;
 
 #ifdef TIMING_ON
    t_start = nanoseconds_since_1970( );
 #endif
-
-   if( !cache[loc].planet_no)
-      {
-      cache[loc].planet_no = planet_no;
-      cache[loc].jd = jd;
-      nodes[curr_node].used++;
-      rval = planet_posn_raw( planet_no, jd, cache[loc].vect);
-      n_posns_cached++;
-      }
-   else
-      {
-      assert( cache[loc].planet_no == planet_no);
-      assert( cache[loc].jd == jd);
-      memcpy( vect_2000, cache[loc].vect, 3 * sizeof( double));
-      return( rval);
-      }
+   rval = planet_posn_raw( planet_no, jd, vect_2000);
 #ifdef TIMING_ON
    planet_ns += nanoseconds_since_1970( ) - t_start;
 #endif
-   memcpy( vect_2000, cache[loc].vect, 3 * sizeof( double));
-   assert( nodes[curr_node].used <= splitting_size);
-#ifdef CHECK_CACHING_INTEGRITY
-   if( n_posns_cached % 10000 == 0)
-      check_integrity( nodes, n_nodes);
-#endif
-   if( nodes[curr_node].used == splitting_size)
+   if( !rval)
+      add_to_cache( set, (uint64_t)planet_no, jd_bits, vect_2000);
+   return( rval);
+}
+
+/* Gets the positions of one planet for 'n' JDs,  with the same results
+as calling planet_posn() for each.  But if the JPL ephemeris is loaded,
+the positions that aren't already cached are computed with one call to
+jpl_pleph_batch(),  which is a good deal faster,  and are added to the
+cache,  so later planet_posn() calls for those JDs will find them.  */
+
+int planet_posn_batch( const int planet_no, const int n, const double *jds,
+                                    double *vects)
+{
+   void *eph = shared_jpl_eph.load( std::memory_order_acquire);
+   const int calc_vel = (planet_no > PLANET_POSN_VELOCITY_OFFSET - 2);
+   const int body = planet_no - (calc_vel ? PLANET_POSN_VELOCITY_OFFSET : 0);
+   void *scratch = nullptr;
+   int i, rval = 0;
+
+   if( body == PLANET_POSN_EARTH || body == PLANET_POSN_MOON)
+      {                 /* get EMB & lunar offset into the cache first */
+      const int vel_offset = planet_no - body;
+
+      planet_posn_batch( 3 + vel_offset, n, jds, vects);
+      planet_posn_batch( 10 + vel_offset, n, jds, vects);
+      }
+   else if( eph && body > 0 && body <= 10 && n > 1)
+      scratch = get_jpl_scratch( eph);
+   if( scratch)
       {
-      POSN_CACHE *tcache = (POSN_CACHE *)calloc( node_size, sizeof( POSN_CACHE));
-      int i, size1 = splitting_size / 2;
-      const int size_left = (curr_node ? nodes[curr_node - 1].used : node_size);
-      const int size_right = (curr_node < n_nodes - 1 ? nodes[curr_node + 1].used : node_size);
+      std::vector<int> missing, targets, centers, err_codes;
+      std::vector<double> missing_jds, states;
+      const Planet_tables *tables = acquire_planet_tables( );
+      Posn_set *sets = get_cache_sets( );    /* sets 'n_sets' on first use */
 
-#ifdef CHECK_CACHING_INTEGRITY
-      check_integrity( nodes, n_nodes);
-#endif
-      collapse_and_partition( tcache, cache);
-      memset( cache, 0, node_size * sizeof( POSN_CACHE));
-      nodes[curr_node].used = 0;
-      if( size_left < size_right && size_left < spillover_size)
-         {        /* "spill over" to left */
-         curr_node--;
-         size1 -= size_left / 2;
-         if( debug_level > 5)
-            debug_printf( "Spilling %d to left: %d\n", curr_node, size1);
-         }
-      else if( size_right <= size_left && size_right < spillover_size)
-         {        /* "spill over" to right */
-         size1 += size_right / 2;
-         if( debug_level > 5)
-            debug_printf( "Spilling %d to right: %d\n", curr_node, size1);
+      for( i = 0; i < n; i++)
+         {
+         Posn_set *set = sets + (hash_function( planet_no, jds[i]) & (n_sets - 1));
+         uint64_t jd_bits;
+
+         memcpy( &jd_bits, jds + i, sizeof( double));
+         if( !calc_vel && tables
+                  && planet_posn_from_tables( tables, planet_no, jds[i], vects + 3 * i))
+            continue;
+         if( find_in_cache( set, (uint64_t)planet_no, jd_bits, vects + 3 * i))
+            local_hits++;
+         else
+            {
+            local_misses++;
+            missing.push_back( i);
+            missing_jds.push_back( jds[i]);
+            }
          }
-      else        /* create new node */
+      release_planet_tables( );
+      if( missing.size( ))
          {
-         memmove( nodes + curr_node + 2, nodes + curr_node + 1,
-                  (n_nodes - curr_node - 1) * sizeof( POSN_NODE));
-         nodes[curr_node + 1].data = (POSN_CACHE *)calloc( node_size, sizeof( POSN_CACHE));
-         nodes[curr_node + 1].used = 0;
-         if( debug_level > 5)
-            debug_printf( "Splitting node %d\n", curr_node);
-         n_nodes++;
+         const int n_missing = (int)missing.size( );
+
+         targets.assign( n_missing, (body == 3 ? 13 : body));
+         centers.assign( n_missing, (body == 10 ? 3 : 11));
+         err_codes.resize( n_missing);
+         states.resize( 6 * n_missing);
+         jpl_pleph_batch( eph, scratch, n_missing, missing_jds.data( ),
+                  targets.data( ), centers.data( ), states.data( ), calc_vel,
+                  err_codes.data( ));
          }
-      while( tcache[size1].jd == tcache[size1 - 1].jd)
-         size1--;
-      for( i = 0; i < splitting_size; i++)
+      for( size_t j = 0; j < missing.size( ); j++)
          {
-         const int n = curr_node + (i < size1 ? 0 : 1);
-         POSN_CACHE *cptr = nodes[n].data;
-         const int new_loc = find_within_node( tcache[i].planet_no,
-                           tcache[i].jd, cptr);
+         double *vect = vects + 3 * missing[j];
 
-         cptr[new_loc] = tcache[i];
-         nodes[n].used++;
+         if( err_codes[j])       /* let planet_posn() sort out the error */
+            rval |= planet_posn( planet_no, missing_jds[j], vect);
+         else
+            {
+            Posn_set *set = sets + (hash_function( planet_no,
+                                    missing_jds[j]) & (n_sets - 1));
+            uint64_t jd_bits;
+
+            memcpy( vect, &states[6 * j + calc_vel * 3], 3 * sizeof( double));
+            equatorial_to_ecliptic( vect);
+            memcpy( &jd_bits, &missing_jds[j], sizeof( double));
+            add_to_cache( set, (uint64_t)planet_no, jd_bits, vect);
+            }
          }
-      nodes[curr_node + 1].min_jd = tcache[size1].jd;
-#ifdef CHECK_CACHING_INTEGRITY
-      check_integrity( nodes, n_nodes);
-#endif
-      free( tcache);
       }
+   else
+      for( i = 0; i < n; i++)
+         rval |= planet_posn( planet_no, jds[i], vects + 3 * i);
    return( rval);
 }
 
+/* Anything that caches results computed from planet positions can use
+this to notice that the JPL ephemeris has been loaded,  unloaded,  or
+replaced since.  */
+
+int get_jpl_ephemeris_generation( void)
+{
+   return( jpl_eph_generation);
+}
+
       /* In the following,  we get the earth's position for a particular    */
       /* instant,  just to ensure that JPL ephemerides (if any) are loaded. */
       /* Then we call with planet = JD = 0,  which causes the info about    */
@@ -23,9 +23,15 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 02110-1301, USA.    */
 
+#include <cstdint>
+
 int planet_posn( const int planet_no, const double jd, double *vect_2000);
+int planet_posn_batch( const int planet_no, const int n, const double *jds,
+                                    double *vects);
 int format_jpl_ephemeris_info( char *buff);           /* pl_cache.cpp */
 int get_jpl_ephemeris_info( int *de_version, double *jd_start, double *jd_end);
+int get_jpl_ephemeris_generation( void);
+int cover_planet_tables( double jd_start, double jd_end);
 
 #define PLANET_POSN_VELOCITY_OFFSET 1000
 
@@ -38,5 +44,21 @@ these values can be fed to planet_posn() in such cases.   */
 #define PLANET_POSN_EARTH        20
 #define PLANET_POSN_MOON         21
 
+/* planet_posn( -1, ...) frees the cached positions _and_ unloads the JPL
+ephemeris;  do that only when no other threads are using them.  The cache
+is shared by all threads.  Worker threads (see 'fit_ctx.cpp') use the
+following when they're done,  to add their hit/miss/eviction counts to
+the totals reported by get_planet_cache_stats().   */
+
+#define PLANET_POSN_FLUSH_THREAD_STATS  -2
+
+struct Planet_cache_stats
+{
+   uint64_t hits, misses, evictions;
+   uint64_t n_slots;                   /* zero if the cache isn't allocated */
+};
+
+void get_planet_cache_stats( Planet_cache_stats *stats);
+
 #endif // !PL_CACHE_INCLUDE
 
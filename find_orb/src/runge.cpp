@@ -36,6 +36,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
 #include <stdarg.h>
 #include <cmath>
 #include <cassert>
+#include <mutex>
 //
 
 
@@ -55,10 +56,10 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
    (implicitly) planet_posn cache
 */
 
-double object_mass = 0.;
+thread_local double object_mass = 0.;
 double j2_multiplier = 1.;
-extern unsigned perturbers;
-extern int n_orbit_params;
+extern thread_local unsigned perturbers;
+extern thread_local int n_orbit_params;
 
 extern int debug_level;
 
@@ -86,12 +87,13 @@ static void compute_ref_state(Elements *ref_orbit, double *ref_state,
 #define IDX_IAPETUS   19
 #define IDX_ASTEROIDS 20
 
-static ldouble vector3_lengthl( const ldouble *vect)
+template <class real> static real vector3_lengthl( const real *vect)
 {
-   return( sqrtl( vect[0] * vect[0] + vect[1] * vect[1] + vect[2] * vect[2]));
+   return( std::sqrt( vect[0] * vect[0] + vect[1] * vect[1] + vect[2] * vect[2]));
 }
 
-static void vector_cross_productl( ldouble *xprod, const ldouble *a, const ldouble *b)
+template <class real> static void vector_cross_productl( real *xprod,
+                                 const real *a, const real *b)
 {
    xprod[0] = a[1] * b[2] - a[2] * b[1];
    xprod[1] = a[2] * b[0] - a[0] * b[2];
@@ -258,7 +260,7 @@ static void numerical_gradient( double *grad, const double *loc,
 
    if( j3 == EARTH_J3)
       {
-      static int n_terms = -9999;
+      static thread_local int n_terms = -9999;
                                     /* height in units of earth radii */
       if( n_terms == -9999)
          {
@@ -277,7 +279,7 @@ static void numerical_gradient( double *grad, const double *loc,
                ht_above_ground = 0.04;
             n_added_terms =  (int)( (double)n_terms / ht_above_ground);
             }
-         geo_potential_in_au( loc[0], loc[1], loc[2], grad, 3 + n_added_terms);
+         geo_gradient_in_au( loc[0], loc[1], loc[2], grad, 3 + n_added_terms);
          return;
          }
       }
@@ -331,24 +333,25 @@ static void numerical_gradient( double *grad, const double *loc,
 
 double general_relativity_factor = 1.;
 
-static void set_relativistic_accel( ldouble *accel, const ldouble *posnvel)
+template <class real> static void set_relativistic_accel( real *accel,
+                                 const real *posnvel)
 {
    int i;
-   const ldouble c = AU_PER_DAY;           /* speed of light in AU per day */
-   const ldouble r_squared = posnvel[0] * posnvel[0] + posnvel[1] * posnvel[1]
-                                                     + posnvel[2] * posnvel[2];
-   const ldouble v_squared = posnvel[3] * posnvel[3] + posnvel[4] * posnvel[4]
-                                                     + posnvel[5] * posnvel[5];
-   const ldouble v_dot_r   = posnvel[0] * posnvel[3] + posnvel[1] * posnvel[4]
-                                                     + posnvel[2] * posnvel[5];
-   const ldouble r = sqrtl( r_squared), r_cubed_c_squared = r_squared * r * c * c;
+   const real c = AU_PER_DAY;              /* speed of light in AU per day */
+   const real r_squared = posnvel[0] * posnvel[0] + posnvel[1] * posnvel[1]
+                                                  + posnvel[2] * posnvel[2];
+   const real v_squared = posnvel[3] * posnvel[3] + posnvel[4] * posnvel[4]
+                                                  + posnvel[5] * posnvel[5];
+   const real v_dot_r   = posnvel[0] * posnvel[3] + posnvel[1] * posnvel[4]
+                                                  + posnvel[2] * posnvel[5];
+   const real r = std::sqrt( r_squared), r_cubed_c_squared = r_squared * r * c * c;
 #ifndef PREVIOUS_EQUATION
    const double r_component =
                   (4. * SOLAR_GM / r - v_squared) / r_cubed_c_squared;
    const double v_component = 4. * v_dot_r / r_cubed_c_squared;
 #else
-   const ldouble v_component = 3. * v_dot_r / r_cubed_c_squared;
-   const ldouble r_component = 0.;
+   const real v_component = 3. * v_dot_r / r_cubed_c_squared;
+   const real r_component = 0.;
 #endif
 
    for( i = 0; i < 3; i++)
@@ -396,11 +399,11 @@ double comet_g_func( const ldouble r)
 {
    if( !is_inverse_square_force_model( ))
       {                      /* default, Marsden/Sekanina formula */
-      static ldouble r0 = 2.808;         /* AU */
-      static ldouble m = 2.15;
-      static ldouble n = 5.093;
-      static ldouble k = 4.6142;
-      static ldouble alpha = 0.;
+      static thread_local ldouble r0 = 2.808;         /* AU */
+      static thread_local ldouble m = 2.15;
+      static thread_local ldouble n = 5.093;
+      static thread_local ldouble k = 4.6142;
+      static thread_local ldouble alpha = 0.;
       ldouble r_over_r0;
 
       if( !r)                 /* resetting parameters */
@@ -538,6 +541,11 @@ static ldouble planetary_system_mass( const int planet_no)
    return( rval);
 }
 
+/* calc_planet_orientation() keeps its own static caches,  so calls to it
+from different fitting threads are serialized.  */
+
+static std::mutex orientation_mutex;
+
 /* "approx_planet_orientation" returns the planet orientation matrix,  as
 described in 'cospar.cpp',  for a time no more than range/2 days away.
 (Which,  at present,  means half a day.)  The idea is that the orientation
@@ -551,9 +559,9 @@ less than half a day).        */
 void calc_approx_planet_orientation( const int planet,
          const int system_number, const double jde, double *matrix)
 {
-   static double cached_matrix[9];
-   static double cached_jde = 0.;
-   static int cached_planet = -1;
+   static thread_local double cached_matrix[9];
+   static thread_local double cached_jde = 0.;
+   static thread_local int cached_planet = -1;
    const double range = 1.;
    const double new_jde = floor( jde / range + .5) * range;
    const double omega = planet_rotation_rate( planet, system_number) * PI / 180.;
@@ -562,6 +570,8 @@ void calc_approx_planet_orientation( const int planet,
       {
       const double ut = new_jde - td_minus_ut( new_jde) / seconds_per_day;
 
+      const std::lock_guard<std::mutex> lock( orientation_mutex);
+
       calc_planet_orientation( planet, system_number, ut, cached_matrix);
       cached_planet = planet;
       cached_jde = new_jde;
@@ -579,13 +589,13 @@ up the mass thrown into the sun linearly.  The reason for this is to avoid
 a discontinuity,  and to instead have a gradual,  linear increase in the
 mass we use for the sun.         */
 
-static ldouble include_thrown_in_planets( const ldouble r)
+template <class real> static real include_thrown_in_planets( const real r)
 {
    const int n_radii = 9;
-   const ldouble radii[9] = { 0., .38709927, .72333566, 1.00000261,
+   const real radii[9] = { 0., .38709927, .72333566, 1.00000261,
                1.52371034, 5.20288799, 9.53667594,  19.18916464,  30.06992276};
-   const ldouble fraction = .2;
-   ldouble rval = 1.;
+   const real fraction = .2;
+   real rval = 1.;
    int i;
 
    for( i = 1; i < n_radii && r > radii[i]; i++)
@@ -693,8 +703,8 @@ static ldouble atmospheric_density( const ldouble ht_in_km)
 #define TITAN_LIMIT .03
 
 unsigned excluded_perturbers = (unsigned)-1;
-int best_fit_planet;
-double best_fit_planet_dist;
+thread_local int best_fit_planet;
+thread_local double best_fit_planet_dist;
 
 /* The Earth and Moon pose a special problem in the following function.
 The way we want things to work is this:  if the earth's perturbations are
@@ -752,8 +762,8 @@ for real non-gravs to kick in.  Given a 'current' state vector and
 jd,  this computes a two-body approximate distance from the sun as
 of the time jd - lag.        */
 
-static double lagged_dist( const ldouble *state_vect, const ldouble jd,
-                             const ldouble lag)
+template <class real> static double lagged_dist( const real *state_vect,
+                             const real jd, const real lag)
 {
    double svect[6], outvect[9], rval;
    size_t i;
@@ -780,7 +790,7 @@ static ldouble planet_radius( const int idx)
    return( planet_radius_in_meters( idx) * FUDGE_FACTOR / AU_IN_METERS);
 }
 
-static ldouble solar_multiplier = 1.;
+static thread_local ldouble solar_multiplier = 1.;
 
 /* If we have constrained an area/mass ratio,  and don't have that as
 a free parameter in the orbit fit,  then the above value will be slightly
@@ -789,7 +799,7 @@ from the sun by solar radiation pressure.      */
 
 void compute_effective_solar_multiplier( const char *constraints)
 {
-   extern int force_model;
+   extern thread_local int force_model;
    const char *tptr;
 
    solar_multiplier = 1.;
@@ -802,25 +812,265 @@ void compute_effective_solar_multiplier( const char *constraints)
       }
 }
 
-int planet_hit = -1;
+/* The above is set on the main thread;  worker threads get it through
+a Fit_context (see 'fit_ctx.cpp').  */
 
-int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
-                           const int reference_planet)
+long double get_solar_multiplier( void)
+{
+   return( solar_multiplier);
+}
+
+void set_solar_multiplier( const long double new_multiplier)
+{
+   solar_multiplier = new_multiplier;
+}
+
+thread_local int planet_hit = -1;
+
+/* Number of times the force model has been evaluated;  used only for
+comparing integrators (see 'integ_test.cpp').   */
+
+thread_local int64_t n_force_evaluations = 0;
+
+/* Adaptive perturber positions.  Normally,  each force evaluation gets
+fresh positions for each perturbing planet.  For a distant planet,  that
+is mostly wasted effort:  its position changes smoothly,  and an error of
+a few hundred km in it may change the acceleration by far less than
+the integration tolerance.  With ADAPTIVE_PERTURBERS set,  the planets
+(except the earth and moon,  when the moon is handled separately) are
+instead interpolated (cubic Lagrange) from positions at 'nodes',  evenly
+spaced in time.  The spacing is set,  for each planet at each evaluation,
+from an estimate of how much a position error would change the
+acceleration.  A planet of mass m at distance d from the object and R
+from the sun,  displaced by delta,  changes the acceleration (direct plus
+indirect terms) by up to about 2 * delta * GM * m * (1/d^3 + 1/R^3).  We
+keep that below ADAPTIVE_PERTURBERS * integration_tolerance times the
+solar acceleration,  GM / r^2.  For a near-circular orbit,  the fourth
+derivative of the planet's position is about k^4 / R^5,  so the
+interpolation error is about .0234 * spacing^4 * k^4 / R^5.  Spacings are
+powers of two,  so that nodes fall on exact times and get reused.
+A planet with a negligible pull isn't skipped outright;  it just gets
+positions computed every MAX_NODE_SPACING days,  which costs next to
+nothing and keeps its (small) contribution.  Which perturbers are used
+at all is still up to the usual 'perturbers' bits and distance tests.
+
+   Positions only depend on time,  so this doesn't care which object is
+being integrated,  or in which direction.  Per-body counters of how many
+positions were actually computed (versus how many were asked for) can
+be had with get_perturber_counts( ).   */
+
+#define MIN_NODE_SPACING   (1. / 64.)
+#define MAX_NODE_SPACING   64.
+
+#define N_NODE_SLOTS       16
+
+typedef struct
+{
+   double spacing[N_NODE_SLOTS];      /* zero if the slot is unused */
+   int64_t node[N_NODE_SLOTS];
+   double posns[N_NODE_SLOTS][3];
+   double last_posn[3];    /* for estimating the distance to the object */
+   double excess;          /* see perturber_posn( ) */
+   bool last_posn_set;
+} Perturber_nodes;
+
+static thread_local Perturber_nodes perturber_nodes[N_PERTURBER_COUNTS];
+static thread_local int64_t n_perturber_requests[N_PERTURBER_COUNTS];
+static thread_local int64_t n_perturber_computed[N_PERTURBER_COUNTS];
+static thread_local double adaptive_perturbers = -1.;
+
+/* Clears the node tables and counters,  and rereads ADAPTIVE_PERTURBERS
+the next time positions are needed.  */
+
+void reset_adaptive_perturbers( void)
+{
+   memset( perturber_nodes, 0, sizeof( perturber_nodes));
+   memset( n_perturber_requests, 0, sizeof( n_perturber_requests));
+   memset( n_perturber_computed, 0, sizeof( n_perturber_computed));
+   adaptive_perturbers = -1.;
+}
+
+void get_perturber_counts( int64_t *n_requested, int64_t *n_computed)
+{
+   memcpy( n_requested, n_perturber_requests, sizeof( n_perturber_requests));
+   memcpy( n_computed, n_perturber_computed, sizeof( n_perturber_computed));
+}
+
+static double node_spacing( const int planet_no, const double *obj_posn,
+                        const double *planet_loc)
+{
+   extern double integration_tolerance;
+   const double tolerance = adaptive_perturbers * integration_tolerance;
+   const double r2 = obj_posn[0] * obj_posn[0] + obj_posn[1] * obj_posn[1]
+                   + obj_posn[2] * obj_posn[2];
+   const double big_r = vector3_length( planet_loc);
+   const double delta[3] = { obj_posn[0] - planet_loc[0],
+            obj_posn[1] - planet_loc[1], obj_posn[2] - planet_loc[2] };
+   const double d = vector3_length( delta);
+   double max_delta, spacing;
+
+   max_delta = tolerance / (2. * r2 * planet_mass[planet_no]
+                   * (1. / (d * d * d) + 1. / (big_r * big_r * big_r)));
+   max_delta *= .25;                /* safety factor for eccentric orbits */
+   spacing = pow( max_delta * pow( big_r, 5.)
+              / (.0234 * GAUSS_K * GAUSS_K * GAUSS_K * GAUSS_K), .25);
+   if( spacing < MIN_NODE_SPACING)
+      return( 0.);
+   if( spacing > MAX_NODE_SPACING)
+      spacing = MAX_NODE_SPACING;
+   return( exp2( floor( log2( spacing))));
+}
+
+/* Nodes are kept in a small direct-mapped cache,  so that those used
+in one step are still there for the next,  or when a step is rejected
+and redone,  or when the integration turns around.  */
+
+static inline int node_slot( const int64_t node)
+{
+   return( (int)( node & (N_NODE_SLOTS - 1)));
+}
+
+static bool node_is_cached( const Perturber_nodes *pn, const int64_t node,
+                        const double spacing)
+{
+   const int slot = node_slot( node);
+
+   return( pn->spacing[slot] == spacing && pn->node[slot] == node);
+}
+
+static const double *node_posn( const int planet_no, const int64_t node,
+                        const double spacing)
+{
+   Perturber_nodes *pn = perturber_nodes + planet_no;
+   const int slot = node_slot( node);
+
+   if( !node_is_cached( pn, node, spacing))
+      {
+      planet_posn( planet_no, (double)node * spacing, pn->posns[slot]);
+      n_perturber_computed[planet_no]++;
+      pn->spacing[slot] = spacing;
+      pn->node[slot] = node;
+      }
+   return( pn->posns[slot]);
+}
+
+/* If the integrator's steps are long compared to the node spacing,  each
+request may need several new nodes,  and we'd be better off computing
+the position directly.  So we keep track of the 'excess',  the number of
+positions computed beyond the number requested (never less than zero;
+savings made earlier don't license waste later),  and only interpolate
+if that won't take the excess over MAX_EXCESS.  That leaves room to set
+up the first four nodes,  but otherwise falls back to direct computation
+if the nodes aren't paying for themselves.  Direct computations slowly
+pay the excess off,  so that we can try nodes again later (the step size
+may have shrunk,  or the spacing changed).  At worst,  that costs about
+three percent more than direct computation.  */
+
+#define MAX_EXCESS         4.
+#define EXCESS_DECAY       (1. / 32.)
+
+static void perturber_posn( const int planet_no, const double jd,
+                        const double *obj_posn, double *posn)
 {
-   ldouble r, r2 = 0., solar_accel = 1. + object_mass;
-   ldouble accel_multiplier = 1.;
+   Perturber_nodes *pn = perturber_nodes + planet_no;
+   double spacing = 0.;
+   int64_t node = 0;
+   int i, j;
+
+   assert( planet_no > 0 && planet_no < N_PERTURBER_COUNTS);
+   if( adaptive_perturbers < 0.)
+      adaptive_perturbers = atof( get_environment_ptr( "ADAPTIVE_PERTURBERS"));
+   n_perturber_requests[planet_no]++;
+   if( adaptive_perturbers > 0. && pn->last_posn_set)
+      spacing = node_spacing( planet_no, obj_posn, pn->last_posn);
+   if( spacing)
+      {
+      int n_needed = 0;
+
+      node = (int64_t)floor( jd / spacing) - 1;
+      for( i = 0; i < 4; i++)
+         if( !node_is_cached( pn, node + i, spacing))
+            n_needed++;
+      if( pn->excess + (double)( n_needed - 1) > MAX_EXCESS)
+         spacing = 0.;
+      else
+         pn->excess += (double)( n_needed - 1);
+      }
+   if( !spacing)
+      {
+      planet_posn( planet_no, jd, posn);
+      n_perturber_computed[planet_no]++;
+      pn->excess -= EXCESS_DECAY;
+      }
+   else
+      {
+      const double u = jd / spacing - (double)node - 1.;    /* 0 <= u < 1 */
+      const double c[4] = { -u * (u - 1.) * (u - 2.) / 6.,
+                        (u + 1.) * (u - 1.) * (u - 2.) / 2.,
+                       -(u + 1.) * u * (u - 2.) / 2.,
+                        (u + 1.) * u * (u - 1.) / 6. };
+
+      for( j = 0; j < 3; j++)
+         posn[j] = 0.;
+      for( i = 0; i < 4; i++)
+         {
+         const double *node_loc = node_posn( planet_no, node + i, spacing);
+
+         for( j = 0; j < 3; j++)
+            posn[j] += c[i] * node_loc[j];
+         }
+      }
+   if( pn->excess < 0.)
+      pn->excess = 0.;
+   memcpy( pn->last_posn, posn, 3 * sizeof( double));
+   pn->last_posn_set = true;
+}
+
+/* If non-null,  calc_derivativesl() accumulates the 3x3 gradient of the
+point-mass accelerations (sun and perturbers) with respect to the object's
+position here.  See calc_derivatives_with_partials( ).  */
+
+static thread_local ldouble *grav_gradient = nullptr;
+
+/* A point mass at offset 'delta' from the object,  exerting an acceleration
+coeff * delta,  where coeff = -GM / r^3,  has gradient
+coeff * (I - 3 * delta * delta^T / r^2).   */
+
+template <class real> static void add_point_mass_gradient( ldouble *grad,
+               const real *delta, const ldouble coeff, const ldouble r)
+{
+   int i, j;
+
+   for( i = 0; i < 3; i++)
+      for( j = 0; j < 3; j++)
+         grad[i * 3 + j] += coeff * ((i == j ? 1. : 0.)
+                                 - 3. * delta[i] * delta[j] / (r * r));
+}
+
+/* The force model is written as a template,  so that the same code
+serves both calc_derivativesl() and the compensated double-precision
+integrator (see take_rk_step_compensated( )).  On x86-64,  long doubles
+mean x87 arithmetic,  which is several times slower than SSE/AVX and
+can't be vectorized.   */
+
+template <class real> static int calc_derivatives_t( const real jd,
+               const real *ival, real *oval, const int reference_planet)
+{
+   real r, r2 = 0., solar_accel = 1. + object_mass;
+   real accel_multiplier = 1.;
    int i, j;
    unsigned local_perturbers = perturbers;
    double lunar_loc[3], jupiter_loc[3], saturn_loc[3];
-   ldouble relativistic_accel[3];
+   real relativistic_accel[3];
    double fraction_illum = 1., ival_as_double[3];
-   extern int force_model;
+   extern thread_local int force_model;
    static const double sphere_of_influence_radius[10] = {
             10000., 0.00075, 0.00412, 0.00618,   /* sun, mer, ven, ear */
             0.00386, 0.32229, 0.36466, 0.34606,  /* mar, jup, sat, ura */
             0.57928, 0.02208 };                  /* nep, plu */
 
-   assert( fabsl( jd) < 1e+9);
+   assert( fabs( (double)jd) < 1e+9);
+   n_force_evaluations++;
    oval[0] = ival[3];
    oval[1] = ival[4];
    oval[2] = ival[5];
@@ -830,7 +1080,7 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
    planet_hit = -1;
    for( i = 0; i < 3; i++)
       r2 += ival[i] * ival[i];
-   r = sqrtl( r2);
+   r = std::sqrt( r2);
    if( n_orbit_params > 6) /* decrease non-gravs when in earth's shadow */
       {
       double earth_loc[3];
@@ -864,6 +1114,8 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
          relativistic_accel[i] = 0.;
 
    solar_accel *= include_thrown_in_planets( r);
+   if( grav_gradient)
+      add_point_mass_gradient( grav_gradient, ival, solar_accel, r);
 
    for( i = 0; i < 3; i++)
       oval[i + 3] = solar_accel * ival[i]
@@ -884,11 +1136,11 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
    if( (n_orbit_params >= 8 && n_orbit_params <= 10 && force_model != FORCE_MODEL_DELTA_V)
                               || force_model == FORCE_MODEL_YARKO_A2)
       {                  /* Marsden & Sekanina comet formula */
-      const ldouble lag = (n_orbit_params == 10 ? ival[9] : 0.);
-      const ldouble g = comet_g_func( lagged_dist( ival, jd, lag)) * fraction_illum;
-      ldouble transverse[3], dot_prod = 0.;
+      const real lag = (n_orbit_params == 10 ? ival[9] : 0.);
+      const real g = comet_g_func( lagged_dist( ival, jd, lag)) * fraction_illum;
+      real transverse[3], dot_prod = 0.;
 
-      memcpy( transverse, ival + 3, 3 * sizeof( ldouble));
+      memcpy( transverse, ival + 3, 3 * sizeof( real));
       for( i = 0; i < 3; i++)
          dot_prod += transverse[i] * ival[i];
       for( i = 0; i < 3; i++)
@@ -903,7 +1155,7 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
                      + ival[7] * transverse[i] / dot_prod);
       if( n_orbit_params >= 9)
          {
-         ldouble out_of_plane[3];
+         real out_of_plane[3];
 
          vector_cross_productl( out_of_plane, ival, transverse);
          dot_prod = vector3_lengthl( out_of_plane);
@@ -912,7 +1164,7 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
          }
       }
    for( i = 0; i < 3; i++)       /* redundant initialization */
-      jupiter_loc[i] = 0.;       /* to avoid gcc-13 warning  */
+      jupiter_loc[i] = saturn_loc[i] = 0.;   /* to avoid gcc warnings */
 
    if( perturbers)
       for( i = 1; i < N_PERTURB + 1; i++)
@@ -965,10 +1217,10 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
                   else if( i == 10)
                      memcpy( planet_loc, lunar_loc, 3 * sizeof( double));
                   else
-                     planet_posn( i, jd, planet_loc);
+                     perturber_posn( i, (double)jd, ival_as_double, planet_loc);
                   }
                else
-                  planet_posn( i, jd, planet_loc);
+                  perturber_posn( i, (double)jd, ival_as_double, planet_loc);
 
                for( j = 0; j < 3; j++)
                   r2 += planet_loc[j] * planet_loc[j];
@@ -1110,11 +1362,17 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
 
 /*          if( accel_multiplier)  */
                {
-               const ldouble accel_factor =
+               const real accel_factor =
                                -SOLAR_GM * mass_to_use / (r * r * r);
 
                for( j = 0; j < 3; j++)
                   oval[j + 3] += accel_factor * accel[j];
+               if( grav_gradient)
+                  {
+                  const real delta[3] = { accel[0], accel[1], accel[2] };
+
+                  add_point_mass_gradient( grav_gradient, delta, accel_factor, r);
+                  }
                }
             if( i != reference_planet)
                {
@@ -1144,11 +1402,318 @@ int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
                }
             }
    if( planet_hit != -1)
+      {
       for( j = 3; j < 6; j++)
          oval[j] *= accel_multiplier;
+      if( grav_gradient)
+         for( j = 0; j < 9; j++)
+            grav_gradient[j] *= accel_multiplier;
+      }
    return( planet_hit);
 }
 
+int calc_derivativesl( const ldouble jd, const ldouble *ival, ldouble *oval,
+                           const int reference_planet)
+{
+   return( calc_derivatives_t( jd, ival, oval, reference_planet));
+}
+
+/* Variational equations.  When the integrators are asked to carry more
+than n_orbit_params values,  the vector is the usual state (position,
+velocity,  and any non-gravitational parameters),  followed by the 6 x
+n_orbit_params state transition matrix Phi,  stored by rows:  element
+[i][k] is the partial of state component i with respect to parameter k
+at the epoch.  (So Phi starts out as the identity,  padded with zeroes.)
+
+   dPhi/dt = A * Phi + B,  where A = [0 I; G 0],  G is the gradient of
+the acceleration with respect to position,  and B holds the partials of
+the acceleration with respect to the non-gravitational parameters.
+
+   G includes only the point-mass terms from the sun and planets.  The
+J2 terms,  relativity,  asteroids and the position dependence of the
+non-gravs are small enough that leaving them out just makes the partials
+a little less than perfect;  the fit still converges,  because the
+residuals themselves use the full force model.  The non-gravs enter the
+acceleration linearly (caller must ensure that's true;  the lag and
+delta-v models don't qualify),  so a unit change in each gives B exactly.
+Non-gravitational parameters don't change,  so their derivatives are 0. */
+
+static int calc_derivatives_with_partials( const ldouble jd,
+               const ldouble *ival, ldouble *oval, const int reference_planet)
+{
+   const int n_params = n_orbit_params;
+   const ldouble *stm = ival + n_params;
+   ldouble *dstm = oval + n_params;
+   ldouble grad[9], dadp[3 * MAX_N_PARAMS];
+   int rval, i, j, k;
+
+   for( i = 0; i < 9; i++)
+      grad[i] = 0.;
+   grav_gradient = grad;
+   rval = calc_derivativesl( jd, ival, oval, reference_planet);
+   grav_gradient = nullptr;
+   for( k = 6; k < n_params; k++)
+      {
+      ldouble tval[MAX_N_PARAMS], toval[MAX_N_PARAMS];
+
+      oval[k] = 0.;
+      memcpy( tval, ival, n_params * sizeof( ldouble));
+      tval[k] += 1.;
+      calc_derivativesl( jd, tval, toval, reference_planet);
+      for( i = 0; i < 3; i++)
+         dadp[i * n_params + k] = toval[i + 3] - oval[i + 3];
+      }
+   for( k = 0; k < n_params; k++)
+      for( i = 0; i < 3; i++)
+         {
+         ldouble tval = (k >= 6 ? dadp[i * n_params + k] : 0.);
+
+         dstm[i * n_params + k] = stm[(i + 3) * n_params + k];
+         for( j = 0; j < 3; j++)
+            tval += grad[i * 3 + j] * stm[j * n_params + k];
+         dstm[(i + 3) * n_params + k] = tval;
+         }
+   return( rval);
+}
+
+/* The step functions integrate 'n_vals' values.  Usually,  that's just
+the position and velocity;  if it's more than n_orbit_params,  they're
+carrying the state transition matrix as well.   */
+
+static int calc_step_derivatives( const ldouble jd, const ldouble *ival,
+               ldouble *oval, const int reference_planet, const int n_vals)
+{
+   if( n_vals > n_orbit_params)
+      return( calc_derivatives_with_partials( jd, ival, oval, reference_planet));
+   else
+      return( calc_derivativesl( jd, ival, oval, reference_planet));
+}
+
+/* Derivatives for an "ensemble" of objects,  all at the same time 'jd'.
+The states are in structure-of-arrays form:  ival[i * stride + k] is
+component i (x, y, z, vx, vy, vz) of object k,  and 'oval' is laid out
+the same way.  The planet positions are found once for the whole
+ensemble,  and the point-mass accelerations are then summed in simple
+loops over the objects,  which the compiler can vectorize.
+
+   That covers the sun,  planets,  moon and relativity,  and is exactly
+what calc_derivativesl() would do for an object well away from any of
+them.  Objects inside the sun or a planet,  within J2 range of a planet,
+close enough to Jupiter or Saturn for their satellites to matter,  or
+in the asteroid belt with asteroid perturbers turned on are flagged in
+'work' (n_objects doubles of scratch space) and redone one at a time with
+calc_derivativesl(),  so they get the full force model.  Caller must
+ensure that n_orbit_params == 6;  there's no reference planet.
+
+   As with calc_derivativesl(),  the return value (and 'planet_hit') is
+the planet that an object is inside of,  or -1 if none are.  */
+
+int calc_ensemble_derivatives( const double jd, const double *ival,
+               double *oval, const unsigned n_objects, const unsigned stride,
+               double *work)
+{
+   const unsigned local_perturbers = (perturbers & ~excluded_perturbers);
+   const double *x = ival, *y = ival + stride, *z = ival + 2 * stride;
+   double *ax = oval + 3 * stride, *ay = oval + 4 * stride;
+   double *az = oval + 5 * stride;
+   double *needs_full_model = work;
+   const double sun_limit = (double)planet_radius( 0);
+   const double solar_gm = -SOLAR_GM * (1. + object_mass) * (double)solar_multiplier;
+   const double gr_factor = (perturbers ? general_relativity_factor : 0.);
+   const double radii[9] = { 0., .38709927, .72333566, 1.00000261,
+               1.52371034, 5.20288799, 9.53667594,  19.18916464,  30.06992276};
+   double lunar_loc[3], indirect[3] = { 0., 0., 0. };
+   bool have_lunar_loc = false;
+   unsigned i, k;
+   int rval = -1;
+
+   assert( n_orbit_params == 6);
+   memcpy( oval, ival + 3 * stride, 3 * stride * sizeof( double));
+   for( k = 0; k < n_objects; k++)
+      {
+      const double r2 = x[k] * x[k] + y[k] * y[k] + z[k] * z[k];
+      const double r = sqrt( r2);
+      const double vx = ival[3 * stride + k], vy = ival[4 * stride + k];
+      const double vz = ival[5 * stride + k];
+      const double v2 = vx * vx + vy * vy + vz * vz;
+      const double r_cubed_c_squared = r2 * r * AU_PER_DAY * AU_PER_DAY;
+      const double r_component = gr_factor * SOLAR_GM
+                        * (4. * SOLAR_GM / r - v2) / r_cubed_c_squared;
+      const double v_component = gr_factor * SOLAR_GM
+                        * 4. * (x[k] * vx + y[k] * vy + z[k] * vz) / r_cubed_c_squared;
+      double mass = 1.;
+
+      for( i = 1; i < 9; i++)      /* see include_thrown_in_planets( ) */
+         if( !((perturbers >> i) & 1))
+            mass += planet_mass[i] * fmin( fmax(
+                           (r / radii[i] - 1.) / .2, 0.), 1.);
+      mass *= solar_gm / (r2 * r);
+      ax[k] = mass * x[k] + r_component * x[k] + v_component * vx;
+      ay[k] = mass * y[k] + r_component * y[k] + v_component * vy;
+      az[k] = mass * z[k] + r_component * z[k] + v_component * vz;
+      needs_full_model[k] = (r < sun_limit ? 1. : 0.);
+      if( (local_perturbers >> IDX_ASTEROIDS) & 1)
+         needs_full_model[k] = (r < 11.5 && r > 1. ? 1. : needs_full_model[k]);
+      }
+   if( local_perturbers & (0x1ff << IDX_IO))   /* satellites always on: */
+      for( k = 0; k < n_objects; k++)          /* do it the slow way    */
+         needs_full_model[k] = 1.;
+   for( i = 1; i <= IDX_MOON; i++)
+      if( (local_perturbers >> i) & 1)
+         {
+         double loc[3], limit = (double)planet_radius( i), mass = planet_mass[i];
+         double dist;
+
+         if( (perturbers & 1024) && i == IDX_EARTH)
+            {                      /* moon is included separately */
+            earth_lunar_posn( jd, loc, lunar_loc);
+            have_lunar_loc = true;
+            }
+         else if( i == IDX_MOON && have_lunar_loc)
+            memcpy( loc, lunar_loc, 3 * sizeof( double));
+         else if( i == IDX_MOON)
+            earth_lunar_posn( jd, nullptr, loc);
+         else
+            planet_posn( i, jd, loc);
+         if( i >= IDX_EARTH && i <= IDX_NEPTUNE && j2_multiplier && limit < .015)
+            limit = .015;
+         if( i == IDX_JUPITER)
+            {
+            limit = fmax( limit, GALILEAN_LIMIT);
+            mass = MASS_JUPITER_SYSTEM;
+            }
+         if( i == IDX_SATURN)
+            {
+            limit = fmax( limit, TITAN_LIMIT);
+            mass = MASS_SATURN_SYSTEM;
+            }
+         if( i == IDX_EARTH)
+            if( !((local_perturbers >> IDX_MOON) & 1))
+               mass += planet_mass[IDX_MOON];
+         mass *= SOLAR_GM;
+         for( k = 0; k < n_objects; k++)
+            {
+            const double dx = x[k] - loc[0], dy = y[k] - loc[1];
+            const double dz = z[k] - loc[2];
+            const double d2 = dx * dx + dy * dy + dz * dz;
+            const double accel_factor = -mass / (d2 * sqrt( d2));
+
+            ax[k] += accel_factor * dx;
+            ay[k] += accel_factor * dy;
+            az[k] += accel_factor * dz;
+            needs_full_model[k] = (d2 < limit * limit ? 1. : needs_full_model[k]);
+            }
+         dist = vector3_length( loc);     /* sun's acceleration toward */
+         mass /= -dist * dist * dist;     /* the planet (indirect term) */
+         for( k = 0; k < 3; k++)
+            indirect[k] += mass * loc[k];
+         }
+   for( k = 0; k < n_objects; k++)
+      {
+      ax[k] += indirect[0];
+      ay[k] += indirect[1];
+      az[k] += indirect[2];
+      }
+   for( k = 0; k < n_objects; k++)
+      if( needs_full_model[k])
+         {
+         ldouble state[6], deriv[6];
+
+         for( i = 0; i < 6; i++)
+            state[i] = (ldouble)ival[i * stride + k];
+         if( calc_derivativesl( (ldouble)jd, state, deriv, -1) != -1)
+            rval = planet_hit;
+         for( i = 0; i < 6; i++)
+            oval[i * stride + k] = (double)deriv[i];
+         }
+   planet_hit = rval;      /* (each calc_derivativesl() call resets it) */
+   return( rval);
+}
+
+/* Dense output.  The integrators take steps of their own choosing;  to
+get states at other times (such as observation times) without having to
+stop there,  we interpolate within a step.  Given the values 'y0' and
+'y1' at the start and end of the step,  and their time derivatives 'f0'
+and 'f1' (from calc_state_derivatives( )),  each position and the
+corresponding velocity is fitted with a quintic Hermite polynomial:  we
+know position,  velocity and acceleration at both ends.  That's good to
+sixth order in the step size,  matching the fifth-order integrators.
+The rows of the state transition matrix,  if present,  come in the same
+position/velocity pairs and are interpolated the same way.  Anything
+else (non-gravitational parameters) doesn't change over the step.
+
+   With Encke's method,  the steps are chosen so that the deviation from
+'ref_orbit' is smooth;  the total state can change far too much over such
+a step for the polynomial to follow it.  So (as in take_rk_step( )) it's
+the deviation that's interpolated,  and the reference orbit at the
+interpolated time is then added back in.  */
+
+int calc_state_derivatives( const ldouble jd, const ldouble *ival,
+               ldouble *oval, const Elements *ref_orbit, const int n_vals)
+{
+   return( calc_step_derivatives( jd, ival, oval, ref_orbit->central_obj, n_vals));
+}
+
+void interpolate_step( Elements *ref_orbit, const ldouble jd,
+               const ldouble *y0, const ldouble *f0,
+               const ldouble *y1, const ldouble *f1, ldouble *ovals,
+               const int n_vals, const ldouble step, const ldouble fraction)
+{
+   const ldouble s = fraction, s2 = s * s, s3 = s2 * s;
+   const ldouble s4 = s3 * s, s5 = s4 * s;
+            /* basis functions for x0, v0, a0, a1, v1, x1: */
+   const ldouble h0 = 1. - 10. * s3 + 15. * s4 - 6. * s5;
+   const ldouble h1 = s - 6. * s3 + 8. * s4 - 3. * s5;
+   const ldouble h2 = (s2 - 3. * s3 + 3. * s4 - s5) / 2.;
+   const ldouble h3 = (s3 - 2. * s4 + s5) / 2.;
+   const ldouble h4 = -4. * s3 + 7. * s4 - 3. * s5;
+   const ldouble h5 = 1. - h0;
+            /* ...and their derivatives with respect to s: */
+   const ldouble d0 = -30. * s2 + 60. * s3 - 30. * s4;
+   const ldouble d1 = 1. - 18. * s2 + 32. * s3 - 15. * s4;
+   const ldouble d2 = (2. * s - 9. * s2 + 12. * s3 - 5. * s4) / 2.;
+   const ldouble d3 = (3. * s2 - 8. * s3 + 5. * s4) / 2.;
+   const ldouble d4 = -12. * s2 + 28. * s3 - 15. * s4;
+   const int n_sets = (n_vals > n_orbit_params ? n_orbit_params + 1 : 1);
+   ldouble dy0[6], df0[6], dy1[6], df1[6];
+   double ref_0[9], ref_1[9], ref_s[9];
+   int i, set;
+
+   compute_ref_state( ref_orbit, ref_0, (double)jd);
+   compute_ref_state( ref_orbit, ref_1, (double)( jd + step));
+   compute_ref_state( ref_orbit, ref_s, (double)( jd + fraction * step));
+   for( i = 0; i < 6; i++)
+      {                 /* deviations of posn/vel,  and of vel/accel */
+      dy0[i] = y0[i] - (ldouble)ref_0[i];
+      dy1[i] = y1[i] - (ldouble)ref_1[i];
+      df0[i] = f0[i] - (ldouble)ref_0[i + 3];
+      df1[i] = f1[i] - (ldouble)ref_1[i + 3];
+      }
+   memcpy( ovals, y1, (n_vals > n_orbit_params ? n_vals : n_orbit_params)
+                        * sizeof( ldouble));
+   for( set = 0; set < n_sets; set++)
+      {              /* set 0 = the state;  the rest = columns of the STM */
+      const int offset = (set ? n_orbit_params + set - 1 : 0);
+      const int stride = (set ? n_orbit_params : 1);
+      const ldouble *y0s = (set ? y0 : dy0), *f0s = (set ? f0 : df0);
+      const ldouble *y1s = (set ? y1 : dy1), *f1s = (set ? f1 : df1);
+
+      for( i = 0; i < 3; i++)
+         {
+         const int p = offset + i * stride, v = offset + (i + 3) * stride;
+
+         ovals[p] = h0 * y0s[p] + h5 * y1s[p]
+                  + step * (h1 * y0s[v] + h4 * y1s[v])
+                  + step * step * (h2 * f0s[v] + h3 * f1s[v]);
+         ovals[v] = d0 * (y0s[p] - y1s[p]) / step
+                  + d1 * y0s[v] + d4 * y1s[v]
+                  + step * (d2 * f0s[v] + d3 * f1s[v]);
+         }
+      }
+   for( i = 0; i < 6; i++)
+      ovals[i] += (ldouble)ref_s[i];
+}
+
 int calc_derivatives( const double jd, const double *ival, double *oval,
                            const int reference_planet)
 {
@@ -1435,7 +2000,7 @@ static void compute_ref_state(Elements *ref_orbit, double *ref_state,
 
 ldouble take_pd89_step( const ldouble jd, Elements *ref_orbit,
                  const ldouble *ival, ldouble *ovals,
-                 const int n_vals, const ldouble step)
+                 const int n_vals, const ldouble step, ldouble *work)
 {
    ldouble *ivals[N_EVALS_PLUS_ONE], *ivals_p[N_EVALS], rval = 0.;
    int i, j, k;
@@ -1455,11 +2020,11 @@ ldouble take_pd89_step( const ldouble jd, Elements *ref_orbit,
    const ldouble avals[N_EVALS_PLUS_ONE] = { 0, A_1, A_2, A_3, A_4, A_5,
              A_6, A_7, A_8, A_9, A_10, A_11, A_12, A_13 };
    const ldouble *bptr = bvals;
+   ldouble state_j[MAX_N_INTEGRATED_VALS];
+   const int n_copied = (n_vals > n_orbit_params ? n_vals : n_orbit_params);
 
-   ivals[0] = (ldouble *)calloc( (2 * N_EVALS + 1) * n_vals, sizeof( ldouble));
-   assert( ivals[0]);
-   if( !ivals[0])
-      return( 0.);
+   assert( n_vals <= MAX_N_INTEGRATED_VALS);
+   ivals[0] = work;
    for( i = 0; i < N_EVALS; i++)
       {
       ivals[i + 1] = ivals[0] + (i + 1) * n_vals;
@@ -1468,7 +2033,7 @@ ldouble take_pd89_step( const ldouble jd, Elements *ref_orbit,
 
    for( j = 0; j <= N_EVALS; j++)
       {
-      ldouble ref_state_j[9], state_j[MAX_N_PARAMS];
+      ldouble ref_state_j[9];
       const ldouble jd_j = jd + step * avals[j];
       double temp_array[9];
 
@@ -1477,10 +2042,10 @@ ldouble take_pd89_step( const ldouble jd, Elements *ref_orbit,
          ref_state_j[i] = (ldouble)temp_array[i];
       if( !j)
          {
-         memcpy( state_j, ival, n_orbit_params * sizeof( ldouble));
+         memcpy( state_j, ival, n_copied * sizeof( ldouble));
                /* subtract the analytic posn/vel from the numeric: */
          for( i = 0; i < n_vals; i++)
-            ivals[0][i] = ival[i] - ref_state_j[i];
+            ivals[0][i] = ival[i] - (i < 6 ? ref_state_j[i] : 0.);
          }
       else
          for( i = 0; i < n_vals; i++)
@@ -1490,21 +2055,22 @@ ldouble take_pd89_step( const ldouble jd, Elements *ref_orbit,
             for( k = 0; k < j; k++)
                tval += bptr[k] * ivals_p[k][i];
             ivals[j][i] = tval * step + ivals[0][i];
-            state_j[i] = ivals[j][i] + ref_state_j[i];
+            state_j[i] = ivals[j][i] + (i < 6 ? ref_state_j[i] : 0.);
             }
       bptr += j;
       if( j != N_EVALS)
          {
          assert( fabsl( jd_j) < 1e+9);
-         calc_derivativesl( jd_j, state_j, ivals_p[j], ref_orbit->central_obj);
+         calc_step_derivatives( jd_j, state_j, ivals_p[j],
+                                    ref_orbit->central_obj, n_vals);
          for( k = 0; k < 6; k++)
             ivals_p[j][k] -= ref_state_j[k + 3];
          }
       else     /* on last iteration,  we have our answer: */
-         memcpy( ovals, state_j, n_orbit_params * sizeof( ldouble));
+         memcpy( ovals, state_j, n_copied * sizeof( ldouble));
       }
 
-   for( i = 0; i < n_vals; i++)
+   for( i = 0; i < 6; i++)       /* error is judged on posn/vel only */
       {
       ldouble tval = 0.;
       const ldouble err_coeff[N_EVALS] = { CHAT_1 - C_1, CHAT_2 - C_2,
@@ -1610,7 +2176,7 @@ A6 | B61 B62 B63 B64 B65
 
 ldouble take_rk_stepl( const ldouble jd, Elements *ref_orbit,
                  const ldouble *ival, ldouble *ovals,
-                 const int n_vals, const ldouble step)
+                 const int n_vals, const ldouble step, ldouble *work)
 {
    ldouble *ivals[7], *ivals_p[6], rval = 0.;
    int i, j, k;
@@ -1625,15 +2191,11 @@ ldouble take_rk_stepl( const ldouble jd, Elements *ref_orbit,
 
    const ldouble avals[7] = { RKF_A1, RKF_A2, RKF_A3, RKF_A4, RKF_A5, RKF_A6, 1.};
    const ldouble *bptr = bvals;
-   ldouble temp_ivals[78];
+   ldouble state_j[MAX_N_INTEGRATED_VALS];
+   const int n_copied = (n_vals > n_orbit_params ? n_vals : n_orbit_params);
 
-   if( n_vals > 6)
-      ivals[0] = (ldouble *)calloc( 13 * n_vals, sizeof( ldouble));
-   else
-      ivals[0] = temp_ivals;
-   assert( ivals[0]);
-   if( !ivals[0])
-      return( 0.);
+   assert( n_vals <= MAX_N_INTEGRATED_VALS);
+   ivals[0] = work;
    for( i = 0; i < 6; i++)
       {
       ivals[i + 1] = ivals[0] + (i + 1) * n_vals;
@@ -1642,7 +2204,7 @@ ldouble take_rk_stepl( const ldouble jd, Elements *ref_orbit,
 
    for( j = 0; j < 7; j++)
       {
-      ldouble ref_state_j[9], state_j[MAX_N_PARAMS];
+      ldouble ref_state_j[9];
       const ldouble jd_j = jd + step * avals[j];
       double temp_array[9];
 
@@ -1651,10 +2213,10 @@ ldouble take_rk_stepl( const ldouble jd, Elements *ref_orbit,
          ref_state_j[i] = (ldouble)temp_array[i];
       if( !j)
          {
-         memcpy( state_j, ival, n_orbit_params * sizeof( ldouble));
+         memcpy( state_j, ival, n_copied * sizeof( ldouble));
                /* subtract the analytic posn/vel from the numeric: */
          for( i = 0; i < n_vals; i++)
-            ivals[0][i] = ival[i] - ref_state_j[i];
+            ivals[0][i] = ival[i] - (i < 6 ? ref_state_j[i] : 0.);
          }
       else
          for( i = 0; i < n_vals; i++)
@@ -1664,21 +2226,22 @@ ldouble take_rk_stepl( const ldouble jd, Elements *ref_orbit,
             for( k = 0; k < j; k++)
                tval += bptr[k] * ivals_p[k][i];
             ivals[j][i] = tval * step + ivals[0][i];
-            state_j[i] = ivals[j][i] + ref_state_j[i];
+            state_j[i] = ivals[j][i] + (i < 6 ? ref_state_j[i] : 0.);
             }
       bptr += j;
       if( j != 6)
          {
          assert( fabsl( jd_j) < 1e+9);
-         calc_derivativesl( jd_j, state_j, ivals_p[j], ref_orbit->central_obj);
+         calc_step_derivatives( jd_j, state_j, ivals_p[j],
+                                    ref_orbit->central_obj, n_vals);
          for( k = 0; k < 6; k++)
             ivals_p[j][k] -= ref_state_j[k + 3];
          }
       else     /* on last iteration,  we have our answer: */
-         memcpy( ovals, state_j, n_orbit_params * sizeof( ldouble));
+         memcpy( ovals, state_j, n_copied * sizeof( ldouble));
       }
 
-   for( i = 0; i < n_vals; i++)
+   for( i = 0; i < 6; i++)       /* error is judged on posn/vel only */
       {
       ldouble tval = 0.;
       static const ldouble err_coeffs[6] = {
@@ -1689,12 +2252,512 @@ ldouble take_rk_stepl( const ldouble jd, Elements *ref_orbit,
          tval += err_coeffs[k] * ivals_p[k][i];
       rval += tval * tval;
       }
-
-   if( n_vals > 6)
-      free( ivals[0]);
    return( sqrtl( rval * step * step));
 }
 
+/* Same Runge-Kutta step as above,  but in doubles,  for use with
+compensated summation.  The state is carried as ival[] + ival_lo[],  where
+ival_lo[] holds the rounding errors accumulated so far (a few units in
+the last place of ival[] at most).  Rather than the new state,  we return
+the change in the first 'n_vals' values over the step in 'delta';  the
+caller adds it,  and ival_lo[],  to ival[] with error-free summation (see
+'orb_func.cpp').  The change is small compared to the state,  so its own
+rounding errors hardly matter.  With Encke's method,  the change is that
+of the reference orbit plus that of the deviation from it;  the former is
+computed in doubles in either case (see compute_ref_state( )),  so we
+lose nothing relative to take_rk_stepl( ).  The state transition matrix
+isn't handled:  'n_vals' must be at most n_orbit_params.   */
+
+double take_rk_step_compensated( const double jd, Elements *ref_orbit,
+                 const double *ival, const double *ival_lo, double *delta,
+                 const int n_vals, const double step)
+{
+   const double bvals[21] = { RKF_B21,
+            RKF_B31, RKF_B32,
+            RKF_B41, RKF_B42, RKF_B43,
+            RKF_B51, RKF_B52, RKF_B53, RKF_B54,
+            RKF_B61, RKF_B62, RKF_B63, RKF_B64, RKF_B65,
+            RKF_CHAT1, RKF_CHAT2, RKF_CHAT3,
+            RKF_CHAT4, RKF_CHAT5, RKF_CHAT6 };
+   const double avals[7] = { RKF_A1, RKF_A2, RKF_A3, RKF_A4, RKF_A5, RKF_A6, 1.};
+   const double err_coeffs[6] = {
+            RKF_CHAT1 - RKF_C1, RKF_CHAT2 - RKF_C2, RKF_CHAT3 - RKF_C3,
+            RKF_CHAT4 - RKF_C4, RKF_CHAT5 - RKF_C5, RKF_CHAT6 - RKF_C6 };
+   const double *bptr = bvals;
+   double derivs[6][MAX_N_PARAMS], state_j[MAX_N_PARAMS];
+   double ref_state_0[9], ref_state_j[9], rval = 0.;
+   int i, j, k;
+
+   assert( n_vals <= n_orbit_params);
+   memcpy( state_j, ival, n_orbit_params * sizeof( double));
+   compute_ref_state( ref_orbit, ref_state_0, jd);
+   for( j = 0; j < 7; j++)
+      {
+      const double jd_j = jd + step * avals[j];
+
+      if( j)
+         {
+         compute_ref_state( ref_orbit, ref_state_j, jd_j);
+         for( i = 0; i < n_vals; i++)
+            {
+            const double ref_delta =
+                    (i < 6 ? ref_state_j[i] - ref_state_0[i] : 0.);
+            double tval = 0.;
+
+            for( k = 0; k < j; k++)
+               tval += bptr[k] * derivs[k][i];
+            if( j == 6)     /* on last iteration,  we have our answer: */
+               delta[i] = ref_delta + tval * step;
+            else
+               state_j[i] = ival[i] + (ref_delta + (ival_lo[i] + tval * step));
+            }
+         }
+      else
+         memcpy( ref_state_j, ref_state_0, 9 * sizeof( double));
+      bptr += j;
+      if( j != 6)
+         {
+         assert( fabs( jd_j) < 1e+9);
+         calc_derivatives_t( jd_j, state_j, derivs[j], ref_orbit->central_obj);
+         for( k = 0; k < 6; k++)
+            derivs[j][k] -= ref_state_j[k + 3];
+         }
+      }
+
+   for( i = 0; i < 6; i++)       /* error is judged on posn/vel only */
+      {
+      double tval = 0.;
+
+      for( k = 0; k < 6; k++)
+         tval += err_coeffs[k] * derivs[k][i];
+      rval += tval * tval;
+      }
+   return( sqrt( rval * step * step));
+}
+
+/* Gauss-Radau step of order 15,  after Everhart (1985) and the IAS15
+version of Rein & Spiegel (2015,  MNRAS 446, 1424).  Over the step,  the
+acceleration is written as a polynomial in the fraction of the step h,
+
+   a(h) = a0 + b0 * h + b1 * h^2 + ... + b6 * h^7
+
+and the b[] coefficients are found by evaluating the acceleration at
+the seven Gauss-Radau spacings below,  iterating (a predictor-corrector
+loop) until they stop changing.  Position and velocity over the step
+follow by integrating the polynomial.  Each iteration costs seven force
+evaluations (plus one at the start of the step),  and the b[] values from
+the previous step,  extrapolated to this one,  usually get us most of the
+way there.  With the large steps possible away from close approaches,
+and rapid changes in step size near them,  this is much cheaper than RKF
+through close approaches.
+
+   As with take_rk_step_compensated( ),  this works in doubles,  with the
+state given as ival[] + ival_lo[] and the change over the step returned
+in 'delta',  and with Encke's method if ref_orbit->central_obj >= 0:  the
+polynomial is then fitted to the acceleration relative to the reference
+orbit,  which changes much more slowly than the total,  allowing much
+longer steps.  Only position and velocity are integrated (no state
+transition matrix).  Call accept_radau_step() if you keep the result,  so
+the next step can be predicted from it.
+
+   The return value is an 'error' such that the step size ought to be
+scaled by (epsilon / error) ^ (1/7).  The original IAS15 used |b6|
+relative to the acceleration.  But near a planet,  the object's position
+relative to it is only good to 1e-16 AU or so (both positions being
+heliocentric doubles),  and that noise in the acceleration gets hugely
+amplified in b6:  at 38000 km from the earth,  steps collapse to about a
+second.  So instead we use the criterion of Pham,  Rein & Spiegel (2024,
+Open J. Astrophys. 7, 1):  the step is a fixed fraction of the timescale
+tau = sqrt( 2|a|^2 / (|a'|^2 + |a''| |a|)) on which the acceleration
+changes,  computed from the lower-order (and much less noisy) b[] at the
+end of the step.  That's equivalent to an error of 1 / (7! * tau^7),
+with tau in units of the step.  With Encke's method,  that's scaled by
+the size of the (fitted) perturbation relative to the total acceleration;
+a perturbation that changes quickly but is tiny needn't shorten the step.
+With the method of Cowell,  the same test is applied to the acceleration
+less the sun's point-mass term,  fitted once the corrector is done,  and
+the larger error is used.  Otherwise,  the slowly changing pull of the sun
+sets the step,  and perturbations with periods of months (mostly the
+heliocentric frame's indirect terms from Mercury and Venus) go unresolved;
+for a Jupiter-family comet,  that cost 1e-6 AU over twenty years.
+
+   The corrector loop stops once b6 changes by less than rs->pc_tolerance
+times |a|.  Iterating all the way down to rounding,  as IAS15 does,  can
+double the cost of a step without improving the result;  the caller sets
+the tolerance to match its step size control.   */
+
+static const double radau_h[8] = { 0.,
+         0.0562625605369221464656521910, 0.1802406917368923649875799428,
+         0.3526247171131696373739077702, 0.5471536263305553830014485577,
+         0.7342101772154105315232106083, 0.8853209468390957680903597629,
+         0.9775206135612875018911745004 };
+
+      /* Converts the g[] (divided differences) into b[] (coefficients) */
+static const double radau_c[21] = {
+         -0.0562625605369221464656522, 0.0101408028300636299864818,
+         -0.2365032522738145114532321, -0.0035758977292516175949345,
+         0.0935376952594620658957485, -0.5891279693869841488271399,
+         0.0019565654099472210769006, -0.0547553868890686864408084,
+         0.4158812000823068616886219, -1.1362815957175395318285885,
+         -0.0014365302363708915424460, 0.0421585277212687077072973,
+         -0.3600995965020568122897665, 1.2501507118406910258505441,
+         -1.8704917729329500633517991, 0.0012717903090268677492943,
+         -0.0387603579159067703699046, 0.3609622434528459832253398,
+         -1.4668842084004269643701553, 2.9061362593084293014237913,
+         -2.7558127197720458314421588 };
+
+      /* ...and the b[] into g[] */
+static const double radau_d[21] = {
+         0.0562625605369221464656522, 0.0031654757181708292499905,
+         0.2365032522738145114532321, 0.0001780977692217433881125,
+         0.0457929855060279188954539, 0.5891279693869841488271399,
+         0.0000100202365223291272096, 0.0084318571535257015445000,
+         0.2535340690545692665214616, 1.1362815957175395318285885,
+         0.0000005637641639318207610, 0.0015297840025004658189490,
+         0.0978342365324440053653648, 0.8752546646840910912297246,
+         1.8704917729329500633517991, 0.0000000317188154017613665,
+         0.0002762930909826476593130, 0.0360285539837364596003871,
+         0.5767330002770787313544596, 2.2485887607691597933926895,
+         2.7558127197720458314421588 };
+
+#define RADAU_MAX_ITERATIONS     12
+
+/* Change in position and velocity from the start of the step to the
+fraction 'h' of the way through it. */
+
+static void radau_increments( const double b[7][3], const double *a0,
+               const double *v0, const double step, const double h,
+               double *delta)
+{
+   int i, k;
+
+   for( i = 0; i < 3; i++)
+      {
+      double xsum = 0., vsum = 0.;
+
+      for( k = 6; k >= 0; k--)
+         {
+         xsum = (xsum + b[k][i] / (double)( (k + 2) * (k + 3))) * h;
+         vsum = (vsum + b[k][i] / (double)( k + 2)) * h;
+         }
+      delta[i] = step * h * (v0[i] + step * h * (a0[i] * .5 + xsum));
+      delta[i + 3] = step * h * (a0[i] + vsum);
+      }
+}
+
+/* Extrapolates the b[] values of the last step to the next one,  which
+is 'ratio' times as long;  see Everhart,  eqn 2.10.  The difference
+between the last step's converged b[] and its prediction is added in
+(as in IAS15),  which improves the guess considerably. */
+
+static void predict_radau_b( Radau_state *rs, const double ratio)
+{
+   int i, j, k;
+
+   if( !rs->step || fabs( ratio) > 20.)  /* no useful prediction */
+      {
+      memset( rs->new_b, 0, sizeof( rs->new_b));
+      memset( rs->new_e, 0, sizeof( rs->new_e));
+      return;
+      }
+   for( i = 0; i < 3; i++)
+      {
+      double q = 1.;
+
+      for( k = 0; k < 7; k++)
+         {
+         double binomial = 1., sum = 0.;
+
+         q *= ratio;
+         for( j = k; j < 7; j++)
+            {                    /* binomial = C(j + 1, k + 1) */
+            sum += binomial * rs->b[j][i];
+            binomial = binomial * (double)( j + 2) / (double)( j + 1 - k);
+            }
+         rs->new_e[k][i] = q * sum;
+         rs->new_b[k][i] = rs->new_e[k][i] + (rs->b[k][i] - rs->e[k][i]);
+         }
+      }
+}
+
+/* Finds the b[] coefficients of the polynomial through accelerations
+given at the eight Gauss-Radau spacings,  from scratch (the corrector
+loop in take_radau_step() updates them incrementally instead).  */
+
+static void radau_b_from_nodes( const double accel[8][3], double b[7][3])
+{
+   double g[7][3];
+   int i, j, k, n;
+
+   memset( b, 0, 7 * 3 * sizeof( double));
+   for( n = 1; n < 8; n++)
+      {
+      const double *cptr = radau_c + (n - 1) * (n - 2) / 2;
+
+      for( i = 0; i < 3; i++)
+         {
+         double val = (accel[n][i] - accel[0][i]) / radau_h[n];
+
+         for( j = 0; j < n - 1; j++)
+            val = (val - g[j][i]) / (radau_h[n] - radau_h[j + 1]);
+         g[n - 1][i] = val;
+         for( k = 0; k < n - 1; k++)
+            b[k][i] += val * cptr[k];
+         b[n - 1][i] += val;
+         }
+      }
+}
+
+/* The error 1 / (7! * tau^7) for the timescale tau of the acceleration
+a0 + b0 * h + ... at the end of the step,  scaled by |a| there over
+sqrt( total2);  see above.  Zero if the acceleration doesn't change.  */
+
+static double radau_timescale_error( const double b[7][3], const double *a0,
+                           const double total2)
+{
+   double y2 = 0., y3 = 0., y4 = 0., timescale2;
+   int i, k;
+
+   for( i = 0; i < 3; i++)       /* a,  a',  a'' at end of step */
+      {
+      double accel = a0[i], deriv1 = 0., deriv2 = 0.;
+
+      for( k = 0; k < 7; k++)
+         {
+         accel += b[k][i];
+         deriv1 += (double)( k + 1) * b[k][i];
+         deriv2 += (double)( k * (k + 1)) * b[k][i];
+         }
+      y2 += accel * accel;
+      y3 += deriv1 * deriv1;
+      y4 += deriv2 * deriv2;
+      }
+   timescale2 = 2. * y2 / (y3 + sqrt( y4 * y2));
+   if( !std::isfinite( timescale2) || !timescale2 || !total2)
+      return( 0.);         /* no change in acceleration:  any step is OK */
+   return( sqrt( y2 / total2) / (5040. * timescale2 * timescale2 * timescale2
+                                   * sqrt( timescale2)));
+}
+
+double take_radau_step( const double jd, Elements *ref_orbit,
+                 Radau_state *rs, const double *ival, const double *ival_lo,
+                 double *delta, const double step)
+{
+   double g[7][3], state_j[MAX_N_PARAMS], derivs[MAX_N_PARAMS];
+   double v0[3], max_accel = 0., pc_error = 1., prev_pc_error;
+   double ref_states[9][9], node_posn[8][3], node_accel[8][3];
+   double total2 = 0., rval;
+   int i, j, k, n, iter = 0;
+
+   predict_radau_b( rs, (rs->step ? step / rs->step : 0.));
+   for( n = 0; n < 8; n++)
+      compute_ref_state( ref_orbit, ref_states[n], jd + radau_h[n] * step);
+   compute_ref_state( ref_orbit, ref_states[8], jd + step);
+   memcpy( state_j, ival, n_orbit_params * sizeof( double));
+   for( i = 0; i < 6; i++)
+      state_j[i] += ival_lo[i];
+   calc_derivatives_t( jd, state_j, derivs, ref_orbit->central_obj);
+   for( i = 0; i < 3; i++)
+      {
+      v0[i] = (ival[i + 3] - ref_states[0][i + 3]) + ival_lo[i + 3];
+      rs->a0[i] = derivs[i + 3] - ref_states[0][i + 6];
+      node_posn[0][i] = state_j[i];
+      node_accel[0][i] = derivs[i + 3];
+      if( max_accel < fabs( derivs[i + 3]))
+         max_accel = fabs( derivs[i + 3]);
+      total2 += derivs[i + 3] * derivs[i + 3];
+      for( j = 0; j < 7; j++)
+         {
+         g[j][i] = rs->new_b[j][i];
+         for( k = j + 1; k < 7; k++)
+            g[j][i] += radau_d[k * (k - 1) / 2 + j] * rs->new_b[k][i];
+         }
+      }
+   if( !max_accel)         /* inside a planet,  or no forces at all */
+      max_accel = 1.;
+   do
+      {
+      prev_pc_error = pc_error;
+      pc_error = 0.;
+      for( n = 1; n < 8; n++)
+         {
+         const double *cptr = radau_c + (n - 1) * (n - 2) / 2;
+
+         radau_increments( rs->new_b, rs->a0, v0, step, radau_h[n], delta);
+         for( i = 0; i < 6; i++)
+            state_j[i] = ival[i] + ((ref_states[n][i] - ref_states[0][i])
+                                 + (ival_lo[i] + delta[i]));
+         calc_derivatives_t( jd + radau_h[n] * step, state_j, derivs,
+                                 ref_orbit->central_obj);
+         for( i = 0; i < 3; i++)
+            {
+            double val = (derivs[i + 3] - ref_states[n][i + 6] - rs->a0[i])
+                                 / radau_h[n], change;
+
+            for( j = 0; j < n - 1; j++)
+               val = (val - g[j][i]) / (radau_h[n] - radau_h[j + 1]);
+            change = val - g[n - 1][i];
+            g[n - 1][i] = val;
+            for( k = 0; k < n - 1; k++)
+               rs->new_b[k][i] += change * cptr[k];
+            rs->new_b[n - 1][i] += change;
+            if( n == 7 && pc_error < fabs( change))
+               pc_error = fabs( change);
+            node_posn[n][i] = state_j[i];
+            node_accel[n][i] = derivs[i + 3];
+            }
+         }
+      pc_error /= max_accel;
+      iter++;
+      }
+      while( pc_error > rs->pc_tolerance && iter < RADAU_MAX_ITERATIONS
+                     && (iter < 2 || pc_error < prev_pc_error));
+   radau_increments( rs->new_b, rs->a0, v0, step, 1., delta);
+   for( i = 0; i < 6; i++)
+      delta[i] += ref_states[8][i] - ref_states[0][i];
+   rval = radau_timescale_error( rs->new_b, rs->a0, total2);
+   if( ref_orbit->central_obj < 0)     /* Cowell:  check non-solar part, */
+      {                                /* as Encke's method would */
+      double pert_b[7][3], pert_err;
+
+      for( n = 0; n < 8; n++)
+         {
+         const double r2 = node_posn[n][0] * node_posn[n][0]
+                  + node_posn[n][1] * node_posn[n][1]
+                  + node_posn[n][2] * node_posn[n][2];
+         const double coeff = SOLAR_GM / (r2 * sqrt( r2));
+
+         for( i = 0; i < 3; i++)
+            node_accel[n][i] += coeff * node_posn[n][i];
+         }
+      radau_b_from_nodes( node_accel, pert_b);
+      pert_err = radau_timescale_error( pert_b, node_accel[0], total2);
+      if( rval < pert_err)
+         rval = pert_err;
+      }
+   return( rval);
+}
+
+void accept_radau_step( Radau_state *rs, const double step)
+{
+   memcpy( rs->b, rs->new_b, sizeof( rs->b));
+   memcpy( rs->e, rs->new_e, sizeof( rs->e));
+   rs->step = step;
+}
+
+/* After accept_radau_step( ),  gives the change in position and velocity
+from the start of that step ('ival' is the state there,  at 'jd') to
+'fraction' of the way through it.  'ref_orbit' must be the one used for
+the step.  The polynomial is as good as the step itself,  so this is a
+much better interpolant than the Hermite one used with RKF.  */
+
+void radau_dense_output( const Radau_state *rs, Elements *ref_orbit,
+                 const double jd, const double *ival, const double fraction,
+                 double *delta)
+{
+   double ref_0[9], ref_f[9], v0[3];
+   int i;
+
+   compute_ref_state( ref_orbit, ref_0, jd);
+   compute_ref_state( ref_orbit, ref_f, jd + fraction * rs->step);
+   for( i = 0; i < 3; i++)
+      v0[i] = ival[i + 3] - ref_0[i + 3];
+   radau_increments( rs->b, rs->a0, v0, rs->step, fraction, delta);
+   for( i = 0; i < 6; i++)
+      delta[i] += ref_f[i] - ref_0[i];
+}
+
+/* Same Runge-Kutta step as above,  but for an ensemble of objects in
+the structure-of-arrays layout used by calc_ensemble_derivatives( ), all
+taking the same step.  Each object has its own Encke reference orbit in
+'ref_orbits' (central_obj < 0 for the method of Cowell).  'work' must
+have room for 58 * stride doubles.  The error returned is the largest of
+the errors for the individual objects,  as take_rk_stepl() would have
+computed them.  If any object was inside a planet at any stage of the
+step,  'planet_hit' is left set to that planet.  */
+
+double take_ensemble_rk_step( const double jd, Elements *ref_orbits,
+               const double *ival, double *ovals, const unsigned n_objects,
+               const unsigned stride, const double step, double *work)
+{
+   const double bvals[21] = { RKF_B21,
+            RKF_B31, RKF_B32,
+            RKF_B41, RKF_B42, RKF_B43,
+            RKF_B51, RKF_B52, RKF_B53, RKF_B54,
+            RKF_B61, RKF_B62, RKF_B63, RKF_B64, RKF_B65,
+            RKF_CHAT1, RKF_CHAT2, RKF_CHAT3,
+            RKF_CHAT4, RKF_CHAT5, RKF_CHAT6 };
+   const double avals[7] = { RKF_A1, RKF_A2, RKF_A3, RKF_A4, RKF_A5, RKF_A6, 1. };
+   const double err_coeffs[6] = {
+            RKF_CHAT1 - RKF_C1, RKF_CHAT2 - RKF_C2, RKF_CHAT3 - RKF_C3,
+            RKF_CHAT4 - RKF_C4, RKF_CHAT5 - RKF_C5, RKF_CHAT6 - RKF_C6 };
+   const size_t n_vals = 6 * (size_t)stride;
+   const double *bptr = bvals;
+   double *derivs[6], *state_j = work + 6 * n_vals;
+   double *delta_0 = state_j + n_vals, *ref_j = delta_0 + n_vals;
+   double *scratch = ref_j + 9 * (size_t)stride, rval = 0.;
+   unsigned i, j, k, m;
+   int hit = -1;
+
+   for( j = 0; j < 6; j++)
+      derivs[j] = work + j * n_vals;
+   for( j = 0; j < 7; j++)
+      {
+      const double jd_j = jd + step * avals[j];
+      double *state_out = (j == 6 ? ovals : state_j);
+
+      for( k = 0; k < n_objects; k++)
+         {
+         double ref_state[9];
+
+         compute_ref_state( ref_orbits + k, ref_state, jd_j);
+         for( i = 0; i < 9; i++)
+            ref_j[i * stride + k] = ref_state[i];
+         }
+      if( !j)     /* subtract the analytic posn/vel from the numeric: */
+         for( i = 0; i < 6; i++)
+            for( k = 0; k < n_objects; k++)
+               delta_0[i * stride + k] = ival[i * stride + k] - ref_j[i * stride + k];
+      else
+         for( i = 0; i < 6; i++)
+            for( k = 0; k < n_objects; k++)
+               {
+               double tval = 0.;
+
+               for( m = 0; m < j; m++)
+                  tval += bptr[m] * derivs[m][i * stride + k];
+               state_out[i * stride + k] = delta_0[i * stride + k] + tval * step
+                                 + ref_j[i * stride + k];
+               }
+      bptr += j;
+      if( j != 6)
+         {
+         if( calc_ensemble_derivatives( jd_j, (j ? state_j : ival),
+                     derivs[j], n_objects, stride, scratch) != -1)
+            hit = planet_hit;
+         for( i = 0; i < 6; i++)
+            for( k = 0; k < n_objects; k++)
+               derivs[j][i * stride + k] -= ref_j[(i + 3) * stride + k];
+         }
+      }
+   planet_hit = hit;
+   for( k = 0; k < n_objects; k++)
+      scratch[k] = 0.;
+   for( i = 0; i < 6; i++)       /* error is judged on posn/vel only */
+      for( k = 0; k < n_objects; k++)
+         {
+         double tval = 0.;
+
+         for( m = 0; m < 6; m++)
+            tval += err_coeffs[m] * derivs[m][i * stride + k];
+         scratch[k] += tval * tval;
+         }
+   for( k = 0; k < n_objects; k++)
+      if( rval < scratch[k])
+         rval = scratch[k];
+   return( sqrt( rval * step * step));
+}
+
 int symplectic_6( double jd, Elements *ref_orbit, double *vect,
                                           const double dt)
 {
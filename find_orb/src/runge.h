@@ -1,12 +1,46 @@
 #ifndef RUNGE_H_INCLUDE
 #define RUNGE_H_INCLUDE
 
+#include <cstdint>
+
 struct Elements;
 
+/* Most we'll ask the integrators to carry:  the state vector plus the
+6 x MAX_N_PARAMS state transition matrix (see 'runge.cpp').  */
+
+#define MAX_N_INTEGRATED_VALS (7 * MAX_N_PARAMS)
+
+/* Scratch space (in long doubles) the step functions need when
+integrating 'n_vals' values.  Callers supply it,  so that nothing is
+allocated within the integration loop.  */
+
+#define RK_STEP_WORKSPACE( n_vals)     (13 * (n_vals))
+#define PD89_STEP_WORKSPACE( n_vals)   (27 * (n_vals))
+
+/* Planet positions requested by the force model and actually computed
+(see ADAPTIVE_PERTURBERS in 'runge.cpp') are counted for planets 0 to
+10;  get_perturber_counts() fills arrays of this size.  */
+
+#define N_PERTURBER_COUNTS 11
+
+/* What's carried from one Gauss-Radau step to the next;  see
+take_radau_step() in 'runge.cpp'.  Zero it and set 'pc_tolerance' before
+the first step.  */
+
+typedef struct
+{
+   double b[7][3], e[7][3];  /* last accepted step: b,  & its prediction */
+   double new_b[7][3], new_e[7][3], a0[3];      /* the last step tried */
+   double step;                  /* last accepted step;  0 if none yet */
+   double pc_tolerance;            /* see take_radau_step( ) */
+} Radau_state;
+
 int find_best_fit_planet(const double jd, const double* ivect, double* rel_vect);
 void find_relative_state_vect(const double jd, const double* ivect,
        double* ovect, const int ref_planet);   
 void compute_effective_solar_multiplier(const char* constraints); 
+long double get_solar_multiplier(void);                    /* runge.cpp */
+void set_solar_multiplier(const long double new_multiplier);
 int get_planet_posn_vel(const double jd, const int planet_no, double* posn, double* vel);
 int calc_derivatives(const double jd, const double* ival, double* oval, const int reference_planet);
 void calc_approx_planet_orientation(const int planet, const int system_number, const double jde, double* matrix);
@@ -16,9 +50,38 @@ int find_best_fit_planet(const double jd, const double* ivect,
     double* rel_vect);         /* runge.cpp */
 long double take_rk_stepl(const long double jd, Elements* ref_orbit,
     const long double* ival, long double* ovals,
-    const int n_vals, const long double step);     /* runge.cpp */
+    const int n_vals, const long double step,
+    long double* work);                           /* runge.cpp */
+long double take_pd89_step(const long double jd, Elements* ref_orbit,
+    const long double* ival, long double* ovals,
+    const int n_vals, const long double step,
+    long double* work);                           /* runge.cpp */
+double take_rk_step_compensated(const double jd, Elements* ref_orbit,
+    const double* ival, const double* ival_lo, double* delta,
+    const int n_vals, const double step);                  /* runge.cpp */
+double take_radau_step(const double jd, Elements* ref_orbit,
+    Radau_state* rs, const double* ival, const double* ival_lo,
+    double* delta, const double step);                     /* runge.cpp */
+void accept_radau_step(Radau_state* rs, const double step);  /* runge.cpp */
+void radau_dense_output(const Radau_state* rs, Elements* ref_orbit,
+    const double jd, const double* ival, const double fraction,
+    double* delta);                                        /* runge.cpp */
+void reset_adaptive_perturbers(void);                      /* runge.cpp */
+void get_perturber_counts(int64_t* n_requested, int64_t* n_computed);
 int symplectic_6(double jd, Elements* ref_orbit, double* vect,
     const double dt);
+int calc_state_derivatives(const long double jd, const long double* ival,
+    long double* oval, const Elements* ref_orbit, const int n_vals);
+void interpolate_step(Elements* ref_orbit, const long double jd,
+    const long double* y0, const long double* f0,
+    const long double* y1, const long double* f1, long double* ovals,
+    const int n_vals, const long double step, const long double fraction);
+int calc_ensemble_derivatives(const double jd, const double* ival,
+    double* oval, const unsigned n_objects, const unsigned stride,
+    double* work);                                           /* runge.cpp */
+double take_ensemble_rk_step(const double jd, Elements* ref_orbits,
+    const double* ival, double* ovals, const unsigned n_objects,
+    const unsigned stride, const double step, double* work);  /* runge.cpp */
 
 
 #endif // !RUNGE_H_INCLUDE
@@ -0,0 +1,50 @@
+/* test_stub.cpp: console hooks for the test programs
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.    */
+
+/* The following are provided by the console Find_Orb (findorb.cpp)
+for showing progress and asking questions.  The test programs that link
+in all of $(OBJS) ('bc405_test',  'integ_test',  'fit_test') get them
+from here instead;  as in 'fo',  they do nothing.  */
+
+#include <cstdio>
+
+int debug_level = 0;
+
+int inquire( const char *prompt, char *buff, const int max_len,
+                     [[maybe_unused]] const int color)
+{
+   printf( "%s\n", prompt);
+   if( buff && max_len)
+      *buff = '\0';
+   return( 0);
+}
+
+void refresh_console( void)
+{
+}
+
+void move_add_nstr( [[maybe_unused]] const int col, [[maybe_unused]] const int row,
+         [[maybe_unused]] const char *msg, [[maybe_unused]] const int n_bytes)
+{
+}
+
+int curses_kbhit_without_mouse( )
+{
+   return( -1);
+}
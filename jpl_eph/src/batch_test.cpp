@@ -0,0 +1,170 @@
+/* batch_test.cpp: checks jpl_pleph_batch() against jpl_pleph_r()
+
+Copyright (C) 2026, Project Pluto
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+02110-1301, USA.
+
+   Computes the state of a random target relative to a random center
+(each one of the thirteen bodies/barycenters jpl_pleph() knows about)
+for a lot of random times,  once with a single jpl_pleph_batch() call
+and once with a jpl_pleph_r() call for each,  and complains about any
+differences.  A quarter of the times fall exactly on record boundaries,
+and a few are outside the ephemeris span,  since that's where the
+bookkeeping differs.  This is done with and without velocities.
+
+   Without AVX2,  the batch code sums the Chebyshev series in the same
+order as interp() does,  and the results ought to match exactly.  With
+AVX2/FMA,  rounding differs slightly,  so differences of a part in 1e+14
+are allowed,  or (for small vectors such as the moon relative to the
+earth-moon barycenter,  which are differences of much larger barycentric
+vectors) the 1e-14 AU and 2e-17 AU/day that 'testeph' allows.
+
+   batch_test (ephemeris file) [-n(count)] [-s(seed)]     */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "jpleph.h"
+
+#define MAX_RELATIVE_ERROR  1e-14
+#define MAX_POSN_ERROR      1e-14       /* AU */
+#define MAX_VEL_ERROR       2e-17       /* AU/day */
+
+/* Returns the number of states that differ. */
+
+static int check_batch( void *ephem, void *scratch, const int n,
+                  const double *et, const int *ntarg, const int *ncent,
+                  const int calc_velocity, double *max_err_found)
+{
+   double *batch = (double *)calloc( 12 * n, sizeof( double));
+   double *scalar = batch + 6 * n;
+   int *err_codes = (int *)calloc( n, sizeof( int));
+   const int n_coords = (calc_velocity ? 6 : 3);
+   int i, j, n_failed, n_differing = 0;
+   clock_t t0;
+
+   t0 = clock( );
+   n_failed = jpl_pleph_batch( ephem, scratch, n, et, ntarg, ncent, batch,
+                  calc_velocity, err_codes);
+   printf( "Batch:   %.3f s (%d failed)\n",
+               (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC, n_failed);
+   t0 = clock( );
+   for( i = 0; i < n; i++)
+      {
+      const int err_code = jpl_pleph_r( ephem, scratch, et[i], ntarg[i],
+                  ncent[i], scalar + 6 * i, calc_velocity);
+
+      if( err_code != err_codes[i])
+         {
+         printf( "JD %f,  %d rel. to %d:  error code %d from batch,  %d alone\n",
+                  et[i], ntarg[i], ncent[i], err_codes[i], err_code);
+         n_differing++;
+         }
+      }
+   printf( "Scalar:  %.3f s\n", (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC);
+   for( i = 0; i < n; i++)
+      if( !err_codes[i])
+         for( j = 0; j < n_coords; j += 3)
+            {
+            const double *bptr = batch + 6 * i + j;
+            const double *sptr = scalar + 6 * i + j;
+            const double len = sqrt( sptr[0] * sptr[0] + sptr[1] * sptr[1]
+                                   + sptr[2] * sptr[2]);
+            const double err = sqrt( (bptr[0] - sptr[0]) * (bptr[0] - sptr[0])
+                                   + (bptr[1] - sptr[1]) * (bptr[1] - sptr[1])
+                                   + (bptr[2] - sptr[2]) * (bptr[2] - sptr[2]));
+
+            if( len && max_err_found[j / 3] < err / len)
+               max_err_found[j / 3] = err / len;
+            if( err > len * MAX_RELATIVE_ERROR
+                        + (j ? MAX_VEL_ERROR : MAX_POSN_ERROR))
+               {
+               printf( "JD %f,  %d rel. to %d:  %s differs by %g\n", et[i],
+                        ntarg[i], ncent[i], (j ? "velocity" : "position"), err);
+               n_differing++;
+               }
+            }
+   free( batch);
+   free( err_codes);
+   return( n_differing);
+}
+
+int main( const int argc, const char **argv)
+{
+   void *ephem = (argc > 1 ? jpl_init_ephemeris( argv[1], NULL, NULL) : NULL);
+   void *scratch;
+   double start_jd, end_jd, step, *et, max_err_found[2] = { 0., 0. };
+   int *ntarg, *ncent, i, n = 100000, n_differing = 0;
+   unsigned seed = 1;
+
+   if( !ephem)
+      {
+      printf( "usage: batch_test <ephemeris file> [-n(count)] [-s(seed)]\n");
+      if( argc > 1)
+         printf( "Couldn't load '%s':  error %d\n", argv[1],
+                                   jpl_init_error_code( ));
+      return( -1);
+      }
+   for( i = 2; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'n':
+               n = atoi( argv[i] + 2);
+               break;
+            case 's':
+               seed = (unsigned)atoi( argv[i] + 2);
+               break;
+            default:
+               printf( "Option '%s' ignored\n", argv[i]);
+               break;
+            }
+   scratch = jpl_alloc_scratch( ephem);
+   start_jd = jpl_get_double( ephem, JPL_EPHEM_START_JD);
+   end_jd = jpl_get_double( ephem, JPL_EPHEM_END_JD);
+   step = jpl_get_double( ephem, JPL_EPHEM_STEP);
+   et = (double *)calloc( n, sizeof( double));
+   ntarg = (int *)calloc( 2 * n, sizeof( int));
+   ncent = ntarg + n;
+   srand( seed);
+   for( i = 0; i < n; i++)
+      {
+      const double frac = (double)rand( ) / (double)RAND_MAX;
+
+      if( i % 4 == 1)
+         et[i] = start_jd + floor( frac * (end_jd - start_jd) / step) * step;
+      else if( i % 1000 == 2)
+         et[i] = end_jd + 1. + frac;
+      else
+         et[i] = start_jd + frac * (end_jd - start_jd);
+      ntarg[i] = rand( ) % 13 + 1;
+      ncent[i] = rand( ) % 13 + 1;
+      }
+   printf( "%d states from '%s'\n", n, argv[1]);
+   for( i = 0; i < 2; i++)
+      n_differing += check_batch( ephem, scratch, n, et, ntarg, ncent, i,
+                     max_err_found);
+   printf( "Largest relative errors:  %g (position),  %g (velocity)\n",
+                     max_err_found[0], max_err_found[1]);
+   free( et);
+   free( ntarg);
+   jpl_free_scratch( scratch);
+   jpl_close_ephemeris( ephem);
+   if( n_differing)
+      printf( "FAILED:  %d states differ\n", n_differing);
+   return( n_differing ? -1 : 0);
+}
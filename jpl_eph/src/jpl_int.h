@@ -25,6 +25,24 @@ struct interpolation_info
    {
    double posn_coeff[MAX_CHEBY], vel_coeff[MAX_CHEBY], twot;
    unsigned n_posn_avail, n_vel_avail;
+   };
+
+            /* Records that have to be copied (because the file couldn't */
+            /* be memory-mapped,  or is in the "wrong" byte order) are   */
+            /* kept in a small per-caller cache of this many records:    */
+#define JPL_N_CACHED_RECORDS  8
+
+            /* Everything jpl_state_r() modifies lives in the scratch    */
+            /* area,  so several threads can share one ephemeris as long */
+            /* as each has its own scratch.  See jpl_alloc_scratch().    */
+struct jpl_eph_scratch
+   {
+   struct interpolation_info iinfo;
+   double pvsun[9];
+   double pvsun_t;
+   uint32_t rec_no[JPL_N_CACHED_RECORDS];
+   unsigned next_slot;
+   double *recs;        /* JPL_N_CACHED_RECORDS records;  nullptr if unneeded */
    };
 
 struct jpl_eph_data {
@@ -45,6 +63,12 @@ struct jpl_eph_data {
    struct interpolation_info iinfo;
    FILE *ifile;
    char name[32];       /* "DE430t", "INPOP-19c",  etc. */
+               /* Items past this point are new,  and are put at the end */
+               /* so that the offsets above (see jpl_get_pvsun()) hold.  */
+   struct jpl_eph_scratch *scratch;   /* used by jpl_state(),  jpl_pleph() */
+   const char *map;                   /* entire file,  if memory-mapped */
+   size_t map_size;
+   void *map_handle;                  /* Windows file mapping handle */
    };
 
 /* 2014 Mar 25:  notes about the file structure :
@@ -59,6 +59,21 @@ details of the implementation encapsulated.
 #include <cstring>
 #include <cstdlib>
 #include <cstdint>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#ifndef JPL_NO_MMAP
+   #ifdef _WIN32
+      #define WIN32_LEAN_AND_MEAN
+      #define NOMINMAX
+      #include <windows.h>
+   #else
+      #include <sys/mman.h>
+      #include <sys/stat.h>
+      #include <fcntl.h>
+      #include <unistd.h>
+   #endif
+#endif
 
 /**** include variable and type definitions, specific for this C version */
 
@@ -203,10 +218,11 @@ long /*DLL_FUNC*/ jpl_get_long( const void *ephem, const int value)
 **           computed,  otherwise not.                                      **
 **                                                                          **
 *****************************************************************************/
-int /*DLL_FUNC*/ jpl_pleph( void *ephem, const double et, const int ntarg,
-                      const int ncent, double rrd[], const int calc_velocity)
+int /*DLL_FUNC*/ jpl_pleph_r( const void *ephem, void *scratch, const double et,
+            const int ntarg, const int ncent, double rrd[], const int calc_velocity)
 {
-  struct jpl_eph_data *eph = (struct jpl_eph_data *)ephem;
+  const struct jpl_eph_data *eph = (const struct jpl_eph_data *)ephem;
+  const struct jpl_eph_scratch *sptr = (const struct jpl_eph_scratch *)scratch;
   double pv[13][6];/* pv is the position/velocity array
                              NUMBERED FROM ZERO: 0=Mercury,1=Venus,...
                              8=Pluto,9=Moon,10=Sun,11=SSBary,12=EMBary
@@ -245,7 +261,7 @@ int /*DLL_FUNC*/ jpl_pleph( void *ephem, const double et, const int ntarg,
          if( eph->ipt[i + 11][1] > 0) /* quantity is in ephemeris */
             {
             list[i + 10] = list_val;
-            rval = jpl_state( ephem, et, list, pv, rrd, 0);
+            rval = jpl_state_r( ephem, scratch, et, list, pv, rrd, 0);
             }
          else          /*  quantity doesn't exist in the ephemeris file  */
             rval = JPL_EPH_QUANTITY_NOT_IN_EPHEMERIS;
@@ -271,11 +287,11 @@ int /*DLL_FUNC*/ jpl_pleph( void *ephem, const double et, const int ntarg,
 
 /*   make call to state   */
 
-   rval = jpl_state( eph, et, list, pv, rrd, 1);
+   rval = jpl_state_r( ephem, scratch, et, list, pv, rrd, 1);
    /* Solar System barycentric Sun state goes to pv[10][] */
    if( ntarg == 11 || ncent == 11)
       for( i = 0; i < 6; i++)
-         pv[10][i] = eph->pvsun[i];
+         pv[10][i] = sptr->pvsun[i];
 
    /* Solar System Barycenter coordinates & velocities equal to zero */
    if( ntarg == 12 || ncent == 12)
@@ -307,6 +323,22 @@ int /*DLL_FUNC*/ jpl_pleph( void *ephem, const double et, const int ntarg,
    return( rval);
 }
 
+/* The original,  non-reentrant jpl_pleph() and jpl_state() use a scratch
+area allocated with the ephemeris,  and copy the barycentric sun state
+back into the ephemeris struct,  where jpl_get_pvsun() expects it.  */
+
+int /*DLL_FUNC*/ jpl_pleph( void *ephem, const double et, const int ntarg,
+                      const int ncent, double rrd[], const int calc_velocity)
+{
+   struct jpl_eph_data *eph = (struct jpl_eph_data *)ephem;
+   const int rval = jpl_pleph_r( ephem, eph->scratch, et, ntarg, ncent,
+                                    rrd, calc_velocity);
+
+   memcpy( eph->pvsun, eph->scratch->pvsun, 9 * sizeof( double));
+   eph->pvsun_t = eph->scratch->pvsun_t;
+   return( rval);
+}
+
 /* Some notes about the information stored in 'iinfo':  the posn_coeff[]
 array contains the Chebyshev polynomials for tc,
 
@@ -551,6 +583,109 @@ static int dimension( const int idx)
    return( rval);
 }
 
+/* Each call to jpl_state_r() needs the record of Chebyshev coefficients
+covering the desired time.  Usually,  the whole ephemeris file has been
+memory-mapped,  and if it's in the byte order of the current platform,
+we can just point into the mapped file;  no copying at all,  and the OS
+takes care of keeping recently-used records in memory.
+
+   Otherwise,  the record is copied (from the mapped file or with fread())
+into the caller's scratch area and byte-swapped if need be.  The scratch
+area holds several records,  so that (for example) stepping back and
+forth across a record boundary,  or interleaving integrations of
+different objects,  doesn't cause the same record to be read and
+swapped over and over.  Slots are re-used round-robin.
+
+   The file_mutex serializes fseek()/fread() on the shared FILE,  for
+the rare cases where mapping the file failed.                       */
+
+static std::mutex file_mutex;
+
+static const double *get_record( const struct jpl_eph_data *eph,
+                  struct jpl_eph_scratch *scratch, const uint32_t nr, int *err_code)
+{
+   const size_t offset = ((size_t)nr + 2) * (size_t)eph->recsize;
+   double *buf;
+   unsigned i;
+
+   if( eph->map && offset + eph->recsize > eph->map_size)
+      {
+      *err_code = JPL_EPH_READ_ERROR;
+      return( nullptr);
+      }
+   if( eph->map && !eph->swap_bytes)
+      return( (const double *)( eph->map + offset));
+   for( i = 0; i < JPL_N_CACHED_RECORDS; i++)
+      if( scratch->rec_no[i] == nr)
+         return( scratch->recs + i * eph->ncoeff);
+   i = scratch->next_slot;
+   scratch->next_slot = (i + 1) % JPL_N_CACHED_RECORDS;
+   scratch->rec_no[i] = (uint32_t)-1;       /* in case the read fails */
+   buf = scratch->recs + i * eph->ncoeff;
+   if( eph->map)
+      memcpy( buf, eph->map + offset, eph->ncoeff * sizeof( double));
+   else
+      {
+      const std::lock_guard<std::mutex> lock( file_mutex);
+
+                  /* Read two blocks ahead to account for header: */
+      if( fseek( eph->ifile, (long)offset, SEEK_SET))
+         {
+         *err_code = JPL_EPH_FSEEK_ERROR;
+         return( nullptr);
+         }
+      if( fread( buf, sizeof( double), (size_t)eph->ncoeff, eph->ifile)
+                               != (size_t)eph->ncoeff)
+         {
+         *err_code = JPL_EPH_READ_ERROR;
+         return( nullptr);
+         }
+      }
+   if( eph->swap_bytes)
+      swap_64_bit_val( buf, eph->ncoeff);
+   scratch->rec_no[i] = nr;
+   return( buf);
+}
+
+/* A scratch area is allocated in one chunk,  with room for the record
+cache after the struct if it'll be needed.  */
+
+void * /*DLL_FUNC*/ jpl_alloc_scratch( const void *ephem)
+{
+   const struct jpl_eph_data *eph = (const struct jpl_eph_data *)ephem;
+   const bool need_recs = (!eph->map || eph->swap_bytes);
+   const size_t recs_size = (need_recs ?
+               JPL_N_CACHED_RECORDS * (size_t)eph->ncoeff * sizeof( double) : 0);
+   struct jpl_eph_scratch *rval = (struct jpl_eph_scratch *)calloc(
+               sizeof( struct jpl_eph_scratch) + recs_size, 1);
+   unsigned i;
+
+   if( !rval)
+      return( nullptr);
+   rval->iinfo.posn_coeff[0] = 1.0;
+            /* Seed a bogus value here.  The first and subsequent calls to */
+            /* 'interp' will correct it to a value between -1 and +1.      */
+   rval->iinfo.posn_coeff[1] = -2.0;
+   rval->iinfo.vel_coeff[0] = 0.0;
+   rval->iinfo.vel_coeff[1] = 1.0;
+   rval->pvsun_t = -1e+80;   /* a time we can't use anyway */
+   for( i = 0; i < JPL_N_CACHED_RECORDS; i++)
+      rval->rec_no[i] = (uint32_t)-1;
+   if( need_recs)
+      rval->recs = (double *)( rval + 1);
+   return( rval);
+}
+
+void /*DLL_FUNC*/ jpl_free_scratch( void *scratch)
+{
+   free( scratch);
+}
+
+const double * /*DLL_FUNC*/ jpl_get_scratch_pvsun( const void *scratch)
+{
+   return( ((const struct jpl_eph_scratch *)scratch)->pvsun);
+}
+
 /*****************************************************************************
 **                        jpl_state(ephem,et2,list,pv,nut,bary)             **
 ******************************************************************************
@@ -632,17 +767,19 @@ static int dimension( const int idx)
 **                       d epsilon dot                                      **
 **                                                                          **
 *****************************************************************************/
-int /*DLL_FUNC*/ jpl_state( void *ephem, const double et, const int list[14],
-                          double pv[][6], double nut[4], const int bary)
+int /*DLL_FUNC*/ jpl_state_r( const void *ephem, void *scratch, const double et,
+            const int list[14], double pv[][6], double nut[4], const int bary)
 {
-   struct jpl_eph_data *eph = (struct jpl_eph_data *)ephem;
+   const struct jpl_eph_data *eph = (const struct jpl_eph_data *)ephem;
+   struct jpl_eph_scratch *sptr = (struct jpl_eph_scratch *)scratch;
    unsigned i, j, n_intervals;
    uint32_t nr;
-   double *buf = eph->cache;
+   const double *buf;
    double t[2];
    const double block_loc = (et - eph->ephem_start) / eph->ephem_step;
    bool recompute_pvsun;
    const double aufac = 1.0 / eph->au;
+   int err_code = 0;
 
 /*   error return for epoch out of range  */
    if( et < eph->ephem_start || et > eph->ephem_end)
@@ -658,26 +795,15 @@ int /*DLL_FUNC*/ jpl_state( void *ephem, const double et, const int list[14],
       nr--;
       }
 
-/*   read correct record if not in core (static vector buf[])   */
-
-   if( nr != eph->curr_cache_loc)
-      {
-      eph->curr_cache_loc = nr;
-                  /* Read two blocks ahead to account for header: */
-      if( fseek( eph->ifile, (nr + 2) * eph->recsize, SEEK_SET))
-         return( JPL_EPH_FSEEK_ERROR);
-      if( fread( buf, sizeof( double), (size_t)eph->ncoeff, eph->ifile)
-                               != (size_t)eph->ncoeff)
-         return( JPL_EPH_READ_ERROR);
-      if( eph->swap_bytes)
-         swap_64_bit_val( buf, eph->ncoeff);
-      }
+   buf = get_record( eph, sptr, nr, &err_code);
+   if( !buf)
+      return( err_code);
    t[1] = eph->ephem_step;
 
-   if( eph->pvsun_t != et)   /* If several calls are made for the same et, */
+   if( sptr->pvsun_t != et)  /* If several calls are made for the same et, */
       {                      /* don't recompute pvsun each time... only on */
       recompute_pvsun = true;   /* the first run through.                     */
-      eph->pvsun_t = et;
+      sptr->pvsun_t = et;
       }
    else
       recompute_pvsun = false;
@@ -693,7 +819,7 @@ int /*DLL_FUNC*/ jpl_state( void *ephem, const double et, const int list[14],
       for( i = 0; i < 15; i++)
          {
          unsigned quantities;
-         uint32_t *iptr;
+         const uint32_t *iptr;
 
          if( i == 14)
             {
@@ -712,10 +838,10 @@ int /*DLL_FUNC*/ jpl_state( void *ephem, const double et, const int list[14],
             if( i < 10)
                dest = pv[i];
             else if( i == 14)
-               dest = eph->pvsun;
+               dest = sptr->pvsun;
             else
                dest = nut;
-            interp( &eph->iinfo, &buf[iptr[0]-1], t, (int)iptr[1],
+            interp( &sptr->iinfo, &buf[iptr[0]-1], t, (int)iptr[1],
                                     dimension( i + 1),
                                     n_intervals, quantities, dest);
 
@@ -727,11 +853,332 @@ int /*DLL_FUNC*/ jpl_state( void *ephem, const double et, const int list[14],
    if( !bary)                             /* gotta correct everybody for */
       for( i = 0; i < 9; i++)            /* the solar system barycenter */
          for( j = 0; j < (unsigned)list[i] * 3; j++)
-            pv[i][j] -= eph->pvsun[j];
+            pv[i][j] -= sptr->pvsun[j];
 
    return( 0);
 }
 
+int /*DLL_FUNC*/ jpl_state( void *ephem, const double et, const int list[14],
+                          double pv[][6], double nut[4], const int bary)
+{
+   struct jpl_eph_data *eph = (struct jpl_eph_data *)ephem;
+   const int rval = jpl_state_r( ephem, eph->scratch, et, list, pv, nut, bary);
+
+   memcpy( eph->pvsun, eph->scratch->pvsun, 9 * sizeof( double));
+   eph->pvsun_t = eph->scratch->pvsun_t;
+   return( rval);
+}
+
+/* jpl_pleph_batch() computes the same thing as calling jpl_pleph_r()
+for each of 'n' epochs/targets/centers,  but more efficiently:
+
+   -- Requests are sorted by record,  so each record is located (and,  if
+need be,  read and byte-swapped) once per batch,  rather than once each
+time the time jumps from one record to another.
+
+   -- For each body needed within a record,  the Chebyshev polynomials
+are evaluated for BATCH_LANES epochs at once.  With AVX2 and FMA (i.e.,
+compiling with -mavx2 -mfma or /arch:AVX2),  that's done with 256-bit
+vectors;  otherwise,  with plain loops the compiler can vectorize as
+it sees fit.  (AVX-512 would let us do eight epochs at a time,  but the
+coefficients for each lane come from different places in the record,
+so the loads,  rather than the arithmetic,  would limit us.)
+
+   'rrd' must have room for 6 * n doubles;  the results for request i are
+at rrd[6 * i].  'err_codes',  if non-null,  gets the jpl_pleph()-style
+return value for each request.  The return value is the number of
+requests that failed.  Nutations,  librations and such (ntarg >= 14)
+are handed off to jpl_pleph_r() one at a time.    */
+
+#define BATCH_LANES 4
+#define N_BATCH_BODIES 11        /* Mercury...Pluto,  geocentric moon,  sun */
+
+#if defined( __AVX2__) && defined( __FMA__)
+   #define JPL_BATCH_AVX2
+   #include <immintrin.h>
+#endif
+
+/* Evaluates one body (three components) from the coefficients at 'coef'
+for up to BATCH_LANES times at once.  Each lane may fall in a different
+sub-interval,  so each gets its own coefficient pointer.  Sums are taken
+in the same order as in interp(). */
+
+static void interp_lanes( const double *coef, const unsigned ncf,
+            const unsigned na, const double *t0, const double step,
+            const unsigned n_lanes, const int velocity_flag, double **posvel)
+{
+   const double vfac = 2. * (double)na / step;
+   const double *cptr[BATCH_LANES];
+   double tc[BATCH_LANES];
+   unsigned i, j, k;
+
+   assert( ncf < MAX_CHEBY);
+   for( k = 0; k < BATCH_LANES; k++)
+      {
+      const double temp = (double)na * t0[k < n_lanes ? k : 0];
+      unsigned l = (unsigned)temp;
+      double unused_temp1;
+
+      tc[k] = 2.0 * modf( temp, &unused_temp1) - 1.0;
+      if( l == na)
+         {
+         l--;
+         tc[k] = 1.;
+         }
+      cptr[k] = coef + ncf * l * 3;
+      }
+#ifdef JPL_BATCH_AVX2
+   __m256d tn[MAX_CHEBY], dtn[MAX_CHEBY];
+   const __m256d twot = _mm256_set_pd( 2. * tc[3], 2. * tc[2], 2. * tc[1], 2. * tc[0]);
+   double results[BATCH_LANES];
+
+   tn[0] = _mm256_set1_pd( 1.);
+   tn[1] = _mm256_set_pd( tc[3], tc[2], tc[1], tc[0]);
+   for( j = 2; j < ncf; j++)
+      tn[j] = _mm256_fmsub_pd( twot, tn[j - 1], tn[j - 2]);
+   for( i = 0; i < 3; i++)
+      {
+      __m256d sum = _mm256_setzero_pd( );
+
+      for( j = ncf; j; j--)
+         {
+         const unsigned offset = ncf * i + j - 1;
+
+         sum = _mm256_fmadd_pd( tn[j - 1], _mm256_set_pd( cptr[3][offset],
+                     cptr[2][offset], cptr[1][offset], cptr[0][offset]), sum);
+         }
+      _mm256_storeu_pd( results, sum);
+      for( k = 0; k < n_lanes; k++)
+         posvel[k][i] = results[k];
+      }
+   if( velocity_flag <= 1)
+      return;
+   dtn[0] = _mm256_setzero_pd( );
+   dtn[1] = _mm256_set1_pd( 1.);
+   for( j = 2; j < ncf; j++)
+      dtn[j] = _mm256_sub_pd( _mm256_fmadd_pd( twot, dtn[j - 1],
+                     _mm256_add_pd( tn[j - 1], tn[j - 1])), dtn[j - 2]);
+   for( i = 0; i < 3; i++)
+      {
+      __m256d sum = _mm256_setzero_pd( );
+
+      for( j = ncf - 1; j; j--)
+         {
+         const unsigned offset = ncf * i + j;
+
+         sum = _mm256_fmadd_pd( dtn[j], _mm256_set_pd( cptr[3][offset],
+                     cptr[2][offset], cptr[1][offset], cptr[0][offset]), sum);
+         }
+      _mm256_storeu_pd( results, _mm256_mul_pd( sum, _mm256_set1_pd( vfac)));
+      for( k = 0; k < n_lanes; k++)
+         posvel[k][i + 3] = results[k];
+      }
+#else
+   double tn[MAX_CHEBY][BATCH_LANES], dtn[MAX_CHEBY][BATCH_LANES];
+
+   for( k = 0; k < BATCH_LANES; k++)
+      {
+      tn[0][k] = 1.;
+      tn[1][k] = tc[k];
+      }
+   for( j = 2; j < ncf; j++)
+      for( k = 0; k < BATCH_LANES; k++)
+         tn[j][k] = 2. * tc[k] * tn[j - 1][k] - tn[j - 2][k];
+   for( i = 0; i < 3; i++)
+      for( k = 0; k < n_lanes; k++)
+         {
+         const double *coeff_ptr = cptr[k] + ncf * i;
+         double sum = 0.;
+
+         for( j = ncf; j; j--)
+            sum += tn[j - 1][k] * coeff_ptr[j - 1];
+         posvel[k][i] = sum;
+         }
+   if( velocity_flag <= 1)
+      return;
+   for( k = 0; k < BATCH_LANES; k++)
+      {
+      dtn[0][k] = 0.;
+      dtn[1][k] = 1.;
+      }
+   for( j = 2; j < ncf; j++)
+      for( k = 0; k < BATCH_LANES; k++)
+         dtn[j][k] = 2. * tc[k] * dtn[j - 1][k] + tn[j - 1][k] + tn[j - 1][k]
+                        - dtn[j - 2][k];
+   for( i = 0; i < 3; i++)
+      for( k = 0; k < n_lanes; k++)
+         {
+         const double *coeff_ptr = cptr[k] + ncf * i;
+         double sum = 0.;
+
+         for( j = ncf - 1; j; j--)
+            sum += dtn[j][k] * coeff_ptr[j];
+         posvel[k][i + 3] = sum * vfac;
+         }
+#endif
+}
+
+/* Which of the N_BATCH_BODIES barycentric states are needed to get
+body 'idx' (numbered as in jpl_pleph());  cf. the 'list' logic there. */
+
+static unsigned batch_bodies_needed( const int idx)
+{
+   const int k = idx - 1;
+   unsigned rval = 0;
+
+   if( k <= 9)
+      rval |= 1u << k;           /* major planets */
+   if( k == 9 || k == 12)
+      rval |= 1u << 2;           /* moon or EMB need the EMB state */
+   if( k == 2)
+      rval |= 1u << 9;           /* earth needs the moon's state */
+   if( k == 10)
+      rval |= 1u << 10;          /* the sun */
+   return( rval);
+}
+
+struct batch_item
+   {
+   int idx;                      /* index into the caller's arrays */
+   uint32_t nr;                  /* record number */
+   double t0;                    /* fraction of the way through record */
+   unsigned bodies;              /* bit mask of states to compute */
+   };
+
+int /*DLL_FUNC*/ jpl_pleph_batch( const void *ephem, void *scratch, const int n,
+            const double *et, const int *ntarg, const int *ncent,
+            double *rrd, const int calc_velocity, int *err_codes)
+{
+   const struct jpl_eph_data *eph = (const struct jpl_eph_data *)ephem;
+   const int list_val = (calc_velocity ? 2 : 1);
+   const double aufac = 1.0 / eph->au;
+   std::vector<batch_item> items;
+   std::vector<double> states;   /* barycentric states for one record */
+   int i, n_failed = 0;
+   size_t start, end;
+
+   for( i = 0; i < n; i++)
+      {
+      double *out = rrd + 6 * i;
+      int rval = 0;
+
+      memset( out, 0, 6 * sizeof( double));
+      if( ntarg[i] == ncent[i])
+         ;
+      else if( ntarg[i] >= 14 || ntarg[i] < 1 || ncent[i] > 13 || ncent[i] < 1)
+         rval = jpl_pleph_r( ephem, scratch, et[i], ntarg[i], ncent[i],
+                             out, calc_velocity);
+      else if( et[i] < eph->ephem_start || et[i] > eph->ephem_end)
+         rval = JPL_EPH_OUTSIDE_RANGE;
+      else
+         {
+         batch_item item;
+         const double block_loc = (et[i] - eph->ephem_start) / eph->ephem_step;
+
+         item.idx = i;
+         item.nr = (uint32_t)block_loc;
+         item.t0 = block_loc - (double)item.nr;
+         if( !item.t0 && item.nr)
+            {
+            item.t0 = 1.;
+            item.nr--;
+            }
+         item.bodies = batch_bodies_needed( ntarg[i]) | batch_bodies_needed( ncent[i]);
+         items.push_back( item);
+         }
+      if( err_codes)
+         err_codes[i] = rval;
+      if( rval)
+         n_failed++;
+      }
+
+   std::stable_sort( items.begin( ), items.end( ),
+            []( const batch_item &a, const batch_item &b) { return( a.nr < b.nr); });
+
+   for( start = 0; start < items.size( ); start = end)
+      {
+      int err_code = 0;
+      const double *buf = get_record( eph, (struct jpl_eph_scratch *)scratch,
+                                      items[start].nr, &err_code);
+      unsigned q;
+
+      for( end = start + 1; end < items.size( ) && items[end].nr == items[start].nr; end++)
+         ;
+      if( !buf)
+         {
+         for( size_t j = start; j < end; j++)
+            {
+            if( err_codes)
+               err_codes[items[j].idx] = err_code;
+            n_failed++;
+            }
+         continue;
+         }
+      states.resize( (end - start) * N_BATCH_BODIES * 6);
+      for( q = 0; q < N_BATCH_BODIES; q++)
+         {
+         const uint32_t *iptr = eph->ipt[q];       /* ipt[10] is the sun */
+         double t0[BATCH_LANES], *posvel[BATCH_LANES];
+         unsigned n_lanes = 0;
+
+         for( size_t j = start; j < end; j++)
+            if( items[j].bodies & (1u << q))
+               {
+               t0[n_lanes] = items[j].t0;
+               posvel[n_lanes++] = &states[((j - start) * N_BATCH_BODIES + q) * 6];
+               if( n_lanes == BATCH_LANES)
+                  {
+                  interp_lanes( buf + iptr[0] - 1, iptr[1], iptr[2], t0,
+                        eph->ephem_step, n_lanes, list_val, posvel);
+                  n_lanes = 0;
+                  }
+               }
+         if( n_lanes)
+            interp_lanes( buf + iptr[0] - 1, iptr[1], iptr[2], t0,
+                        eph->ephem_step, n_lanes, list_val, posvel);
+         }
+
+            /* Now combine states just as jpl_pleph() does : */
+      for( size_t j = start; j < end; j++)
+         {
+         const batch_item *item = &items[j];
+         const int targ = ntarg[item->idx], cent = ncent[item->idx];
+         const double *state = &states[(j - start) * N_BATCH_BODIES * 6];
+         double pv[13][6], *out = rrd + 6 * item->idx;
+         unsigned k;
+
+         for( q = 0; q < N_BATCH_BODIES; q++)
+            if( item->bodies & (1u << q))
+               for( k = 0; k < list_val * 3u; k++)
+                  pv[q][k] = state[q * 6 + k] * aufac;
+         for( k = 0; k < 6; k++)
+            {
+            pv[11][k] = 0.;         /* solar system barycenter */
+            if( !(item->bodies & (1u << 9)))
+               pv[9][k] = 0.;       /* the EMB alone doesn't need the moon */
+            }
+         if( targ == 13 || cent == 13)
+            for( k = 0; k < 6; k++)
+               pv[12][k] = pv[2][k];
+         if( (targ * cent) == 30 && (targ + cent) == 13)
+            for( k = 0; k < 6; k++)
+               pv[2][k] = 0.;
+         else
+            {
+            if( item->bodies & (1u << 2))
+               for( k = 0; k < list_val * 3u; k++)
+                  pv[2][k] -= pv[9][k] / (1.0 + eph->emrat);
+            if( item->bodies & (1u << 9))
+               for( k = 0; k < list_val * 3u; k++)
+                  pv[9][k] += pv[2][k];
+            }
+         for( k = 0; k < list_val * 3u; k++)
+            out[k] = pv[targ - 1][k] - pv[cent - 1][k];
+         }
+      }
+   return( n_failed);
+}
+
 static int init_err_code = JPL_INIT_NOT_CALLED;
 
 int /*DLL_FUNC*/ jpl_init_error_code( void)
@@ -753,6 +1200,77 @@ int /*DLL_FUNC*/ jpl_init_error_code( void)
 #define JPL_HEADER_SIZE (5 * sizeof( double) + 41 * sizeof( int32_t))
 
             /* ...also known as 5 * 8 + 41 * 4 = 204 bytes.   */
+/* Map the entire ephemeris file into memory,  if we can.  If not (on a
+32-bit system with a big ephemeris,  for example),  'map' is left
+null,  and records are read with fseek()/fread() as they always were.
+Compile with -DJPL_NO_MMAP to always do the latter.   */
+
+static void map_ephemeris_file( struct jpl_eph_data *eph, const char *filename)
+{
+#ifdef JPL_NO_MMAP
+   (void)eph;
+   (void)filename;
+#elif defined( _WIN32)
+   HANDLE hfile = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ,
+                  nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   LARGE_INTEGER size;
+
+   if( hfile == INVALID_HANDLE_VALUE)
+      return;
+   if( GetFileSizeEx( hfile, &size) && (uint64_t)size.QuadPart <= (uint64_t)SIZE_MAX)
+      {
+      HANDLE hmap = CreateFileMappingA( hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+      if( hmap)
+         {
+         eph->map = (const char *)MapViewOfFile( hmap, FILE_MAP_READ, 0, 0, 0);
+         if( eph->map)
+            {
+            eph->map_size = (size_t)size.QuadPart;
+            eph->map_handle = hmap;
+            }
+         else
+            CloseHandle( hmap);
+         }
+      }
+   CloseHandle( hfile);       /* the mapping keeps the file open */
+#else
+   const int fd = open( filename, O_RDONLY);
+   struct stat st;
+
+   if( fd < 0)
+      return;
+   if( !fstat( fd, &st) && st.st_size > 0
+                  && (uint64_t)st.st_size <= (uint64_t)SIZE_MAX)
+      {
+      void *addr = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+      if( addr != MAP_FAILED)
+         {
+         eph->map = (const char *)addr;
+         eph->map_size = (size_t)st.st_size;
+         }
+      }
+   close( fd);                /* the mapping keeps the file open */
+#endif
+}
+
+static void unmap_ephemeris_file( struct jpl_eph_data *eph)
+{
+#ifndef JPL_NO_MMAP
+   if( eph->map)
+      {
+#ifdef _WIN32
+      UnmapViewOfFile( eph->map);
+      CloseHandle( (HANDLE)eph->map_handle);
+#else
+      munmap( (void *)eph->map, eph->map_size);
+#endif
+      }
+#endif
+   eph->map = nullptr;
+}
+
 /****************************************************************************
 **    jpl_init_ephemeris( ephemeris_filename, nam, val, n_constants)       **
 *****************************************************************************
@@ -922,15 +1440,22 @@ void * /*DLL_FUNC*/ jpl_init_ephemeris( const char *ephemeris_filename,
       return( nullptr);
       }
    memcpy( rval, &temp_data, sizeof( struct jpl_eph_data));
-   rval->iinfo.posn_coeff[0] = 1.0;
-            /* Seed a bogus value here.  The first and subsequent calls to */
-            /* 'interp' will correct it to a value between -1 and +1.      */
-   rval->iinfo.posn_coeff[1] = -2.0;
-   rval->iinfo.vel_coeff[0] = 0.0;
-   rval->iinfo.vel_coeff[1] = 1.0;
    rval->curr_cache_loc = (uint32_t)-1;
           /* The 'cache' data is right after the 'jpl_eph_data' struct: */
    rval->cache = (double *)( rval + 1);
+   rval->map = nullptr;
+   rval->map_size = 0;
+   rval->map_handle = nullptr;
+   map_ephemeris_file( rval, ephemeris_filename);
+   rval->scratch = (struct jpl_eph_scratch *)jpl_alloc_scratch( rval);
+   if( !rval->scratch)
+      {
+      init_err_code = JPL_INIT_MEMORY_FAILURE;
+      unmap_ephemeris_file( rval);
+      fclose( ifile);
+      free( rval);
+      return( nullptr);
+      }
                /* If there are more than 400 constants,  the names of       */
                /* the extra constants are stored in what would normally     */
                /* be zero-padding after the header record.  However,        */
@@ -984,6 +1509,8 @@ void /*DLL_FUNC*/ jpl_close_ephemeris( void *ephem)
 {
    struct jpl_eph_data *eph = (struct jpl_eph_data *)ephem;
 
+   jpl_free_scratch( eph->scratch);
+   unmap_ephemeris_file( eph);
    fclose( eph->ifile);
    free( ephem);
 }
@@ -1001,6 +1528,7 @@ double /*DLL_FUNC*/ jpl_get_constant( const int idx, void *ephem, char *constant
       {
       const long seek_loc = (idx < 400 ? 84L * 3L + (long)idx * 6 :
                       START_400TH_CONSTANT_NAME + (idx - 400) * 6);
+      const std::lock_guard<std::mutex> lock( file_mutex);
 
       fseek( eph->ifile, seek_loc, SEEK_SET);
       if( fread( constant_name, 1, 6, eph->ifile))
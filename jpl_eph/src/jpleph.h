@@ -54,6 +54,24 @@ int /*DLL_FUNC*/ make_sub_ephem( void *ephem, const char *sub_filename,
 double /*DLL_FUNC*/ jpl_get_constant( const int idx, void *ephem, char *constant_name);
 const char * /*DLL_FUNC*/ jpl_get_ephem_name( const void *ephem);
 
+         /* jpl_state() and jpl_pleph() keep interpolation data and the */
+         /* current record within the ephemeris struct,  and therefore  */
+         /* can't be called from several threads at once.  The '_r'     */
+         /* versions take a caller-supplied scratch area instead,  and  */
+         /* can be.  Allocate one scratch area per thread;  free it     */
+         /* before closing the ephemeris.                               */
+
+void * /*DLL_FUNC*/ jpl_alloc_scratch( const void *ephem);
+void /*DLL_FUNC*/ jpl_free_scratch( void *scratch);
+int /*DLL_FUNC*/ jpl_state_r( const void *ephem, void *scratch, const double et,
+            const int list[14], double pv[][6], double nut[4], const int bary);
+int /*DLL_FUNC*/ jpl_pleph_r( const void *ephem, void *scratch, const double et,
+            const int ntarg, const int ncent, double rrd[], const int calc_velocity);
+const double * /*DLL_FUNC*/ jpl_get_scratch_pvsun( const void *scratch);
+int /*DLL_FUNC*/ jpl_pleph_batch( const void *ephem, void *scratch, const int n,
+            const double *et, const int *ntarg, const int *ncent,
+            double *rrd, const int calc_velocity, int *err_codes);
+
          /* Following are constants used in          */
          /* jpl_get_double( ) and jpl_get_long( ):   */
 
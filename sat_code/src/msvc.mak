@@ -16,7 +16,7 @@ CFLAGS=-MT -O1 -D "NDEBUG" $(COMMON_FLAGS)
 LINK=link /nologo /stack:0x8800
 
 OBJS= sgp.obj sgp4.obj sgp8.obj sdp4.obj sdp8.obj deep.obj \
-     basics.obj get_el.obj common.obj tle_out.obj
+     basics.obj get_el.obj common.obj tle_out.obj sgp4_bat.obj
 
 dropouts.exe: dropouts.obj
    $(LINK) dropouts.obj
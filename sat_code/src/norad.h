@@ -78,6 +78,14 @@ reasonable position/velocity was determined.       */
 #define SXPX_ERR_NEGATIVE_XN              -5
 #define SXPX_ERR_CONVERGENCE_FAIL         -6
 
+/* SGP4 for many satellites at once ('sgp4_bat.cpp').  By default,  results
+agree with SGP4() to well under a millimeter;  with the following flag,
+they're bit-for-bit the same,  but computed much more slowly. */
+
+#define SGP4_BATCH_EXACT                  1
+
+struct sgp4_batch_t;
+
 /* Function prototypes */
 /* norad.c */
 
@@ -126,6 +134,12 @@ void /*DLL_FUNC*/ sxpx_set_dpsec_integration_step( const double new_step_size);
 void /*DLL_FUNC*/ lunar_solar_position( const double jd,
                     double *lunar_xyzr, double *solar_xyzr);
 
+sgp4_batch_t * /*DLL_FUNC*/ SGP4_batch_init( const tle_t *tles,
+                        const int n_tles, const int flags);
+int  /*DLL_FUNC*/ SGP4_batch( const sgp4_batch_t *batch, const double *tsince,
+                                 double *pos, double *vel, int *err_codes);
+void /*DLL_FUNC*/ SGP4_batch_free( sgp4_batch_t *batch);
+
 
 }                       /* end of 'extern "C"' section */
 
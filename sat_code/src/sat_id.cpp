@@ -65,8 +65,19 @@ should be used,  and the others are suppressed.       */
 #include <ctype.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#ifndef __WATCOMC__
+   #include <atomic>
+   #include <thread>
+   #include <vector>
+   #define USE_THREADS
+#endif
 #if defined( _WIN32) || defined( __WATCOMC__)
    #include <malloc.h>     /* for alloca() prototype */
+   #include <process.h>    /* for _getpid() prototype */
+   #define getpid _getpid
 #else
    #include <unistd.h>
 #endif
@@ -121,6 +132,7 @@ typedef struct
    OBSERVATION *obs;
    size_t idx1, idx2, n_obs, n_matches;
    double speed;
+   double shifted_loc[3];     /* see set_single_obs_locations() */
    match_t *matches;
 } object_t;
 
@@ -762,6 +774,8 @@ Additional command-line arguments are:\n\
    -a YYYYMMDD  Only use observations after this time\n\
    -b YYYYMMDD  Only use observations before this time\n\
    -c           Check all TLEs for existence\n\
+   -j (n)       Use this many threads (default=one per core)\n\
+   -k           Don't use or update the parsed-TLE cache files\n\
    -m (nrevs)   Only consider objects with fewer # revs/day (default=6)\n\
    -n (NORAD)   Only consider objects with this NORAD identifier\n\
    -r (radius)  Only show matches within this radius in degrees (default=4)\n\
@@ -985,6 +999,183 @@ static double lookahead_warning_days = 7.;
 
 double motion_mismatch_limit = 60.;
 
+/* Most of the time in sat_id goes to running SGP4/SDP4 for every
+(TLE, object) pair,  almost all of which come nowhere near one another.
+To cut that down,  the objects are sorted by the time of their first
+observation and gathered into 'buckets' no more than a couple of minutes
+wide.  For each TLE,  we compute the satellite position and velocity once
+at the middle of each bucket.  Over half a bucket width,  the satellite
+can't get further from that point than |v|dt + g dt^2 / 2 (using surface
+gravity,  the largest acceleration it can feel),  so it's somewhere within
+a sphere of that radius.  If that sphere is entirely more than the search
+radius away from the observed RA/dec (as seen from the observer's
+location),  we needn't compute the 'real' position for that object.
+
+   Some padding is added for aberration,  the difference between TEME
+and the mean equator of date,  and the drag and resonance terms in the
+propagators.  The filter is deliberately conservative;  its only effect
+should be on speed.  Buckets containing a single object are left alone,
+since computing the bound would cost as much as just checking it.
+
+   This is done in geocentric terms rather than by binning the sky
+(HEALPix or similar),  since for low-orbit objects,  topocentric parallax
+is many degrees and a sky cell seen from the geocenter says little about
+where the satellite appears from the observatory.  */
+
+#define PREFILTER_BUCKET_WIDTH   (2. / minutes_per_day)
+
+typedef struct
+{
+   double jd, half_width;
+   size_t start, n_objects;
+} time_bucket_t;
+
+static time_bucket_t *time_buckets = NULL;
+static size_t n_time_buckets = 0, *bucket_objects = NULL;
+static double *observed_vects = NULL;
+static const object_t *bucketed_objects = NULL;
+static size_t n_bucketed_objects = 0;
+
+static int compare_object_times( const void *a, const void *b, void *context)
+{
+   const object_t *objects = (const object_t *)context;
+   const object_t *obj_a = objects + *(const size_t *)a;
+   const object_t *obj_b = objects + *(const size_t *)b;
+   const double jd_a = obj_a->obs[obj_a->idx1].jd;
+   const double jd_b = obj_b->obs[obj_b->idx1].jd;
+
+   return( jd_a > jd_b ? 1 : (jd_a < jd_b ? -1 : 0));
+}
+
+static void free_time_buckets( void)
+{
+   free( time_buckets);
+   free( bucket_objects);
+   free( observed_vects);
+   time_buckets = NULL;
+   bucket_objects = NULL;
+   observed_vects = NULL;
+   bucketed_objects = NULL;
+   n_bucketed_objects = n_time_buckets = 0;
+}
+
+static void build_time_buckets( const object_t *objects, const size_t n_objects)
+{
+   size_t i;
+
+   free_time_buckets( );
+   bucketed_objects = objects;
+   n_bucketed_objects = n_objects;
+   bucket_objects = (size_t *)malloc( n_objects * sizeof( size_t));
+   time_buckets = (time_bucket_t *)malloc( n_objects * sizeof( time_bucket_t));
+   observed_vects = (double *)malloc( n_objects * 3 * sizeof( double));
+   assert( bucket_objects && time_buckets && observed_vects);
+   for( i = 0; i < n_objects; i++)
+      {
+      const OBSERVATION *optr = objects[i].obs + objects[i].idx1;
+      double *vect = observed_vects + i * 3;
+
+      bucket_objects[i] = i;
+      polar3_to_cartesian( vect, optr->ra, optr->dec);
+      }
+   shellsort_r( bucket_objects, n_objects, sizeof( size_t),
+                           compare_object_times, (void *)objects);
+   for( i = 0; i < n_objects; )
+      {
+      const object_t *obj = objects + bucket_objects[i];
+      const double jd0 = obj->obs[obj->idx1].jd;
+      double jd1 = jd0;
+      time_bucket_t *bucket = time_buckets + n_time_buckets;
+
+      bucket->start = i;
+      while( i < n_objects)
+         {
+         obj = objects + bucket_objects[i];
+         if( obj->obs[obj->idx1].jd > jd0 + PREFILTER_BUCKET_WIDTH)
+            break;
+         jd1 = obj->obs[obj->idx1].jd;
+         i++;
+         }
+      bucket->n_objects = i - bucket->start;
+      bucket->jd = (jd0 + jd1) / 2.;
+      bucket->half_width = (jd1 - jd0) / 2.;
+      n_time_buckets++;
+      }
+   if( verbose)
+      printf( "%u objects in %u time buckets\n", (unsigned)n_objects,
+                                      (unsigned)n_time_buckets);
+}
+
+/* Sets candidates[i] for each object that might be within 'max_sep'
+(in radians) of where the satellite described by 'tle' is at the time of
+the object's first observation.  Objects with a zero flag can be skipped.
+The buckets must already have been built for these objects;  that's done
+before any worker threads are started.   */
+
+static void find_candidate_objects( const object_t *objects, tle_t *tle,
+            const double *sat_params, const double max_sep, char *candidates)
+{
+   const double earth_gm = 398600.4418;      /* km^3/s^2 */
+   const double seconds_per_min = 60.;
+   const double earth_r = EARTH_MAJOR_AXIS / 1000.;   /* in km */
+   const double surface_gravity = earth_gm / (earth_r * earth_r);
+   const double margin = 0.1 * PI / 180.;
+   const int is_deep = select_ephemeris( tle);
+   double params[N_SAT_PARAMS];
+   size_t i, j;
+
+   assert( objects == bucketed_objects);
+            /* SDP4 keeps the state of its resonance integration in the
+            parameter array;  work on a copy,  leaving the job's copy as
+            it was just after initialization */
+   memcpy( params, sat_params, sizeof( params));
+   for( i = 0; i < n_time_buckets; i++)
+      {
+      const time_bucket_t *bucket = time_buckets + i;
+      const size_t *obj_idx = bucket_objects + bucket->start;
+      const double t_since = (bucket->jd - tle->epoch) * minutes_per_day;
+      double pos[3], vel[3], radius;
+      const double dt = bucket->half_width * 86400.;
+      int sxpx_rval;
+
+      if( bucket->n_objects == 1)
+         {
+         candidates[*obj_idx] = 1;
+         continue;
+         }
+      if( is_deep)
+         sxpx_rval = SDP4( t_since, tle, params, pos, vel);
+      else
+         sxpx_rval = SGP4( t_since, tle, params, pos, vel);
+      if( sxpx_rval == SXPX_WARN_PERIGEE_WITHIN_EARTH)
+         sxpx_rval = 0;
+      radius = vector3_length( vel) * dt / seconds_per_min
+                     + surface_gravity * dt * dt / 2.;
+      radius = radius * 1.1 + 10.;    /* allow for drag,  resonance, etc. */
+      for( j = 0; j < bucket->n_objects; j++)
+         {
+         const OBSERVATION *optr = objects[obj_idx[j]].obs + objects[obj_idx[j]].idx1;
+         const double *vect = observed_vects + obj_idx[j] * 3;
+         double delta[3], dist, cos_sep;
+         size_t k;
+
+         for( k = 0; k < 3; k++)
+            delta[k] = pos[k] - optr->observer_loc[k];
+         dist = vector3_length( delta);
+         cos_sep = dot_product( delta, vect) / dist;
+         if( sxpx_rval || dist <= radius || cos_sep >= 1.)
+            candidates[obj_idx[j]] = 1;
+         else
+            {
+            const double sep = (cos_sep <= -1. ? PI : acos( cos_sep));
+
+            candidates[obj_idx[j]] =
+                     (sep - asin( radius / dist) < max_sep + margin);
+            }
+         }
+      }
+}
+
 /* Given a set of MPC observations and a TLE file,  this function looks at
 each TLE in the file and checks to see if that satellite came close to any
 of the observations.  The function is called for each TLE file.
@@ -1007,6 +1198,499 @@ that we know we have a good handle on.  */
 static double max_expected_error = 180.;
 static int n_tles_expected_in_file = 0;
 
+/* Objects with only one observation have no motion to compare;  instead,
+we compute where the satellite would be a moment later and use that to
+show a 'computed' motion.  The observer's location at that time doesn't
+depend on the TLE,  so it's computed once here,  rather than (as used to
+be the case) for every TLE,  and also so that the worker threads needn't
+touch the (not thread-safe) station code lookup.  */
+
+static const double min_dt = 1e-6;   /* 0.0864 seconds */
+
+static void set_single_obs_locations( object_t *objects, size_t n_objects)
+{
+   while( n_objects--)
+      {
+      const OBSERVATION *optr1 = objects->obs + objects->idx1;
+      const OBSERVATION *optr2 = objects->obs + objects->idx2;
+
+      if( optr2->jd == optr1->jd)
+         {
+         OBSERVATION temp_obs = *optr2;
+
+         temp_obs.jd += min_dt;
+         set_observer_location( &temp_obs);
+         memcpy( objects->shifted_loc, temp_obs.observer_loc, 3 * sizeof( double));
+         }
+      objects++;
+      }
+}
+
+/* Parsing TLEs and running SGP4_init()/SDP4_init() on them used to be
+done anew for every TLE in every file on every run.  Instead,  the first
+time a TLE file is read all the way through,  the parsed TLEs and their
+initialized parameters are written to a binary file of the same name
+with '.cache' appended (assuming we can write there;  if we can't,  we
+just carry on without a cache).  On later runs,  if the TLE file's
+modification time and size still match those stored in the cache,  the
+parsed data is read from it instead.  The TLE text is still read,  since
+the '#' lines in it control what we do with the TLEs.
+
+   The modification time has (on some systems) only one-second
+resolution,  so a same-size rewrite within the second the cache was
+made wouldn't be noticed.  To avoid that,  no cache is saved for a file
+modified within the last couple of seconds;  it'll be cached on a later
+run instead.
+
+   The cache is written to a temporary file,  which is then renamed,  so
+that (say) several sat_id2 or sat_id3 runs at once never see a partly
+written cache.
+
+   Each parsed TLE is keyed by the offset of the end of its second line
+within the TLE file.  Since the file is read in order,  so is the cache,
+and lookups are just a matter of moving a cursor forward.  The cache can
+be turned off with -k.     */
+
+static bool use_tle_cache = true;
+
+typedef struct
+{
+   int64_t offset;
+   tle_t tle;
+   double params[N_SAT_PARAMS];
+} cached_tle_t;
+
+typedef struct
+{
+   char magic[8];
+   int64_t mtime, file_size;
+   int64_t n_records;
+   int32_t record_size, n_params;
+} tle_cache_header_t;
+
+typedef struct
+{
+   cached_tle_t *recs;
+   size_t n_recs, n_alloced, cursor;
+   bool loaded, building;
+   tle_cache_header_t header;
+} tle_cache_t;
+
+static const char tle_cache_magic[8] = "satid03";
+
+static void init_tle_cache( tle_cache_t *cache, const char *tle_file_name)
+{
+   struct stat file_stats;
+   char cache_name[300];
+   FILE *ifile;
+
+   memset( cache, 0, sizeof( tle_cache_t));
+   if( !use_tle_cache || stat( tle_file_name, &file_stats))
+      return;
+   memcpy( cache->header.magic, tle_cache_magic, sizeof( tle_cache_magic));
+   cache->header.mtime = (int64_t)file_stats.st_mtime;
+   cache->header.file_size = (int64_t)file_stats.st_size;
+   cache->header.record_size = (int32_t)sizeof( cached_tle_t);
+   cache->header.n_params = N_SAT_PARAMS;
+   snprintf_err( cache_name, sizeof( cache_name), "%s.cache", tle_file_name);
+   ifile = fopen( cache_name, "rb");
+   if( ifile)
+      {
+      tle_cache_header_t hdr;
+
+      if( fread( &hdr, sizeof( hdr), 1, ifile) == 1
+               && !memcmp( &hdr, &cache->header,
+                           offsetof( tle_cache_header_t, n_records))
+               && hdr.record_size == cache->header.record_size
+               && hdr.n_params == cache->header.n_params)
+         {
+         cache->n_recs = (size_t)hdr.n_records;
+         cache->recs = (cached_tle_t *)malloc( cache->n_recs * sizeof( cached_tle_t) + 1);
+         if( cache->recs && fread( cache->recs, sizeof( cached_tle_t),
+                                   cache->n_recs, ifile) == cache->n_recs)
+            cache->loaded = true;
+         else
+            {
+            free( cache->recs);
+            cache->recs = NULL;
+            cache->n_recs = 0;
+            }
+         }
+      fclose( ifile);
+      }
+   cache->building = (!cache->loaded
+               && (int64_t)time( NULL) > cache->header.mtime + 2);
+   if( verbose > 1)
+      printf( "TLE cache for '%s' %s\n", tle_file_name,
+                     (cache->loaded ? "loaded" : (cache->building ?
+                     "will be rebuilt" : "not made;  file just modified")));
+}
+
+static const cached_tle_t *find_cached_tle( tle_cache_t *cache, const int64_t offset)
+{
+   while( cache->cursor < cache->n_recs && cache->recs[cache->cursor].offset < offset)
+      cache->cursor++;
+   if( cache->cursor < cache->n_recs && cache->recs[cache->cursor].offset == offset)
+      return( cache->recs + cache->cursor);
+   return( NULL);
+}
+
+static const cached_tle_t *add_to_tle_cache( tle_cache_t *cache, const int64_t offset,
+                                    const tle_t *tle)
+{
+   cached_tle_t *rec;
+
+   if( cache->n_recs == cache->n_alloced)
+      {
+      cache->n_alloced += 100 + cache->n_alloced / 2;
+      cache->recs = (cached_tle_t *)realloc( cache->recs,
+                                 cache->n_alloced * sizeof( cached_tle_t));
+      assert( cache->recs);
+      }
+   rec = cache->recs + cache->n_recs++;
+   memset( rec, 0, sizeof( cached_tle_t));
+   rec->offset = offset;
+   rec->tle = *tle;
+   if( select_ephemeris( &rec->tle))
+      SDP4_init( rec->params, &rec->tle);
+   else
+      SGP4_init( rec->params, &rec->tle);
+   return( rec);
+}
+
+/* Only called if we read the TLE file all the way through,  so that
+the cache really does contain all of its TLEs. */
+
+static void save_tle_cache( tle_cache_t *cache, const char *tle_file_name)
+{
+   char cache_name[300], temp_name[320];
+   FILE *ofile;
+
+   snprintf_err( cache_name, sizeof( cache_name), "%s.cache", tle_file_name);
+   snprintf_err( temp_name, sizeof( temp_name), "%s.%ld.tmp", cache_name,
+                                             (long)getpid( ));
+   ofile = fopen( temp_name, "wb");
+   if( ofile)
+      {
+      bool written_ok;
+
+      cache->header.n_records = (int64_t)cache->n_recs;
+      written_ok = (fwrite( &cache->header, sizeof( tle_cache_header_t), 1, ofile) == 1
+               && fwrite( cache->recs, sizeof( cached_tle_t), cache->n_recs, ofile)
+                                 == cache->n_recs);
+      if( fclose( ofile))
+         written_ok = false;
+#if defined( _WIN32) || defined( __WATCOMC__)
+      if( written_ok)         /* rename() won't replace an existing file */
+         remove( cache_name);
+#endif
+      if( !written_ok || rename( temp_name, cache_name))
+         remove( temp_name);
+      }
+}
+
+static void free_tle_cache( tle_cache_t *cache)
+{
+   free( cache->recs);
+   memset( cache, 0, sizeof( tle_cache_t));
+}
+
+/* TLEs are read serially (the '#' lines have to be handled in order),
+and each one that passes the various filters becomes a 'job'.  Jobs are
+then handed out to worker threads,  each of which checks its TLE against
+all the objects and notes any matches (and the text describing them) in
+the job.  Once all jobs are done,  the matches are added to the objects
+and printed,  in the same order they'd have been found had everything
+been done on one thread.  So output doesn't depend on the number of
+threads (set with -j;  the default is one per core).
+
+   Note that each job gets its own copy of the initialized parameters,
+which SDP4 will modify (it keeps its resonance integration state there).
+Each TLE is checked against the objects in the same order as before,  so
+the results are the same as those from the single-threaded version.  */
+
+typedef struct
+{
+   size_t obj_idx;
+   match_t match;
+   char output[400];
+} found_t;
+
+typedef struct
+{
+   tle_t tle;
+   double sat_params[N_SAT_PARAMS];
+   double max_expected_error, tle_start, tle_range;
+   char line0[100];
+   found_t *found;
+   size_t n_found;
+} tle_job_t;
+
+static unsigned n_threads_requested = 0;
+
+static void check_tle_job( const object_t *objects, const size_t n_objects,
+               tle_job_t *job, const double search_radius, char *candidates)
+{
+   tle_t *tle = &job->tle;
+   const double max_sep = (search_radius < job->max_expected_error ?
+                     search_radius : job->max_expected_error) * PI / 180.;
+   size_t idx;
+
+   find_candidate_objects( objects, tle, job->sat_params, max_sep, candidates);
+   for( idx = 0; idx < n_objects; idx++)
+      {
+      const object_t *obj_ptr = objects + idx;
+      const OBSERVATION *optr1 = obj_ptr->obs + obj_ptr->idx1;
+      const OBSERVATION *optr2 = obj_ptr->obs + obj_ptr->idx2;
+
+      assert( obj_ptr->idx1 <= obj_ptr->idx2);
+      assert( optr2->jd >= optr1->jd);
+      if( candidates[idx]
+               && is_in_range( optr1->jd, job->tle_start, job->tle_range))
+         {
+         double radius;
+         double ra, dec, dist_to_satellite;
+         double sat_params[N_SAT_PARAMS];
+         int sxpx_rval;
+         size_t i = 0;
+         bool in_shadow;
+
+            /* SDP4 keeps the state of its resonance integration in the */
+            /* parameter array.  Each object starts from a fresh copy,  */
+            /* so its results don't depend on which objects were checked */
+            /* before it (or skipped by find_candidate_objects()).       */
+         memcpy( sat_params, job->sat_params, sizeof( sat_params));
+         sxpx_rval = compute_artsat_ra_dec( &ra, &dec, &dist_to_satellite,
+                        optr1, tle, sat_params, &in_shadow);
+         radius = angular_sep( ra - optr1->ra, dec, optr1->dec, NULL) * 180. / PI;
+                  /* Matches are only added after all threads are done, */
+                  /* so it's safe to look at them here.  But we'll have  */
+                  /* to check again when adding new matches.             */
+         while( i < obj_ptr->n_matches
+                 && obj_ptr->matches[i].norad_number != tle->norad_number
+                 && obj_ptr->matches[i].norad_number)
+            i++;
+         if( !sxpx_rval && radius < search_radius      /* good enough for us! */
+                 && radius < job->max_expected_error
+                 && i == obj_ptr->n_matches)
+            {
+            double dt = optr2->jd - optr1->jd;
+            double motion_diff, ra2, dec2;
+            double temp_array[8];
+            bool show_computed_motion = true;
+
+            assert( dt >= 0.);
+            if( !dt)
+               {
+               OBSERVATION temp_obs = *optr2;
+
+               temp_obs.jd += min_dt;
+               memcpy( temp_obs.observer_loc, obj_ptr->shifted_loc, 3 * sizeof( double));
+               if( vector3_length( optr2->observer_loc) > 6400.)
+                  show_computed_motion = false;   /* spacecraft-based obs */
+               compute_artsat_ra_dec( &ra2, &dec2, &dist_to_satellite,
+                        &temp_obs, tle, sat_params, NULL);
+               }
+            else
+               compute_artsat_ra_dec( &ra2, &dec2, &dist_to_satellite,
+                        optr2, tle, sat_params, NULL);
+            temp_array[0] = ra;     /* starting point (computed) */
+            temp_array[1] = dec;
+            temp_array[2] = ra2;    /* ending point (computed) */
+            temp_array[3] = dec2;
+            temp_array[4] = optr1->ra;  /* starting point (observed) */
+            temp_array[5] = optr1->dec;
+            temp_array[6] = optr2->ra;  /* ending point (observed) */
+            temp_array[7] = optr2->dec;
+            if( !dt)
+               motion_diff = 0.;
+            else
+               motion_diff = relative_motion( temp_array);
+            motion_diff *= 3600. * 180. / PI;  /* cvt to arcseconds */
+            if( motion_diff < motion_mismatch_limit)
+               {
+               char obuff[200];
+               char full_intl_desig[20];
+               double motion_rate = 0., motion_pa = 0.;
+               const double arcminutes_per_radian = 60. * 180. / PI;
+               found_t *found;
+               match_t *match;
+
+               job->found = (found_t *)realloc( job->found,
+                                 (job->n_found + 1) * sizeof( found_t));
+               found = job->found + job->n_found++;
+               found->obj_idx = idx;
+               match = &found->match;
+               memset( match, 0, sizeof( match_t));
+               motion_rate = angular_sep( optr1->ra - optr2->ra,
+                                    optr1->dec, optr2->dec, &motion_pa);
+               motion_rate *= arcminutes_per_radian;
+               if( dt)
+                  motion_rate /= dt * minutes_per_day;
+               match->dist = radius;
+               match->norad_number = tle->norad_number;
+               strncpy( match->intl_desig, tle->intl_desig, 9);
+               snprintf_err( full_intl_desig, sizeof( full_intl_desig), "%s%.2s-%s",
+                        (tle->intl_desig[0] < '5' ? "20" : "19"),
+                        tle->intl_desig, tle->intl_desig + 2);
+               snprintf_err( obuff, sizeof( obuff), "     %05dU = %-11s ",
+                     tle->norad_number, full_intl_desig);
+               if( tle->ephemeris_type != 'H')
+                  snprintf_append( obuff, sizeof( obuff),
+                         "e=%.2f; P=%.1f min; i=%.1f",
+                         tle->eo, 2. * PI / tle->xno,
+                         tle->xincl * 180. / PI);
+               if( tle_checksum( job->line0))         /* object name given... */
+                  {
+                  char norad_desig[20];
+
+                  remove_redundant_desig( job->line0, full_intl_desig);
+                  snprintf( norad_desig, sizeof( norad_desig),
+                                     "NORAD %05d", tle->norad_number);
+                  remove_redundant_desig( job->line0, norad_desig);
+                  snprintf_append( obuff, sizeof( obuff), ": %s", job->line0);
+                  }
+               strlcpy( match->text, obuff + 26, sizeof( match->text));
+               obuff[79] = '\0';    /* avoid buffer overrun */
+//             snprintf_append( obuff, sizeof( obuff), " motion %f", motion_diff);
+               strlcat_error( obuff, "\n");
+               if( !dt)
+                  strlcat_error( obuff,
+                        "             no observed motion (single obs) ");
+               else
+                  snprintf_append( obuff, sizeof( obuff),
+                        "             motion %7.4f\"/sec at PA %5.1f;",
+                        motion_rate, motion_pa);
+               snprintf_append( obuff, sizeof( obuff),
+                             " dist=%8.1f km; offset=%7.4f deg\n",
+                             dist_to_satellite, radius);
+                        /* "Speed" is displayed in arcminutes/second,
+                            or in degrees/minute */
+               snprintf_err( found->output, sizeof( found->output),
+                              "%s\n%s", optr1->text, obuff);
+#ifdef SHOW_RA_DEC_OFFSETS
+               snprintf_append( found->output, sizeof( found->output),
+                              "dRA = %.3f  dDec = %.3f\n",
+                              (ra - optr1->ra) * 180. / PI,
+                              (dec - optr1->dec) * 180. / PI);
+#endif
+               motion_rate = angular_sep( ra - ra2, dec, dec2, &motion_pa);
+               motion_rate *= arcminutes_per_radian;
+               if( dt)
+                  motion_rate /= dt * minutes_per_day;
+               else
+                  motion_rate /= min_dt * minutes_per_day;
+               if( show_computed_motion)
+                  snprintf_append( found->output, sizeof( found->output),
+                        "             motion %7.4f\"/sec at PA %5.1f (computed)\n\n",
+                        motion_rate, motion_pa);
+               match->ra = ra;
+               match->dec = dec;
+               match->motion_rate = motion_rate;
+               match->motion_pa = motion_pa;
+               match->in_shadow = in_shadow;
+               }
+            }
+         }
+      }
+}
+
+/* Adds the matches found for a job to the objects,  keeping each
+object's matches sorted by distance,  and shows them.  A TLE for a
+satellite that's already been matched to the object (earlier in this
+batch of jobs) is ignored,  just as it would have been had the jobs been
+run one at a time.   */
+
+static void add_job_matches( object_t *objects, tle_job_t *job)
+{
+   size_t j;
+
+   for( j = 0; j < job->n_found; j++)
+      {
+      const found_t *found = job->found + j;
+      object_t *obj_ptr = objects + found->obj_idx;
+      size_t i = 0;
+
+      while( i < obj_ptr->n_matches
+              && obj_ptr->matches[i].norad_number != found->match.norad_number
+              && obj_ptr->matches[i].norad_number)
+         i++;
+      if( i == obj_ptr->n_matches)
+         {
+         i = 0;
+         while( i < obj_ptr->n_matches && found->match.dist > obj_ptr->matches[i].dist)
+            i++;
+         obj_ptr->matches = (match_t *)realloc( obj_ptr->matches,
+                        (obj_ptr->n_matches + 1) * sizeof( match_t));
+         memmove( obj_ptr->matches + i + 1, obj_ptr->matches + i,
+                  (obj_ptr->n_matches - i) * sizeof( match_t));
+         obj_ptr->matches[i] = found->match;
+         obj_ptr->n_matches++;
+         if( verbose || !field_mode)
+            printf( "%s", found->output);
+         }
+      }
+   free( job->found);
+   job->found = NULL;
+   job->n_found = 0;
+}
+
+static void run_tle_jobs( object_t *objects, const size_t n_objects,
+               tle_job_t *jobs, const size_t n_jobs, const double search_radius)
+{
+   unsigned n_threads = n_threads_requested;
+   size_t i;
+
+   if( !n_jobs)
+      return;
+   if( objects != bucketed_objects || n_objects != n_bucketed_objects)
+      {
+      build_time_buckets( objects, n_objects);
+      set_single_obs_locations( objects, n_objects);
+      }
+#ifdef USE_THREADS
+   if( !n_threads)
+      n_threads = std::thread::hardware_concurrency( );
+#endif
+   if( !n_threads)
+      n_threads = 1;
+   if( n_threads > n_jobs)
+      n_threads = (unsigned)n_jobs;
+#ifdef USE_THREADS
+   if( n_threads > 1)
+      {
+      std::atomic<size_t> next_job( 0);
+      std::vector<std::thread> workers;
+
+      for( i = 0; i < n_threads; i++)
+         workers.emplace_back( [&]( )
+            {
+            char *candidates = (char *)malloc( n_objects);
+            size_t idx;
+
+            while( (idx = next_job++) < n_jobs)
+               check_tle_job( objects, n_objects, jobs + idx, search_radius,
+                                                      candidates);
+            free( candidates);
+            });
+      for( auto &w : workers)
+         w.join( );
+      }
+   else
+#endif
+      {
+      char *candidates = (char *)malloc( n_objects);
+
+      for( i = 0; i < n_jobs; i++)
+         check_tle_job( objects, n_objects, jobs + i, search_radius, candidates);
+      free( candidates);
+      }
+   for( i = 0; i < n_jobs; i++)
+      add_job_matches( objects, jobs + i);
+}
+
+#define MAX_TLE_JOBS 4096
+
 static int add_tle_to_obs( object_t *objects, const size_t n_objects,
              const char *tle_file_name, const double search_radius,
              const double max_revs_per_day)
@@ -1022,12 +1706,16 @@ static int add_tle_to_obs( object_t *objects, const size_t n_objects,
    static size_t n_norad_ids = 0;
    const double mjd_1970 = 40587.;     /* MJD for 1970 Jan 1 */
    const double curr_mjd = mjd_1970 + (double)time( NULL) / 86400.;
+   tle_cache_t cache;
+   tle_job_t *jobs;
+   size_t n_jobs = 0;
 
    if( !tle_file_name)     /* flag to free internal memory at shutdown */
       {
       if( norad_ids)
          free( norad_ids);
       n_norad_ids = 0;
+      free_time_buckets( );
       return( 0);
       }
    tle_file = fopen( tle_file_name, "rb");
@@ -1045,18 +1733,39 @@ static int add_tle_to_obs( object_t *objects, const size_t n_objects,
    if( verbose)
       printf( "Looking through TLE file '%s', %u objs, radius %f, max %f revs/day\n",
                  tle_file_name, (unsigned)n_objects, search_radius, max_revs_per_day);
+   init_tle_cache( &cache, tle_file_name);
+   jobs = (tle_job_t *)malloc( MAX_TLE_JOBS * sizeof( tle_job_t));
+   assert( jobs);
    *line0 = *line1 = '\0';
    while( fgets_trimmed( line2, sizeof( line2), tle_file))
       {
       tle_t tle;  /* Structure for two-line elements set for satellite */
       const double mins_per_day = 24. * 60.;
+      const int64_t offset = (int64_t)ftell( tle_file);
+      const cached_tle_t *cached = NULL;
       bool is_a_tle = false;
 
       if( verbose > 3)
          printf( "%s\n", line2);
-      if( look_for_tles && parse_elements( line1, line2, &tle) >= 0)
+      if( cache.loaded)
+         {
+         if( look_for_tles)
+            cached = find_cached_tle( &cache, offset);
+         }
+      else if( (look_for_tles || cache.building)
+                     && parse_elements( line1, line2, &tle) >= 0)
+         {
+         if( cache.building)
+            cached = add_to_tle_cache( &cache, offset, &tle);
+         is_a_tle = look_for_tles;
+         }
+      if( cached)
+         {
+         tle = cached->tle;
+         is_a_tle = look_for_tles;
+         }
+      if( is_a_tle)
          {
-         is_a_tle = true;
          n_tles_found++;
          if( tle.norad_number == 99999)
             look_up_extended_identifiers( line0, &tle);
@@ -1077,167 +1786,27 @@ static int add_tle_to_obs( object_t *objects, const size_t n_objects,
                  && (!intl_desig || !_compare_intl_desigs( tle.intl_desig, intl_desig))
                  && (search_norad || !already_found_desig( tle.norad_number, n_norad_ids, norad_ids)))
          {                           /* hey! we got a TLE! */
-         double sat_params[N_SAT_PARAMS];
-         size_t idx;
+         tle_job_t *job = jobs + n_jobs++;
 
          if( verbose > 1)
             printf( "TLE found:\n%s\n%s\n", line1, line2);
-         if( select_ephemeris( &tle))
-            SDP4_init( sat_params, &tle);
+         job->tle = tle;
+         if( cached)
+            memcpy( job->sat_params, cached->params, sizeof( job->sat_params));
+         else if( select_ephemeris( &tle))
+            SDP4_init( job->sat_params, &tle);
          else
-            SGP4_init( sat_params, &tle);
-         for( idx = 0; idx < n_objects; idx++)
+            SGP4_init( job->sat_params, &tle);
+         job->max_expected_error = max_expected_error;
+         job->tle_start = tle_start;
+         job->tle_range = tle_range;
+         strlcpy_error( job->line0, line0);
+         job->found = NULL;
+         job->n_found = 0;
+         if( n_jobs == MAX_TLE_JOBS)
             {
-            object_t *obj_ptr = objects + idx;
-            const OBSERVATION *optr1 = obj_ptr->obs + obj_ptr->idx1;
-            const OBSERVATION *optr2 = obj_ptr->obs + obj_ptr->idx2;
-
-            assert( obj_ptr->idx1 <= obj_ptr->idx2);
-            assert( optr2->jd >= optr1->jd);
-            if( is_in_range( optr1->jd, tle_start, tle_range))
-               {
-               double radius;
-               double ra, dec, dist_to_satellite;
-               int sxpx_rval;
-               size_t i = 0;
-               bool in_shadow;
-
-               sxpx_rval = compute_artsat_ra_dec( &ra, &dec, &dist_to_satellite,
-                              optr1, &tle, sat_params, &in_shadow);
-               radius = angular_sep( ra - optr1->ra, dec, optr1->dec, NULL) * 180. / PI;
-               while( i < obj_ptr->n_matches
-                       && obj_ptr->matches[i].norad_number != tle.norad_number
-                       && obj_ptr->matches[i].norad_number)
-                  i++;
-               if( !sxpx_rval && radius < search_radius      /* good enough for us! */
-                       && radius < max_expected_error
-                       && i == obj_ptr->n_matches)
-                  {
-                  double dt = optr2->jd - optr1->jd;
-                  const double min_dt = 1e-6;   /* 0.0864 seconds */
-                  double motion_diff, ra2, dec2;
-                  double temp_array[8];
-                  bool show_computed_motion = true;
-
-                  assert( dt >= 0.);
-                  if( !dt)
-                     {
-                     OBSERVATION temp_obs = *optr2;
-
-                     temp_obs.jd += min_dt;
-                     set_observer_location( &temp_obs);
-                     if( vector3_length( optr2->observer_loc) > 6400.)
-                        show_computed_motion = false;   /* spacecraft-based obs */
-                     compute_artsat_ra_dec( &ra2, &dec2, &dist_to_satellite,
-                              &temp_obs, &tle, sat_params, NULL);
-                     }
-                  else
-                     compute_artsat_ra_dec( &ra2, &dec2, &dist_to_satellite,
-                              optr2, &tle, sat_params, NULL);
-                  temp_array[0] = ra;     /* starting point (computed) */
-                  temp_array[1] = dec;
-                  temp_array[2] = ra2;    /* ending point (computed) */
-                  temp_array[3] = dec2;
-                  temp_array[4] = optr1->ra;  /* starting point (observed) */
-                  temp_array[5] = optr1->dec;
-                  temp_array[6] = optr2->ra;  /* ending point (observed) */
-                  temp_array[7] = optr2->dec;
-                  if( !dt)
-                     motion_diff = 0.;
-                  else
-                     motion_diff = relative_motion( temp_array);
-                  motion_diff *= 3600. * 180. / PI;  /* cvt to arcseconds */
-                  if( motion_diff < motion_mismatch_limit)
-                     {
-                     char obuff[200];
-                     char full_intl_desig[20];
-                     double motion_rate = 0., motion_pa = 0.;
-                     const double arcminutes_per_radian = 60. * 180. / PI;
-
-                     motion_rate = angular_sep( optr1->ra - optr2->ra,
-                                          optr1->dec, optr2->dec, &motion_pa);
-                     motion_rate *= arcminutes_per_radian;
-                     if( dt)
-                        motion_rate /= dt * minutes_per_day;
-                     line1[8] = line1[16] = '\0';
-                     memcpy( line1 + 30, line1 + 11, 6);
-                     line1[11] = '\0';
-                     i = 0;
-                     while( i < obj_ptr->n_matches && radius > obj_ptr->matches[i].dist)
-                        i++;
-                     obj_ptr->matches = (match_t *)realloc( obj_ptr->matches,
-                                    (obj_ptr->n_matches + 1) * sizeof( match_t));
-                     memmove( obj_ptr->matches + i + 1, obj_ptr->matches + i,
-                              (obj_ptr->n_matches - i) * sizeof( match_t));
-                     memset( obj_ptr->matches + i, 0, sizeof( match_t));
-                     obj_ptr->matches[i].dist = radius;
-                     obj_ptr->matches[i].norad_number = tle.norad_number;
-                     obj_ptr->n_matches++;
-                     strncpy( obj_ptr->matches[i].intl_desig,
-                                                      tle.intl_desig, 9);
-                     snprintf_err( full_intl_desig, sizeof( full_intl_desig), "%s%.2s-%s",
-                              (tle.intl_desig[0] < '5' ? "20" : "19"),
-                              tle.intl_desig, tle.intl_desig + 2);
-                     snprintf_err( obuff, sizeof( obuff), "     %05dU = %-11s ",
-                           tle.norad_number, full_intl_desig);
-                     if( tle.ephemeris_type != 'H')
-                        snprintf_append( obuff, sizeof( obuff),
-                               "e=%.2f; P=%.1f min; i=%.1f",
-                               tle.eo, 2. * PI / tle.xno,
-                               tle.xincl * 180. / PI);
-                     if( tle_checksum( line0))         /* object name given... */
-                        {
-                        char norad_desig[20];
-
-                        remove_redundant_desig( line0, full_intl_desig);
-                        snprintf( norad_desig, sizeof( norad_desig),
-                                           "NORAD %05d", tle.norad_number);
-                        remove_redundant_desig( line0, norad_desig);
-                        snprintf_append( obuff, sizeof( obuff), ": %s", line0);
-                        }
-                     strlcpy( obj_ptr->matches[i].text, obuff + 26, sizeof( obj_ptr->matches[i].text));
-                     obuff[79] = '\0';    /* avoid buffer overrun */
-//                   snprintf_append( obuff, sizeof( obuff), " motion %f", motion_diff);
-                     strlcat_error( obuff, "\n");
-                     if( !dt)
-                        strlcat_error( obuff,
-                              "             no observed motion (single obs) ");
-                     else
-                        snprintf_append( obuff, sizeof( obuff),
-                              "             motion %7.4f\"/sec at PA %5.1f;",
-                              motion_rate, motion_pa);
-                     snprintf_append( obuff, sizeof( obuff),
-                                   " dist=%8.1f km; offset=%7.4f deg\n",
-                                   dist_to_satellite, radius);
-                              /* "Speed" is displayed in arcminutes/second,
-                                  or in degrees/minute */
-                     if( verbose || !field_mode)
-                        {
-                        printf( "%s\n", optr1->text);
-                        printf( "%s", obuff);
-#ifdef SHOW_RA_DEC_OFFSETS
-                        printf( "dRA = %.3f  dDec = %.3f\n",
-                                    (ra - optr1->ra) * 180. / PI,
-                                    (dec - optr1->dec) * 180. / PI);
-#endif
-                        }
-                     motion_rate = angular_sep( ra - ra2, dec, dec2, &motion_pa);
-                     motion_rate *= arcminutes_per_radian;
-                     if( dt)
-                        motion_rate /= dt * minutes_per_day;
-                     else
-                        motion_rate /= min_dt * minutes_per_day;
-                     if( show_computed_motion && (verbose || !field_mode))
-                        printf( "             motion %7.4f\"/sec at PA %5.1f (computed)\n\n",
-                            motion_rate, motion_pa);
-                     obj_ptr->matches[i].ra = ra;
-                     obj_ptr->matches[i].dec = dec;
-                     obj_ptr->matches[i].motion_rate = motion_rate;
-                     obj_ptr->matches[i].motion_pa = motion_pa;
-                     obj_ptr->matches[i].in_shadow = in_shadow;
-                     }
-                  }
-               }
+            run_tle_jobs( objects, n_objects, jobs, n_jobs, search_radius);
+            n_jobs = 0;
             }
          }
       else if( !strncmp( line2, "# No updates", 12))
@@ -1293,6 +1862,9 @@ static int add_tle_to_obs( object_t *objects, const size_t n_objects,
             if( verbose)
                fprintf( stderr, REVERSE_VIDEO "'%s' contains no TLEs for our time range\n"
                                NORMAL_VIDEO, tle_file_name);
+            run_tle_jobs( objects, n_objects, jobs, n_jobs, search_radius);
+            free( jobs);
+            free_tle_cache( &cache);
             fclose( tle_file);
             return( 0);
             }
@@ -1360,6 +1932,8 @@ static int add_tle_to_obs( object_t *objects, const size_t n_objects,
                norad_ids[i] = search_norad;
                n_norad_ids++;
                }
+            run_tle_jobs( objects, n_objects, jobs, n_jobs, search_radius);
+            n_jobs = 0;
             rval = add_tle_to_obs( objects, n_objects, iname, search_radius,
                                     max_revs_per_day);
             max_expected_error = saved_max_expected_error;
@@ -1383,6 +1957,11 @@ static int add_tle_to_obs( object_t *objects, const size_t n_objects,
       strlcpy_error( line0, line1);
       strlcpy_error( line1, line2);
       }
+   run_tle_jobs( objects, n_objects, jobs, n_jobs, search_radius);
+   free( jobs);
+   if( cache.building && feof( tle_file))
+      save_tle_cache( &cache, tle_file_name);
+   free_tle_cache( &cache);
    if( verbose)
       printf( "%d TLEs read from '%s', %.3f seconds\n", n_tles_found,
                 tle_file_name,
@@ -1511,6 +2090,12 @@ int main( const int argc, const char **argv)
             case 'i':
                intl_desig = param;
                break;
+            case 'j':
+               n_threads_requested = (unsigned)atoi( param);
+               break;
+            case 'k':
+               use_tle_cache = false;
+               break;
             case 'l':
                lookahead_warning_days = atof( param);
                break;
@@ -93,12 +93,13 @@ static void raw_lunar_solar_position( const double jd, double *lunar_xyzr, doubl
 
 /* For the RK4 integration,  we're frequently asking for the sun and
 moon positions at the exact same time we needed for the preceding step.
-Caching those positions saves recomputing them. */
+Caching those positions saves recomputing them.  The cache is per-thread,
+since Sat_ID calls this from several threads at once. */
 
 void /*DLL_FUNC*/ lunar_solar_position( const double jd,
                     double *lunar_xyzr, double *solar_xyzr)
 {
-   static double curr_jd = 0., lunar[4], solar[4];
+   static thread_local double curr_jd = 0., lunar[4], solar[4];
    size_t i;
 
    if( curr_jd != jd)
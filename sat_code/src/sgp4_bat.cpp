@@ -0,0 +1,499 @@
+/* Copyright (C) 2018, Project Pluto.  See LICENSE.  */
+
+/* sgp4_bat.cpp: SGP4 for many satellites at once.
+
+   SGP4() and sxpx_posn_vel() propagate one satellite to one time.  For
+screening a whole catalogue (Sat_ID,  conjunction checks and the like),
+most of that time goes into calls to sin(),  cos(),  atan2() and fmod(),
+one at a time,  for each satellite.  The following instead keeps the
+elements and initialized SGP4 parameters for many satellites in a
+'structure of arrays' (all the inclinations together,  then all the
+eccentricities,  etc.) and runs the SGP4 math on blocks of BATCH_LANES
+satellites.  Each step is a loop over the lanes of a block,  without
+branches or calls in the loop,  so that the compiler can turn it into
+AVX2 or AVX-512 code (use -mavx2 -mfma,  -march=native or similar).
+GCC also needs -fno-math-errno and -fno-trapping-math to vectorize the
+loops;  the makefile supplies those,  and they don't change any results.
+With plain SSE2,  GCC leaves the loops scalar,  and you gain only from
+the inlined sin()/cos() (see below.)
+
+   The branches in SGP4 (the 'simple' flag for low perigees,  the first
+Kepler iteration's step limit) become selections between two computed
+values,  and the Kepler loop runs until every lane in the block has
+converged,  with converged lanes simply not moving any further.
+
+   By default,  sin()/cos() are replaced with polynomials that can be
+inlined and vectorized,  and the atan2()/sin()/cos() of the argument of
+latitude is replaced with the angle-sum formulae.  Results agree with
+SGP4() to well under a millimeter (test_bat.cpp checks this).  If the
+batch is made with the SGP4_BATCH_EXACT flag,  the library sin(),  cos(),
+atan2() and fmod() are used instead,  and the arithmetic is done in the
+same order as in SGP4(),  so the results match those from SGP4() bit for
+bit (as long as both are compiled with the same floating-point options;
+in particular,  with FMA contraction,  -ffp-contract=off may be needed.)
+That's much slower,  and intended for testing.
+
+   Deep-space TLEs are propagated with SGP4,  just as SGP4() would do;  the
+caller should use select_ephemeris() and send those to SDP4() instead. */
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "norad.h"
+#include "norad_in.h"
+
+#ifdef __AVX512F__
+   #define BATCH_LANES 8
+#else
+   #define BATCH_LANES 4
+#endif
+
+#define MINIMAL_E    1.e-4
+#define ECC_EPS      1.e-6     /* Too low for computing further drops. */
+#define MAX_KEPLER_ITER 10
+
+/* Per-satellite quantities,  each stored as an array of 'n_padded'
+doubles.  The first six come from the TLE;  then there are those from
+SGP4_init(),  and last,  some that sxpx_posn_vel() recomputes on each
+call but which depend only on the inclination. */
+
+enum
+{
+   B_XMO, B_OMEGAO, B_XNODEO, B_BSTAR, B_EO, B_XINCL,
+   B_C1, B_C4, B_XNODCF, B_T2COF, B_AODP, B_COSIO, B_SINIO, B_OMGDOT,
+   B_XMDOT, B_XNODOT, B_XNODP, B_C5, B_D2, B_D3, B_D4, B_DELMO, B_ETA,
+   B_OMGCOF, B_SINMO, B_T3COF, B_T4COF, B_T5COF, B_XMCOF, B_SIMPLE,
+   B_XLCOF, B_AYCOF, B_X3THM1, B_SINIO2, B_X7THM1,
+   N_BATCH_FIELDS
+};
+
+struct sgp4_batch_t
+{
+   size_t n_sats, n_padded;
+   int flags;
+   double *data;
+};
+
+/* Indices within the params[] array filled in by SGP4_init();  see the
+#defines at the top of 'sgp4.cpp'. */
+
+static const int param_idx[B_SIMPLE - B_C1] = { 2, 3, 4, 5, 10, 11, 12, 13,
+               14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28 };
+
+sgp4_batch_t * /*DLL_FUNC*/ SGP4_batch_init( const tle_t *tles,
+                        const int n_tles, const int flags)
+{
+   sgp4_batch_t *rval = (sgp4_batch_t *)calloc( 1, sizeof( sgp4_batch_t));
+   size_t i;
+   int j;
+
+   if( !rval || n_tles <= 0)
+      {
+      free( rval);
+      return( NULL);
+      }
+   rval->n_sats = (size_t)n_tles;
+   rval->n_padded = (rval->n_sats + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+   rval->flags = flags;
+   rval->data = (double *)malloc( rval->n_padded * N_BATCH_FIELDS * sizeof( double));
+   if( !rval->data)
+      {
+      free( rval);
+      return( NULL);
+      }
+   for( i = 0; i < rval->n_padded; i++)
+      {           /* padding lanes just repeat the last satellite */
+      const tle_t *tle = tles + (i < rval->n_sats ? i : rval->n_sats - 1);
+      double params[N_SAT_PARAMS], *dptr = rval->data + i;
+      const size_t stride = rval->n_padded;
+      double cosio, cosio_squared;
+
+      SGP4_init( params, tle);
+      dptr[B_XMO * stride] = tle->xmo;
+      dptr[B_OMEGAO * stride] = tle->omegao;
+      dptr[B_XNODEO * stride] = tle->xnodeo;
+      dptr[B_BSTAR * stride] = tle->bstar;
+      dptr[B_EO * stride] = tle->eo;
+      dptr[B_XINCL * stride] = tle->xincl;
+      for( j = B_C1; j < B_SIMPLE; j++)
+         dptr[j * stride] = params[param_idx[j - B_C1]];
+      dptr[B_SIMPLE * stride] = (*((int *)( params + 29)) ? 1. : 0.);
+      cosio = params[11];
+      cosio_squared = cosio * cosio;
+      dptr[B_XLCOF * stride] = .125 * a3ovk2 * params[12] * (3+5*cosio)/ (1. + cosio);
+      dptr[B_AYCOF * stride] = 0.25 * a3ovk2 * params[12];
+      dptr[B_X3THM1 * stride] = 3.0 * cosio_squared - 1.0;
+      dptr[B_SINIO2 * stride] = 1.0 - cosio_squared;
+      dptr[B_X7THM1 * stride] = 7.0 * cosio_squared - 1.0;
+      }
+   return( rval);
+}
+
+void /*DLL_FUNC*/ SGP4_batch_free( sgp4_batch_t *batch)
+{
+   if( batch)
+      {
+      free( batch->data);
+      free( batch);
+      }
+}
+
+/* sin() and cos() from the 'fdlibm' kernel polynomials,  after a three-part
+Cody-Waite reduction by pi/2.  Accurate to an ulp or two for arguments up
+to about 1e+6 radians,  which covers mean anomalies for a decade or so
+from epoch.  The quadrant is worked out in floating point,  since most
+SIMD instruction sets lack a double-to-64-bit-integer conversion.
+
+   Rounding to an integer is done by adding and subtracting 1.5 * 2^52,
+rather than with floor(),  because floor() isn't vectorized without
+SSE4.1 or -fno-trapping-math.  This works for |x| < 2^51 (and relies on
+the compiler not simplifying (x + c) - c to x,  which it won't unless
+told to with -ffast-math or similar.)  */
+
+static inline double round_to_integer( const double x)
+{
+   const double round_const = 6755399441055744.;    /* 1.5 * 2^52 */
+
+   return( (x + round_const) - round_const);
+}
+
+static inline void fast_sincos( const double x, double *sin_x, double *cos_x)
+{
+   const double two_over_pi = 6.36619772367581382433e-01;
+   const double pio2_1 = 1.57079632673412561417e+00;
+   const double pio2_2 = 6.07710050630396597660e-11;
+   const double pio2_3 = 2.02226624871116645580e-21;
+   const double q = round_to_integer( x * two_over_pi);
+   const double r = ((x - q * pio2_1) - q * pio2_2) - q * pio2_3;
+   const double z = r * r;
+   const double s = r + r * z * (-1.66666666666666324348e-01
+                  + z * (8.33333333332248946124e-03
+                  + z * (-1.98412698298579493134e-04
+                  + z * (2.75573137070700676789e-06
+                  + z * (-2.50507602534068634195e-08
+                  + z * 1.58969099521155010221e-10)))));
+   const double c = 1. - 0.5 * z + z * z * (4.16666666666666019037e-02
+                  + z * (-1.38888888888741095749e-03
+                  + z * (2.48015872894767294178e-05
+                  + z * (-2.75573143513906633035e-07
+                  + z * (2.08757232129817482790e-09
+                  + z * -1.13596475577881948265e-11)))));
+   const double q4 = q - 4. * round_to_integer( q * 0.25);  /* -2...2 */
+   const double quadrant = (q4 < 0. ? q4 + 4. : q4);       /* 0, 1, 2, 3 */
+   const bool swap = (quadrant == 1. || quadrant == 3.);
+   const double s1 = (swap ? c : s), c1 = (swap ? s : c);
+
+   *sin_x = (quadrant >= 2. ? -s1 : s1);
+   *cos_x = (quadrant == 1. || quadrant == 2. ? -c1 : c1);
+}
+
+template <bool exact> static inline void sincos_lane( const double x,
+                                 double *sin_x, double *cos_x)
+{
+   if( exact)
+      {
+      *sin_x = sin( x);
+      *cos_x = cos( x);
+      }
+   else
+      fast_sincos( x, sin_x, cos_x);
+}
+
+/* As in common.cpp,  puts an angle in -pi to pi. */
+
+template <bool exact> static inline double centralize_lane( const double ival)
+{
+   if( exact)
+      {
+      double rval = fmod( ival, twopi);
+
+      if( rval > pi)
+         rval -= twopi;
+      else if( rval < - pi)
+         rval += twopi;
+      return( rval);
+      }
+   else
+      return( ival - twopi * round_to_integer( ival * (1. / twopi)));
+}
+
+/* One block of BATCH_LANES satellites:  their elements and parameters,
+times,  and the results.  Copying everything into one local structure
+costs little,  and lets the compiler see that none of the arrays overlap
+(without which it won't vectorize the loops.)  */
+
+typedef struct
+{
+   double in[N_BATCH_FIELDS][BATCH_LANES];
+   double tsince[BATCH_LANES];
+   double pos[3][BATCH_LANES], vel[3][BATCH_LANES], err_code[BATCH_LANES];
+} lane_block_t;
+
+/* Propagates one block of satellites.  The code follows SGP4() and
+sxpx_posn_vel() line for line;  see those functions for comments on the
+math.  'if's are written as ?: selections,  and error codes and 'converged'
+flags are kept as doubles,  so the compiler needn't mix integer and
+floating-point lanes;  again,  all this is needed to get the loops
+vectorized. */
+
+template <bool exact> static void sgp4_block( lane_block_t *blk)
+{
+   const double *tsince = blk->tsince;
+#define FIELD( idx)  (blk->in[idx])
+   const double *xmo = FIELD( B_XMO), *omegao = FIELD( B_OMEGAO);
+   const double *xnodeo = FIELD( B_XNODEO), *bstar = FIELD( B_BSTAR);
+   const double *eo = FIELD( B_EO), *xincl = FIELD( B_XINCL);
+   const double *c1 = FIELD( B_C1), *c4 = FIELD( B_C4);
+   const double *xnodcf = FIELD( B_XNODCF), *t2cof = FIELD( B_T2COF);
+   const double *aodp = FIELD( B_AODP), *cosio = FIELD( B_COSIO);
+   const double *sinio = FIELD( B_SINIO), *omgdot = FIELD( B_OMGDOT);
+   const double *xmdot = FIELD( B_XMDOT), *xnodot = FIELD( B_XNODOT);
+   const double *xnodp = FIELD( B_XNODP), *c5 = FIELD( B_C5);
+   const double *d2 = FIELD( B_D2), *d3 = FIELD( B_D3), *d4 = FIELD( B_D4);
+   const double *delmo = FIELD( B_DELMO), *eta = FIELD( B_ETA);
+   const double *omgcof = FIELD( B_OMGCOF), *sinmo = FIELD( B_SINMO);
+   const double *t3cof = FIELD( B_T3COF), *t4cof = FIELD( B_T4COF);
+   const double *t5cof = FIELD( B_T5COF), *xmcof = FIELD( B_XMCOF);
+   const double *simple = FIELD( B_SIMPLE);
+   const double *xlcof = FIELD( B_XLCOF), *aycof = FIELD( B_AYCOF);
+   const double *x3thm1 = FIELD( B_X3THM1), *sinio2 = FIELD( B_SINIO2);
+   const double *x7thm1 = FIELD( B_X7THM1);
+#undef FIELD
+   double (*pos)[BATCH_LANES] = blk->pos, (*vel)[BATCH_LANES] = blk->vel;
+   double *err_codes = blk->err_code;
+   double a[BATCH_LANES], e[BATCH_LANES], omega[BATCH_LANES];
+   double xl[BATCH_LANES], xnode[BATCH_LANES];
+   double axn[BATCH_LANES], ayn[BATCH_LANES], elsq[BATCH_LANES];
+   double capu[BATCH_LANES], epw[BATCH_LANES];
+   double sin_epw[BATCH_LANES], cos_epw[BATCH_LANES];
+   double ecos_e[BATCH_LANES], esin_e[BATCH_LANES];
+   double done[BATCH_LANES], rval[BATCH_LANES];
+   int i, j;
+   double n_done;
+
+   for( j = 0; j < BATCH_LANES; j++)
+      {           /* Update for secular gravity and atmospheric drag. */
+      const double t = tsince[j];
+      const double xmdf = xmo[j]+xmdot[j]*t;
+      const double omgadf = omegao[j]+omgdot[j]*t;
+      const double xnoddf = xnodeo[j]+xnodot[j]*t;
+      const double tsq = t*t;
+      const double delomg = omgcof[j]*t;
+      const double tcube = tsq*t;
+      const double tfour = t*tcube;
+      const bool is_simple = (simple[j] != 0.);
+      double sin_xmp, cos_xmdf, unused, delm, temp;
+      double xmp, tempa, tempe, templ, a0, e0;
+      double xmp_c, omega_c, tempa_c, tempe_c, templ_c;
+
+      tempa = 1-c1[j]*t;
+      tempe = bstar[j]*c4[j]*t;
+      templ = t2cof[j]*tsq;
+                  /* the 'complex' (non-simple) case: */
+      sincos_lane<exact>( xmdf, &unused, &cos_xmdf);
+      delm = 1. + eta[j] * cos_xmdf;
+      delm = xmcof[j] * (delm * delm * delm - delmo[j]);
+      temp = delomg+delm;
+      xmp_c = xmdf+temp;
+      omega_c = omgadf-temp;
+      tempa_c = tempa-d2[j]*tsq-d3[j]*tcube-d4[j]*tfour;
+      sincos_lane<exact>( xmp_c, &sin_xmp, &unused);
+      tempe_c = tempe+bstar[j]*c5[j]*(sin_xmp-sinmo[j]);
+      templ_c = templ+t3cof[j]*tcube+tfour*(t4cof[j]+t*t5cof[j]);
+      xmp = (is_simple ? xmdf : xmp_c);
+      omega[j] = (is_simple ? omgadf : omega_c);
+      tempa = (is_simple ? tempa : tempa_c);
+      tempe = (is_simple ? tempe : tempe_c);
+      templ = (is_simple ? templ : templ_c);
+      xnode[j] = xnoddf+xnodcf[j]*tsq;
+      a0 = aodp[j]*tempa*tempa;
+      e0 = eo[j]-tempe;
+      e[j] = (e0 < ECC_EPS ? ECC_EPS : e0);
+      xl[j] = xmp+omega[j]+xnode[j]+xnodp[j]*templ;
+      a[j] = (tempa < 0. ? -a0 : a0);
+      }
+
+   for( j = 0; j < BATCH_LANES; j++)
+      {              /* Long period periodics */
+      double sin_omega, cos_omega;
+      const double chicken_factor_on_eccentricity = 1.e-6;
+      double temp, xll, aynl, xlt, perigee, apogee, err;
+
+      sincos_lane<exact>( omega[j], &sin_omega, &cos_omega);
+      axn[j] = e[j]*cos_omega;
+      temp = 1/(a[j]*(1.-e[j]*e[j]));
+      xll = temp*xlcof[j]*axn[j];
+      aynl = temp*aycof[j];
+      xlt = xl[j]+xll;
+      ayn[j] = e[j]*sin_omega+aynl;
+      elsq[j] = axn[j]*axn[j]+ayn[j]*ayn[j];
+      capu[j] = centralize_lane<exact>( xlt - xnode[j]);
+      epw[j] = capu[j];
+      perigee = a[j] * (1. - e[j]);
+      apogee = a[j] * (1. + e[j]);
+      err = (perigee < 1. || apogee < 1. ? SXPX_WARN_PERIGEE_WITHIN_EARTH : 0.);
+      err = (a[j] < 0. ? SXPX_ERR_NEGATIVE_MAJOR_AXIS : err);
+      err = (elsq[j] > 1. - chicken_factor_on_eccentricity ?
+                                     SXPX_ERR_NEARLY_PARABOLIC : err);
+      rval[j] = err;
+      done[j] = 0.;
+      }
+
+         /* Solve Kepler's Equation.  Lanes that have converged keep  */
+         /* the same 'epw',  and therefore recompute the same values. */
+   n_done = 0.;
+   for( i = 0; i < MAX_KEPLER_ITER && n_done < BATCH_LANES; i++)
+      {
+      for( j = 0; j < BATCH_LANES; j++)
+         {
+         const double newton_raphson_epsilon = 1e-12;
+                  /* first step is clamped to +/- 1.25e */
+         const double max_newton_raphson = (i ? HUGE_VAL : 1.25 * fabs( e[j]));
+         double f, fdot, delta, delta2;
+
+         sincos_lane<exact>( epw[j], sin_epw + j, cos_epw + j);
+         ecos_e[j] = axn[j] * cos_epw[j] + ayn[j] * sin_epw[j];
+         esin_e[j] = axn[j] * sin_epw[j] - ayn[j] * cos_epw[j];
+         f = capu[j] - epw[j] + esin_e[j];
+         done[j] = (fabs( f) < newton_raphson_epsilon ? 1. : done[j]);
+         fdot = 1. - ecos_e[j];
+         delta = f / fdot;
+         delta2 = f / (fdot + 0.5*esin_e[j]*delta);
+         delta2 = (delta > max_newton_raphson ? max_newton_raphson : delta2);
+         delta2 = (delta < -max_newton_raphson ? -max_newton_raphson : delta2);
+         delta2 = (done[j] != 0. ? 0. : delta2);
+         epw[j] += delta2;
+         }
+      n_done = 0.;         /* kept out of the above loop,  since the */
+      for( j = 0; j < BATCH_LANES; j++)    /* sum would prevent it */
+         n_done += done[j];                /* from being vectorized */
+      }
+
+   for( j = 0; j < BATCH_LANES; j++)
+      {
+      const double is_error = (rval[j] == SXPX_ERR_NEGATIVE_MAJOR_AXIS ? 1. :
+                               (rval[j] == SXPX_ERR_NEARLY_PARABOLIC ? 1. :
+                               (done[j] == 0. ? 1. : 0.)));
+      double temp, temp1, temp2, pl, r, betal, cosu, sinu;
+      double sin2u, cos2u, rk, xnodek, xinck;
+      double sinuk, cosuk, sinik, cosik, sinnok, cosnok, xmx, xmy;
+      double ux, uy, uz, rdot, rfdot, xn, rdotk, rfdotk, vx, vy, vz;
+      double posn[3], velocity[3];
+
+      rval[j] = (rval[j] == SXPX_ERR_NEGATIVE_MAJOR_AXIS ? rval[j] :
+                 (rval[j] == SXPX_ERR_NEARLY_PARABOLIC ? rval[j] :
+                 (done[j] == 0. ? SXPX_ERR_CONVERGENCE_FAIL : rval[j])));
+               /* Short period preliminary quantities */
+      temp = 1-elsq[j];
+      pl = a[j]*temp;
+      r = a[j]*(1-ecos_e[j]);
+      temp2 = a[j] / r;
+      betal = sqrt(temp);
+      temp = esin_e[j]/(1+betal);
+      cosu = temp2 * (cos_epw[j] - axn[j] + ayn[j] * temp);
+      sinu = temp2 * (sin_epw[j] - ayn[j] - axn[j] * temp);
+      sin2u = 2*sinu*cosu;
+      cos2u = 2*cosu*cosu-1;
+      temp1 = ck2 / pl;
+      temp2 = temp1 / pl;
+      if( exact)
+         {
+         const double u = atan2( sinu, cosu);
+
+         sinuk = sin( u-0.25*temp2*x7thm1[j]*sin2u);
+         cosuk = cos( u-0.25*temp2*x7thm1[j]*sin2u);
+         }
+      else
+         {           /* sin/cos of (u + du),  without computing u */
+         const double norm = 1. / sqrt( sinu * sinu + cosu * cosu);
+         const double sin_u = sinu * norm, cos_u = cosu * norm;
+         double sin_du, cos_du;
+
+         fast_sincos( -0.25*temp2*x7thm1[j]*sin2u, &sin_du, &cos_du);
+         sinuk = sin_u * cos_du + cos_u * sin_du;
+         cosuk = cos_u * cos_du - sin_u * sin_du;
+         }
+               /* Update for short periodics */
+      rk = r*(1-1.5*temp2*betal*x3thm1[j])+0.5*temp1*sinio2[j]*cos2u;
+      xnodek = xnode[j]+1.5*temp2*cosio[j]*sin2u;
+      xinck = xincl[j]+1.5*temp2*cosio[j]*sinio[j]*cos2u;
+               /* Orientation vectors */
+      sincos_lane<exact>( xinck, &sinik, &cosik);
+      sincos_lane<exact>( xnodek, &sinnok, &cosnok);
+      xmx = -sinnok*cosik;
+      xmy = cosnok*cosik;
+      ux = xmx*sinuk+cosnok*cosuk;
+      uy = xmy*sinuk+sinnok*cosuk;
+      uz = sinik*sinuk;
+               /* Position and velocity;  zeroed on errors (not warnings) */
+      rdot = xke * sqrt(a[j]) * esin_e[j] / r;
+      rfdot = xke * sqrt(pl) / r;
+      xn = xke / (a[j] * sqrt(a[j]));
+      rdotk = rdot - xn * temp1 * sinio2[j] * sin2u;
+      rfdotk = rfdot + xn * temp1 * (sinio2[j] * cos2u + 1.5 * x3thm1[j]);
+      vx = xmx * cosuk - cosnok * sinuk;
+      vy = xmy * cosuk - sinnok * sinuk;
+      vz = sinik*cosuk;
+      posn[0] = rk * ux * earth_radius_in_km;
+      posn[1] = rk * uy * earth_radius_in_km;
+      posn[2] = rk * uz * earth_radius_in_km;
+      velocity[0] = (rdotk * ux + rfdotk * vx) * earth_radius_in_km;
+      velocity[1] = (rdotk * uy + rfdotk * vy) * earth_radius_in_km;
+      velocity[2] = (rdotk * uz + rfdotk * vz) * earth_radius_in_km;
+      for( i = 0; i < 3; i++)
+         {
+         pos[i][j] = (is_error != 0. ? 0. : posn[i]);
+         vel[i][j] = (is_error != 0. ? 0. : velocity[i]);
+         }
+      err_codes[j] = rval[j];
+      }
+}
+
+/* Propagates all satellites in the batch;  satellite i goes to
+tsince[i] minutes from its epoch.  'pos' and 'vel' get three values per
+satellite (as from SGP4()),  in km and km/min;  'vel' can be NULL.
+'err_codes' (which can also be NULL) gets what SGP4() would have
+returned for each satellite.  The return value is the number of
+satellites for which an error (not just a warning) occurred.  */
+
+int /*DLL_FUNC*/ SGP4_batch( const sgp4_batch_t *batch, const double *tsince,
+                                 double *pos, double *vel, int *err_codes)
+{
+   size_t i0;
+   int n_errors = 0;
+
+   for( i0 = 0; i0 < batch->n_sats; i0 += BATCH_LANES)
+      {
+      const size_t n_lanes = (batch->n_sats - i0 < BATCH_LANES ?
+                           batch->n_sats - i0 : BATCH_LANES);
+      lane_block_t blk;
+      size_t j, k;
+      int err;
+
+      for( k = 0; k < N_BATCH_FIELDS; k++)
+         memcpy( blk.in[k], batch->data + k * batch->n_padded + i0,
+                                 BATCH_LANES * sizeof( double));
+      for( j = 0; j < BATCH_LANES; j++)
+         blk.tsince[j] = tsince[i0 + (j < n_lanes ? j : n_lanes - 1)];
+      if( batch->flags & SGP4_BATCH_EXACT)
+         sgp4_block<true>( &blk);
+      else
+         sgp4_block<false>( &blk);
+      for( j = 0; j < n_lanes; j++)
+         {
+         for( k = 0; k < 3; k++)
+            {
+            pos[(i0 + j) * 3 + k] = blk.pos[k][j];
+            if( vel)
+               vel[(i0 + j) * 3 + k] = blk.vel[k][j];
+            }
+         err = (int)blk.err_code[j];
+         if( err_codes)
+            err_codes[i0 + j] = err;
+         if( err && err != SXPX_WARN_ORBIT_WITHIN_EARTH
+                     && err != SXPX_WARN_PERIGEE_WITHIN_EARTH)
+            n_errors++;
+         }
+      }
+   return( n_errors);
+}
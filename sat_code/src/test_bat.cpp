@@ -0,0 +1,171 @@
+/* Copyright (C) 2018, Project Pluto.  See LICENSE.  */
+
+/* test_bat.cpp:  checks the batch SGP4 code in 'sgp4_bat.cpp' against
+SGP4(),  and compares their speeds.  Near-earth TLEs are read from the
+file given on the command line (default 'test.tle'),  then propagated
+over a range of times from a day before to thirty days after epoch,
+both one at a time with SGP4() and all at once with SGP4_batch().  The
+'exact' batch mode ought to match SGP4() bit for bit;  the default mode
+ought to match to better than a millimeter in position (and a micron/s
+in velocity).  Use -n(num) to repeat the timing runs.   */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "norad.h"
+
+#define MAX_POSN_DIFF  1e-6         /* km,  i.e.,  one millimeter */
+#define MAX_VEL_DIFF   1e-6 * 60.   /* km/min,  i.e.,  a micron/second */
+
+int main( const int argc, const char **argv)
+{
+   const char *filename = "test.tle";
+   FILE *ifile;
+   char line1[100], line2[100];
+   tle_t *tles = NULL;
+   double *params, *tsince, *pos, *vel, *pos1, *vel1;
+   int *errs;
+   sgp4_batch_t *batch, *exact_batch;
+   double max_posn_diff = 0., max_vel_diff = 0., scalar_time, batch_time;
+   int i, n_reps = 1, n_tles = 0, n_alloced = 0, step, n_mismatches = 0, rval = 0;
+   clock_t t0;
+   const int n_steps = 31 * 24;
+
+   for( i = 1; i < argc; i++)
+      if( argv[i][0] == '-')
+         switch( argv[i][1])
+            {
+            case 'n':
+               n_reps = atoi( argv[i] + 2);
+               break;
+            default:
+               printf( "Option '%s' ignored\n", argv[i]);
+               break;
+            }
+      else
+         filename = argv[i];
+   ifile = fopen( filename, "rb");
+   if( !ifile)
+      {
+      printf( "Couldn't open input TLE file '%s'\n", filename);
+      return( -1);
+      }
+   *line1 = '\0';
+   while( fgets( line2, sizeof( line2), ifile))
+      {
+      tle_t tle;
+
+      if( *line1 == '1' && *line2 == '2' && parse_elements( line1, line2, &tle) >= 0
+                  && !select_ephemeris( &tle))
+         {
+         if( n_tles == n_alloced)
+            {
+            n_alloced += 1000 + n_alloced;
+            tles = (tle_t *)realloc( tles, n_alloced * sizeof( tle_t));
+            }
+         tles[n_tles++] = tle;
+         }
+      strcpy( line1, line2);
+      }
+   fclose( ifile);
+   printf( "%d near-earth TLEs read\n", n_tles);
+   if( !n_tles)
+      return( -1);
+   params = (double *)malloc( n_tles * (N_SGP4_PARAMS + 13) * sizeof( double));
+   tsince = params + n_tles * N_SGP4_PARAMS;
+   pos = tsince + n_tles;
+   vel = pos + n_tles * 3;
+   pos1 = vel + n_tles * 3;
+   vel1 = pos1 + n_tles * 3;
+   errs = (int *)malloc( n_tles * sizeof( int));
+   for( i = 0; i < n_tles; i++)
+      SGP4_init( params + i * N_SGP4_PARAMS, tles + i);
+   batch = SGP4_batch_init( tles, n_tles, 0);
+   exact_batch = SGP4_batch_init( tles, n_tles, SGP4_BATCH_EXACT);
+
+   for( step = 0; step < n_steps; step++)
+      {
+      for( i = 0; i < n_tles; i++)    /* vary the times a bit per object */
+         tsince[i] = -1440. + (double)step * 60. + (double)i * 0.37;
+      SGP4_batch( exact_batch, tsince, pos, vel, errs);
+      for( i = 0; i < n_tles; i++)
+         {
+         const int err = SGP4( tsince[i], tles + i, params + i * N_SGP4_PARAMS,
+                          pos1 + i * 3, vel1 + i * 3);
+
+         if( err != errs[i] || memcmp( pos + i * 3, pos1 + i * 3, 3 * sizeof( double))
+                  || memcmp( vel + i * 3, vel1 + i * 3, 3 * sizeof( double)))
+            {
+            if( !n_mismatches++)
+               printf( "Exact mismatch: TLE %d,  t=%f: %d %d\n", i, tsince[i],
+                              err, errs[i]);
+            }
+         }
+      SGP4_batch( batch, tsince, pos, vel, errs);
+      for( i = 0; i < n_tles * 3; i++)
+         {
+         const double dpos = fabs( pos[i] - pos1[i]);
+         const double dvel = fabs( vel[i] - vel1[i]);
+
+         if( max_posn_diff < dpos)
+            max_posn_diff = dpos;
+         if( max_vel_diff < dvel)
+            max_vel_diff = dvel;
+         }
+      }
+   printf( "%d exact-mode mismatches\n", n_mismatches);
+   printf( "Max differences: %.3g mm,  %.3g micron/s\n",
+               max_posn_diff * 1e+6, max_vel_diff * 1e+9 / 60.);
+   if( n_mismatches || max_posn_diff > MAX_POSN_DIFF
+                    || max_vel_diff > MAX_VEL_DIFF)
+      {
+      printf( "FAILED\n");
+      if( n_mismatches)
+         printf( "(Exact-mode mismatches can be caused by FMA contraction;\n"
+                 "try compiling with -ffp-contract=off.)\n");
+      rval = -1;
+      }
+
+            /* Now for timing: */
+   t0 = clock( );
+   for( i = 0; i < n_reps; i++)
+      for( step = 0; step < n_steps; step++)
+         {
+         int j;
+
+         for( j = 0; j < n_tles; j++)
+            SGP4( (double)step * 60., tles + j, params + j * N_SGP4_PARAMS,
+                          pos1 + j * 3, vel1 + j * 3);
+         }
+   scalar_time = (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC;
+   for( i = 0; i < n_tles; i++)
+      tsince[i] = 0.;
+   t0 = clock( );
+   for( i = 0; i < n_reps; i++)
+      for( step = 0; step < n_steps; step++)
+         {
+         int j;
+
+         for( j = 0; j < n_tles; j++)
+            tsince[j] = (double)step * 60.;
+         SGP4_batch( batch, tsince, pos, vel, NULL);
+         }
+   batch_time = (double)( clock( ) - t0) / (double)CLOCKS_PER_SEC;
+   if( scalar_time > 0. && batch_time > 0.)
+      {
+      const double n_propagations = (double)n_reps * (double)n_steps * (double)n_tles;
+
+      printf( "SGP4():       %.3f s,  %.0f propagations/s\n", scalar_time,
+                  n_propagations / scalar_time);
+      printf( "SGP4_batch(): %.3f s,  %.0f propagations/s  (%.2fx)\n", batch_time,
+                  n_propagations / batch_time, scalar_time / batch_time);
+      }
+   SGP4_batch_free( batch);
+   SGP4_batch_free( exact_batch);
+   free( params);
+   free( errs);
+   free( tles);
+   return( rval);
+}